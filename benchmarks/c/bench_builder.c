@@ -0,0 +1,85 @@
+/*
+ * Builder benchmark - append N children to a sequence and to a mapping
+ * through the building API, and build the same sequence with the bulk
+ * yyaml_doc_add_int_array. With constant-time appends the ns/elem column
+ * stays flat as N grows by 10x.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "yyaml.h"
+
+static double bench_seq(size_t count) {
+    yyaml_doc *doc = yyaml_doc_new();
+    double start = yyaml_bench_now();
+    uint32_t seq = yyaml_doc_add_sequence(doc);
+    size_t i;
+    for (i = 0; i < count; i++) {
+        uint32_t child = yyaml_doc_add_int(doc, (int64_t)i);
+        if (!yyaml_doc_seq_append(doc, seq, child)) {
+            fprintf(stderr, "seq append failed at %zu\n", i);
+            exit(1);
+        }
+    }
+    yyaml_doc_set_root(doc, seq);
+    start = yyaml_bench_now() - start;
+    yyaml_doc_free(doc);
+    return start;
+}
+
+static double bench_map(size_t count) {
+    yyaml_doc *doc = yyaml_doc_new();
+    double start = yyaml_bench_now();
+    uint32_t map = yyaml_doc_add_mapping(doc);
+    char key[32];
+    size_t i;
+    for (i = 0; i < count; i++) {
+        int len = snprintf(key, sizeof(key), "key_%zu", i);
+        uint32_t child = yyaml_doc_add_double(doc, (double)i * 0.5);
+        if (!yyaml_doc_map_append(doc, map, key, (size_t)len, child)) {
+            fprintf(stderr, "map append failed at %zu\n", i);
+            exit(1);
+        }
+    }
+    yyaml_doc_set_root(doc, map);
+    start = yyaml_bench_now() - start;
+    yyaml_doc_free(doc);
+    return start;
+}
+
+static double bench_int_array(size_t count) {
+    yyaml_doc *doc = yyaml_doc_new();
+    int64_t *vals = (int64_t *)malloc(count * sizeof(int64_t));
+    double start;
+    size_t i;
+    for (i = 0; i < count; i++) vals[i] = (int64_t)i;
+    start = yyaml_bench_now();
+    if (!yyaml_doc_set_root(doc, yyaml_doc_add_int_array(doc, vals, count))) {
+        fprintf(stderr, "int array failed\n");
+        exit(1);
+    }
+    start = yyaml_bench_now() - start;
+    free(vals);
+    yyaml_doc_free(doc);
+    return start;
+}
+
+int main(void) {
+    static const size_t sizes[] = {10000, 100000, 1000000};
+    size_t i;
+    printf("%-32s %10s %15s %18s\n", "case", "elements", "total", "per element");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        yyaml_bench_report("seq_append(int)", sizes[i], bench_seq(sizes[i]));
+    }
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        yyaml_bench_report("map_append(key, double)", sizes[i],
+                           bench_map(sizes[i]));
+    }
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        yyaml_bench_report("add_int_array", sizes[i],
+                           bench_int_array(sizes[i]));
+    }
+    return 0;
+}
@@ -0,0 +1,341 @@
+/*
+ * Writer benchmark - serialize integer-heavy documents (a flat int sequence
+ * and a sequence of metric records with four int fields each), a double
+ * sequence, a log of quoted string messages and deeply nested mappings with
+ * yyaml_write (and yyaml_write_buf for the metric records), in block and
+ * auto flow style, serially and on four threads, and with sorted keys. The
+ * metric records are also streamed through yyaml_emitter without building a
+ * document, digested with yyaml_doc_hash and compared against an edited
+ * copy with yyaml_node_equal, and against an unchanged one with
+ * yyaml_node_equal_cached. The ns/elem column is the cost of formatting
+ * one node plus its surrounding indentation and keys.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "yyaml.h"
+
+#define BENCH_REPEAT 5
+
+static double bench_write(const yyaml_doc *doc, const yyaml_write_opts *opts) {
+    yyaml_err err;
+    double best = 0.0;
+    int round;
+    for (round = 0; round < BENCH_REPEAT; round++) {
+        char *out = NULL;
+        size_t out_len = 0;
+        double start = yyaml_bench_now();
+        if (!yyaml_write(yyaml_doc_get_root(doc), &out, &out_len, opts, &err)) {
+            fprintf(stderr, "write failed: %s\n", err.msg);
+            exit(1);
+        }
+        start = yyaml_bench_now() - start;
+        if (!round || start < best) best = start;
+        yyaml_free_string(out);
+    }
+    return best;
+}
+
+/* yyaml_write_buf into one preallocated buffer: no heap traffic per call */
+static double bench_write_buf(const yyaml_doc *doc) {
+    const yyaml_node *root = yyaml_doc_get_root(doc);
+    size_t cap = yyaml_write_len(root, NULL);
+    char *buf = (char *)malloc(cap);
+    yyaml_err err;
+    double best = 0.0;
+    int round;
+    for (round = 0; round < BENCH_REPEAT; round++) {
+        size_t written = 0;
+        double start = yyaml_bench_now();
+        if (!yyaml_write_buf(root, buf, cap, &written, NULL, &err)) {
+            fprintf(stderr, "write_buf failed: %s\n", err.msg);
+            exit(1);
+        }
+        start = yyaml_bench_now() - start;
+        if (!round || start < best) best = start;
+    }
+    free(buf);
+    return best;
+}
+
+/* Detached copy of the root of doc in a new document. */
+static yyaml_doc *copy_doc(const yyaml_doc *doc) {
+    yyaml_doc *copy = yyaml_doc_new();
+    yyaml_doc_set_root(copy, yyaml_doc_import(copy, yyaml_doc_get_root(doc)));
+    return copy;
+}
+
+/* yyaml_doc_hash without cached digests, so every node is hashed */
+static double bench_hash(const yyaml_doc *doc) {
+    double best = 0.0;
+    int round;
+    for (round = 0; round < BENCH_REPEAT; round++) {
+        double start = yyaml_bench_now();
+        if (!yyaml_doc_hash(yyaml_doc_get_root(doc))) {
+            fprintf(stderr, "hash failed\n");
+            exit(1);
+        }
+        start = yyaml_bench_now() - start;
+        if (!round || start < best) best = start;
+    }
+    return best;
+}
+
+/* yyaml_node_equal of two copies of doc, the second with one record changed.
+ * Cold copies are walked up to the change; warm ones went through
+ * yyaml_doc_cache_hashes, so their digests reject the difference at the
+ * root. */
+static double bench_equal(const yyaml_doc *doc, bool warm) {
+    double best = 0.0;
+    int round;
+    for (round = 0; round < BENCH_REPEAT; round++) {
+        yyaml_doc *a = copy_doc(doc);
+        yyaml_doc *b = copy_doc(doc);
+        const yyaml_node *root = yyaml_doc_get_root(b);
+        uint32_t rec = yyaml_node_index(b, yyaml_seq_get(root,
+                                                         yyaml_seq_len(root) / 2));
+        double start;
+        yyaml_doc_map_set(b, rec, "count", 5, yyaml_doc_add_int(b, -1));
+        root = yyaml_doc_get_root(b);
+        if (warm && (!yyaml_doc_cache_hashes(a) || !yyaml_doc_cache_hashes(b))) {
+            fprintf(stderr, "cache hashes failed\n");
+            exit(1);
+        }
+        start = yyaml_bench_now();
+        if (yyaml_node_equal(yyaml_doc_get_root(a), root, false)) {
+            fprintf(stderr, "equal failed\n");
+            exit(1);
+        }
+        start = yyaml_bench_now() - start;
+        if (!round || start < best) best = start;
+        yyaml_doc_free(a);
+        yyaml_doc_free(b);
+    }
+    return best;
+}
+
+/* yyaml_node_equal_cached of two unchanged copies of doc with cached
+ * digests, which match at the root without a walk. */
+static double bench_equal_cached(const yyaml_doc *doc) {
+    double best = 0.0;
+    int round;
+    for (round = 0; round < BENCH_REPEAT; round++) {
+        yyaml_doc *a = copy_doc(doc);
+        yyaml_doc *b = copy_doc(doc);
+        double start;
+        if (!yyaml_doc_cache_hashes(a) || !yyaml_doc_cache_hashes(b)) {
+            fprintf(stderr, "cache hashes failed\n");
+            exit(1);
+        }
+        start = yyaml_bench_now();
+        if (!yyaml_node_equal_cached(yyaml_doc_get_root(a),
+                                     yyaml_doc_get_root(b))) {
+            fprintf(stderr, "equal cached failed\n");
+            exit(1);
+        }
+        start = yyaml_bench_now() - start;
+        if (!round || start < best) best = start;
+        yyaml_doc_free(a);
+        yyaml_doc_free(b);
+    }
+    return best;
+}
+
+static yyaml_doc *make_int_seq(size_t count) {
+    yyaml_doc *doc = yyaml_doc_new();
+    int64_t *vals = (int64_t *)malloc(count * sizeof(int64_t));
+    size_t i;
+    /* mix of widths, about half negative */
+    for (i = 0; i < count; i++) {
+        vals[i] = (int64_t)(i * 2654435761u) >> (i % 48);
+        if (i & 1) vals[i] = -vals[i];
+    }
+    yyaml_doc_set_root(doc, yyaml_doc_add_int_array(doc, vals, count));
+    free(vals);
+    return doc;
+}
+
+static yyaml_doc *make_metrics(size_t records) {
+    yyaml_doc *doc = yyaml_doc_new();
+    uint32_t seq = yyaml_doc_add_sequence(doc);
+    size_t i;
+    for (i = 0; i < records; i++) {
+        uint32_t rec = yyaml_doc_add_mapping(doc);
+        yyaml_doc_map_append(doc, rec, "id", 2, yyaml_doc_add_int(doc, (int64_t)i));
+        yyaml_doc_map_append(doc, rec, "ts", 2,
+                             yyaml_doc_add_int(doc, 1700000000000LL + (int64_t)i * 15));
+        yyaml_doc_map_append(doc, rec, "count", 5,
+                             yyaml_doc_add_int(doc, (int64_t)(i % 1000)));
+        yyaml_doc_map_append(doc, rec, "bytes", 5,
+                             yyaml_doc_add_int(doc, (int64_t)(i * 4096 + 17)));
+        yyaml_doc_seq_append(doc, seq, rec);
+    }
+    yyaml_doc_set_root(doc, seq);
+    return doc;
+}
+
+/* the records of make_metrics streamed through yyaml_emitter, no document */
+static double bench_emit_metrics(size_t records) {
+    yyaml_err err;
+    double best = 0.0;
+    int round;
+    for (round = 0; round < BENCH_REPEAT; round++) {
+        yyaml_emitter *em = yyaml_emitter_new(NULL);
+        char *out = NULL;
+        size_t i;
+        double start = yyaml_bench_now();
+        yyaml_emitter_begin_seq(em);
+        for (i = 0; i < records; i++) {
+            yyaml_emitter_begin_map(em);
+            yyaml_emitter_key(em, "id", 2);
+            yyaml_emitter_int(em, (int64_t)i);
+            yyaml_emitter_key(em, "ts", 2);
+            yyaml_emitter_int(em, 1700000000000LL + (int64_t)i * 15);
+            yyaml_emitter_key(em, "count", 5);
+            yyaml_emitter_int(em, (int64_t)(i % 1000));
+            yyaml_emitter_key(em, "bytes", 5);
+            yyaml_emitter_int(em, (int64_t)(i * 4096 + 17));
+            yyaml_emitter_end_map(em);
+        }
+        yyaml_emitter_end_seq(em);
+        if (!yyaml_emitter_finish(em, &out, NULL, &err)) {
+            fprintf(stderr, "emit failed: %s\n", err.msg);
+            exit(1);
+        }
+        start = yyaml_bench_now() - start;
+        if (!round || start < best) best = start;
+        yyaml_free_string(out);
+        yyaml_emitter_free(em);
+    }
+    return best;
+}
+
+static yyaml_doc *make_double_seq(size_t count) {
+    yyaml_doc *doc = yyaml_doc_new();
+    double *vals = (double *)malloc(count * sizeof(double));
+    size_t i;
+    for (i = 0; i < count; i++) vals[i] = (double)i * 0.37 + 1.0 / (double)(i + 1);
+    yyaml_doc_set_root(doc, yyaml_doc_add_double_array(doc, vals, count));
+    free(vals);
+    return doc;
+}
+
+static yyaml_doc *make_log(size_t records) {
+    static const char *messages[] = {
+        "GET /api/v1/items?page=2 returned 200 in 12ms",
+        "user \"alice\" logged in from 10.0.0.7",
+        "retrying upstream request\tattempt=3",
+        "cache warmup finished: 48211 entries, 0 evictions, 3 stale",
+    };
+    yyaml_doc *doc = yyaml_doc_new();
+    uint32_t seq = yyaml_doc_add_sequence(doc);
+    size_t i;
+    for (i = 0; i < records; i++) {
+        const char *msg = messages[i % 4];
+        uint32_t rec = yyaml_doc_add_mapping(doc);
+        yyaml_doc_map_append(doc, rec, "level", 5,
+                             yyaml_doc_add_string(doc, (i % 5) ? "info" : "warn", 4));
+        yyaml_doc_map_append(doc, rec, "message", 7,
+                             yyaml_doc_add_string(doc, msg, strlen(msg)));
+        yyaml_doc_seq_append(doc, seq, rec);
+    }
+    yyaml_doc_set_root(doc, seq);
+    return doc;
+}
+
+#define BENCH_DEPTH 32
+
+/* records chains of BENCH_DEPTH mappings {level: n, child: {...}} */
+static yyaml_doc *make_deep(size_t records) {
+    yyaml_doc *doc = yyaml_doc_new();
+    uint32_t seq = yyaml_doc_add_sequence(doc);
+    size_t i;
+    int level;
+    for (i = 0; i < records; i++) {
+        uint32_t inner = yyaml_doc_add_int(doc, (int64_t)i);
+        for (level = BENCH_DEPTH; level > 0; level--) {
+            uint32_t map = yyaml_doc_add_mapping(doc);
+            yyaml_doc_map_append(doc, map, "level", 5, yyaml_doc_add_int(doc, level));
+            yyaml_doc_map_append(doc, map, "child", 5, inner);
+            inner = map;
+        }
+        yyaml_doc_seq_append(doc, seq, inner);
+    }
+    yyaml_doc_set_root(doc, seq);
+    return doc;
+}
+
+int main(void) {
+    static const size_t sizes[] = {10000, 100000, 1000000};
+    yyaml_write_opts exact = {0};
+    yyaml_write_opts flow = {0};
+    yyaml_write_opts threaded = {0};
+    yyaml_write_opts sorted = {0};
+    size_t i;
+    exact.indent = 2;
+    exact.final_newline = true;
+    exact.exact_size = true;
+    flow.indent = 2;
+    flow.final_newline = true;
+    flow.style = YYAML_STYLE_AUTO;
+    threaded.indent = 2;
+    threaded.final_newline = true;
+    threaded.threads = 4;
+    sorted.indent = 2;
+    sorted.final_newline = true;
+    sorted.sort_keys = true;
+    printf("%-32s %10s %15s %18s\n", "case", "elements", "total", "per element");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        yyaml_doc *doc = make_int_seq(sizes[i]);
+        yyaml_bench_report("write(int seq)", sizes[i], bench_write(doc, NULL));
+        yyaml_bench_report("write(int seq, flow)", sizes[i],
+                           bench_write(doc, &flow));
+        yyaml_doc_free(doc);
+    }
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        yyaml_doc *doc = make_metrics(sizes[i] / 4);
+        yyaml_bench_report("write(metric records)", sizes[i], bench_write(doc, NULL));
+        yyaml_bench_report("write(metric records, exact)", sizes[i],
+                           bench_write(doc, &exact));
+        yyaml_bench_report("write_buf(metric records)", sizes[i],
+                           bench_write_buf(doc));
+        yyaml_bench_report("write(metric records, flow)", sizes[i],
+                           bench_write(doc, &flow));
+        yyaml_bench_report("write(metric records, 4 threads)", sizes[i],
+                           bench_write(doc, &threaded));
+        yyaml_bench_report("write(metric records, sorted)", sizes[i],
+                           bench_write(doc, &sorted));
+        yyaml_bench_report("hash(metric records)", sizes[i], bench_hash(doc));
+        yyaml_bench_report("equal(metric records, edited)", sizes[i],
+                           bench_equal(doc, false));
+        yyaml_bench_report("equal(metric records, cached)", sizes[i],
+                           bench_equal(doc, true));
+        yyaml_bench_report("equal_cached(metric records)", sizes[i],
+                           bench_equal_cached(doc));
+        yyaml_bench_report("emit(metric records)", sizes[i],
+                           bench_emit_metrics(sizes[i] / 4));
+        yyaml_doc_free(doc);
+    }
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        yyaml_doc *doc = make_double_seq(sizes[i]);
+        yyaml_bench_report("write(double seq)", sizes[i], bench_write(doc, NULL));
+        yyaml_doc_free(doc);
+    }
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        yyaml_doc *doc = make_log(sizes[i] / 2);
+        yyaml_bench_report("write(log strings)", sizes[i], bench_write(doc, NULL));
+        yyaml_bench_report("write(log strings, exact)", sizes[i],
+                           bench_write(doc, &exact));
+        yyaml_doc_free(doc);
+    }
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        /* two nodes per level */
+        yyaml_doc *doc = make_deep(sizes[i] / (2 * BENCH_DEPTH));
+        yyaml_bench_report("write(deep nesting)", sizes[i], bench_write(doc, NULL));
+        yyaml_doc_free(doc);
+    }
+    return 0;
+}
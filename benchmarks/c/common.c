@@ -0,0 +1,33 @@
+/*
+ * This code is for Mohammad Raziei (https://github.com/mohammadraziei/yyaml).
+ * Released under the MIT license.
+ * If you use it, please star the repository and report issues via GitHub.
+ */
+
+#include "common.h"
+
+#include <stdio.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+double yyaml_bench_now(void) {
+#if defined(_WIN32)
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+void yyaml_bench_report(const char *label, size_t count, double seconds) {
+    printf("%-32s %10zu %12.3f ms %10.2f ns/elem\n", label, count,
+           seconds * 1e3, count ? seconds * 1e9 / (double)count : 0.0);
+}
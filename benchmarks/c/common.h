@@ -0,0 +1,26 @@
+/*
+ * This code is for Mohammad Raziei (https://github.com/mohammadraziei/yyaml).
+ * Released under the MIT license.
+ * If you use it, please star the repository and report issues via GitHub.
+ */
+
+#ifndef YYAML_BENCH_COMMON_H
+#define YYAML_BENCH_COMMON_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Monotonic wall-clock time in seconds. */
+double yyaml_bench_now(void);
+
+/** Print one result row: label, element count, total seconds, ns/element. */
+void yyaml_bench_report(const char *label, size_t count, double seconds);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* YYAML_BENCH_COMMON_H */
@@ -4,13 +4,14 @@
 
 #include <cstddef>
 #include <cstdint>
-#include <fstream>
 #include <iterator>
 #include <limits>
 #include <memory>
+#include <ostream>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <vector>
 
 namespace yyaml {
 
@@ -28,19 +29,25 @@ class const_node_iterator;
 /**
  * @brief Exception type thrown by the C++ yyaml wrapper.
  *
- * Captures position, line, and column when raised from the underlying C API so
- * callers can report detailed parsing or serialization errors.
+ * Captures the error code, position, line, and column when raised from the
+ * underlying C API so callers can report detailed parsing or serialization
+ * errors.
  */
 struct yyaml_error : public std::runtime_error {
     std::size_t pos = 0;
     std::size_t line = 0;
     std::size_t column = 0;
+    ::yyaml_err_code code = YYAML_ERR_NONE;
 
     explicit yyaml_error(const std::string &msg)
         : std::runtime_error(msg) {}
 
+    yyaml_error(const std::string &msg, ::yyaml_err_code err_code)
+        : std::runtime_error(msg), code(err_code) {}
+
     explicit yyaml_error(const ::yyaml_err &err)
-        : std::runtime_error(err.msg), pos(err.pos), line(err.line), column(err.column) {}
+        : std::runtime_error(err.msg), pos(err.pos), line(err.line), column(err.column),
+          code(err.code) {}
 };
 
 /**
@@ -83,11 +90,29 @@ public:
     double as_number() const;
     std::string as_string() const;
     std::string to_string() const;
+    /** @return The subtree as JSON text, minified unless pretty is set. */
+    std::string to_json(bool pretty = false) const;
     /** @return Index of the node within its owning document. */
     uint32_t index() const;
+    /** @return Order-insensitive digest of the subtree, see yyaml_doc_hash. */
+    std::uint64_t digest() const;
+    /**
+     * @return True when other holds an equal subtree, see yyaml_node_equal.
+     * Unchanged sections are walked in full; equals_cached skips them.
+     */
+    bool equals(const node &other, bool ignore_key_order = false) const;
+    /**
+     * @return True when other holds an equal subtree in any key order, taking
+     * matching cached digests as proof; see yyaml_node_equal_cached.
+     */
+    bool equals_cached(const node &other) const;
     ///@}
 
-    /** @name Child access */
+    /** @name Child access
+     *  Indexed access on a document built or edited since it was last indexed
+     *  rebuilds the sequence index first, so loops over it stay O(1) per
+     *  element; index an edited document before sharing it between threads.
+     */
     ///@{
     node at(const std::string &key) const;
     node at(std::size_t index) const;
@@ -244,12 +269,62 @@ public:
      * @throws yyaml_error if the file cannot be opened or parsing fails.
      */
     static document parse_file(const std::string &path, const read_opts *opts = nullptr) {
-        std::ifstream input(path, std::ios::binary);
-        if (!input) {
-            throw yyaml_error("unable to open YAML file: " + path);
+        ::yyaml_err err = {0};
+        ::yyaml_doc *doc = yyaml_read_file(path.c_str(), opts, &err);
+        if (!doc) {
+            if (err.code == YYAML_ERR_IO) {
+                throw yyaml_error(std::string(err.msg) + ": " + path, err.code);
+            }
+            throw yyaml_error(err);
+        }
+        return document(doc);
+    }
+
+    /**
+     * @brief Load a binary snapshot written by save_binary().
+     *
+     * @throws yyaml_error if the file is missing or not a valid snapshot.
+     */
+    static document load_binary(const std::string &path) {
+        ::yyaml_err err = {0};
+        ::yyaml_doc *doc = yyaml_doc_load_binary(path.c_str(), &err);
+        if (!doc) {
+            throw yyaml_error(err);
+        }
+        return document(doc);
+    }
+
+    /** Write the document to a binary snapshot file. */
+    void save_binary(const std::string &path) const {
+        require_doc();
+        ::yyaml_err err = {0};
+        if (!yyaml_doc_save_binary(_doc, path.c_str(), &err)) {
+            throw yyaml_error(err);
+        }
+    }
+
+    /**
+     * @brief Attach a read-only view of a document published with publish().
+     *
+     * @param fd Descriptor of the shared memory object holding the image.
+     * @throws yyaml_error if the descriptor does not hold a published image.
+     */
+    static document attach(int fd) {
+        ::yyaml_err err = {0};
+        ::yyaml_doc *doc = yyaml_doc_attach(fd, &err);
+        if (!doc) {
+            throw yyaml_error(err);
+        }
+        return document(doc);
+    }
+
+    /** Publish a read-only image of the document into a shared memory object. */
+    void publish(int fd) const {
+        require_doc();
+        ::yyaml_err err = {0};
+        if (!yyaml_doc_publish(_doc, fd, &err)) {
+            throw yyaml_error(err);
         }
-        std::string data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
-        return parse(data, opts);
     }
 
     /** @return The root node or an invalid node when the document is empty. */
@@ -274,10 +349,68 @@ public:
     void map_append(const node &map, const std::string &key, const node &value);
     ///@}
 
+    /** @name Mutation helpers
+     *  Removed or replaced subtrees are released; nodes referring to them
+     *  must not be used afterwards.
+     */
+    ///@{
+    bool map_remove(const node &map, const std::string &key);
+    void map_set(const node &map, const std::string &key, const node &value);
+    void seq_insert(const node &seq, std::size_t pos, const node &child);
+    void seq_remove(const node &seq, std::size_t pos);
+    ///@}
+
+    /** @name Bulk builder helpers
+     *  Create a whole sequence of scalars with one node reservation.
+     */
+    ///@{
+    node add_int_array(const std::int64_t *values, std::size_t count);
+    node add_double_array(const double *values, std::size_t count);
+    node add_bool_array(const bool *values, std::size_t count);
+    node add_string_array(const std::vector<std::string> &values);
+    ///@}
+
+    /**
+     * @brief Deep-copy a subtree, possibly from another document.
+     *
+     * The returned copy is detached; link it like any other new node.
+     * @throws yyaml_error when the source is unbound or out of memory.
+     */
+    node import_node(const node &source);
+
+    /**
+     * @brief Lay the node pool out depth-first with contiguous children.
+     *
+     * Invalidates nodes obtained before the call; fetch them again via root().
+     * @throws yyaml_error when out of memory.
+     */
+    void compact();
+
+    /** Rebuild the O(1) sequence index after edits; see yyaml_doc_index_sequences. */
+    void index_sequences();
+
+    /** Cache subtree digests for node comparisons; see yyaml_doc_cache_hashes. */
+    void cache_hashes();
+
+    /** Release spare buffer capacity; invalidates nodes obtained before. */
+    void shrink();
+
+    /**
+     * @brief Compact and drop all storage left behind by mutations.
+     *
+     * Invalidates nodes obtained before the call; fetch them again via root().
+     * @throws yyaml_error when out of memory.
+     */
+    void gc();
+
     /** @return Whether the underlying document pointer is initialized. */
     bool valid() const { return static_cast<bool>(_doc); }
     /** Serialize the document to YAML text. */
     std::string dump(const write_opts *opts = nullptr) const;
+    /** Stream the document as YAML text without building it in memory. */
+    void dump(std::ostream &os, const write_opts *opts = nullptr) const;
+    /** Serialize the document to JSON text; see yyaml_write_json. */
+    std::string dump_json(const write_opts *opts = nullptr) const;
 
 private:
     ::yyaml_doc* _doc = nullptr;
@@ -302,6 +435,7 @@ inline node node::at(std::size_t index) const {
     if (!is_sequence()) {
         throw yyaml_error("yyaml::node only work at sequence type");
     }
+    (void)yyaml_doc_index_sequences(const_cast<::yyaml_doc *>(_node->doc));
     const ::yyaml_node *child = yyaml_seq_get(_node, index);
     return node(child);
 }
@@ -487,6 +621,40 @@ inline std::string node::to_string() const {
     return out;
 }
 
+inline std::string node::to_json(bool pretty) const {
+    require_bound();
+
+    char *buffer = nullptr;
+    size_t len = 0;
+    ::yyaml_err err = {0};
+
+    ::yyaml_write_opts opts{};
+    opts.indent = 2;
+    opts.final_newline = false;
+    opts.pretty = pretty;
+
+    if (!yyaml_write_json(_node, &buffer, &len, &opts, &err)) {
+        throw yyaml_error(err);
+    }
+
+    std::string out(buffer, len);
+    yyaml_free_string(buffer);
+    return out;
+}
+
+inline void document::dump(std::ostream &os, const write_opts *opts) const {
+    require_doc();
+    ::yyaml_err err = {0};
+    auto sink = [](void *ctx, const char *data, std::size_t len) -> bool {
+        auto &stream = *static_cast<std::ostream *>(ctx);
+        stream.write(data, static_cast<std::streamsize>(len));
+        return static_cast<bool>(stream);
+    };
+    if (!yyaml_write_cb(yyaml_doc_get_root(_doc), sink, &os, opts, &err)) {
+        throw yyaml_error(err);
+    }
+}
+
 inline uint32_t node::index() const {
     require_bound();
     const uint32_t idx = yyaml_node_index(_node->doc, _node);
@@ -496,6 +664,23 @@ inline uint32_t node::index() const {
     return idx;
 }
 
+inline std::uint64_t node::digest() const {
+    require_bound();
+    return yyaml_doc_hash(_node);
+}
+
+inline bool node::equals(const node &other, bool ignore_key_order) const {
+    require_bound();
+    other.require_bound();
+    return yyaml_node_equal(_node, other._node, ignore_key_order);
+}
+
+inline bool node::equals_cached(const node &other) const {
+    require_bound();
+    other.require_bound();
+    return yyaml_node_equal_cached(_node, other._node);
+}
+
 inline void document::require_doc() const {
     if (!_doc) {
         throw yyaml_error("yyaml::document is not initialized");
@@ -614,6 +799,133 @@ inline void document::map_append(const node &map, const std::string &key, const
     }
 }
 
+inline void document::compact() {
+    require_doc();
+    if (!yyaml_doc_compact(_doc)) {
+        throw yyaml_error("failed to compact yyaml document");
+    }
+}
+
+inline void document::index_sequences() {
+    require_doc();
+    if (!yyaml_doc_index_sequences(_doc)) {
+        throw yyaml_error("failed to index yyaml sequences");
+    }
+}
+
+inline void document::cache_hashes() {
+    require_doc();
+    if (!yyaml_doc_cache_hashes(_doc)) {
+        throw yyaml_error("failed to cache yyaml digests");
+    }
+}
+
+inline void document::shrink() {
+    require_doc();
+    if (!yyaml_doc_shrink(_doc)) {
+        throw yyaml_error("failed to shrink yyaml document");
+    }
+}
+
+inline void document::gc() {
+    require_doc();
+    if (!yyaml_doc_gc(_doc)) {
+        throw yyaml_error("failed to collect yyaml document garbage");
+    }
+}
+
+inline bool document::map_remove(const node &map, const std::string &key) {
+    if (!map.is_mapping()) {
+        throw yyaml_error("yyaml::node is not a mapping");
+    }
+    return yyaml_doc_map_remove(_doc, index_of(map), key.data(), key.size());
+}
+
+inline void document::map_set(const node &map, const std::string &key, const node &value) {
+    if (!map.is_mapping()) {
+        throw yyaml_error("yyaml::node is not a mapping");
+    }
+    const uint32_t map_idx = index_of(map);
+    const uint32_t val_idx = index_of(value);
+    if (!yyaml_doc_map_set(_doc, map_idx, key.data(), key.size(), val_idx)) {
+        throw yyaml_error("failed to set mapping entry");
+    }
+}
+
+inline void document::seq_insert(const node &seq, std::size_t pos, const node &child) {
+    if (!seq.is_sequence()) {
+        throw yyaml_error("yyaml::node is not a sequence");
+    }
+    const uint32_t seq_idx = index_of(seq);
+    const uint32_t child_idx = index_of(child);
+    if (!yyaml_doc_seq_insert(_doc, seq_idx, pos, child_idx)) {
+        throw yyaml_error("failed to insert child into sequence");
+    }
+}
+
+inline void document::seq_remove(const node &seq, std::size_t pos) {
+    if (!seq.is_sequence()) {
+        throw yyaml_error("yyaml::node is not a sequence");
+    }
+    if (!yyaml_doc_seq_remove(_doc, index_of(seq), pos)) {
+        throw yyaml_error("sequence index out of range");
+    }
+}
+
+inline node document::add_int_array(const std::int64_t *values, std::size_t count) {
+    require_doc();
+    const uint32_t idx = yyaml_doc_add_int_array(_doc, values, count);
+    if (idx == std::numeric_limits<uint32_t>::max()) {
+        throw yyaml_error("failed to allocate int array");
+    }
+    return node_from_index(idx);
+}
+
+inline node document::add_double_array(const double *values, std::size_t count) {
+    require_doc();
+    const uint32_t idx = yyaml_doc_add_double_array(_doc, values, count);
+    if (idx == std::numeric_limits<uint32_t>::max()) {
+        throw yyaml_error("failed to allocate double array");
+    }
+    return node_from_index(idx);
+}
+
+inline node document::add_bool_array(const bool *values, std::size_t count) {
+    require_doc();
+    const uint32_t idx = yyaml_doc_add_bool_array(_doc, values, count);
+    if (idx == std::numeric_limits<uint32_t>::max()) {
+        throw yyaml_error("failed to allocate bool array");
+    }
+    return node_from_index(idx);
+}
+
+inline node document::add_string_array(const std::vector<std::string> &values) {
+    require_doc();
+    std::vector<const char *> ptrs;
+    std::vector<std::size_t> lens;
+    ptrs.reserve(values.size());
+    lens.reserve(values.size());
+    for (const auto &value : values) {
+        ptrs.push_back(value.data());
+        lens.push_back(value.size());
+    }
+    const uint32_t idx = yyaml_doc_add_string_array(_doc, ptrs.data(), lens.data(), values.size());
+    if (idx == std::numeric_limits<uint32_t>::max()) {
+        throw yyaml_error("failed to allocate string array");
+    }
+    return node_from_index(idx);
+}
+
+inline node document::import_node(const node &source) {
+    require_doc();
+    source.require_bound();
+    const uint32_t idx = yyaml_doc_import(_doc, source._node);
+    if (idx == std::numeric_limits<uint32_t>::max()) {
+        throw yyaml_error("failed to import yyaml node");
+    }
+    return node_from_index(idx);
+}
+
 inline void node::require_bound() const {
     if (!_node || !_node->doc) {
         throw yyaml_error("yyaml::node is not bound to a document");
@@ -658,5 +970,21 @@ inline std::string document::dump(const write_opts *opts) const {
     return out;
 }
 
+inline std::string document::dump_json(const write_opts *opts) const {
+    require_doc();
+
+    char *buffer = nullptr;
+    size_t len = 0;
+    ::yyaml_err err = {0};
+
+    if (!yyaml_write_json(yyaml_doc_get_root(_doc), &buffer, &len, opts, &err)) {
+        throw yyaml_error(err);
+    }
+
+    std::string out(buffer, len);
+    yyaml_free_string(buffer);
+    return out;
+}
+
 } // namespace yyaml
 
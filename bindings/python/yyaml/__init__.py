@@ -1,5 +1,14 @@
 """Python convenience layer for the yyaml extension module."""
 
-from .yyaml_python import Document, Node, NodeIterator, dump, dumps, load, loads
+from .yyaml_python import (
+    Document,
+    Node,
+    NodeIterator,
+    dump,
+    dumps,
+    dumps_json,
+    load,
+    loads,
+)
 
-__all__ = ["Document", "Node", "NodeIterator", "dump", "dumps", "load", "loads"]
+__all__ = ["Document", "Node", "NodeIterator", "dump", "dumps", "dumps_json", "load", "loads"]
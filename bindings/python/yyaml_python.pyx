@@ -5,7 +5,9 @@ This module exposes a small, pythonic wrapper around the C structures while
 keeping allocations inside the yyaml library. The public surface mirrors a
 subset of the C++ helpers defined in ``yyaml.hpp``.
 """
-from libc.stdint cimport uint32_t, int64_t
+import os
+
+from libc.stdint cimport uint32_t, int64_t, uint64_t
 from libc.string cimport strlen
 from libc.stddef cimport size_t
 
@@ -26,16 +28,39 @@ cdef extern from "yyaml.h":
         yyaml_bool allow_trailing_content
         yyaml_bool allow_inf_nan
         size_t max_nesting
+        yyaml_bool compact
+        yyaml_bool keep_source
+
+    ctypedef enum yyaml_write_style:
+        YYAML_STYLE_BLOCK
+        YYAML_STYLE_AUTO
+        YYAML_STYLE_FLOW
+        YYAML_STYLE_LINE
 
     ctypedef struct yyaml_write_opts:
         size_t indent
         yyaml_bool final_newline
+        yyaml_bool pretty
+        yyaml_bool exact_size
+        yyaml_write_style style
+        size_t flow_width
+        size_t threads
+        yyaml_bool sort_keys
+        yyaml_bool canonical
+
+    ctypedef enum yyaml_err_code:
+        YYAML_ERR_NONE
+        YYAML_ERR_PARSE
+        YYAML_ERR_IO
+        YYAML_ERR_MEMORY
+        YYAML_ERR_INVALID
 
     ctypedef struct yyaml_err:
         size_t pos
         size_t line
         size_t column
         char msg[96]
+        yyaml_err_code code
 
     ctypedef struct yyaml_doc
 
@@ -53,18 +78,22 @@ cdef extern from "yyaml.h":
         yyaml_doc *doc
         uint32_t type
         uint32_t flags
-        yyaml_node *parent
-        yyaml_node *next
-        yyaml_node *child
+        uint32_t parent
+        uint32_t next
+        uint32_t child
         uint32_t extra
         yyaml_node_val val
 
     yyaml_doc *yyaml_read(const char *data, size_t len,
                           const yyaml_read_opts *opts,
                           yyaml_err *err)
+    yyaml_doc *yyaml_read_file(const char *path,
+                               const yyaml_read_opts *opts,
+                               yyaml_err *err)
     yyaml_doc *yyaml_doc_new()
     void yyaml_doc_free(yyaml_doc *doc)
     const yyaml_node *yyaml_doc_get_root(const yyaml_doc *doc)
+    const yyaml_node *yyaml_doc_get(const yyaml_doc *doc, uint32_t idx)
     const char *yyaml_doc_get_scalar_buf(const yyaml_doc *doc)
 
     bint yyaml_is_scalar(const yyaml_node *node)
@@ -73,22 +102,29 @@ cdef extern from "yyaml.h":
     const yyaml_node *yyaml_seq_get(const yyaml_node *seq, size_t index)
     size_t yyaml_seq_len(const yyaml_node *seq)
     size_t yyaml_map_len(const yyaml_node *map)
-
-    yyaml_node *yyaml_doc_add_null(yyaml_doc *doc)
-    yyaml_node *yyaml_doc_add_bool(yyaml_doc *doc, bint value)
-    yyaml_node *yyaml_doc_add_int(yyaml_doc *doc, int64_t value)
-    yyaml_node *yyaml_doc_add_double(yyaml_doc *doc, double value)
-    yyaml_node *yyaml_doc_add_string(yyaml_doc *doc, const char *str, size_t len)
-    yyaml_node *yyaml_doc_add_sequence(yyaml_doc *doc)
-    yyaml_node *yyaml_doc_add_mapping(yyaml_doc *doc)
-    bint yyaml_doc_set_root(yyaml_doc *doc, yyaml_node *root)
-    bint yyaml_doc_seq_append(yyaml_doc *doc, yyaml_node *seq, yyaml_node *child)
-    bint yyaml_doc_map_append(yyaml_doc *doc, yyaml_node *map,
+    uint64_t yyaml_doc_hash(const yyaml_node *node)
+    bint yyaml_doc_cache_hashes(yyaml_doc *doc)
+    bint yyaml_node_equal(const yyaml_node *a, const yyaml_node *b,
+                          bint ignore_key_order)
+    bint yyaml_node_equal_cached(const yyaml_node *a, const yyaml_node *b)
+
+    uint32_t yyaml_doc_add_null(yyaml_doc *doc)
+    uint32_t yyaml_doc_add_bool(yyaml_doc *doc, bint value)
+    uint32_t yyaml_doc_add_int(yyaml_doc *doc, int64_t value)
+    uint32_t yyaml_doc_add_double(yyaml_doc *doc, double value)
+    uint32_t yyaml_doc_add_string(yyaml_doc *doc, const char *str, size_t len)
+    uint32_t yyaml_doc_add_sequence(yyaml_doc *doc)
+    uint32_t yyaml_doc_add_mapping(yyaml_doc *doc)
+    bint yyaml_doc_set_root(yyaml_doc *doc, uint32_t idx)
+    bint yyaml_doc_seq_append(yyaml_doc *doc, uint32_t seq_idx, uint32_t child_idx)
+    bint yyaml_doc_map_append(yyaml_doc *doc, uint32_t map_idx,
                               const char *key, size_t key_len,
-                              yyaml_node *value)
+                              uint32_t val_idx)
 
     bint yyaml_write(const yyaml_node *root, char **out, size_t *out_len,
                      const yyaml_write_opts *opts, yyaml_err *err)
+    bint yyaml_write_json(const yyaml_node *root, char **out, size_t *out_len,
+                          const yyaml_write_opts *opts, yyaml_err *err)
     void yyaml_free_string(char *str)
 
 
@@ -101,9 +137,53 @@ cdef inline str _format_error(const yyaml_err *err):
     return f"{text} (line {err.line}, column {err.column})"
 
 
-cdef yyaml_node *_build_node(object obj, yyaml_doc *doc):
-    cdef yyaml_node *node
-    cdef yyaml_node *child
+cdef uint32_t _INDEX_NONE = 0xFFFFFFFF
+
+
+cdef yyaml_read_opts *_read_opts(object opts, yyaml_read_opts *c_opts):
+    """Fill c_opts from a Python mapping; NULL selects the C defaults."""
+    if opts is None:
+        return NULL
+    c_opts.allow_duplicate_keys = bool(opts.get("allow_duplicate_keys", False))
+    c_opts.allow_trailing_content = bool(opts.get("allow_trailing_content", False))
+    c_opts.allow_inf_nan = bool(opts.get("allow_inf_nan", True))
+    c_opts.max_nesting = <size_t>opts.get("max_nesting", 0)
+    c_opts.compact = bool(opts.get("compact", False))
+    c_opts.keep_source = bool(opts.get("keep_source", False))
+    return c_opts
+
+
+_WRITE_STYLES = {
+    "block": YYAML_STYLE_BLOCK,
+    "auto": YYAML_STYLE_AUTO,
+    "flow": YYAML_STYLE_FLOW,
+    "line": YYAML_STYLE_LINE,
+}
+
+
+cdef yyaml_write_opts *_write_opts(object opts, yyaml_write_opts *c_opts):
+    """Fill c_opts from a Python mapping; NULL selects the C defaults."""
+    if opts is None:
+        return NULL
+    style = opts.get("style", "block")
+    if style not in _WRITE_STYLES:
+        raise ValueError(f"unknown write style: {style!r}")
+    c_opts.indent = <size_t>opts.get("indent", 2)
+    c_opts.final_newline = bool(opts.get("final_newline", True))
+    c_opts.pretty = bool(opts.get("pretty", False))
+    c_opts.exact_size = bool(opts.get("exact_size", False))
+    c_opts.style = _WRITE_STYLES[style]
+    c_opts.flow_width = <size_t>opts.get("flow_width", 0)
+    c_opts.threads = <size_t>opts.get("threads", 0)
+    c_opts.sort_keys = bool(opts.get("sort_keys", False))
+    c_opts.canonical = bool(opts.get("canonical", False))
+    return c_opts
+
+
+cdef uint32_t _build_node(object obj, yyaml_doc *doc):
+    """Append ``obj`` to ``doc`` and return its node index (UINT32_MAX on failure)."""
+    cdef uint32_t node
+    cdef uint32_t child
     cdef bytes data
     if obj is None:
         return yyaml_doc_add_null(doc)
@@ -120,28 +200,28 @@ cdef yyaml_node *_build_node(object obj, yyaml_doc *doc):
         return yyaml_doc_add_string(doc, data, <size_t>len(data))
     if isinstance(obj, (list, tuple)):
         node = yyaml_doc_add_sequence(doc)
-        if node is NULL:
-            return NULL
+        if node == _INDEX_NONE:
+            return _INDEX_NONE
         for item in obj:
             child = _build_node(item, doc)
-            if child is NULL:
-                return NULL
+            if child == _INDEX_NONE:
+                return _INDEX_NONE
             if not yyaml_doc_seq_append(doc, node, child):
-                return NULL
+                return _INDEX_NONE
         return node
     if isinstance(obj, dict):
         node = yyaml_doc_add_mapping(doc)
-        if node is NULL:
-            return NULL
+        if node == _INDEX_NONE:
+            return _INDEX_NONE
         for key, value in obj.items():
             key_text = str(key)
             key_bytes = key_text.encode("utf-8")
             child = _build_node(value, doc)
-            if child is NULL:
-                return NULL
+            if child == _INDEX_NONE:
+                return _INDEX_NONE
             if not yyaml_doc_map_append(doc, node, key_bytes,
                                         <size_t>len(key_bytes), child):
-                return NULL
+                return _INDEX_NONE
         return node
     # Fallback: store the string representation
     return _build_node(str(obj), doc)
@@ -232,6 +312,26 @@ cdef class Node:
             raise TypeError("node is not iterable")
         return NodeIterator(self)
 
+    def digest(self):
+        """Return the order-insensitive 64-bit digest of this subtree."""
+        return yyaml_doc_hash(self._node)
+
+    def equals(self, Node other not None, ignore_key_order=False):
+        """Compare this subtree with other, possibly from another document.
+
+        Unchanged sections are walked in full; see equals_cached.
+        """
+        return bool(yyaml_node_equal(self._node, other._node,
+                                     bool(ignore_key_order)))
+
+    def equals_cached(self, Node other not None):
+        """Compare in any key order, taking matching cached digests as proof.
+
+        Sections cached on both sides with Document.cache_hashes are not
+        walked, so comparing an unchanged section is O(1).
+        """
+        return bool(yyaml_node_equal_cached(self._node, other._node))
+
     def to_dict(self):
         """Convert this node tree into native Python objects."""
         cdef const char *buf
@@ -255,25 +355,22 @@ cdef class Node:
                 raise ValueError("yyaml scalar buffer is null")
             return (<const char *>buf + self._node.val.str.ofs)[:self._node.val.str.len].decode("utf-8")
         if t == YYAML_SEQUENCE:
-            size = yyaml_seq_len(self._node)
             out = []
-            for i in range(size):
-                child = yyaml_seq_get(self._node, i)
-                if child is NULL:
-                    out.append(None)
-                else:
-                    out.append(_wrap_node(self._owner, child).to_dict())
+            child = yyaml_doc_get(self._node.doc, self._node.child)
+            while child is not NULL:
+                out.append(_wrap_node(self._owner, child).to_dict())
+                child = yyaml_doc_get(self._node.doc, child.next)
             return out
         if t == YYAML_MAPPING:
             buf = yyaml_doc_get_scalar_buf(self._node.doc)
             if buf is NULL:
                 raise ValueError("yyaml scalar buffer is null")
             result = {}
-            child = self._node.child
+            child = yyaml_doc_get(self._node.doc, self._node.child)
             while child is not NULL:
                 key = (<const char *>buf + child.extra)[:child.flags].decode("utf-8")
                 result[key] = _wrap_node(self._owner, child).to_dict()
-                child = child.next
+                child = yyaml_doc_get(self._node.doc, child.next)
             return result
         raise TypeError("unknown yyaml node type")
 
@@ -285,7 +382,7 @@ cdef class NodeIterator:
     def __cinit__(self, Node parent):
         self._parent = parent
         if parent._node is not NULL and yyaml_is_container(parent._node):
-            self._next = parent._node.child
+            self._next = yyaml_doc_get(parent._node.doc, parent._node.child)
         else:
             self._next = NULL
 
@@ -296,7 +393,7 @@ cdef class NodeIterator:
         if self._next is NULL:
             raise StopIteration
         current = _wrap_node(self._parent._owner, self._next)
-        self._next = self._next.next
+        self._next = yyaml_doc_get(self._next.doc, self._next.next)
         return current
 
 
@@ -332,6 +429,13 @@ cdef class Document:
             return None
         return _wrap_node(self, raw)
 
+    def cache_hashes(self):
+        """Cache subtree digests for :meth:`Node.equals` and its cached variant."""
+        if self._doc is NULL:
+            raise ValueError("document is not initialized")
+        if not yyaml_doc_cache_hashes(self._doc):
+            raise MemoryError("failed to cache yyaml digests")
+
     def to_dict(self):
         root_node = self.root
         if root_node is None:
@@ -344,11 +448,7 @@ cdef class Document:
             raise ValueError("document is not initialized")
 
         cdef yyaml_write_opts c_opts
-        cdef yyaml_write_opts *opts_ptr = NULL
-        if opts is not None:
-            c_opts.indent = <size_t>opts.get("indent", 2)
-            c_opts.final_newline = bool(opts.get("final_newline", True))
-            opts_ptr = &c_opts
+        cdef yyaml_write_opts *opts_ptr = _write_opts(opts, &c_opts)
 
         cdef char *buffer = NULL
         cdef size_t length = 0
@@ -362,6 +462,26 @@ cdef class Document:
             if buffer is not NULL:
                 yyaml_free_string(buffer)
 
+    def dump_json(self, opts=None):
+        """Serialize the document to JSON text (minified unless ``pretty``)."""
+        if self._doc is NULL:
+            raise ValueError("document is not initialized")
+
+        cdef yyaml_write_opts c_opts
+        cdef yyaml_write_opts *opts_ptr = _write_opts(opts, &c_opts)
+
+        cdef char *buffer = NULL
+        cdef size_t length = 0
+        cdef yyaml_err err
+        cdef const yyaml_node *root = yyaml_doc_get_root(self._doc)
+        if not yyaml_write_json(root, &buffer, &length, opts_ptr, &err):
+            raise ValueError(_format_error(&err))
+        try:
+            return (<const char *>buffer)[:length].decode("utf-8")
+        finally:
+            if buffer is not NULL:
+                yyaml_free_string(buffer)
+
     @staticmethod
     def parse(text, opts=None):
         """Parse YAML text into a :class:`Document`."""
@@ -370,13 +490,7 @@ cdef class Document:
         cdef size_t size = <size_t>len(encoded)
 
         cdef yyaml_read_opts c_opts
-        cdef yyaml_read_opts *opts_ptr = NULL
-        if opts is not None:
-            c_opts.allow_duplicate_keys = bool(opts.get("allow_duplicate_keys", False))
-            c_opts.allow_trailing_content = bool(opts.get("allow_trailing_content", False))
-            c_opts.allow_inf_nan = bool(opts.get("allow_inf_nan", True))
-            c_opts.max_nesting = <size_t>opts.get("max_nesting", 0)
-            opts_ptr = &c_opts
+        cdef yyaml_read_opts *opts_ptr = _read_opts(opts, &c_opts)
 
         cdef yyaml_err err
         cdef yyaml_doc *doc = yyaml_read(data, size, opts_ptr, &err)
@@ -389,9 +503,21 @@ cdef class Document:
 
     @staticmethod
     def parse_file(path, opts=None):
-        with open(path, "rb") as handle:
-            content = handle.read().decode("utf-8")
-        return Document.parse(content, opts=opts)
+        """Parse a YAML file into a :class:`Document` without a Python copy."""
+        cdef bytes encoded = os.fsencode(path)
+        cdef yyaml_read_opts c_opts
+        cdef yyaml_read_opts *opts_ptr = _read_opts(opts, &c_opts)
+
+        cdef yyaml_err err
+        cdef yyaml_doc *doc = yyaml_read_file(encoded, opts_ptr, &err)
+        if doc is NULL:
+            if err.code == YYAML_ERR_IO:
+                raise OSError(f"{(<const char *>err.msg).decode('utf-8', 'replace')}: {path}")
+            raise ValueError(_format_error(&err))
+
+        cdef Document wrapper = Document.__new__(Document)
+        wrapper._doc = doc
+        return wrapper
 
     @staticmethod
     def from_dict(obj, *, opts=None):
@@ -400,8 +526,8 @@ cdef class Document:
         if doc is NULL:
             raise MemoryError("failed to allocate document")
 
-        cdef yyaml_node *root = _build_node(obj, doc)
-        if root is NULL or not yyaml_doc_set_root(doc, root):
+        cdef uint32_t root = _build_node(obj, doc)
+        if root == _INDEX_NONE or not yyaml_doc_set_root(doc, root):
             yyaml_doc_free(doc)
             raise ValueError("failed to build document from input")
 
@@ -434,6 +560,13 @@ def dumps(obj, *, opts=None):
     return Document.from_dict(obj, opts=opts).dump(opts=opts)
 
 
+def dumps_json(obj, *, opts=None):
+    """Serialize Python objects or :class:`Document` instances to JSON text."""
+    if isinstance(obj, Document):
+        return obj.dump_json(opts=opts)
+    return Document.from_dict(obj, opts=opts).dump_json(opts=opts)
+
+
 def dump(obj, fp, *, opts=None):
     """Serialize and write YAML content to a file-like object."""
     text = dumps(obj, opts=opts)
@@ -447,5 +580,6 @@ __all__ = [
     "loads",
     "load",
     "dumps",
+    "dumps_json",
     "dump",
 ]
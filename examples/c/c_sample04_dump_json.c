@@ -1,7 +1,7 @@
 /*
  * Sample 04 - Iterate through the YAML data set in examples/data, load each
- * document, and dump its content as a JSON-like structure. This highlights how
- * to traverse nodes generically.
+ * document, and dump its content as JSON with yyaml_write_json, once pretty
+ * printed and once minified.
  */
 
 #include <errno.h>
@@ -20,132 +20,6 @@
 #include "common.h"
 #include "yyaml.h"
 
-static void print_indent(size_t depth) {
-    size_t i;
-    for (i = 0; i < depth; i++) {
-        putchar(' ');
-    }
-}
-
-static void print_escaped_json(const char *str, size_t len) {
-    size_t i;
-    putchar('"');
-    for (i = 0; i < len; i++) {
-        unsigned char c = (unsigned char)str[i];
-        switch (c) {
-        case '\\':
-            fputs("\\\\", stdout);
-            break;
-        case '\"':
-            fputs("\\\"", stdout);
-            break;
-        case '\n':
-            fputs("\\n", stdout);
-            break;
-        case '\r':
-            fputs("\\r", stdout);
-            break;
-        case '\t':
-            fputs("\\t", stdout);
-            break;
-        default:
-            if (c < 0x20) {
-                static const char hex[] = "0123456789ABCDEF";
-                putchar('\\');
-                putchar('u');
-                putchar(hex[(c >> 4) & 0xF]);
-                putchar(hex[c & 0xF]);
-            } else {
-                putchar((char)c);
-            }
-            break;
-        }
-    }
-    putchar('"');
-}
-
-static void dump_node_json(const yyaml_doc *doc, const yyaml_node *node, size_t depth);
-
-static void dump_sequence_json(const yyaml_doc *doc, const yyaml_node *seq, size_t depth) {
-    const yyaml_node *child = yyaml_doc_get(doc, seq->child);
-    puts("[");
-    while (child) {
-        const yyaml_node *next = yyaml_doc_get(doc, child->next);
-        print_indent(depth + 2);
-        dump_node_json(doc, child, depth + 2);
-        if (next) {
-            putchar(',');
-        }
-        putchar('\n');
-        child = next;
-    }
-    print_indent(depth);
-    putchar(']');
-}
-
-static void dump_mapping_json(const yyaml_doc *doc, const yyaml_node *map, size_t depth) {
-    const yyaml_node *child = yyaml_doc_get(doc, map->child);
-    const char *scalars = yyaml_doc_get_scalar_buf(doc);
-    puts("{");
-    while (child) {
-        const yyaml_node *next = yyaml_doc_get(doc, child->next);
-        print_indent(depth + 2);
-        if (scalars && child->flags > 0) {
-            print_escaped_json(scalars + child->extra, child->flags);
-        } else {
-            fputs("\"<key>\"", stdout);
-        }
-        fputs(": ", stdout);
-        dump_node_json(doc, child, depth + 2);
-        if (next) {
-            putchar(',');
-        }
-        putchar('\n');
-        child = next;
-    }
-    print_indent(depth);
-    putchar('}');
-}
-
-static void dump_node_json(const yyaml_doc *doc, const yyaml_node *node, size_t depth) {
-    const char *scalars;
-    if (!node) {
-        fputs("null", stdout);
-        return;
-    }
-    scalars = yyaml_doc_get_scalar_buf(doc);
-    switch (node->type) {
-    case YYAML_NULL:
-        fputs("null", stdout);
-        break;
-    case YYAML_BOOL:
-        fputs(node->val.boolean ? "true" : "false", stdout);
-        break;
-    case YYAML_INT:
-        printf("%lld", (long long)node->val.integer);
-        break;
-    case YYAML_DOUBLE:
-        printf("%g", node->val.real);
-        break;
-    case YYAML_STRING:
-        if (scalars && node->val.str.len > 0) {
-            print_escaped_json(scalars + node->val.str.ofs, node->val.str.len);
-        } else {
-            fputs("\"\"", stdout);
-        }
-        break;
-    case YYAML_SEQUENCE:
-        dump_sequence_json(doc, node, depth);
-        break;
-    case YYAML_MAPPING:
-        dump_mapping_json(doc, node, depth);
-        break;
-    default:
-        fputs("null", stdout);
-        break;
-    }
-}
-
 static bool has_yaml_extension(const char *name) {
     size_t len;
     if (!name) return false;
@@ -160,6 +34,7 @@ static void process_file(const char *path, const char *display_name) {
     size_t file_len = 0;
     yyaml_err err = {0};
     yyaml_doc *doc;
+    int pass;
 
     if (!yyaml_example_read_file(path, &file_data, &file_len)) {
         fprintf(stderr, "Failed to read %s: %s\n", path, strerror(errno));
@@ -175,9 +50,23 @@ static void process_file(const char *path, const char *display_name) {
     }
 
     printf("=== %s (%s) ===\n", display_name, path);
-    printf("JSON dump of %s:\n", display_name);
-    dump_node_json(doc, yyaml_doc_get_root(doc), 0);
-    printf("\n\n");
+    for (pass = 0; pass < 2; pass++) {
+        yyaml_write_opts opts = {0};
+        char *json = NULL;
+        size_t json_len = 0;
+        opts.indent = 2;
+        opts.final_newline = true;
+        opts.pretty = pass == 0;
+        if (!yyaml_write_json(yyaml_doc_get_root(doc), &json, &json_len, &opts, &err)) {
+            fprintf(stderr, "Failed to write JSON for %s: %s\n", path, err.msg);
+            break;
+        }
+        printf("%s JSON dump of %s:\n", opts.pretty ? "Pretty" : "Minified",
+               display_name);
+        fwrite(json, 1, json_len, stdout);
+        yyaml_free_string(json);
+    }
+    printf("\n");
 
     yyaml_doc_free(doc);
     free(file_data);
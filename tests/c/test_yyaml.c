@@ -4,6 +4,13 @@
 #include <stdio.h>
 #include <math.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 // Test basic scalar parsing
 UTEST(yyaml_tests, test_parse_null) {
     yyaml_doc *doc = NULL;
@@ -229,6 +236,7 @@ UTEST(yyaml_tests, test_parse_invalid_yaml) {
     doc = yyaml_read(invalid_yaml, strlen(invalid_yaml), NULL, &err);
     ASSERT_TRUE(doc == NULL);
     ASSERT_NE(0, err.pos);
+    ASSERT_EQ(YYAML_ERR_PARSE, err.code);
 }
 
 UTEST(yyaml_tests, test_parse_empty_string) {
@@ -434,3 +442,1532 @@ UTEST(yyaml_tests, test_doc_get_functions) {
     
     if (doc) yyaml_doc_free(doc);
 }
+
+// Test indexed sequence access stays consistent across rebuilds
+UTEST(yyaml_tests, test_seq_get_indexed_access) {
+    yyaml_doc *doc = NULL;
+    yyaml_err err = {0};
+    char yaml[4096];
+    size_t len = 0;
+    size_t i;
+
+    len += (size_t)snprintf(yaml + len, sizeof(yaml) - len, "items:\n");
+    for (i = 0; i < 200; i++) {
+        len += (size_t)snprintf(yaml + len, sizeof(yaml) - len, "  - %zu\n", i);
+    }
+    len += (size_t)snprintf(yaml + len, sizeof(yaml) - len, "flow: [a, [b, c], d]\n");
+
+    doc = yyaml_read(yaml, len, NULL, &err);
+    ASSERT_TRUE(doc != NULL);
+
+    const yyaml_node *root = yyaml_doc_get_root(doc);
+    const yyaml_node *items = yyaml_map_get(root, "items");
+    ASSERT_EQ(200, yyaml_seq_len(items));
+    for (i = 0; i < 200; i++) {
+        const yyaml_node *item = yyaml_seq_get(items, i);
+        ASSERT_TRUE(item != NULL);
+        ASSERT_EQ((int64_t)i, item->val.integer);
+    }
+    ASSERT_TRUE(yyaml_seq_get(items, 200) == NULL);
+
+    const yyaml_node *flow = yyaml_map_get(root, "flow");
+    ASSERT_EQ(3, yyaml_seq_len(flow));
+    ASSERT_TRUE(yyaml_str_eq(doc, yyaml_seq_get(flow, 2), "d"));
+    ASSERT_TRUE(yyaml_str_eq(doc, yyaml_seq_get(yyaml_seq_get(flow, 1), 1), "c"));
+
+    /* appending invalidates the index; reads walk the links until rebuilt */
+    uint32_t items_idx = yyaml_node_index(doc, items);
+    ASSERT_TRUE(yyaml_doc_seq_append(doc, items_idx, yyaml_doc_add_int(doc, 200)));
+    items = yyaml_doc_get(doc, items_idx);
+    ASSERT_EQ(201, yyaml_seq_len(items));
+    ASSERT_EQ(200, yyaml_seq_get(items, 200)->val.integer);
+    ASSERT_EQ(7, yyaml_seq_get(items, 7)->val.integer);
+
+    ASSERT_TRUE(yyaml_doc_index_sequences(doc));
+    for (i = 0; i < 201; i++) {
+        ASSERT_EQ((int64_t)i, yyaml_seq_get(items, i)->val.integer);
+    }
+    flow = yyaml_map_get(yyaml_doc_get_root(doc), "flow");
+    ASSERT_TRUE(yyaml_str_eq(doc, yyaml_seq_get(yyaml_seq_get(flow, 1), 0), "b"));
+    ASSERT_FALSE(yyaml_doc_index_sequences(NULL));
+
+    yyaml_doc_free(doc);
+}
+
+// Test depth-first compaction keeps content and makes children contiguous
+UTEST(yyaml_tests, test_doc_compact_layout) {
+    yyaml_doc *doc = NULL;
+    yyaml_err err = {0};
+    const char *yaml =
+        "name: demo\n"
+        "flow: [1, [2, 3], 4]\n"
+        "nested:\n"
+        "  - a: 1\n"
+        "    b: [x, y]\n"
+        "  - plain\n"
+        "map: {k: v, n: [7, 8]}\n";
+
+    doc = yyaml_read(yaml, strlen(yaml), NULL, &err);
+    ASSERT_TRUE(doc != NULL);
+    /* an orphan node created by the builder is dropped by compaction */
+    ASSERT_TRUE(yyaml_doc_add_int(doc, 99) != UINT32_MAX);
+    size_t before_count = yyaml_doc_node_count(doc);
+
+    char *before = NULL;
+    size_t before_len = 0;
+    ASSERT_TRUE(yyaml_write(yyaml_doc_get_root(doc), &before, &before_len, NULL, &err));
+    ASSERT_TRUE(yyaml_doc_compact(doc));
+    ASSERT_EQ(before_count - 1, yyaml_doc_node_count(doc));
+
+    const yyaml_node *root = yyaml_doc_get_root(doc);
+    ASSERT_EQ(0u, yyaml_node_index(doc, root));
+    ASSERT_EQ(yyaml_doc_node_count(doc), yyaml_node_subtree_size(root));
+
+    char *after = NULL;
+    size_t after_len = 0;
+    ASSERT_TRUE(yyaml_write(root, &after, &after_len, NULL, &err));
+    ASSERT_EQ(before_len, after_len);
+    ASSERT_STREQ(before, after);
+    yyaml_free_string(before);
+    yyaml_free_string(after);
+
+    /* every container: children contiguous, subtree is node + range */
+    size_t count = yyaml_doc_node_count(doc);
+    for (uint32_t i = 0; i < count; i++) {
+        const yyaml_node *node = yyaml_doc_get(doc, i);
+        if (!yyaml_is_container(node) || node->child == UINT32_MAX) continue;
+        uint32_t expect = node->child;
+        for (uint32_t c = node->child; c != UINT32_MAX; c = yyaml_doc_get(doc, c)->next) {
+            ASSERT_EQ(expect, c);
+            ASSERT_EQ(i, yyaml_doc_get(doc, c)->parent);
+            expect++;
+        }
+        size_t subtree = yyaml_node_subtree_size(node);
+        for (uint32_t d = node->child; d < node->child + subtree - 1; d++) {
+            uint32_t up = d;
+            while (up != UINT32_MAX && up != i) up = yyaml_doc_get(doc, up)->parent;
+            ASSERT_EQ(i, up);
+        }
+    }
+
+    const yyaml_node *nested = yyaml_map_get(root, "nested");
+    ASSERT_EQ(7, yyaml_node_subtree_size(nested));
+    ASSERT_TRUE(yyaml_str_eq(doc, yyaml_seq_get(yyaml_map_get(yyaml_seq_get(nested, 0), "b"), 1), "y"));
+
+    yyaml_doc_free(doc);
+
+    yyaml_read_opts opts = {0};
+    opts.allow_inf_nan = true;
+    opts.max_nesting = 64;
+    opts.compact = true;
+    doc = yyaml_read(yaml, strlen(yaml), &opts, &err);
+    ASSERT_TRUE(doc != NULL);
+    root = yyaml_doc_get_root(doc);
+    ASSERT_EQ(yyaml_doc_node_count(doc), yyaml_node_subtree_size(root));
+    ASSERT_EQ(4, yyaml_seq_get(yyaml_map_get(root, "flow"), 2)->val.integer);
+    yyaml_doc_free(doc);
+
+    /* moving the root of a compacted document into it ends the layout:
+     * collection drops the rest and the snapshot loads back */
+    const char *path = "yyaml_test_reroot.bin";
+    doc = yyaml_read("a: [1, 2]\nb: 3\n", 15, &opts, &err);
+    ASSERT_TRUE(doc != NULL);
+    uint32_t seq = yyaml_node_index(doc, yyaml_map_get(yyaml_doc_get_root(doc), "a"));
+    ASSERT_TRUE(yyaml_doc_set_root(doc, seq));
+    ASSERT_TRUE(yyaml_doc_gc(doc));
+    ASSERT_EQ(3u, yyaml_doc_node_count(doc));
+    ASSERT_EQ(3u, yyaml_node_subtree_size(yyaml_doc_get_root(doc)));
+    ASSERT_TRUE(yyaml_doc_save_binary(doc, path, &err));
+    yyaml_doc_free(doc);
+    doc = yyaml_doc_load_binary(path, &err);
+    ASSERT_TRUE(doc != NULL);
+    root = yyaml_doc_get_root(doc);
+    ASSERT_EQ(2u, yyaml_seq_len(root));
+    ASSERT_EQ(2, yyaml_seq_get(root, 1)->val.integer);
+    yyaml_doc_free(doc);
+    remove(path);
+}
+
+// Test bulk builders produce the same documents as per-node appends
+UTEST(yyaml_tests, test_bulk_builders) {
+    yyaml_doc *doc = yyaml_doc_new();
+    yyaml_err err = {0};
+    ASSERT_TRUE(doc != NULL);
+
+    const int64_t ints[] = {1, -2, 3};
+    const double reals[] = {0.5, 2.0};
+    const bool flags[] = {true, false};
+    const char *const strs[] = {"alpha", "beta gamma"};
+
+    uint32_t root = yyaml_doc_add_mapping(doc);
+    ASSERT_TRUE(yyaml_doc_set_root(doc, root));
+    ASSERT_TRUE(yyaml_doc_map_append(doc, root, "first", 5, yyaml_doc_add_null(doc)));
+
+    const char *const keys[] = {"ints", "reals", "flags", "strs", "empty"};
+    uint32_t vals[5];
+    vals[0] = yyaml_doc_add_int_array(doc, ints, 3);
+    vals[1] = yyaml_doc_add_double_array(doc, reals, 2);
+    vals[2] = yyaml_doc_add_bool_array(doc, flags, 2);
+    vals[3] = yyaml_doc_add_string_array(doc, strs, NULL, 2);
+    vals[4] = yyaml_doc_add_int_array(doc, NULL, 0);
+    for (int i = 0; i < 5; i++) ASSERT_NE(UINT32_MAX, vals[i]);
+    ASSERT_TRUE(yyaml_doc_map_append_n(doc, root, keys, NULL, vals, 5));
+    /* a bad batch is rejected without partial effects */
+    const uint32_t bad[] = {vals[0], UINT32_MAX - 1};
+    ASSERT_FALSE(yyaml_doc_map_append_n(doc, root, keys, NULL, bad, 2));
+    /* linked values, repeats and the mapping itself are rejected as well */
+    uint32_t spare = yyaml_doc_add_int(doc, 9);
+    const uint32_t linked[] = {spare, vals[1]};
+    const uint32_t twice[] = {spare, spare};
+    const uint32_t self[] = {spare, root};
+    ASSERT_FALSE(yyaml_doc_map_append_n(doc, root, keys, NULL, linked, 2));
+    ASSERT_FALSE(yyaml_doc_map_append_n(doc, root, keys, NULL, twice, 2));
+    ASSERT_FALSE(yyaml_doc_map_append_n(doc, root, keys, NULL, self, 2));
+    ASSERT_EQ(UINT32_MAX, yyaml_doc_get(doc, spare)->parent);
+
+    const yyaml_node *map = yyaml_doc_get_root(doc);
+    ASSERT_EQ(6, yyaml_map_len(map));
+    ASSERT_EQ(-2, yyaml_seq_get(yyaml_map_get(map, "ints"), 1)->val.integer);
+    ASSERT_EQ(2.0, yyaml_seq_get(yyaml_map_get(map, "reals"), 1)->val.real);
+    ASSERT_FALSE(yyaml_seq_get(yyaml_map_get(map, "flags"), 1)->val.boolean);
+    ASSERT_TRUE(yyaml_str_eq(doc, yyaml_seq_get(yyaml_map_get(map, "strs"), 1), "beta gamma"));
+    ASSERT_EQ(0, yyaml_seq_len(yyaml_map_get(map, "empty")));
+
+    char *out = NULL;
+    size_t out_len = 0;
+    ASSERT_TRUE(yyaml_write(map, &out, &out_len, NULL, &err));
+    ASSERT_STREQ("first: null\n"
+                 "ints:\n  - 1\n  - -2\n  - 3\n"
+                 "reals:\n  - 0.5\n  - 2.0\n"
+                 "flags:\n  - true\n  - false\n"
+                 "strs:\n  - alpha\n  - \"beta gamma\"\n"
+                 "empty: []\n", out);
+    yyaml_free_string(out);
+
+    /* appending after a bulk batch keeps linking at the tail */
+    uint32_t ints_idx = yyaml_node_index(doc, yyaml_map_get(map, "ints"));
+    ASSERT_TRUE(yyaml_doc_seq_append(doc, ints_idx, yyaml_doc_add_int(doc, 4)));
+    ASSERT_EQ(4, yyaml_seq_get(yyaml_doc_get(doc, ints_idx), 3)->val.integer);
+
+    yyaml_doc_free(doc);
+}
+
+// Test mutation API edits in place and recycles released nodes
+UTEST(yyaml_tests, test_doc_mutation) {
+    yyaml_doc *doc = NULL;
+    yyaml_err err = {0};
+    const char *yaml =
+        "name: demo\n"
+        "nested:\n"
+        "  inner: [1, 2]\n"
+        "list:\n"
+        "  - a\n"
+        "  - b\n"
+        "  - c\n";
+
+    doc = yyaml_read(yaml, strlen(yaml), NULL, &err);
+    ASSERT_TRUE(doc != NULL);
+    uint32_t root = yyaml_node_index(doc, yyaml_doc_get_root(doc));
+    uint32_t list = yyaml_node_index(doc, yyaml_map_get(yyaml_doc_get_root(doc), "list"));
+    size_t count = yyaml_doc_node_count(doc);
+
+    /* replace a value, remove a subtree, edit a sequence */
+    ASSERT_TRUE(yyaml_doc_map_set(doc, root, "name", 4, yyaml_doc_add_int(doc, 7)));
+    ASSERT_TRUE(yyaml_doc_map_remove(doc, root, "nested", 6));
+    ASSERT_FALSE(yyaml_doc_map_remove(doc, root, "missing", 7));
+    ASSERT_TRUE(yyaml_doc_seq_remove(doc, list, 1));
+    ASSERT_FALSE(yyaml_doc_seq_remove(doc, list, 2));
+    ASSERT_TRUE(yyaml_doc_seq_insert(doc, list, 0, yyaml_doc_add_string(doc, "z", 1)));
+    ASSERT_TRUE(yyaml_doc_seq_insert(doc, list, 3, yyaml_doc_add_string(doc, "end", 3)));
+    ASSERT_TRUE(yyaml_doc_map_set(doc, root, "added", 5, yyaml_doc_add_bool(doc, true)));
+    /* the root and nodes that are already linked cannot be attached */
+    ASSERT_FALSE(yyaml_doc_seq_insert(doc, list, 0, root));
+    ASSERT_FALSE(yyaml_doc_seq_insert(doc, list, 0, list));
+
+    char *out = NULL;
+    size_t out_len = 0;
+    ASSERT_TRUE(yyaml_write(yyaml_doc_get_root(doc), &out, &out_len, NULL, &err));
+    ASSERT_STREQ("name: 7\nlist:\n  - z\n  - a\n  - c\n  - end\nadded: true\n", out);
+    yyaml_free_string(out);
+
+    /* six slots were released (old name, nested, inner, 1, 2, b) and three
+     * of them were reused by the nodes added afterwards */
+    size_t free_nodes = 0, dead_bytes = 0;
+    yyaml_doc_garbage(doc, &free_nodes, &dead_bytes);
+    ASSERT_EQ(3u, free_nodes);
+    ASSERT_EQ(5u + 7u + 6u + 2u, dead_bytes);
+    ASSERT_EQ(count + 1, yyaml_doc_node_count(doc));
+
+    /* new nodes reuse released slots instead of growing the pool */
+    for (size_t i = 0; i < free_nodes; i++) {
+        ASSERT_TRUE(yyaml_doc_seq_append(doc, list, yyaml_doc_add_null(doc)));
+    }
+    ASSERT_EQ(count + 1, yyaml_doc_node_count(doc));
+    ASSERT_EQ(4 + free_nodes, yyaml_seq_len(yyaml_doc_get(doc, list)));
+    yyaml_doc_garbage(doc, &free_nodes, NULL);
+    ASSERT_EQ(0u, free_nodes);
+
+    yyaml_doc_free(doc);
+}
+
+// Test garbage collection reclaims released nodes and dead scalar bytes
+UTEST(yyaml_tests, test_doc_gc) {
+    yyaml_doc *doc = NULL;
+    yyaml_err err = {0};
+    const char *yaml =
+        "keep: value\n"
+        "drop:\n"
+        "  long_key_name: long string value\n"
+        "list: [x, y, z]\n";
+
+    doc = yyaml_read(yaml, strlen(yaml), NULL, &err);
+    ASSERT_TRUE(doc != NULL);
+    uint32_t root = yyaml_node_index(doc, yyaml_doc_get_root(doc));
+    uint32_t list = yyaml_node_index(doc, yyaml_map_get(yyaml_doc_get_root(doc), "list"));
+    ASSERT_TRUE(yyaml_doc_map_remove(doc, root, "drop", 4));
+    ASSERT_TRUE(yyaml_doc_seq_remove(doc, list, 0));
+    /* detached nodes never linked to the root are collected as well */
+    ASSERT_TRUE(yyaml_doc_add_string(doc, "orphan", 6) != UINT32_MAX);
+
+    size_t free_nodes = 0, dead_bytes = 0;
+    yyaml_doc_garbage(doc, &free_nodes, &dead_bytes);
+    ASSERT_EQ(2u, free_nodes); /* three released, one reused by orphan */
+    ASSERT_TRUE(dead_bytes > 0);
+
+    ASSERT_TRUE(yyaml_doc_gc(doc));
+    yyaml_doc_garbage(doc, &free_nodes, &dead_bytes);
+    ASSERT_EQ(0u, free_nodes);
+    ASSERT_EQ(0u, dead_bytes);
+    ASSERT_EQ(5u, yyaml_doc_node_count(doc));
+
+    const yyaml_node *r = yyaml_doc_get_root(doc);
+    ASSERT_TRUE(yyaml_str_eq(doc, yyaml_map_get(r, "keep"), "value"));
+    ASSERT_EQ(2u, yyaml_seq_len(yyaml_map_get(r, "list")));
+
+    /* shrinking a collected document is a no-op that keeps it usable */
+    ASSERT_TRUE(yyaml_doc_shrink(doc));
+    ASSERT_TRUE(yyaml_doc_map_append(doc, 0, "n", 1, yyaml_doc_add_int(doc, 1)));
+
+    char *out = NULL;
+    size_t out_len = 0;
+    ASSERT_TRUE(yyaml_write(yyaml_doc_get_root(doc), &out, &out_len, NULL, &err));
+    ASSERT_STREQ("keep: value\nlist:\n  - y\n  - z\nn: 1\n", out);
+    yyaml_free_string(out);
+    yyaml_doc_free(doc);
+}
+
+// Test subtree import across documents for plain and compacted sources
+UTEST(yyaml_tests, test_doc_import) {
+    yyaml_err err = {0};
+    const char *yaml =
+        "meta:\n"
+        "  name: \"svc\"\n"
+        "  tags: [a, b]\n"
+        "  limits:\n"
+        "    cpu: 2\n"
+        "    mem: 1.5\n"
+        "other: true\n";
+    const char *expected =
+        "name: svc\n"
+        "tags:\n"
+        "  - a\n"
+        "  - b\n"
+        "limits:\n"
+        "  cpu: 2\n"
+        "  mem: 1.5\n";
+
+    for (int pass = 0; pass < 2; pass++) {
+        yyaml_doc *src = yyaml_read(yaml, strlen(yaml), NULL, &err);
+        ASSERT_TRUE(src != NULL);
+        if (pass) ASSERT_TRUE(yyaml_doc_compact(src));
+        const yyaml_node *meta = yyaml_map_get(yyaml_doc_get_root(src), "meta");
+
+        yyaml_doc *dst = yyaml_doc_new();
+        uint32_t root = yyaml_doc_add_mapping(dst);
+        ASSERT_TRUE(yyaml_doc_set_root(dst, root));
+        uint32_t copy = yyaml_doc_import(dst, meta);
+        ASSERT_NE(UINT32_MAX, copy);
+        ASSERT_EQ(yyaml_node_subtree_size(meta),
+                  yyaml_node_subtree_size(yyaml_doc_get(dst, copy)));
+
+        /* the copy is independent of the source document */
+        yyaml_doc_free(src);
+        char *out = NULL;
+        size_t out_len = 0;
+        ASSERT_TRUE(yyaml_write(yyaml_doc_get(dst, copy), &out, &out_len, NULL, &err));
+        ASSERT_STREQ(expected, out);
+        yyaml_free_string(out);
+
+        /* appending to imported containers links after their last child */
+        const yyaml_node *tags = yyaml_map_get(yyaml_doc_get(dst, copy), "tags");
+        uint32_t tags_idx = yyaml_node_index(dst, tags);
+        ASSERT_TRUE(yyaml_doc_seq_append(dst, tags_idx, yyaml_doc_add_string(dst, "c", 1)));
+        ASSERT_TRUE(yyaml_doc_map_append(dst, root, "meta", 4, copy));
+
+        /* importing within the same document duplicates the subtree */
+        uint32_t dup = yyaml_doc_import(dst, yyaml_doc_get(dst, tags_idx));
+        ASSERT_NE(UINT32_MAX, dup);
+        ASSERT_TRUE(yyaml_doc_map_append(dst, root, "tags", 4, dup));
+        ASSERT_TRUE(yyaml_write(yyaml_doc_get_root(dst), &out, &out_len, NULL, &err));
+        ASSERT_STREQ("meta:\n  name: svc\n  tags:\n    - a\n    - b\n    - c\n"
+                     "  limits:\n    cpu: 2\n    mem: 1.5\n"
+                     "tags:\n  - a\n  - b\n  - c\n", out);
+        yyaml_free_string(out);
+        yyaml_doc_free(dst);
+    }
+}
+
+// Test binary snapshots round-trip plain, mutated and compacted documents
+UTEST(yyaml_tests, test_doc_binary_snapshot) {
+    const char *path = "yyaml_test_snapshot.bin";
+    yyaml_err err = {0};
+    const char *yaml =
+        "service: api\n"
+        "ports: [80, 443]\n"
+        "limits:\n"
+        "  cpu: 1.5\n"
+        "  debug: false\n";
+
+    for (int pass = 0; pass < 2; pass++) {
+        yyaml_doc *doc = yyaml_read(yaml, strlen(yaml), NULL, &err);
+        ASSERT_TRUE(doc != NULL);
+        uint32_t root = yyaml_node_index(doc, yyaml_doc_get_root(doc));
+        ASSERT_TRUE(yyaml_doc_map_remove(doc, root, "service", 7));
+        if (pass) ASSERT_TRUE(yyaml_doc_gc(doc));
+        char *before = NULL;
+        size_t before_len = 0;
+        ASSERT_TRUE(yyaml_write(yyaml_doc_get_root(doc), &before, &before_len, NULL, &err));
+        ASSERT_TRUE(yyaml_doc_save_binary(doc, path, &err));
+        yyaml_doc_free(doc);
+
+        doc = yyaml_doc_load_binary(path, &err);
+        ASSERT_TRUE(doc != NULL);
+        const yyaml_node *r = yyaml_doc_get_root(doc);
+        ASSERT_EQ(443, yyaml_seq_get(yyaml_map_get(r, "ports"), 1)->val.integer);
+        size_t free_nodes = 0;
+        yyaml_doc_garbage(doc, &free_nodes, NULL);
+        ASSERT_EQ(pass ? 0u : 1u, free_nodes);
+
+        char *after = NULL;
+        size_t after_len = 0;
+        ASSERT_TRUE(yyaml_write(r, &after, &after_len, NULL, &err));
+        ASSERT_STREQ(before, after);
+        yyaml_free_string(after);
+
+        /* loaded documents stay editable, growing storage on demand */
+        root = yyaml_node_index(doc, r);
+        ASSERT_TRUE(yyaml_doc_map_append(doc, root, "name", 4,
+                                         yyaml_doc_add_string(doc, "x", 1)));
+        ASSERT_TRUE(yyaml_str_eq(doc, yyaml_map_get(yyaml_doc_get_root(doc), "name"), "x"));
+        yyaml_free_string(before);
+        yyaml_doc_free(doc);
+    }
+
+    /* anything that is not a snapshot is rejected */
+    FILE *fp = fopen(path, "wb");
+    ASSERT_TRUE(fp != NULL);
+    fputs("service: api\n", fp);
+    fclose(fp);
+    ASSERT_TRUE(yyaml_doc_load_binary(path, &err) == NULL);
+    ASSERT_TRUE(yyaml_doc_load_binary("missing_snapshot.bin", &err) == NULL);
+
+    /* subtree sizes of a compacted snapshot are derived from its links:
+     * a wrong size is replaced, a link that breaks the layout is rejected */
+    yyaml_doc *doc = yyaml_read(yaml, strlen(yaml), NULL, &err);
+    ASSERT_TRUE(doc != NULL);
+    ASSERT_TRUE(yyaml_doc_compact(doc));
+    size_t total = yyaml_node_subtree_size(yyaml_doc_get_root(doc));
+    ASSERT_TRUE(yyaml_doc_save_binary(doc, path, &err));
+    yyaml_doc_free(doc);
+    uint64_t nodes_ofs = 0, subtree_ofs = 0;
+    uint32_t bad = 1000000;
+    fp = fopen(path, "r+b");
+    ASSERT_TRUE(fp != NULL);
+    /* offsets of nodes_ofs and subtree_ofs in the snapshot header */
+    ASSERT_EQ(0, fseek(fp, 64, SEEK_SET));
+    ASSERT_EQ(1u, fread(&nodes_ofs, sizeof(nodes_ofs), 1, fp));
+    ASSERT_EQ(0, fseek(fp, 80, SEEK_SET));
+    ASSERT_EQ(1u, fread(&subtree_ofs, sizeof(subtree_ofs), 1, fp));
+    ASSERT_EQ(0, fseek(fp, (long)subtree_ofs, SEEK_SET));
+    ASSERT_EQ(1u, fwrite(&bad, sizeof(bad), 1, fp));
+    fclose(fp);
+    doc = yyaml_doc_load_binary(path, &err);
+    ASSERT_TRUE(doc != NULL);
+    ASSERT_EQ(total, yyaml_node_subtree_size(yyaml_doc_get_root(doc)));
+    yyaml_doc *copy = yyaml_doc_new();
+    ASSERT_NE(UINT32_MAX, yyaml_doc_import(copy, yyaml_doc_get_root(doc)));
+    ASSERT_EQ(total, yyaml_doc_node_count(copy));
+    yyaml_doc_free(copy);
+    yyaml_doc_free(doc);
+
+    /* the root's first child claims a later node as its next sibling */
+    uint32_t next = 3;
+    fp = fopen(path, "r+b");
+    ASSERT_TRUE(fp != NULL);
+    ASSERT_EQ(0, fseek(fp, (long)(nodes_ofs + sizeof(yyaml_node) +
+                                  offsetof(yyaml_node, next)), SEEK_SET));
+    ASSERT_EQ(1u, fwrite(&next, sizeof(next), 1, fp));
+    fclose(fp);
+    ASSERT_TRUE(yyaml_doc_load_binary(path, &err) == NULL);
+
+    /* snapshots that were not compacted have their links walked as well:
+     * a count past the chain and a chain that loops back are rejected */
+    doc = yyaml_read("[1, 2]", 6, NULL, &err);
+    ASSERT_TRUE(doc != NULL);
+    ASSERT_TRUE(yyaml_doc_save_binary(doc, path, &err));
+    yyaml_doc_free(doc);
+    doc = yyaml_doc_load_binary(path, &err);
+    ASSERT_TRUE(doc != NULL);
+    ASSERT_EQ(2u, yyaml_seq_len(yyaml_doc_get_root(doc)));
+    yyaml_doc_free(doc);
+    fp = fopen(path, "r+b");
+    ASSERT_TRUE(fp != NULL);
+    ASSERT_EQ(0, fseek(fp, 64, SEEK_SET));
+    ASSERT_EQ(1u, fread(&nodes_ofs, sizeof(nodes_ofs), 1, fp));
+    int64_t len = 3;
+    ASSERT_EQ(0, fseek(fp, (long)(nodes_ofs + offsetof(yyaml_node, val)), SEEK_SET));
+    ASSERT_EQ(1u, fwrite(&len, sizeof(len), 1, fp));
+    fclose(fp);
+    ASSERT_TRUE(yyaml_doc_load_binary(path, &err) == NULL);
+    ASSERT_EQ(YYAML_ERR_INVALID, err.code);
+    len = 2;
+    next = 1;
+    fp = fopen(path, "r+b");
+    ASSERT_TRUE(fp != NULL);
+    ASSERT_EQ(0, fseek(fp, (long)(nodes_ofs + offsetof(yyaml_node, val)), SEEK_SET));
+    ASSERT_EQ(1u, fwrite(&len, sizeof(len), 1, fp));
+    ASSERT_EQ(0, fseek(fp, (long)(nodes_ofs + 2 * sizeof(yyaml_node) +
+                                  offsetof(yyaml_node, next)), SEEK_SET));
+    ASSERT_EQ(1u, fwrite(&next, sizeof(next), 1, fp));
+    fclose(fp);
+    ASSERT_TRUE(yyaml_doc_load_binary(path, &err) == NULL);
+    ASSERT_EQ(YYAML_ERR_INVALID, err.code);
+    remove(path);
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+// Test published documents are readable from other processes and read-only
+UTEST(yyaml_tests, test_doc_publish_attach) {
+    const char *path = "yyaml_test_shared.bin";
+    yyaml_err err = {0};
+    const char *yaml =
+        "name: shared\n"
+        "workers: [1, 2, 3]\n"
+        "db:\n"
+        "  host: localhost\n";
+
+    yyaml_doc *doc = yyaml_read(yaml, strlen(yaml), NULL, &err);
+    ASSERT_TRUE(doc != NULL);
+    char *expected = NULL;
+    size_t expected_len = 0;
+    ASSERT_TRUE(yyaml_write(yyaml_doc_get_root(doc), &expected, &expected_len, NULL, &err));
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    ASSERT_TRUE(fd >= 0);
+    ASSERT_TRUE(yyaml_doc_publish(doc, fd, &err));
+    yyaml_doc_free(doc);
+
+    /* a second view in the same process cannot reuse the first one's
+     * address and falls back to a patched private mapping */
+    yyaml_doc *views[2];
+    for (int i = 0; i < 2; i++) {
+        views[i] = yyaml_doc_attach(fd, &err);
+        ASSERT_TRUE(views[i] != NULL);
+        const yyaml_node *root = yyaml_doc_get_root(views[i]);
+        ASSERT_EQ(3, yyaml_seq_get(yyaml_map_get(root, "workers"), 2)->val.integer);
+        ASSERT_TRUE(yyaml_str_eq(views[i], yyaml_map_get(yyaml_map_get(root, "db"), "host"),
+                                 "localhost"));
+        char *out = NULL;
+        size_t out_len = 0;
+        ASSERT_TRUE(yyaml_write(root, &out, &out_len, NULL, &err));
+        ASSERT_STREQ(expected, out);
+        yyaml_free_string(out);
+
+        uint32_t root_idx = yyaml_node_index(views[i], root);
+        ASSERT_EQ(UINT32_MAX, yyaml_doc_add_int(views[i], 1));
+        ASSERT_FALSE(yyaml_doc_map_remove(views[i], root_idx, "name", 4));
+        ASSERT_FALSE(yyaml_doc_gc(views[i]));
+    }
+
+    pid_t pid = fork();
+    ASSERT_TRUE(pid >= 0);
+    if (pid == 0) {
+        yyaml_doc *child = yyaml_doc_attach(fd, NULL);
+        const yyaml_node *root = child ? yyaml_doc_get_root(child) : NULL;
+        _exit(root && yyaml_seq_len(yyaml_map_get(root, "workers")) == 3 ? 0 : 1);
+    }
+    int status = 0;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    yyaml_doc_free(views[0]);
+    yyaml_doc_free(views[1]);
+    yyaml_free_string(expected);
+    close(fd);
+    remove(path);
+}
+
+// Test attaching rejects an image whose nodes were tampered with
+UTEST(yyaml_tests, test_doc_attach_rejects_corrupt_image) {
+    const char *path = "yyaml_test_shared_bad.bin";
+    yyaml_err err = {0};
+    yyaml_doc *doc = yyaml_read("a: [1, 2]\nb: x\n", 15, NULL, &err);
+    ASSERT_TRUE(doc != NULL);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    ASSERT_TRUE(fd >= 0);
+    ASSERT_TRUE(yyaml_doc_publish(doc, fd, &err));
+    yyaml_doc_free(doc);
+
+    /* nodes_ofs follows magic, version, node and doc sizes, base, size and
+     * doc_ofs in the header; point the second node's parent past the pool */
+    uint64_t nodes_ofs = 0;
+    uint32_t bad = 1000;
+    ASSERT_EQ((ssize_t)sizeof(nodes_ofs), pread(fd, &nodes_ofs, sizeof(nodes_ofs), 48));
+    ASSERT_EQ((ssize_t)sizeof(bad),
+              pwrite(fd, &bad, sizeof(bad),
+                     (off_t)(nodes_ofs + sizeof(yyaml_node) + offsetof(yyaml_node, parent))));
+
+    /* the first attach maps at the publisher's address; with that address
+     * taken the second patches a private copy. Both must refuse the image */
+    uint64_t base = 0, size = 0;
+    ASSERT_EQ((ssize_t)sizeof(base), pread(fd, &base, sizeof(base), 24));
+    ASSERT_EQ((ssize_t)sizeof(size), pread(fd, &size, sizeof(size), 32));
+    void *taken = MAP_FAILED;
+    for (int i = 0; i < 2; i++) {
+        err.msg[0] = '\0';
+        ASSERT_TRUE(yyaml_doc_attach(fd, &err) == NULL);
+        ASSERT_STREQ("invalid shared document", err.msg);
+        if (!i) {
+            taken = mmap((void *)(uintptr_t)base, (size_t)size, PROT_READ,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            ASSERT_TRUE(taken != MAP_FAILED);
+        }
+    }
+    munmap(taken, (size_t)size);
+    close(fd);
+    remove(path);
+}
+#endif
+
+// Test file reading, including a number that ends exactly at end of file
+UTEST(yyaml_tests, test_read_file) {
+    const char *path = "yyaml_test_read_file.yaml";
+    yyaml_err err = {0};
+    char content[4096];
+    const char *tail = "\nnum: 12345";
+    size_t pad = sizeof(content) - strlen("pad: ") - strlen(tail);
+
+    /* one full page without a trailing newline */
+    memcpy(content, "pad: ", 5);
+    memset(content + 5, 'x', pad);
+    memcpy(content + 5 + pad, tail, strlen(tail));
+    FILE *fp = fopen(path, "wb");
+    ASSERT_TRUE(fp != NULL);
+    ASSERT_EQ(sizeof(content), fwrite(content, 1, sizeof(content), fp));
+    fclose(fp);
+
+    yyaml_doc *doc = yyaml_read_file(path, NULL, &err);
+    ASSERT_TRUE(doc != NULL);
+    const yyaml_node *root = yyaml_doc_get_root(doc);
+    ASSERT_EQ(12345, yyaml_map_get(root, "num")->val.integer);
+    ASSERT_EQ(pad, (size_t)yyaml_map_get(root, "pad")->val.str.len);
+    yyaml_doc_free(doc);
+
+    /* empty files parse like empty input */
+    fp = fopen(path, "wb");
+    ASSERT_TRUE(fp != NULL);
+    fclose(fp);
+    doc = yyaml_read_file(path, NULL, &err);
+    ASSERT_TRUE(doc != NULL);
+    ASSERT_EQ(YYAML_NULL, yyaml_doc_get_root(doc)->type);
+    yyaml_doc_free(doc);
+    remove(path);
+
+    ASSERT_TRUE(yyaml_read_file("missing_file.yaml", NULL, &err) == NULL);
+    ASSERT_STREQ("unable to open file", err.msg);
+    ASSERT_EQ(YYAML_ERR_IO, err.code);
+    ASSERT_EQ(0u, err.line);
+    ASSERT_TRUE(yyaml_read_file(NULL, NULL, &err) == NULL);
+    ASSERT_EQ(YYAML_ERR_INVALID, err.code);
+}
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t calls;
+    size_t fail_after;
+} test_sink_state;
+
+static bool test_sink(void *ctx, const char *data, size_t len) {
+    test_sink_state *st = (test_sink_state *)ctx;
+    if (st->fail_after && st->calls == st->fail_after) return false;
+    st->data = (char *)realloc(st->data, st->len + len + 1);
+    memcpy(st->data + st->len, data, len);
+    st->len += len;
+    st->data[st->len] = '\0';
+    st->calls++;
+    return true;
+}
+
+// Test streaming writers produce the same text as yyaml_write
+UTEST(yyaml_tests, test_write_streaming) {
+    yyaml_err err = {0};
+    yyaml_doc *doc = yyaml_doc_new();
+    uint32_t root = yyaml_doc_add_mapping(doc);
+    ASSERT_TRUE(yyaml_doc_set_root(doc, root));
+    int64_t vals[20000];
+    for (size_t i = 0; i < 20000; i++) vals[i] = (int64_t)i * 7;
+    ASSERT_TRUE(yyaml_doc_map_append(doc, root, "values", 6,
+                                     yyaml_doc_add_int_array(doc, vals, 20000)));
+    /* a scalar larger than the staging buffer is passed straight through */
+    size_t big_len = YYAML_WRITE_BUF_SIZE + 100;
+    char *big = (char *)malloc(big_len);
+    memset(big, 'y', big_len);
+    ASSERT_TRUE(yyaml_doc_map_append(doc, root, "big", 3,
+                                     yyaml_doc_add_string(doc, big, big_len)));
+    /* and so is a plain key, without growing the staging buffer */
+    memset(big, 'k', big_len);
+    ASSERT_TRUE(yyaml_doc_map_append(doc, root, big, big_len,
+                                     yyaml_doc_add_int(doc, 1)));
+    free(big);
+
+    char *expected = NULL;
+    size_t expected_len = 0;
+    ASSERT_TRUE(yyaml_write(yyaml_doc_get_root(doc), &expected, &expected_len, NULL, &err));
+
+    test_sink_state st = {0};
+    ASSERT_TRUE(yyaml_write_cb(yyaml_doc_get_root(doc), test_sink, &st, NULL, &err));
+    ASSERT_EQ(expected_len, st.len);
+    ASSERT_TRUE(memcmp(expected, st.data, st.len) == 0);
+    ASSERT_TRUE(st.calls > 2);
+    free(st.data);
+
+    /* sink failures abort the write */
+    test_sink_state failing = {0};
+    failing.fail_after = 1;
+    ASSERT_FALSE(yyaml_write_cb(yyaml_doc_get_root(doc), test_sink, &failing, NULL, &err));
+    ASSERT_STREQ("output write failed", err.msg);
+    ASSERT_EQ(YYAML_ERR_IO, err.code);
+    free(failing.data);
+
+    /* flow style stages keys separately too */
+    yyaml_write_opts flow = {0};
+    flow.final_newline = true;
+    flow.style = YYAML_STYLE_LINE;
+    char *flow_text = NULL;
+    size_t flow_len = 0;
+    ASSERT_TRUE(yyaml_write(yyaml_doc_get_root(doc), &flow_text, &flow_len, &flow, &err));
+    test_sink_state flow_st = {0};
+    ASSERT_TRUE(yyaml_write_cb(yyaml_doc_get_root(doc), test_sink, &flow_st, &flow, &err));
+    ASSERT_EQ(flow_len, flow_st.len);
+    ASSERT_TRUE(memcmp(flow_text, flow_st.data, flow_len) == 0);
+    free(flow_st.data);
+    yyaml_free_string(flow_text);
+
+    /* stdio output */
+    FILE *fp = tmpfile();
+    ASSERT_TRUE(fp != NULL);
+    ASSERT_TRUE(yyaml_write_fp(yyaml_doc_get_root(doc), fp, NULL, &err));
+    ASSERT_EQ((long)expected_len, ftell(fp));
+    rewind(fp);
+    char *back = (char *)malloc(expected_len);
+    ASSERT_EQ(expected_len, fread(back, 1, expected_len, fp));
+    ASSERT_TRUE(memcmp(expected, back, expected_len) == 0);
+    free(back);
+    fclose(fp);
+
+#if defined(__unix__) || defined(__APPLE__)
+    const char *path = "yyaml_test_write_fd.yaml";
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    ASSERT_TRUE(fd >= 0);
+    ASSERT_TRUE(yyaml_write_fd(yyaml_doc_get_root(doc), fd, NULL, &err));
+    close(fd);
+    yyaml_doc *reread = yyaml_read_file(path, NULL, &err);
+    ASSERT_TRUE(reread != NULL);
+    ASSERT_EQ(20000u, yyaml_seq_len(yyaml_map_get(yyaml_doc_get_root(reread), "values")));
+    yyaml_doc_free(reread);
+    remove(path);
+#endif
+
+    yyaml_free_string(expected);
+    yyaml_doc_free(doc);
+}
+
+// Test doubles are written with the shortest digits that read back exactly
+UTEST(yyaml_tests, test_write_double_shortest) {
+    static const double vals[] = {0.1, 1.0, -2.5, 1e16, 1e17, 1e-5, 0.0001,
+                                  123456.789, 5e-324, 1.7976931348623157e308, -0.0};
+    static const char *expected = "- 0.1\n- 1.0\n- -2.5\n- 10000000000000000.0\n"
+                                  "- 1e+17\n- 1e-05\n- 0.0001\n- 123456.789\n"
+                                  "- 5e-324\n- 1.7976931348623157e+308\n- -0.0\n";
+    yyaml_err err = {0};
+    yyaml_doc *doc = yyaml_doc_new();
+    ASSERT_TRUE(yyaml_doc_set_root(doc, yyaml_doc_add_double_array(doc, vals, 11)));
+    char *out = NULL;
+    size_t out_len = 0;
+    ASSERT_TRUE(yyaml_write(yyaml_doc_get_root(doc), &out, &out_len, NULL, &err));
+    ASSERT_STREQ(expected, out);
+
+    /* every value reads back bit-identical */
+    yyaml_doc *back = yyaml_read(out, out_len, NULL, &err);
+    ASSERT_TRUE(back != NULL);
+    for (size_t i = 0; i < 11; i++) {
+        const yyaml_node *node = yyaml_seq_get(yyaml_doc_get_root(back), i);
+        ASSERT_TRUE(node != NULL);
+        ASSERT_TRUE(memcmp(&vals[i], &node->val.real, sizeof(double)) == 0);
+    }
+    yyaml_doc_free(back);
+    yyaml_free_string(out);
+    yyaml_doc_free(doc);
+}
+
+// Test integer formatting across widths and at the int64 limits
+UTEST(yyaml_tests, test_write_int_digits) {
+    static const int64_t vals[] = {0, 7, -7, 10, 99, 100, -1000, 123456789,
+                                   INT64_MAX, INT64_MIN};
+    static const char *expected = "- 0\n- 7\n- -7\n- 10\n- 99\n- 100\n- -1000\n"
+                                  "- 123456789\n- 9223372036854775807\n"
+                                  "- -9223372036854775808\n";
+    yyaml_err err = {0};
+    yyaml_doc *doc = yyaml_doc_new();
+    ASSERT_TRUE(yyaml_doc_set_root(doc, yyaml_doc_add_int_array(doc, vals, 10)));
+    char *out = NULL;
+    size_t out_len = 0;
+    ASSERT_TRUE(yyaml_write(yyaml_doc_get_root(doc), &out, &out_len, NULL, &err));
+    ASSERT_STREQ(expected, out);
+    ASSERT_EQ(strlen(expected), out_len);
+    yyaml_free_string(out);
+    yyaml_doc_free(doc);
+}
+
+// Test quoting and escaping, including strings longer than the stream buffer
+UTEST(yyaml_tests, test_write_string_escapes) {
+    yyaml_err err = {0};
+    yyaml_doc *doc = yyaml_doc_new();
+    uint32_t root = yyaml_doc_add_sequence(doc);
+    ASSERT_TRUE(yyaml_doc_set_root(doc, root));
+    ASSERT_TRUE(yyaml_doc_seq_append(doc, root, yyaml_doc_add_string(doc, "plain_name-1", 12)));
+    ASSERT_TRUE(yyaml_doc_seq_append(doc, root, yyaml_doc_add_string(doc, "9lives", 6)));
+    const char *esc = "a \"quoted\" \\path\n\twith\x01" "ctl";
+    ASSERT_TRUE(yyaml_doc_seq_append(doc, root, yyaml_doc_add_string(doc, esc, strlen(esc))));
+    ASSERT_TRUE(yyaml_doc_seq_append(doc, root, yyaml_doc_add_string(doc, "caf\xc3\xa9", 5)));
+    char *out = NULL;
+    size_t out_len = 0;
+    ASSERT_TRUE(yyaml_write(yyaml_doc_get_root(doc), &out, &out_len, NULL, &err));
+    ASSERT_STREQ("- plain_name-1\n- \"9lives\"\n"
+                 "- \"a \\\"quoted\\\" \\\\path\\n\\twith\\x01ctl\"\n"
+                 "- \"caf\xc3\xa9\"\n",
+                 out);
+    yyaml_free_string(out);
+
+    /* a quoted scalar whose escaped form spans several stream buffers */
+    size_t big_len = YYAML_WRITE_BUF_SIZE;
+    char *big = (char *)malloc(big_len);
+    for (size_t i = 0; i < big_len; i++) big[i] = (i % 3) ? '\n' : ' ';
+    ASSERT_TRUE(yyaml_doc_seq_append(doc, root, yyaml_doc_add_string(doc, big, big_len)));
+    free(big);
+    ASSERT_TRUE(yyaml_write(yyaml_doc_get_root(doc), &out, &out_len, NULL, &err));
+    test_sink_state st = {0};
+    ASSERT_TRUE(yyaml_write_cb(yyaml_doc_get_root(doc), test_sink, &st, NULL, &err));
+    ASSERT_EQ(out_len, st.len);
+    ASSERT_TRUE(memcmp(out, st.data, st.len) == 0);
+    free(st.data);
+    yyaml_doc *back = yyaml_read(out, out_len, NULL, &err);
+    ASSERT_TRUE(back != NULL);
+    const yyaml_node *last = yyaml_seq_get(yyaml_doc_get_root(back), 4);
+    ASSERT_TRUE(last != NULL);
+    ASSERT_EQ(big_len, (size_t)last->val.str.len);
+    yyaml_doc_free(back);
+    yyaml_free_string(out);
+    yyaml_doc_free(doc);
+}
+
+// Test JSON output in minified and pretty modes
+UTEST(yyaml_tests, test_write_json) {
+    const char *yaml = "name: \"say \\\"hi\\\"\\t\\x01\"\n"
+                       "ratio: 0.5\n"
+                       "count: -3\n"
+                       "on: true\n"
+                       "none: null\n"
+                       "empty_seq: []\n"
+                       "empty_map: {}\n"
+                       "items:\n"
+                       "  - 1\n"
+                       "  - tags:\n"
+                       "      - a\n";
+    yyaml_err err = {0};
+    yyaml_doc *doc = yyaml_read(yaml, strlen(yaml), NULL, &err);
+    ASSERT_TRUE(doc != NULL);
+    char *out = NULL;
+    size_t out_len = 0;
+    ASSERT_TRUE(yyaml_write_json(yyaml_doc_get_root(doc), &out, &out_len, NULL, &err));
+    ASSERT_STREQ("{\"name\":\"say \\\"hi\\\"\\t\\u0001\",\"ratio\":0.5,\"count\":-3,"
+                 "\"on\":true,\"none\":null,\"empty_seq\":[],\"empty_map\":{},"
+                 "\"items\":[1,{\"tags\":[\"a\"]}]}\n",
+                 out);
+    ASSERT_EQ(strlen(out), out_len);
+    yyaml_free_string(out);
+
+    yyaml_write_opts opts = {0};
+    opts.pretty = true;
+    ASSERT_TRUE(yyaml_write_json(yyaml_map_get(yyaml_doc_get_root(doc), "items"), &out,
+                                 &out_len, &opts, &err));
+    ASSERT_STREQ("[\n  1,\n  {\n    \"tags\": [\n      \"a\"\n    ]\n  }\n]", out);
+    yyaml_free_string(out);
+
+    /* non-finite doubles have no JSON spelling */
+    yyaml_doc *nums = yyaml_doc_new();
+    uint32_t seq = yyaml_doc_add_sequence(nums);
+    ASSERT_TRUE(yyaml_doc_seq_append(nums, seq, yyaml_doc_add_double(nums, NAN)));
+    ASSERT_TRUE(yyaml_doc_seq_append(nums, seq, yyaml_doc_add_double(nums, -INFINITY)));
+    ASSERT_TRUE(yyaml_doc_seq_append(nums, seq, yyaml_doc_add_double(nums, 1e21)));
+    ASSERT_TRUE(yyaml_doc_set_root(nums, seq));
+    ASSERT_TRUE(yyaml_write_json(yyaml_doc_get_root(nums), &out, &out_len, &opts, &err));
+    ASSERT_STREQ("[\n  null,\n  null,\n  1e+21\n]", out);
+    yyaml_free_string(out);
+    yyaml_doc_free(nums);
+    yyaml_doc_free(doc);
+}
+
+// Test the measuring pass matches the written length exactly
+UTEST(yyaml_tests, test_write_len) {
+    const char *yaml = "name: \"tab\\there \\\"q\\\" \\x02\"\n"
+                       "\"odd key\": -12345\n"
+                       "ratio: 2.5e-07\n"
+                       "none: null\n"
+                       "empty: {}\n"
+                       "list:\n"
+                       "  - []\n"
+                       "  -\n"
+                       "    - 1\n"
+                       "    - true\n"
+                       "  - inner: x\n"
+                       "    other: [1, 2]\n";
+    yyaml_err err = {0};
+    yyaml_doc *doc = yyaml_read(yaml, strlen(yaml), NULL, &err);
+    ASSERT_TRUE(doc != NULL);
+    static const size_t indents[] = {0, 1, 4, 80};
+    for (size_t i = 0; i < 4; i++) {
+        yyaml_write_opts opts = {0};
+        opts.indent = indents[i];
+        opts.final_newline = (i & 1) != 0;
+        char *out = NULL;
+        size_t out_len = 0;
+        ASSERT_TRUE(yyaml_write(yyaml_doc_get_root(doc), &out, &out_len, &opts, &err));
+        ASSERT_EQ(out_len, yyaml_write_len(yyaml_doc_get_root(doc), &opts));
+
+        /* exact sizing produces the same text */
+        opts.exact_size = true;
+        char *exact = NULL;
+        size_t exact_len = 0;
+        ASSERT_TRUE(yyaml_write(yyaml_doc_get_root(doc), &exact, &exact_len, &opts, &err));
+        ASSERT_EQ(out_len, exact_len);
+        ASSERT_STREQ(out, exact);
+        yyaml_free_string(exact);
+        yyaml_free_string(out);
+    }
+    ASSERT_EQ(5u, yyaml_write_len(NULL, NULL));
+    yyaml_doc_free(doc);
+}
+
+// Test writing into a caller-provided buffer, including overflow reporting
+UTEST(yyaml_tests, test_write_buf) {
+    const char *yaml = "name: \"quoted value\"\nports:\n  - 80\n  - 443\n";
+    yyaml_err err = {0};
+    yyaml_doc *doc = yyaml_read(yaml, strlen(yaml), NULL, &err);
+    ASSERT_TRUE(doc != NULL);
+    const yyaml_node *root = yyaml_doc_get_root(doc);
+    char *expected = NULL;
+    size_t expected_len = 0;
+    ASSERT_TRUE(yyaml_write(root, &expected, &expected_len, NULL, &err));
+
+    char buf[128];
+    size_t written = 0;
+    memset(buf, 'x', sizeof(buf));
+    ASSERT_TRUE(yyaml_write_buf(root, buf, sizeof(buf), &written, NULL, &err));
+    ASSERT_EQ(expected_len, written);
+    ASSERT_STREQ(expected, buf);
+
+    /* an exact fit has no room for the terminator and leaves the rest alone */
+    memset(buf, 'x', sizeof(buf));
+    ASSERT_TRUE(yyaml_write_buf(root, buf, expected_len, &written, NULL, &err));
+    ASSERT_EQ(expected_len, written);
+    ASSERT_TRUE(memcmp(expected, buf, expected_len) == 0);
+    ASSERT_EQ('x', buf[expected_len]);
+
+    /* overflow reports the required size */
+    memset(buf, 'x', sizeof(buf));
+    ASSERT_FALSE(yyaml_write_buf(root, buf, 10, &written, NULL, &err));
+    ASSERT_EQ(expected_len, written);
+    ASSERT_STREQ("output buffer too small", err.msg);
+    ASSERT_EQ('x', buf[10]);
+    ASSERT_FALSE(yyaml_write_buf(root, NULL, 0, &written, NULL, &err));
+    ASSERT_EQ(expected_len, written);
+
+    yyaml_free_string(expected);
+    yyaml_doc_free(doc);
+}
+
+// Test flow, auto and single-line write styles and that their output reads back
+UTEST(yyaml_tests, test_write_styles) {
+    const char *yaml = "name: svc\nports:\n  - 80\n  - 443\nlimits:\n  cpu: 2\n"
+                       "  mem: 512\nhosts:\n  - name: a\n    tags:\n      - x\n";
+    static const char *expected[] = {
+        "name: svc\nports: [80, 443]\nlimits: {cpu: 2, mem: 512}\nhosts:\n"
+        "  - name: a\n    tags: [x]\n",
+        "name: svc\nports: [80, 443]\nlimits: {cpu: 2, mem: 512}\n"
+        "hosts: [{name: a, tags: [x]}]\n",
+        "{name: svc, ports: [80, 443], limits: {cpu: 2, mem: 512}, "
+        "hosts: [{name: a, tags: [x]}]}\n",
+    };
+    yyaml_write_opts opts = {0};
+    yyaml_err err = {0};
+    yyaml_doc *doc = yyaml_read(yaml, strlen(yaml), NULL, &err);
+    ASSERT_TRUE(doc != NULL);
+    const yyaml_node *root = yyaml_doc_get_root(doc);
+    char *block = NULL;
+    size_t block_len = 0;
+    ASSERT_TRUE(yyaml_write(root, &block, &block_len, NULL, &err));
+    ASSERT_STREQ(yaml, block);
+
+    opts.final_newline = true;
+    for (int i = 0; i < 3; i++) {
+        char *out = NULL;
+        size_t out_len = 0;
+        opts.style = (yyaml_write_style)(YYAML_STYLE_AUTO + i);
+        ASSERT_TRUE(yyaml_write(root, &out, &out_len, &opts, &err));
+        ASSERT_STREQ(expected[i], out);
+        ASSERT_EQ(out_len, yyaml_write_len(root, &opts));
+
+        /* flow output parses back to the same tree */
+        yyaml_doc *back = yyaml_read(out, out_len, NULL, &err);
+        ASSERT_TRUE(back != NULL);
+        char *again = NULL;
+        ASSERT_TRUE(yyaml_write(yyaml_doc_get_root(back), &again, NULL, NULL,
+                                &err));
+        ASSERT_STREQ(block, again);
+        yyaml_free_string(again);
+        yyaml_doc_free(back);
+        yyaml_free_string(out);
+    }
+
+    /* mappings wider than flow_width stay in block style */
+    char *narrow = NULL;
+    opts.style = YYAML_STYLE_AUTO;
+    opts.flow_width = 10;
+    ASSERT_TRUE(yyaml_write(root, &narrow, NULL, &opts, &err));
+    ASSERT_STREQ("name: svc\nports: [80, 443]\nlimits:\n  cpu: 2\n  mem: 512\n"
+                 "hosts:\n  - name: a\n    tags: [x]\n",
+                 narrow);
+    yyaml_free_string(narrow);
+
+    yyaml_free_string(block);
+    yyaml_doc_free(doc);
+}
+
+// Test only brackets opening a value hide the colons of a flow collection
+UTEST(yyaml_tests, test_parse_brackets_in_plain_keys) {
+    yyaml_err err = {0};
+    const char *yaml = "k[: 1\nm{: 2\nflow: [a: 1, {b: 2}]\nlist:\n  - [c: 3]\n";
+    yyaml_doc *doc = yyaml_read(yaml, strlen(yaml), NULL, &err);
+    ASSERT_TRUE(doc != NULL);
+    const yyaml_node *root = yyaml_doc_get_root(doc);
+    ASSERT_EQ(4, yyaml_map_len(root));
+    ASSERT_EQ(1, yyaml_map_get(root, "k[")->val.integer);
+    ASSERT_EQ(2, yyaml_map_get(root, "m{")->val.integer);
+    ASSERT_EQ(2, yyaml_seq_len(yyaml_map_get(root, "flow")));
+    const yyaml_node *list = yyaml_map_get(root, "list");
+    ASSERT_EQ(YYAML_SEQUENCE, yyaml_seq_get(list, 0)->type);
+    yyaml_doc_free(doc);
+}
+
+// Test that the threaded writer matches the serial output
+UTEST(yyaml_tests, test_write_threads) {
+    yyaml_doc *doc = yyaml_doc_new();
+    uint32_t seq = yyaml_doc_add_sequence(doc);
+    for (int i = 0; i < 20000; i++) {
+        uint32_t rec = yyaml_doc_add_mapping(doc);
+        yyaml_doc_map_append(doc, rec, "id", 2, yyaml_doc_add_int(doc, i));
+        yyaml_doc_map_append(doc, rec, "name", 4,
+                             yyaml_doc_add_string(doc, "a b", 3));
+        yyaml_doc_seq_append(doc, seq, rec);
+    }
+    yyaml_doc_set_root(doc, seq);
+    const yyaml_node *root = yyaml_doc_get_root(doc);
+    yyaml_err err = {0};
+    char *serial = NULL;
+    size_t serial_len = 0;
+    ASSERT_TRUE(yyaml_write(root, &serial, &serial_len, NULL, &err));
+
+    yyaml_write_opts opts = {0};
+    opts.indent = 2;
+    opts.final_newline = true;
+    opts.threads = 4;
+    char *parallel = NULL;
+    size_t parallel_len = 0;
+    ASSERT_TRUE(yyaml_write(root, &parallel, &parallel_len, &opts, &err));
+    ASSERT_EQ(serial_len, parallel_len);
+    ASSERT_STREQ(serial, parallel);
+    yyaml_free_string(parallel);
+
+#if defined(__unix__) || defined(__APPLE__)
+    FILE *fp = tmpfile();
+    ASSERT_TRUE(fp != NULL);
+    ASSERT_TRUE(yyaml_write_fd(root, fileno(fp), &opts, &err));
+    ASSERT_EQ((long)serial_len, ftell(fp));
+    rewind(fp);
+    char *back = (char *)malloc(serial_len);
+    ASSERT_EQ(serial_len, fread(back, 1, serial_len, fp));
+    ASSERT_TRUE(memcmp(serial, back, serial_len) == 0);
+    free(back);
+    fclose(fp);
+#endif
+
+    yyaml_free_string(serial);
+    yyaml_doc_free(doc);
+}
+
+// Events for the document checked by test_emitter
+static bool test_emit_sample(yyaml_emitter *em) {
+    return yyaml_emitter_begin_map(em) &&
+           yyaml_emitter_key(em, "name", 4) && yyaml_emitter_string(em, "svc", 3) &&
+           yyaml_emitter_key(em, "ports", 5) && yyaml_emitter_begin_seq(em) &&
+           yyaml_emitter_int(em, 80) && yyaml_emitter_int(em, 443) &&
+           yyaml_emitter_end_seq(em) &&
+           yyaml_emitter_key(em, "empty", 5) && yyaml_emitter_begin_seq(em) &&
+           yyaml_emitter_end_seq(em) &&
+           yyaml_emitter_key(em, "hosts", 5) && yyaml_emitter_begin_seq(em) &&
+           yyaml_emitter_begin_map(em) &&
+           yyaml_emitter_key(em, "name", 4) && yyaml_emitter_string(em, "a", 1) &&
+           yyaml_emitter_key(em, "ratio", 5) && yyaml_emitter_double(em, 0.5) &&
+           yyaml_emitter_end_map(em) &&
+           yyaml_emitter_begin_map(em) && yyaml_emitter_end_map(em) &&
+           yyaml_emitter_end_seq(em) &&
+           yyaml_emitter_key(em, "odd key", 7) && yyaml_emitter_null(em) &&
+           yyaml_emitter_end_map(em);
+}
+
+// Test the streaming emitter layout in block and line style, and misuse errors
+UTEST(yyaml_tests, test_emitter) {
+    const char *yaml = "name: svc\nports:\n  - 80\n  - 443\nempty: []\n"
+                       "hosts:\n  - name: a\n    ratio: 0.5\n  - {}\n"
+                       "\"odd key\": null\n";
+    yyaml_err err = {0};
+    char *out = NULL;
+    size_t out_len = 0;
+    yyaml_emitter *em = yyaml_emitter_new(NULL);
+    ASSERT_TRUE(em != NULL);
+    ASSERT_TRUE(test_emit_sample(em));
+    ASSERT_TRUE(yyaml_emitter_finish(em, &out, &out_len, &err));
+    ASSERT_STREQ(yaml, out);
+    ASSERT_EQ(strlen(yaml), out_len);
+    ASSERT_FALSE(yyaml_emitter_null(em));
+    yyaml_emitter_free(em);
+
+    yyaml_free_string(out);
+
+    yyaml_write_opts opts = {0};
+    opts.final_newline = true;
+    opts.style = YYAML_STYLE_LINE;
+    em = yyaml_emitter_new(&opts);
+    ASSERT_TRUE(test_emit_sample(em));
+    ASSERT_TRUE(yyaml_emitter_finish(em, &out, NULL, &err));
+    ASSERT_STREQ("{name: svc, ports: [80, 443], empty: [], hosts: [{name: a, "
+                 "ratio: 0.5}, {}], \"odd key\": null}\n",
+                 out);
+    yyaml_free_string(out);
+    yyaml_emitter_free(em);
+
+    /* misuse is sticky and reported by finish */
+    em = yyaml_emitter_new(NULL);
+    ASSERT_TRUE(yyaml_emitter_begin_map(em));
+    ASSERT_FALSE(yyaml_emitter_int(em, 1));
+    ASSERT_FALSE(yyaml_emitter_key(em, "a", 1));
+    ASSERT_FALSE(yyaml_emitter_finish(em, &out, NULL, &err));
+    ASSERT_STREQ("mapping value without key", err.msg);
+    yyaml_emitter_free(em);
+
+    em = yyaml_emitter_new(NULL);
+    ASSERT_TRUE(yyaml_emitter_begin_seq(em));
+    ASSERT_FALSE(yyaml_emitter_end_map(em));
+    yyaml_emitter_free(em);
+
+    em = yyaml_emitter_new(NULL);
+    ASSERT_TRUE(yyaml_emitter_begin_seq(em));
+    ASSERT_FALSE(yyaml_emitter_finish(em, &out, NULL, &err));
+    ASSERT_STREQ("unclosed collection", err.msg);
+    yyaml_emitter_free(em);
+}
+
+// Test quoting decisions recorded at build and parse time survive edits,
+// compaction and import
+UTEST(yyaml_tests, test_write_string_classes) {
+    const char *expected = "plain: \"new value\"\n\"two words\": \"a b\"\n"
+                           "\"tab\\tkey\": \"say \\\"hi\\\"\"\nlist:\n"
+                           "  - \"x y\"\n  - ok\n";
+    static const char *const items[] = {"x y", "ok"};
+    yyaml_err err = {0};
+    yyaml_doc *doc = yyaml_doc_new();
+    uint32_t root = yyaml_doc_add_mapping(doc);
+    ASSERT_TRUE(yyaml_doc_map_append(doc, root, "plain", 5,
+                                     yyaml_doc_add_string(doc, "word", 4)));
+    ASSERT_TRUE(yyaml_doc_map_append(doc, root, "two words", 9,
+                                     yyaml_doc_add_string(doc, "a b", 3)));
+    ASSERT_TRUE(yyaml_doc_map_append(doc, root, "tab\tkey", 7,
+                                     yyaml_doc_add_string(doc, "say \"hi\"", 8)));
+    ASSERT_TRUE(yyaml_doc_map_append(doc, root, "list", 4,
+                                     yyaml_doc_add_string_array(doc, items, NULL, 2)));
+    /* the replacement takes over the key and its class */
+    ASSERT_TRUE(yyaml_doc_map_set(doc, root, "plain", 5,
+                                  yyaml_doc_add_string(doc, "new value", 9)));
+    yyaml_doc_set_root(doc, root);
+
+    char *out = NULL;
+    size_t out_len = 0;
+    ASSERT_TRUE(yyaml_write(yyaml_doc_get_root(doc), &out, &out_len, NULL, &err));
+    ASSERT_STREQ(expected, out);
+    ASSERT_EQ(out_len, yyaml_write_len(yyaml_doc_get_root(doc), NULL));
+    yyaml_free_string(out);
+
+    ASSERT_TRUE(yyaml_doc_gc(doc));
+    yyaml_doc *copy = yyaml_doc_new();
+    ASSERT_TRUE(yyaml_doc_set_root(copy,
+                                   yyaml_doc_import(copy, yyaml_doc_get_root(doc))));
+    ASSERT_TRUE(yyaml_write(yyaml_doc_get_root(copy), &out, &out_len, NULL, &err));
+    ASSERT_STREQ(expected, out);
+    yyaml_free_string(out);
+    ASSERT_TRUE(yyaml_write_json(yyaml_doc_get_root(copy), &out, &out_len, NULL, &err));
+    ASSERT_STREQ("{\"plain\":\"new value\",\"two words\":\"a b\","
+                 "\"tab\\tkey\":\"say \\\"hi\\\"\",\"list\":[\"x y\",\"ok\"]}\n",
+                 out);
+    yyaml_free_string(out);
+    yyaml_doc_free(copy);
+    yyaml_doc_free(doc);
+
+    /* parsed strings are classified once, compacted or not */
+    const char *yaml = "name: \"a b\"\nlevel: info\nmsg: \"tab\\there\"\n";
+    for (int pass = 0; pass < 2; pass++) {
+        yyaml_read_opts opts = {0};
+        opts.allow_inf_nan = true;
+        opts.max_nesting = 64;
+        opts.compact = pass == 1;
+        doc = yyaml_read(yaml, strlen(yaml), &opts, &err);
+        ASSERT_TRUE(doc != NULL);
+        ASSERT_TRUE(yyaml_write(yyaml_doc_get_root(doc), &out, &out_len, NULL, &err));
+        ASSERT_STREQ(yaml, out);
+        yyaml_free_string(out);
+        yyaml_doc_free(doc);
+    }
+}
+
+// Test documents read with keep_source copy unmodified entries verbatim and
+// only serialize what was changed
+UTEST(yyaml_tests, test_write_keep_source) {
+    const char *yaml = "# service\n"
+                       "name:   demo   # trailing\n"
+                       "\n"
+                       "ports:\n"
+                       "    - 80\n"
+                       "    # tls\n"
+                       "    - 443\n"
+                       "items:\n"
+                       "  - id: 1\n"
+                       "    tags: [a, b]\n"
+                       "  # second\n"
+                       "  - id: 2\n"
+                       "    text: |\n"
+                       "      kept\n";
+    yyaml_err err = {0};
+    for (int pass = 0; pass < 2; pass++) {
+        yyaml_read_opts opts = {0};
+        opts.allow_inf_nan = true;
+        opts.max_nesting = 64;
+        opts.compact = pass == 1;
+        opts.keep_source = true;
+        yyaml_doc *doc = yyaml_read(yaml, strlen(yaml), &opts, &err);
+        ASSERT_TRUE(doc != NULL);
+        const yyaml_node *root = yyaml_doc_get_root(doc);
+        char *out = NULL;
+        size_t out_len = 0;
+        ASSERT_TRUE(yyaml_write(root, &out, &out_len, NULL, &err));
+        ASSERT_STREQ(yaml, out);
+        ASSERT_EQ(out_len, yyaml_write_len(root, NULL));
+        yyaml_free_string(out);
+
+        /* the edited item is written again, comments above it stay */
+        const yyaml_node *items = yyaml_map_get(root, "items");
+        uint32_t item = yyaml_node_index(doc, yyaml_seq_get(items, 1));
+        ASSERT_TRUE(yyaml_doc_map_set(doc, item, "id", 2,
+                                      yyaml_doc_add_int(doc, 7)));
+        root = yyaml_doc_get_root(doc);
+        uint32_t ports = yyaml_node_index(doc, yyaml_map_get(root, "ports"));
+        ASSERT_TRUE(yyaml_doc_seq_append(doc, ports, yyaml_doc_add_int(doc, 8080)));
+        root = yyaml_doc_get_root(doc);
+        ASSERT_TRUE(yyaml_write(root, &out, &out_len, NULL, &err));
+        ASSERT_STREQ("# service\n"
+                     "name:   demo   # trailing\n"
+                     "\n"
+                     "ports:\n"
+                     "  - 80\n"
+                     "  # tls\n"
+                     "  - 443\n"
+                     "  - 8080\n"
+                     "items:\n"
+                     "  - id: 1\n"
+                     "    tags: [a, b]\n"
+                     "  # second\n"
+                     "  - id: 7\n"
+                     "    text: |\n"
+                     "      kept\n",
+                     out);
+        ASSERT_EQ(out_len, yyaml_write_len(root, NULL));
+        yyaml_free_string(out);
+
+        /* other styles never reuse the text */
+        yyaml_write_opts line = {0};
+        line.indent = 2;
+        line.final_newline = true;
+        line.style = YYAML_STYLE_LINE;
+        ASSERT_TRUE(yyaml_write(root, &out, &out_len, &line, &err));
+        ASSERT_STREQ("{name: demo, ports: [80, 443, 8080], items: [{id: 1, "
+                     "tags: [a, b]}, {id: 7, text: \"kept\\n\"}]}\n",
+                     out);
+        yyaml_free_string(out);
+        yyaml_doc_free(doc);
+    }
+}
+
+// Test sorted and canonical output and the order-insensitive document hash
+UTEST(yyaml_tests, test_write_sort_keys_and_hash) {
+    yyaml_err err = {0};
+    yyaml_doc *docs[2];
+    char key[4];
+    for (int d = 0; d < 2; d++) {
+        yyaml_doc *doc = yyaml_doc_new();
+        uint32_t root = yyaml_doc_add_mapping(doc);
+        uint32_t inner = yyaml_doc_add_mapping(doc);
+        uint32_t list = yyaml_doc_add_sequence(doc);
+        yyaml_doc_seq_append(doc, list, yyaml_doc_add_int(doc, 2));
+        yyaml_doc_seq_append(doc, list, yyaml_doc_add_int(doc, 1));
+        yyaml_doc_map_append(doc, inner, "z", 1, yyaml_doc_add_int(doc, 1));
+        yyaml_doc_map_append(doc, inner, "a", 1, yyaml_doc_add_double(doc, -0.0));
+        yyaml_doc_map_append(doc, inner, "m", 1, list);
+        /* twenty keys, descending in the first document, ascending in the other */
+        for (int i = 0; i < 20; i++) {
+            int k = d ? i : 19 - i;
+            snprintf(key, sizeof(key), "k%02d", k);
+            yyaml_doc_map_append(doc, root, key, 3, yyaml_doc_add_int(doc, k));
+        }
+        yyaml_doc_map_append(doc, root, "b", 1, inner);
+        yyaml_doc_map_append(doc, root, "a", 1, yyaml_doc_add_string(doc, "x", 1));
+        yyaml_doc_set_root(doc, root);
+        docs[d] = doc;
+    }
+
+    yyaml_write_opts sorted = {0};
+    sorted.indent = 2;
+    sorted.final_newline = true;
+    sorted.sort_keys = true;
+    yyaml_write_opts canonical = {0};
+    canonical.indent = 2;
+    canonical.final_newline = true;
+    canonical.canonical = true;
+    const yyaml_node *root = yyaml_doc_get_root(docs[0]);
+    char *out = NULL;
+    size_t out_len = 0;
+    ASSERT_TRUE(yyaml_write(root, &out, &out_len, &sorted, &err));
+    ASSERT_EQ(0, strncmp(out, "a: x\nb:\n  a: -0.0\n  m:\n    - 2\n    - 1\n"
+                              "  z: 1\nk00: 0\nk01: 1\nk02: 2\n",
+                         strlen("a: x\nb:\n  a: -0.0\n  m:\n    - 2\n    - 1\n"
+                                "  z: 1\nk00: 0\nk01: 1\nk02: 2\n")));
+    ASSERT_EQ(0, strcmp(out + out_len - 8, "k19: 19\n"));
+    ASSERT_EQ(out_len, yyaml_write_len(root, &sorted));
+    yyaml_free_string(out);
+
+    /* canonical implies sorted keys and folds the sign of zero */
+    char *other = NULL;
+    ASSERT_TRUE(yyaml_write(root, &out, &out_len, &canonical, &err));
+    ASSERT_TRUE(yyaml_write(yyaml_doc_get_root(docs[1]), &other, NULL, &canonical,
+                            &err));
+    ASSERT_STREQ(out, other);
+    ASSERT_TRUE(strstr(out, "  a: 0.0\n") != NULL);
+    yyaml_free_string(other);
+    yyaml_free_string(out);
+
+    canonical.style = YYAML_STYLE_LINE;
+    ASSERT_TRUE(yyaml_write(yyaml_map_get(root, "b"), &out, NULL, &canonical, &err));
+    ASSERT_STREQ("{a: 0.0, m: [2, 1], z: 1}\n", out);
+    yyaml_free_string(out);
+    ASSERT_TRUE(yyaml_write_json(yyaml_map_get(root, "b"), &out, NULL, &sorted,
+                                 &err));
+    ASSERT_STREQ("{\"a\":-0.0,\"m\":[2,1],\"z\":1}\n", out);
+    yyaml_free_string(out);
+
+    /* the digest ignores key order, not sequence order or types */
+    uint64_t hash = yyaml_doc_hash(root);
+    ASSERT_NE((uint64_t)0, hash);
+    ASSERT_EQ(hash, yyaml_doc_hash(yyaml_doc_get_root(docs[1])));
+    ASSERT_EQ(yyaml_doc_hash(yyaml_map_get(root, "b")),
+              yyaml_doc_hash(yyaml_map_get(yyaml_doc_get_root(docs[1]), "b")));
+    ASSERT_NE(yyaml_doc_hash(yyaml_seq_get(yyaml_map_get(yyaml_map_get(root, "b"), "m"), 0)),
+              yyaml_doc_hash(yyaml_seq_get(yyaml_map_get(yyaml_map_get(root, "b"), "m"), 1)));
+
+    yyaml_doc *parsed = yyaml_read("{m: [2, 1], z: 1, a: 0.0}", 25, NULL, &err);
+    ASSERT_TRUE(parsed != NULL);
+    ASSERT_EQ(yyaml_doc_hash(yyaml_map_get(root, "b")),
+              yyaml_doc_hash(yyaml_doc_get_root(parsed)));
+    yyaml_doc_free(parsed);
+    parsed = yyaml_read("{m: [1, 2], z: 1, a: 0.0}", 25, NULL, &err);
+    ASSERT_TRUE(parsed != NULL);
+    ASSERT_NE(yyaml_doc_hash(yyaml_map_get(root, "b")),
+              yyaml_doc_hash(yyaml_doc_get_root(parsed)));
+    yyaml_doc_free(parsed);
+    parsed = yyaml_read("[1, 1.0]", 8, NULL, &err);
+    ASSERT_TRUE(parsed != NULL);
+    ASSERT_NE(yyaml_doc_hash(yyaml_seq_get(yyaml_doc_get_root(parsed), 0)),
+              yyaml_doc_hash(yyaml_seq_get(yyaml_doc_get_root(parsed), 1)));
+    yyaml_doc_free(parsed);
+
+    /* an edit changes the digest, compaction keeps it */
+    ASSERT_TRUE(yyaml_doc_map_set(docs[0], yyaml_node_index(docs[0], root), "a", 1,
+                                  yyaml_doc_add_string(docs[0], "y", 1)));
+    root = yyaml_doc_get_root(docs[0]);
+    uint64_t edited = yyaml_doc_hash(root);
+    ASSERT_NE(hash, edited);
+    ASSERT_TRUE(yyaml_doc_compact(docs[0]));
+    ASSERT_EQ(edited, yyaml_doc_hash(yyaml_doc_get_root(docs[0])));
+    ASSERT_EQ((uint64_t)0, yyaml_doc_hash(NULL));
+    yyaml_doc_free(docs[0]);
+    yyaml_doc_free(docs[1]);
+}
+
+// Test structural equality and the digest cache across edits
+UTEST(yyaml_tests, test_node_equal_and_cached_hash) {
+    const char *before = "server:\n"
+                         "  host: example.org\n"
+                         "  ports: [80, 443]\n"
+                         "limits:\n"
+                         "  rate: 1.5\n"
+                         "  burst: 10\n"
+                         "users: [alice, bob]\n";
+    const char *after = "server:\n"
+                        "  ports: [80, 443]\n"
+                        "  host: example.org\n"
+                        "limits:\n"
+                        "  rate: 1.5\n"
+                        "  burst: 20\n"
+                        "users: [alice, bob]\n";
+    yyaml_err err = {0};
+    yyaml_doc *old_doc = yyaml_read(before, strlen(before), NULL, &err);
+    yyaml_doc *new_doc = yyaml_read(after, strlen(after), NULL, &err);
+    ASSERT_TRUE(old_doc != NULL);
+    ASSERT_TRUE(new_doc != NULL);
+    const yyaml_node *old_root = yyaml_doc_get_root(old_doc);
+    const yyaml_node *new_root = yyaml_doc_get_root(new_doc);
+
+    /* only the section whose values changed differs, in any key order */
+    ASSERT_FALSE(yyaml_node_equal(old_root, new_root, true));
+    ASSERT_TRUE(yyaml_node_equal(yyaml_map_get(old_root, "users"),
+                                 yyaml_map_get(new_root, "users"), false));
+    ASSERT_FALSE(yyaml_node_equal(yyaml_map_get(old_root, "server"),
+                                  yyaml_map_get(new_root, "server"), false));
+    ASSERT_TRUE(yyaml_node_equal(yyaml_map_get(old_root, "server"),
+                                 yyaml_map_get(new_root, "server"), true));
+    ASSERT_FALSE(yyaml_node_equal(yyaml_map_get(old_root, "limits"),
+                                  yyaml_map_get(new_root, "limits"), true));
+    ASSERT_TRUE(yyaml_node_equal(old_root, old_root, false));
+    ASSERT_TRUE(yyaml_node_equal(NULL, NULL, false));
+    ASSERT_FALSE(yyaml_node_equal(old_root, NULL, false));
+
+    /* scalars compare by type, -0.0 equals 0.0 and NaN equals NaN */
+    yyaml_doc *nums = yyaml_read("[1, 1.0, -0.0, 0.0, .nan, .nan, '1']", 36,
+                                 NULL, &err);
+    ASSERT_TRUE(nums != NULL);
+    const yyaml_node *list = yyaml_doc_get_root(nums);
+    ASSERT_FALSE(yyaml_node_equal(yyaml_seq_get(list, 0), yyaml_seq_get(list, 1),
+                                  false));
+    ASSERT_FALSE(yyaml_node_equal(yyaml_seq_get(list, 0), yyaml_seq_get(list, 6),
+                                  false));
+    ASSERT_TRUE(yyaml_node_equal(yyaml_seq_get(list, 2), yyaml_seq_get(list, 3),
+                                 false));
+    ASSERT_TRUE(yyaml_node_equal(yyaml_seq_get(list, 4), yyaml_seq_get(list, 5),
+                                 false));
+    yyaml_doc_free(nums);
+
+    /* editing the old document invalidates the cached digests on its path */
+    ASSERT_TRUE(yyaml_doc_cache_hashes(old_doc));
+    ASSERT_TRUE(yyaml_doc_cache_hashes(new_doc));
+    ASSERT_FALSE(yyaml_doc_cache_hashes(NULL));
+    uint64_t users_hash = yyaml_doc_hash(yyaml_map_get(old_root, "users"));
+    uint64_t limits_hash = yyaml_doc_hash(yyaml_map_get(old_root, "limits"));
+    uint32_t limits = yyaml_node_index(old_doc, yyaml_map_get(old_root, "limits"));
+    ASSERT_TRUE(yyaml_doc_map_set(old_doc, limits, "burst", 5,
+                                  yyaml_doc_add_int(old_doc, 20)));
+    old_root = yyaml_doc_get_root(old_doc);
+    ASSERT_EQ(users_hash, yyaml_doc_hash(yyaml_map_get(old_root, "users")));
+    ASSERT_NE(limits_hash, yyaml_doc_hash(yyaml_map_get(old_root, "limits")));
+    ASSERT_EQ(yyaml_doc_hash(new_root), yyaml_doc_hash(old_root));
+    ASSERT_TRUE(yyaml_node_equal(old_root, new_root, true));
+    ASSERT_FALSE(yyaml_node_equal(old_root, new_root, false));
+
+    uint32_t users = yyaml_node_index(old_doc, yyaml_map_get(old_root, "users"));
+    ASSERT_TRUE(yyaml_doc_seq_append(old_doc, users,
+                                     yyaml_doc_add_string(old_doc, "carol", 5)));
+    old_root = yyaml_doc_get_root(old_doc);
+    ASSERT_NE(users_hash, yyaml_doc_hash(yyaml_map_get(old_root, "users")));
+    ASSERT_FALSE(yyaml_node_equal(old_root, new_root, true));
+    ASSERT_TRUE(yyaml_doc_cache_hashes(old_doc));
+    ASSERT_FALSE(yyaml_node_equal(old_root, new_root, true));
+    ASSERT_TRUE(yyaml_doc_seq_remove(old_doc, users, 2));
+    old_root = yyaml_doc_get_root(old_doc);
+    ASSERT_EQ(users_hash, yyaml_doc_hash(yyaml_map_get(old_root, "users")));
+    ASSERT_TRUE(yyaml_node_equal(old_root, new_root, true));
+
+    /* the cached variant takes matching digests as proof, and the digests
+     * do not see key order */
+    ASSERT_TRUE(yyaml_doc_cache_hashes(old_doc));
+    ASSERT_TRUE(yyaml_node_equal_cached(old_root, new_root));
+    ASSERT_TRUE(yyaml_node_equal_cached(yyaml_map_get(old_root, "server"),
+                                        yyaml_map_get(new_root, "server")));
+    ASSERT_TRUE(yyaml_doc_map_set(old_doc, limits, "rate", 4,
+                                  yyaml_doc_add_double(old_doc, 2.5)));
+    old_root = yyaml_doc_get_root(old_doc);
+    ASSERT_FALSE(yyaml_node_equal_cached(old_root, new_root));
+    ASSERT_TRUE(yyaml_doc_map_set(old_doc, limits, "rate", 4,
+                                  yyaml_doc_add_double(old_doc, 1.5)));
+    old_root = yyaml_doc_get_root(old_doc);
+    ASSERT_TRUE(yyaml_node_equal_cached(old_root, new_root));
+    ASSERT_TRUE(yyaml_node_equal_cached(NULL, NULL));
+    ASSERT_FALSE(yyaml_node_equal_cached(old_root, NULL));
+
+    /* compaction moves the cached digests along with the nodes */
+    ASSERT_TRUE(yyaml_doc_compact(old_doc));
+    old_root = yyaml_doc_get_root(old_doc);
+    ASSERT_EQ(yyaml_doc_hash(new_root), yyaml_doc_hash(old_root));
+    ASSERT_TRUE(yyaml_node_equal(old_root, new_root, true));
+    uint32_t copy = yyaml_doc_import(new_doc, old_root);
+    ASSERT_NE(UINT32_MAX, copy);
+    new_root = yyaml_doc_get_root(new_doc);
+    ASSERT_TRUE(yyaml_node_equal(yyaml_doc_get(new_doc, copy), new_root, true));
+    yyaml_doc_free(old_doc);
+    yyaml_doc_free(new_doc);
+
+    /* key order on mappings larger than the in-place sort */
+    yyaml_doc *maps[2];
+    char key[4];
+    for (int d = 0; d < 2; d++) {
+        maps[d] = yyaml_doc_new();
+        uint32_t map = yyaml_doc_add_mapping(maps[d]);
+        for (int i = 0; i < 24; i++) {
+            int k = d ? i : 23 - i;
+            snprintf(key, sizeof(key), "k%02d", k);
+            yyaml_doc_map_append(maps[d], map, key, 3, yyaml_doc_add_int(maps[d], k));
+        }
+        yyaml_doc_set_root(maps[d], map);
+    }
+    ASSERT_TRUE(yyaml_node_equal(yyaml_doc_get_root(maps[0]),
+                                 yyaml_doc_get_root(maps[1]), true));
+    ASSERT_FALSE(yyaml_node_equal(yyaml_doc_get_root(maps[0]),
+                                  yyaml_doc_get_root(maps[1]), false));
+    yyaml_doc_free(maps[0]);
+    yyaml_doc_free(maps[1]);
+}
@@ -7,6 +7,7 @@
 #include <vector>
 #include <filesystem>
 #include <iostream>
+#include <sstream>
 
 namespace {
 
@@ -127,6 +128,10 @@ metadata:
 
     auto roundtrip = yyaml::document::parse(serialized);
     ASSERT_TRUE(nodes_equal(doc.root(), roundtrip.root()));
+
+    std::ostringstream streamed;
+    doc.dump(streamed);
+    ASSERT_TRUE(serialized == streamed.str());
 }
 
 UTEST(cpp_tests, node_to_string_emits_yaml_for_scalars_and_subtrees) {
@@ -195,6 +200,59 @@ UTEST(cpp_tests, node_to_string_emits_yaml_for_scalars_and_subtrees) {
     }
 }
 
+UTEST(cpp_tests, node_to_json_emits_minified_and_pretty_json) {
+    auto doc = yyaml::document::parse("name: demo\nports:\n  - 80\n  - 443\nratio: 1.0\n");
+
+    ASSERT_STREQ("{\"name\":\"demo\",\"ports\":[80,443],\"ratio\":1.0}",
+                 doc.root().to_json().c_str());
+    ASSERT_STREQ("[\n  80,\n  443\n]", doc.root()["ports"].to_json(true).c_str());
+
+    yyaml::write_opts opts{};
+    opts.indent = 4;
+    opts.final_newline = true;
+    opts.pretty = true;
+    ASSERT_STREQ("{\n    \"name\": \"demo\",\n    \"ports\": [\n        80,\n        443\n"
+                 "    ],\n    \"ratio\": 1.0\n}\n",
+                 doc.dump_json(&opts).c_str());
+}
+
+UTEST(cpp_tests, node_equals_compares_subtrees_across_documents) {
+    auto before = yyaml::document::parse("server:\n  host: a\n  port: 80\nusers: [x, y]\n");
+    auto after = yyaml::document::parse("server:\n  port: 80\n  host: a\nusers: [x, z]\n");
+
+    ASSERT_TRUE(before.root()["server"].equals(after.root()["server"], true));
+    ASSERT_FALSE(before.root()["server"].equals(after.root()["server"]));
+    ASSERT_FALSE(before.root()["users"].equals(after.root()["users"], true));
+    ASSERT_EQ(before.root()["server"].digest(), after.root()["server"].digest());
+    ASSERT_NE(before.root().digest(), after.root().digest());
+
+    before.cache_hashes();
+    after.cache_hashes();
+    ASSERT_TRUE(before.root()["server"].equals(after.root()["server"], true));
+    ASSERT_FALSE(before.root().equals(after.root(), true));
+    ASSERT_TRUE(before.root()["server"].equals_cached(after.root()["server"]));
+    ASSERT_FALSE(before.root().equals_cached(after.root()));
+}
+
+UTEST(cpp_tests, parse_file_reports_error_codes) {
+    ::yyaml_err_code code = YYAML_ERR_NONE;
+    try {
+        yyaml::document::parse_file("missing_file.yaml");
+    } catch (const yyaml::yyaml_error &e) {
+        code = e.code;
+        ASSERT_NE(std::string::npos, std::string(e.what()).find("missing_file.yaml"));
+    }
+    ASSERT_EQ(YYAML_ERR_IO, code);
+
+    try {
+        yyaml::document::parse("key: value\n  - item");
+    } catch (const yyaml::yyaml_error &e) {
+        code = e.code;
+        ASSERT_NE(0u, e.line);
+    }
+    ASSERT_EQ(YYAML_ERR_PARSE, code);
+}
+
 UTEST(cpp_tests, node_empty_reflects_structure_and_scalar_content) {
     yyaml::node unbound;
     ASSERT_TRUE(unbound.empty());
@@ -323,6 +381,26 @@ UTEST(cpp_tests, document_builder_constructs_nested_structures) {
     ASSERT_TRUE(built_root["meta"].is_mapping());
 }
 
+UTEST(cpp_tests, document_indexed_access_follows_edits) {
+    auto doc = yyaml::document::create();
+    std::vector<std::int64_t> values(1000);
+    for (std::size_t i = 0; i < values.size(); i++) {
+        values[i] = static_cast<std::int64_t>(i);
+    }
+    doc.set_root(doc.add_int_array(values.data(), values.size()));
+    ASSERT_EQ(999, doc.root()[999].as_int());
+
+    auto first = doc.add_int(-1);
+    doc.seq_insert(doc.root(), 0, first);
+    doc.seq_remove(doc.root(), 500);
+    auto list = doc.root();
+    ASSERT_EQ(1000u, list.size());
+    ASSERT_EQ(-1, list[0].as_int());
+    ASSERT_EQ(498, list[499].as_int());
+    ASSERT_EQ(500, list[500].as_int());
+    ASSERT_EQ(999, list[999].as_int());
+}
+
 // Helper function to read file content
 static std::string read_file(const std::string& filename) {
     std::ifstream file(filename, std::ios::binary);
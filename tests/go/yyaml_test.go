@@ -1,6 +1,7 @@
 package yyaml_test
 
 import (
+	"encoding/json"
 	"os"
 	"path/filepath"
 	"strings"
@@ -91,6 +92,31 @@ func TestMarshalSimple(t *testing.T) {
 	}
 }
 
+func TestYAMLToJSON(t *testing.T) {
+	input := []byte("name: Alice\ntags:\n  - a\n  - b\nratio: 0.5\n")
+
+	output, err := yyaml.YAMLToJSON(input, false)
+	if err != nil {
+		t.Fatalf("YAMLToJSON failed: %v", err)
+	}
+	expected := `{"name":"Alice","tags":["a","b"],"ratio":0.5}`
+	if string(output) != expected {
+		t.Errorf("Expected %s, got %s", expected, output)
+	}
+
+	pretty, err := yyaml.YAMLToJSON(input, true)
+	if err != nil {
+		t.Fatalf("YAMLToJSON pretty failed: %v", err)
+	}
+	var decoded map[string]interface{}
+	if err := json.Unmarshal(pretty, &decoded); err != nil {
+		t.Fatalf("pretty output is not valid JSON: %v\n%s", err, pretty)
+	}
+	if !strings.Contains(string(pretty), "\n  \"tags\": [\n    \"a\",") {
+		t.Errorf("Unexpected pretty layout:\n%s", pretty)
+	}
+}
+
 func TestRoundtrip(t *testing.T) {
 	original := map[string]interface{}{
 		"string": "hello",
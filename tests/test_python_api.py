@@ -33,3 +33,60 @@ def test_dump_and_load_file_objects():
 
     parsed = yyaml.load(buffer)
     assert parsed == data
+
+
+def test_dumps_json_matches_json_module():
+    import json
+
+    data = {"name": "demo", "ports": [80, 443], "ratio": 0.5, "meta": {"tag": 'say "hi"'}}
+
+    assert json.loads(yyaml.dumps_json(data)) == data
+    pretty = yyaml.dumps_json(data, opts={"pretty": True, "indent": 2})
+    assert pretty.startswith('{\n  "name": "demo",')
+    assert json.loads(pretty) == data
+
+
+def test_dumps_flow_styles_roundtrip():
+    data = {"name": "demo", "ports": [80, 443], "meta": {"owner": "tester"}}
+
+    assert yyaml.dumps(data, opts={"style": "line"}) == (
+        "{name: demo, ports: [80, 443], meta: {owner: tester}}\n"
+    )
+    for style in ("auto", "flow", "line"):
+        assert yyaml.loads(yyaml.dumps(data, opts={"style": style})) == data
+
+
+def test_dumps_sort_keys_and_canonical():
+    data = {"b": {"z": 1, "a": -0.0}, "a": [2, 1]}
+
+    assert yyaml.dumps(data, opts={"sort_keys": True, "style": "line"}) == (
+        "{a: [2, 1], b: {a: -0.0, z: 1}}\n"
+    )
+    assert yyaml.dumps(data, opts={"canonical": True, "style": "line"}) == (
+        "{a: [2, 1], b: {a: 0.0, z: 1}}\n"
+    )
+    assert yyaml.loads(yyaml.dumps(data, opts={"sort_keys": True})) == data
+
+
+def test_node_equals_and_digest():
+    before = yyaml.Document.parse("server: {host: a, port: 80}\nusers: [x, y]\n")
+    after = yyaml.Document.parse("server: {port: 80, host: a}\nusers: [x, z]\n")
+
+    assert before.root["server"].equals(after.root["server"], ignore_key_order=True)
+    assert not before.root["server"].equals(after.root["server"])
+    assert not before.root["users"].equals(after.root["users"])
+    assert before.root["server"].digest() == after.root["server"].digest()
+
+    before.cache_hashes()
+    after.cache_hashes()
+    assert before.root["server"].equals_cached(after.root["server"])
+    assert not before.root.equals_cached(after.root)
+
+
+def test_parse_file_missing_raises_oserror():
+    try:
+        yyaml.Document.parse_file("missing_file.yaml")
+    except OSError as exc:
+        assert "missing_file.yaml" in str(exc)
+    else:
+        raise AssertionError("expected OSError")
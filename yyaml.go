@@ -73,6 +73,23 @@ func Marshal(v interface{}) ([]byte, error) {
 	return []byte(str), nil
 }
 
+// YAMLToJSON converts YAML data to JSON without building Go values in between.
+// The output is minified unless pretty is set, in which case it is indented
+// by two spaces per level.
+func YAMLToJSON(data []byte, pretty bool) ([]byte, error) {
+	doc, err := parseString(string(data))
+	if err != nil {
+		return nil, err
+	}
+	defer doc.Close()
+
+	str, err := doc.DumpJSON(pretty)
+	if err != nil {
+		return nil, err
+	}
+	return []byte(str), nil
+}
+
 // parseString parses YAML string into Document.
 func parseString(str string) (*Document, error) {
 	var cErr C.yyaml_err
@@ -205,6 +222,32 @@ func (d *Document) DumpString() (string, error) {
 	return C.GoStringN(cOut, C.int(cLen)), nil
 }
 
+// DumpJSON serializes Document to a JSON string, minified unless pretty is set.
+func (d *Document) DumpJSON(pretty bool) (string, error) {
+	root := d.root()
+	if root == nil {
+		return "", errors.New("document has no root")
+	}
+
+	var cOut *C.char
+	var cLen C.size_t
+	var cErr C.yyaml_err
+	var cOpts C.yyaml_write_opts
+	cOpts.indent = 2
+	cOpts.pretty = C.bool(pretty)
+
+	success := C.yyaml_write_json(root.node, &cOut, &cLen, &cOpts, &cErr)
+	if !success {
+		return "", errors.New(C.GoString(&cErr.msg[0]))
+	}
+	if cOut == nil {
+		return "", errors.New("yyaml_write_json returned nil output")
+	}
+
+	defer C.yyaml_free_string(cOut)
+	return C.GoStringN(cOut, C.int(cLen)), nil
+}
+
 // root returns the root node.
 func (d *Document) root() *Node {
 	cNode := C.yyaml_doc_get_root(d.doc)
@@ -244,14 +287,17 @@ func (n *Node) toInterface() interface{} {
 		return C.GoStringN(strPtr, C.int(length))
 	case C.YYAML_SEQUENCE:
 		length := int(C.yyaml_seq_len(n.node))
-		result := make([]interface{}, length)
-		for i := 0; i < length; i++ {
-			cNode := C.yyaml_seq_get(n.node, C.size_t(i))
-			if cNode == nil {
-				result[i] = nil
-			} else {
-				result[i] = (&Node{node: cNode, doc: n.doc}).toInterface()
+		result := make([]interface{}, 0, length)
+
+		// Follow the links: documents built by Marshal have no sequence index
+		childIdx := n.node.child
+		for childIdx != ^C.uint32_t(0) {
+			cChild := C.yyaml_doc_get(n.doc.doc, childIdx)
+			if cChild == nil {
+				break
 			}
+			result = append(result, (&Node{node: cChild, doc: n.doc}).toInterface())
+			childIdx = cChild.next
 		}
 		return result
 	case C.YYAML_MAPPING:
@@ -1,3 +1,15 @@
+/* Feature macros go before the first system header, yyaml.h included:
+ * strict -std=c99 hides ftruncate and pread otherwise, and on glibc
+ * _DEFAULT_SOURCE keeps extensions such as MAP_FIXED_NOREPLACE. */
+#if defined(__unix__) || defined(__APPLE__)
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE 1
+#endif
+#endif
+
 #include "yyaml.h"
 
 #include <stddef.h>
@@ -9,6 +21,32 @@
 #include <errno.h>
 #include <math.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define YYAML_HAS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define YYAML_HAS_POSIX 1
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+/* Where a block node came from in the source kept by keep_source: its
+ * entry begins at key (the key or the '-' of a sequence item), comment and
+ * blank lines before it start at start, and the entry with its whole
+ * subtree ends at end (before the line break). The root spans the text. */
+typedef struct {
+    uint32_t start;
+    uint32_t key;   /* YYAML_INDEX_NONE when the node has no source */
+    uint32_t end;
+    bool dirty;     /* subtree changed since parsing, set up to the root */
+} yyaml_span;
+
 struct yyaml_doc {
     yyaml_node *nodes;
     size_t node_count;
@@ -17,10 +55,32 @@ struct yyaml_doc {
     size_t scalar_len;
     size_t scalar_cap;
     uint32_t root;
+    uint32_t *seq_index;  /* per-node element offsets followed by elements */
+    bool seq_index_valid; /* seq_index reflects the current child links */
+    uint32_t *subtree;    /* per-node subtree sizes, valid while compact */
+    bool compact;         /* children contiguous, descendants follow child */
+    uint32_t *tails;      /* per-node last child, allocated by the builder */
+    uint8_t *str_class;   /* per-node quoting class of value and key, or NULL */
+    yyaml_span *spans;    /* per-node source spans with keep_source, or NULL */
+    uint64_t *hashes;     /* per-node subtree digests, 0 until computed, or NULL */
+    char *source;         /* copy of the parsed text with keep_source */
+    uint32_t free_head;   /* first released node slot, chained via next */
+    size_t free_count;    /* number of released node slots */
+    size_t scalar_dead;   /* scalar bytes no longer referenced by any node */
+    void *mapped;         /* snapshot mapping backing the buffers, or NULL */
+    size_t mapped_len;
+    bool read_only;       /* published view living inside its own mapping */
 };
 
 #define YYAML_INDEX_NONE UINT32_MAX
 
+/* str_class bits: the value class sits in the low nibble, the key class in
+ * the high one. A nibble without YYAML_STR_KNOWN is classified on demand. */
+#define YYAML_STR_KNOWN 0x1   /* class below has been computed */
+#define YYAML_STR_PLAIN 0x2   /* can be written as a plain scalar */
+#define YYAML_STR_ESCAPES 0x4 /* quoted form needs escape sequences */
+#define YYAML_STR_KEY_SHIFT 4
+
 typedef struct {
     size_t indent;
     uint32_t container;
@@ -42,9 +102,21 @@ static void yyaml_set_error(yyaml_err *err, size_t pos, size_t line,
     err->pos = pos;
     err->line = line;
     err->column = col;
+    err->code = YYAML_ERR_PARSE;
     snprintf(err->msg, sizeof(err->msg), "%s", msg ? msg : "parse error");
 }
 
+/* A failure that is not located in the input: I/O, memory or misuse. */
+static void yyaml_set_failure(yyaml_err *err, yyaml_err_code code,
+                              const char *msg) {
+    if (!err) return;
+    err->pos = 0;
+    err->line = 0;
+    err->column = 0;
+    err->code = code;
+    snprintf(err->msg, sizeof(err->msg), "%s", msg);
+}
+
 static size_t yyaml_next_capacity(size_t current, size_t need, size_t init) {
     size_t cap = current ? current : init;
     if (cap < init) cap = init;
@@ -57,15 +129,45 @@ static size_t yyaml_next_capacity(size_t current, size_t need, size_t init) {
     return cap;
 }
 
+static bool yyaml_doc_own_storage(yyaml_doc *doc);
+static unsigned yyaml_str_class(const char *str, size_t len);
+
 static bool yyaml_doc_reserve_nodes(yyaml_doc *doc, size_t need) {
     size_t cap;
     yyaml_node *new_nodes;
-    if (need > SIZE_MAX / sizeof(yyaml_node)) return false;
+    if (doc->read_only || need > SIZE_MAX / sizeof(yyaml_node)) return false;
     if (doc->node_cap >= need) return true;
+    if (doc->mapped && !yyaml_doc_own_storage(doc)) return false;
     cap = yyaml_next_capacity(doc->node_cap, need, YYAML_NODE_CAP_INIT);
     new_nodes = (yyaml_node *)realloc(doc->nodes, cap * sizeof(yyaml_node));
     if (!new_nodes) return false;
     doc->nodes = new_nodes;
+    if (doc->tails) {
+        uint32_t *new_tails = (uint32_t *)realloc(doc->tails,
+                                                  cap * sizeof(uint32_t));
+        if (!new_tails) return false;
+        doc->tails = new_tails;
+    }
+    if (doc->spans) {
+        yyaml_span *new_spans = (yyaml_span *)realloc(doc->spans,
+                                                      cap * sizeof(yyaml_span));
+        if (!new_spans) return false;
+        doc->spans = new_spans;
+    }
+    if (doc->hashes) {
+        uint64_t *new_hashes = (uint64_t *)realloc(doc->hashes,
+                                                   cap * sizeof(uint64_t));
+        if (!new_hashes) return false;
+        doc->hashes = new_hashes;
+    }
+    /* documents loaded from a snapshot start without classes and keep
+     * classifying strings on demand */
+    if (doc->str_class || !doc->node_cap) {
+        uint8_t *new_class = (uint8_t *)realloc(doc->str_class, cap);
+        if (!new_class) return false;
+        memset(new_class + doc->node_cap, 0, cap - doc->node_cap);
+        doc->str_class = new_class;
+    }
     doc->node_cap = cap;
     return true;
 }
@@ -73,7 +175,9 @@ static bool yyaml_doc_reserve_nodes(yyaml_doc *doc, size_t need) {
 static bool yyaml_doc_reserve_str(yyaml_doc *doc, size_t need) {
     size_t cap;
     char *new_buf;
+    if (doc->read_only) return false;
     if (doc->scalar_cap >= need) return true;
+    if (doc->mapped && !yyaml_doc_own_storage(doc)) return false;
     cap = yyaml_next_capacity(doc->scalar_cap, need, YYAML_STR_CAP_INIT);
     new_buf = (char *)realloc(doc->scalars, cap);
     if (!new_buf) return false;
@@ -84,8 +188,20 @@ static bool yyaml_doc_reserve_str(yyaml_doc *doc, size_t need) {
 
 static uint32_t yyaml_doc_add_node(yyaml_doc *doc, yyaml_type type) {
     uint32_t idx;
-    if (!yyaml_doc_reserve_nodes(doc, doc->node_count + 1)) return YYAML_INDEX_NONE;
-    idx = (uint32_t)doc->node_count++;
+    if (doc->read_only) return YYAML_INDEX_NONE;
+    if (doc->free_head != YYAML_INDEX_NONE) {
+        /* reuse a slot released by the mutation API */
+        idx = doc->free_head;
+        doc->free_head = doc->nodes[idx].next;
+        doc->free_count--;
+    } else {
+        if (!yyaml_doc_reserve_nodes(doc, doc->node_count + 1)) {
+            return YYAML_INDEX_NONE;
+        }
+        idx = (uint32_t)doc->node_count++;
+    }
+    doc->seq_index_valid = false;
+    doc->compact = false;
     doc->nodes[idx].doc = doc;
     doc->nodes[idx].type = type;
     doc->nodes[idx].flags = 0;
@@ -94,6 +210,13 @@ static uint32_t yyaml_doc_add_node(yyaml_doc *doc, yyaml_type type) {
     doc->nodes[idx].child = YYAML_INDEX_NONE;
     doc->nodes[idx].extra = 0;
     doc->nodes[idx].val.integer = 0;
+    if (doc->tails) doc->tails[idx] = YYAML_INDEX_NONE;
+    if (doc->str_class) doc->str_class[idx] = 0;
+    if (doc->hashes) doc->hashes[idx] = 0;
+    if (doc->spans) {
+        doc->spans[idx].key = YYAML_INDEX_NONE;
+        doc->spans[idx].dirty = false;
+    }
     if (type == YYAML_BOOL) doc->nodes[idx].val.boolean = false;
     else if (type == YYAML_INT) doc->nodes[idx].val.integer = 0;
     else if (type == YYAML_DOUBLE) doc->nodes[idx].val.real = 0.0;
@@ -104,6 +227,104 @@ static uint32_t yyaml_doc_add_node(yyaml_doc *doc, yyaml_type type) {
     return idx;
 }
 
+/* Record the quoting class of the value (key false) or key string of node
+ * idx so the writer does not have to rescan it. */
+static void yyaml_doc_classify(yyaml_doc *doc, uint32_t idx, bool key,
+                               const char *str, size_t len) {
+    unsigned shift = key ? YYAML_STR_KEY_SHIFT : 0;
+    if (!doc->str_class) return;
+    doc->str_class[idx] = (uint8_t)((doc->str_class[idx] & ~(0xFu << shift)) |
+                                    (yyaml_str_class(str, len) << shift));
+}
+
+/* Classify every string value and key of a freshly parsed document while
+ * its scalar bytes are still warm in cache. */
+static void yyaml_doc_classify_all(yyaml_doc *doc) {
+    size_t i;
+    if (!doc->str_class) return;
+    for (i = 0; i < doc->node_count; i++) {
+        const yyaml_node *node = &doc->nodes[i];
+        if (node->type == YYAML_STRING) {
+            yyaml_doc_classify(doc, (uint32_t)i, false,
+                               doc->scalars + node->val.str.ofs,
+                               node->val.str.len);
+        }
+        if (node->parent != YYAML_INDEX_NONE &&
+            doc->nodes[node->parent].type == YYAML_MAPPING) {
+            yyaml_doc_classify(doc, (uint32_t)i, true,
+                               doc->scalars + node->extra, node->flags);
+        }
+    }
+}
+
+/* Offset of the line break ending the text before pos, i.e. pos with the
+ * trailing line breaks (and blank lines) before it dropped, not below from. */
+static size_t yyaml_source_trim(const char *src, size_t from, size_t pos) {
+    while (pos > from && (src[pos - 1] == '\n' || src[pos - 1] == '\r')) pos--;
+    return pos;
+}
+
+/* Record where a block node parsed from the kept source begins (key) and
+ * where its own text ends (before next, the start of the following line). */
+static void yyaml_doc_note_source(yyaml_doc *doc, uint32_t idx, size_t key,
+                                  size_t next) {
+    if (!doc->spans) return;
+    doc->spans[idx].key = (uint32_t)key;
+    doc->spans[idx].end = (uint32_t)yyaml_source_trim(doc->source, key, next);
+}
+
+/* Complete the spans once the tree is built: the root covers the text up to
+ * stop, an entry extends to the end of its last descendant, and the comment
+ * and blank lines after the previous sibling (or after the parent's own
+ * line) lead into it. Nodes are created parent first, so one reverse pass
+ * propagates the ends. */
+static void yyaml_doc_finish_source(yyaml_doc *doc, size_t stop) {
+    const char *src = doc->source;
+    yyaml_span *spans = doc->spans;
+    size_t i;
+    if (!spans) return;
+    for (i = doc->node_count; i-- > 0;) {
+        uint32_t parent = doc->nodes[i].parent;
+        if (spans[i].key == YYAML_INDEX_NONE || parent == YYAML_INDEX_NONE)
+            continue;
+        if (spans[parent].end < spans[i].end) spans[parent].end = spans[i].end;
+    }
+    spans[doc->root].start = 0;
+    spans[doc->root].key = 0;
+    spans[doc->root].end = (uint32_t)yyaml_source_trim(src, 0, stop);
+    for (i = 0; i < doc->node_count; i++) {
+        const yyaml_node *node = &doc->nodes[i];
+        size_t prev;
+        uint32_t idx;
+        if (!yyaml_is_container(node) || spans[i].key == YYAML_INDEX_NONE)
+            continue;
+        if (i == doc->root) {
+            prev = 0;
+        } else {
+            const char *nl = (const char *)memchr(src + spans[i].key, '\n',
+                                                  stop - spans[i].key);
+            prev = nl ? (size_t)(nl - src) : stop;
+        }
+        for (idx = node->child; idx != YYAML_INDEX_NONE;
+             idx = doc->nodes[idx].next) {
+            yyaml_span *span = &spans[idx];
+            const char *nl;
+            if (span->key == YYAML_INDEX_NONE) {
+                prev = SIZE_MAX;
+                continue;
+            }
+            span->start = span->key;
+            if (i == doc->root && idx == node->child) {
+                span->start = 0;
+            } else if (prev < span->key) {
+                nl = (const char *)memchr(src + prev, '\n', span->key - prev);
+                if (nl) span->start = (uint32_t)(nl - src + 1);
+            }
+            prev = span->end;
+        }
+    }
+}
+
 static bool yyaml_doc_store_string(yyaml_doc *doc, const char *str, size_t len,
                                    uint32_t *out_ofs) {
     size_t need = doc->scalar_len + len + 1;
@@ -126,17 +347,62 @@ static void yyaml_doc_link_child(yyaml_doc *doc, yyaml_level *lvl,
     yyaml_node *parent = &doc->nodes[lvl->container];
     child->parent = lvl->container;
     child->next = YYAML_INDEX_NONE;
+    doc->seq_index_valid = false;
+    doc->compact = false;
     if (lvl->last_child == YYAML_INDEX_NONE) {
         parent->child = child_idx;
     } else {
         doc->nodes[lvl->last_child].next = child_idx;
     }
     lvl->last_child = child_idx;
+    if (doc->tails) doc->tails[lvl->container] = child_idx;
     if (parent->type == YYAML_SEQUENCE || parent->type == YYAML_MAPPING) {
         parent->val.integer++;
     }
 }
 
+/* Allocate the per-container last-child table used by the building API and
+ * seed it from the existing links, so appends never walk sibling chains. */
+static bool yyaml_doc_init_tails(yyaml_doc *doc) {
+    size_t cap = doc->node_cap ? doc->node_cap : 1;
+    size_t i;
+    if (doc->tails) return true;
+    doc->tails = (uint32_t *)malloc(cap * sizeof(uint32_t));
+    if (!doc->tails) return false;
+    for (i = 0; i < doc->node_count; i++) {
+        const yyaml_node *node = &doc->nodes[i];
+        uint32_t last = YYAML_INDEX_NONE;
+        if (yyaml_is_container(node)) {
+            last = node->child;
+            while (last != YYAML_INDEX_NONE &&
+                   doc->nodes[last].next != YYAML_INDEX_NONE) {
+                last = doc->nodes[last].next;
+            }
+        }
+        doc->tails[i] = last;
+    }
+    return true;
+}
+
+/* Mark idx and its ancestors as changed so the writer stops copying their
+ * source text and their digests are recomputed. Ancestors of a dirty node
+ * are dirty already, and a node with a cached digest has cached digests
+ * below it, so both walks stop early. */
+static void yyaml_doc_touch(yyaml_doc *doc, uint32_t idx) {
+    uint32_t up;
+    if (doc->hashes) {
+        for (up = idx; up != YYAML_INDEX_NONE && doc->hashes[up];
+             up = doc->nodes[up].parent) {
+            doc->hashes[up] = 0;
+        }
+    }
+    if (!doc->spans) return;
+    while (idx != YYAML_INDEX_NONE && !doc->spans[idx].dirty) {
+        doc->spans[idx].dirty = true;
+        idx = doc->nodes[idx].parent;
+    }
+}
+
 static bool yyaml_doc_link_last(yyaml_doc *doc, uint32_t parent_idx,
                                 uint32_t child_idx) {
     yyaml_node *parent;
@@ -149,15 +415,24 @@ static bool yyaml_doc_link_last(yyaml_doc *doc, uint32_t parent_idx,
     child = &doc->nodes[child_idx];
     child->parent = parent_idx;
     child->next = YYAML_INDEX_NONE;
-    if (parent->child == YYAML_INDEX_NONE) {
-        parent->child = child_idx;
-        return true;
+    doc->seq_index_valid = false;
+    doc->compact = false;
+    yyaml_doc_touch(doc, parent_idx);
+    if (yyaml_doc_init_tails(doc)) {
+        last = doc->tails[parent_idx];
+        doc->tails[parent_idx] = child_idx;
+    } else {
+        last = parent->child;
+        while (last != YYAML_INDEX_NONE &&
+               doc->nodes[last].next != YYAML_INDEX_NONE) {
+            last = doc->nodes[last].next;
+        }
     }
-    last = parent->child;
-    while (doc->nodes[last].next != YYAML_INDEX_NONE) {
-        last = doc->nodes[last].next;
+    if (last == YYAML_INDEX_NONE) {
+        parent->child = child_idx;
+    } else {
+        doc->nodes[last].next = child_idx;
     }
-    doc->nodes[last].next = child_idx;
     return true;
 }
 
@@ -220,6 +495,12 @@ static bool yyaml_is_flow_mapping(const char *str, size_t len,
     return false;
 }
 
+static bool yyaml_fill_flow_mapping(yyaml_doc *doc, uint32_t map_idx,
+                                    const char *data, size_t len,
+                                    const yyaml_read_opts *cfg,
+                                    yyaml_err *err, size_t line_start,
+                                    size_t line, size_t column);
+
 static bool yyaml_fill_flow_sequence(yyaml_doc *doc, uint32_t seq_idx,
                                      const char *data, size_t len,
                                      const yyaml_read_opts *cfg,
@@ -242,13 +523,17 @@ static bool yyaml_fill_flow_sequence(yyaml_doc *doc, uint32_t seq_idx,
 
         while (pos < len) {
             char c = data[pos];
+            if (in_double && c == '\\' && pos + 1 < len) {
+                pos += 2;
+                continue;
+            }
             if (c == '\'' && !in_double) {
                 in_single = !in_single;
             } else if (c == '"' && !in_single) {
                 in_double = !in_double;
             } else if (!in_single && !in_double) {
-                if (c == '[') bracket_depth++;
-                else if (c == ']') {
+                if (c == '[' || c == '{') bracket_depth++;
+                else if (c == ']' || c == '}') {
                     if (bracket_depth == 0) break;
                     bracket_depth--;
                 } else if (c == ',' && bracket_depth == 0) {
@@ -274,8 +559,7 @@ static bool yyaml_fill_flow_sequence(yyaml_doc *doc, uint32_t seq_idx,
             const char *item_ptr = data + item_start;
             uint32_t child_idx = yyaml_doc_add_node(doc, YYAML_NULL);
             if (child_idx == YYAML_INDEX_NONE) {
-                yyaml_set_error(err, line_start, line, column,
-                                 "out of memory");
+                yyaml_set_failure(err, YYAML_ERR_MEMORY, "out of memory");
                 return false;
             }
 
@@ -291,6 +575,15 @@ static bool yyaml_fill_flow_sequence(yyaml_doc *doc, uint32_t seq_idx,
                                               column)) {
                     return false;
                 }
+            } else if (yyaml_is_flow_mapping(item_ptr, item_len, &inner_start,
+                                             &inner_end)) {
+                doc->nodes[child_idx].type = YYAML_MAPPING;
+                if (!yyaml_fill_flow_mapping(doc, child_idx,
+                                             item_ptr + inner_start,
+                                             inner_end - inner_start, cfg,
+                                             err, line_start, line, column)) {
+                    return false;
+                }
             } else {
                 yyaml_node temp = {0};
                 if (!yyaml_parse_scalar(item_ptr, item_len, doc, &temp, cfg,
@@ -347,6 +640,10 @@ static bool yyaml_fill_flow_mapping(yyaml_doc *doc, uint32_t map_idx,
 
         while (pos < len) {
             char c = data[pos];
+            if (in_d && c == '\\' && pos + 1 < len) {
+                pos += 2;
+                continue;
+            }
             if (c == '\'' && !in_d) in_s = !in_s;
             else if (c == '"' && !in_s) in_d = !in_d;
             else if (!in_s && !in_d) {
@@ -384,6 +681,10 @@ static bool yyaml_fill_flow_mapping(yyaml_doc *doc, uint32_t map_idx,
         bracket_depth = brace_depth = 0;
         while (pos < len) {
             char c = data[pos];
+            if (in_d && c == '\\' && pos + 1 < len) {
+                pos += 2;
+                continue;
+            }
             if (c == '\'' && !in_d) in_s = !in_s;
             else if (c == '"' && !in_s) in_d = !in_d;
             else if (!in_s && !in_d) {
@@ -413,14 +714,12 @@ static bool yyaml_fill_flow_mapping(yyaml_doc *doc, uint32_t map_idx,
             uint32_t key_ofs = 0;
             size_t key_len = key_end - key_start;
             if (idx == YYAML_INDEX_NONE) {
-                yyaml_set_error(err, line_start, line, column,
-                                 "out of memory");
+                yyaml_set_failure(err, YYAML_ERR_MEMORY, "out of memory");
                 return false;
             }
             if (!yyaml_doc_store_string(doc, data + key_start, key_len,
                                         &key_ofs)) {
-                yyaml_set_error(err, line_start, line, column,
-                                 "out of memory");
+                yyaml_set_failure(err, YYAML_ERR_MEMORY, "out of memory");
                 return false;
             }
             doc->nodes[idx].flags = (uint32_t)key_len;
@@ -487,7 +786,7 @@ static bool yyaml_parse_block_scalar(const char *data, size_t len,
     char *buf = (char *)malloc(buf_cap);
 
     if (!buf) {
-        yyaml_set_error(err, start_pos, *line, 1, "out of memory");
+        yyaml_set_failure(err, YYAML_ERR_MEMORY, "out of memory");
         return false;
     }
 
@@ -563,7 +862,7 @@ static bool yyaml_parse_block_scalar(const char *data, size_t len,
         uint32_t ofs;
         if (!yyaml_doc_store_string(doc, buf, buf_len, &ofs)) {
             free(buf);
-            yyaml_set_error(err, start_pos, *line, 1, "out of memory");
+            yyaml_set_failure(err, YYAML_ERR_MEMORY, "out of memory");
             return false;
         }
         node->type = YYAML_STRING;
@@ -671,6 +970,13 @@ static bool yyaml_parse_inf_nan(const char *str, size_t len, double *out,
     return false;
 }
 
+static int yyaml_hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
 static bool yyaml_parse_quoted(const char *str, size_t len, yyaml_doc *doc,
                                uint32_t *out_idx, uint32_t *out_len,
                                yyaml_err *err, size_t pos, size_t line,
@@ -706,6 +1012,19 @@ static bool yyaml_parse_quoted(const char *str, size_t len, yyaml_doc *doc,
                 case 'r': buf[j++] = '\r'; break;
                 case 't': buf[j++] = '\t'; break;
                 case '0': buf[j++] = '\0'; break;
+                case 'x': {
+                    /* \xHH, as emitted by the writer for control bytes */
+                    int hi = i + 2 < len - 1 ? yyaml_hex_digit(str[i + 1]) : -1;
+                    int lo = hi >= 0 ? yyaml_hex_digit(str[i + 2]) : -1;
+                    if (lo < 0) {
+                        yyaml_set_error(err, pos, line, col,
+                                        "invalid escape sequence");
+                        return false;
+                    }
+                    buf[j++] = (char)((hi << 4) | lo);
+                    i += 2;
+                    break;
+                }
                 default:
                     yyaml_set_error(err, pos, line, col, "unsupported escape");
                     return false;
@@ -729,6 +1048,7 @@ static bool yyaml_parse_scalar(const char *str, size_t len, yyaml_doc *doc,
     bool boolean;
     double dbl;
     char *end;
+    char num[64];
     if (!len) {
         node->type = YYAML_NULL;
         return true;
@@ -747,18 +1067,37 @@ static bool yyaml_parse_scalar(const char *str, size_t len, yyaml_doc *doc,
         if (!yyaml_is_num_char((unsigned char)str[i])) break;
     }
     if (i == len && len > 0) {
-        /* number candidate */
+        /* number candidate; strtoll/strtod need a terminated copy since the
+         * input buffer (possibly a file mapping) may end right after it */
+        char *buf = len < sizeof(num) ? num : (char *)malloc(len + 1);
         long long ival;
+        int kind = YYAML_STRING;
+        if (!buf) {
+            yyaml_set_failure(err, YYAML_ERR_MEMORY, "out of memory");
+            return false;
+        }
+        memcpy(buf, str, len);
+        buf[len] = '\0';
         errno = 0;
-        ival = strtoll(str, &end, 10);
-        if (end == str + len && errno != ERANGE) {
+        ival = strtoll(buf, &end, 10);
+        if (end == buf + len && errno != ERANGE) {
+            kind = YYAML_INT;
+        } else {
+            errno = 0;
+            dbl = strtod(buf, &end);
+            /* subnormals report ERANGE too but are exact enough to keep */
+            if (end == buf + len &&
+                (errno != ERANGE || (dbl != 0.0 && !isinf(dbl)))) {
+                kind = YYAML_DOUBLE;
+            }
+        }
+        if (buf != num) free(buf);
+        if (kind == YYAML_INT) {
             node->type = YYAML_INT;
             node->val.integer = ival;
             return true;
         }
-        errno = 0;
-        dbl = strtod(str, &end);
-        if (end == str + len && errno != ERANGE) {
+        if (kind == YYAML_DOUBLE) {
             node->type = YYAML_DOUBLE;
             node->val.real = dbl;
             return true;
@@ -790,7 +1129,8 @@ static bool yyaml_parse_scalar(const char *str, size_t len, yyaml_doc *doc,
 
 /* ------------------------------- parsing --------------------------------- */
 
-static const yyaml_read_opts yyaml_default_opts = {false, false, true, 64};
+static const yyaml_read_opts yyaml_default_opts = {false, false, true, 64,
+                                                    false, false};
 
 YYAML_API yyaml_doc *yyaml_read(const char *data, size_t len,
                                 const yyaml_read_opts *opts,
@@ -802,14 +1142,16 @@ YYAML_API yyaml_doc *yyaml_read(const char *data, size_t len,
     size_t stack_sz = 0;
     yyaml_pending pending = {0};
     size_t last_indent = 0;
+    size_t text_end = len; /* end of the document text for keep_source */
 
     if (!data) {
-        yyaml_set_error(err, 0, 1, 1, "input buffer is null");
+        yyaml_set_failure(err, YYAML_ERR_INVALID, "input buffer is null");
         return NULL;
     }
     doc = (yyaml_doc *)calloc(1, sizeof(*doc));
     if (!doc) return NULL;
     doc->root = YYAML_INDEX_NONE;
+    doc->free_head = YYAML_INDEX_NONE;
 
     /* Pre-reserve buffers based on a lightweight heuristic to minimize
      * reallocations on large inputs. We assume roughly one node per line and
@@ -828,6 +1170,13 @@ YYAML_API yyaml_doc *yyaml_read(const char *data, size_t len,
         yyaml_doc_reserve_nodes(doc, node_hint);
         yyaml_doc_reserve_str(doc, str_hint);
     }
+    if (cfg->keep_source && len < UINT32_MAX) {
+        doc->source = (char *)malloc(len ? len : 1);
+        doc->spans = (yyaml_span *)malloc((doc->node_cap ? doc->node_cap : 1) *
+                                          sizeof(yyaml_span));
+        if (!doc->source || !doc->spans) goto fail_nomem;
+        memcpy(doc->source, data, len);
+    }
 
     while (pos < len) {
         size_t line_start = pos;
@@ -838,6 +1187,8 @@ YYAML_API yyaml_doc *yyaml_read(const char *data, size_t len,
         const char *line_ptr;
         bool has_colon = false;
         bool in_single = false, in_double = false;
+        int flow_depth = 0;
+        bool at_value = true;
         yyaml_level *parent_level = NULL;
         yyaml_node temp_node;
         char ch;
@@ -887,6 +1238,7 @@ YYAML_API yyaml_doc *yyaml_read(const char *data, size_t len,
         }
         content_start = pos;
         while (pos < len && data[pos] != '\n' && data[pos] != '\r') {
+            bool key_colon = false;
             ch = data[pos];
             if (in_double && ch == '\\' && pos + 1 < len &&
                 data[pos + 1] != '\n' && data[pos + 1] != '\r') {
@@ -897,13 +1249,23 @@ YYAML_API yyaml_doc *yyaml_read(const char *data, size_t len,
             if (ch == '\'' && !in_double) in_single = !in_single;
             else if (ch == '"' && !in_single) in_double = !in_double;
             else if (ch == '#' && !in_single && !in_double) break;
-            else if (ch == ':' && !in_single && !in_double) {
+            else if ((ch == '[' || ch == '{') && !in_single && !in_double &&
+                     (flow_depth || at_value)) {
+                /* only a bracket opening a value starts a flow collection;
+                 * one inside a plain scalar such as k[ is just text */
+                flow_depth++;
+            } else if ((ch == ']' || ch == '}') && !in_single && !in_double) {
+                if (flow_depth > 0) flow_depth--;
+            } else if (ch == ':' && !in_single && !in_double && !flow_depth) {
+                /* colons inside a flow collection are its own entries */
                 size_t nxt = pos + 1;
                 if (nxt >= len || data[nxt] == ' ' || data[nxt] == '\t' ||
                     data[nxt] == '\r' || data[nxt] == '\n') {
                     has_colon = true;
+                    key_colon = true;
                 }
             }
+            if (ch != ' ') at_value = key_colon;
             pos++;
             col++;
         }
@@ -916,7 +1278,10 @@ YYAML_API yyaml_doc *yyaml_read(const char *data, size_t len,
         if (yyaml_is_doc_marker(data + content_start,
                                 content_end - content_start, '-')) {
             if (doc->root != YYAML_INDEX_NONE) {
-                if (cfg->allow_trailing_content) break;
+                if (cfg->allow_trailing_content) {
+                    text_end = line_start;
+                    break;
+                }
                 yyaml_set_error(err, line_start, line, indent + 1,
                                 "multiple root nodes");
                 goto fail;
@@ -926,6 +1291,7 @@ YYAML_API yyaml_doc *yyaml_read(const char *data, size_t len,
 
         if (yyaml_is_doc_marker(data + content_start,
                                 content_end - content_start, '.')) {
+            text_end = line_start;
             break;
         }
 
@@ -1058,6 +1424,7 @@ YYAML_API yyaml_doc *yyaml_read(const char *data, size_t len,
                 uint32_t map_idx = yyaml_doc_add_node(doc, YYAML_MAPPING);
                 if (map_idx == YYAML_INDEX_NONE) goto fail_nomem;
                 yyaml_doc_link_child(doc, parent_level, map_idx);
+                yyaml_doc_note_source(doc, map_idx, line_start + indent, pos);
                 map_level.indent = map_child_indent;
                 map_level.container = map_idx;
                 map_level.last_child = YYAML_INDEX_NONE;
@@ -1070,6 +1437,7 @@ YYAML_API yyaml_doc *yyaml_read(const char *data, size_t len,
                 uint32_t idx = yyaml_doc_add_node(doc, YYAML_NULL);
                 if (idx == YYAML_INDEX_NONE) goto fail_nomem;
                 yyaml_doc_link_child(doc, parent_level, idx);
+                yyaml_doc_note_source(doc, idx, line_start + indent, pos);
                 pending.active = true;
                 pending.node = idx;
                 pending.prefer_sequence = false;
@@ -1093,6 +1461,7 @@ YYAML_API yyaml_doc *yyaml_read(const char *data, size_t len,
                     doc->nodes[idx] = block_node;
                     doc->nodes[idx].doc = doc;
                     yyaml_doc_link_child(doc, parent_level, idx);
+                    yyaml_doc_note_source(doc, idx, line_start + indent, pos);
                     col = 1;
                     continue;
                     }
@@ -1142,6 +1511,8 @@ YYAML_API yyaml_doc *yyaml_read(const char *data, size_t len,
                         yyaml_doc_link_child(doc, parent_level, idx);
                     }
                 }
+                yyaml_doc_note_source(doc, parent_level->last_child,
+                                      line_start + indent, pos);
                 continue;
             }
 
@@ -1240,6 +1611,7 @@ YYAML_API yyaml_doc *yyaml_read(const char *data, size_t len,
                     }
                 }
                 }
+                yyaml_doc_note_source(doc, idx, key_start, pos);
                 if ((cfg->max_nesting && stack_sz >= cfg->max_nesting) ||
                     stack_sz >= sizeof(stack) / sizeof(stack[0])) {
                     yyaml_set_error(err, line_start, line, indent,
@@ -1400,6 +1772,7 @@ YYAML_API yyaml_doc *yyaml_read(const char *data, size_t len,
 done_value_parse:
                 ;
             }
+            yyaml_doc_note_source(doc, idx, key_start, pos);
             continue;
         }
 
@@ -1410,7 +1783,10 @@ done_value_parse:
             goto fail;
         }
         if (doc->root != YYAML_INDEX_NONE) {
-            if (cfg->allow_trailing_content) break;
+            if (cfg->allow_trailing_content) {
+                text_end = line_start;
+                break;
+            }
             yyaml_set_error(err, line_start, line, indent + 1,
                              "multiple root nodes");
             goto fail;
@@ -1424,6 +1800,36 @@ done_value_parse:
                              "unexpected scalar inside container");
             goto fail;
         }
+        {
+            size_t flow_start = 0;
+            size_t flow_end = 0;
+            size_t value_len = content_end - content_start;
+            bool flow_seq = yyaml_is_flow_sequence(data + content_start,
+                                                   value_len, &flow_start,
+                                                   &flow_end);
+            if (flow_seq || yyaml_is_flow_mapping(data + content_start,
+                                                  value_len, &flow_start,
+                                                  &flow_end)) {
+                /* flow collection as the document root */
+                doc->root = yyaml_doc_add_node(doc, flow_seq ? YYAML_SEQUENCE
+                                                             : YYAML_MAPPING);
+                if (doc->root == YYAML_INDEX_NONE) goto fail_nomem;
+                if (flow_seq ? !yyaml_fill_flow_sequence(doc, doc->root,
+                                                         data + content_start +
+                                                             flow_start,
+                                                         flow_end - flow_start,
+                                                         cfg, err, line_start,
+                                                         line, indent + 1)
+                             : !yyaml_fill_flow_mapping(doc, doc->root,
+                                                        data + content_start +
+                                                            flow_start,
+                                                        flow_end - flow_start,
+                                                        cfg, err, line_start,
+                                                        line, indent + 1))
+                    goto fail;
+                continue;
+            }
+        }
         if (!yyaml_parse_scalar(data + content_start,
                                  content_end - content_start, doc,
                                  &temp_node, cfg, err, line_start, line,
@@ -1439,19 +1845,100 @@ done_value_parse:
         doc->root = yyaml_doc_add_node(doc, YYAML_NULL);
         if (doc->root == YYAML_INDEX_NONE) goto fail_nomem;
     }
+    yyaml_doc_finish_source(doc, text_end);
+    yyaml_doc_classify_all(doc);
+    if (cfg->compact && !yyaml_doc_compact(doc)) goto fail_nomem;
+    /* best effort: without the index yyaml_seq_get walks the links */
+    (void)yyaml_doc_index_sequences(doc);
     return doc;
 
 fail_nomem:
-    yyaml_set_error(err, pos, line, col, "out of memory");
+    yyaml_set_failure(err, YYAML_ERR_MEMORY, "out of memory");
 fail:
     yyaml_doc_free(doc);
     return NULL;
 }
 
+YYAML_API yyaml_doc *yyaml_read_file(const char *path,
+                                     const yyaml_read_opts *opts,
+                                     yyaml_err *err) {
+    yyaml_doc *doc;
+    if (!path) {
+        yyaml_set_failure(err, YYAML_ERR_INVALID, "invalid argument");
+        return NULL;
+    }
+#ifdef YYAML_HAS_POSIX
+    {
+        struct stat st;
+        void *map;
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            yyaml_set_failure(err, YYAML_ERR_IO, "unable to open file");
+            return NULL;
+        }
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            yyaml_set_failure(err, YYAML_ERR_IO, "unable to read file");
+            return NULL;
+        }
+        if (st.st_size == 0) {
+            close(fd);
+            return yyaml_read("", 0, opts, err);
+        }
+        /* parse straight out of the page cache; scalars are still copied
+         * into the document, so the mapping can go once parsing is done */
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            yyaml_set_failure(err, YYAML_ERR_IO, "unable to map file");
+            return NULL;
+        }
+#ifdef MADV_SEQUENTIAL
+        madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+        doc = yyaml_read((const char *)map, (size_t)st.st_size, opts, err);
+        munmap(map, (size_t)st.st_size);
+    }
+#else
+    {
+        char *buf;
+        long size;
+        FILE *fp = fopen(path, "rb");
+        if (!fp) {
+            yyaml_set_failure(err, YYAML_ERR_IO, "unable to open file");
+            return NULL;
+        }
+        if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0 ||
+            fseek(fp, 0, SEEK_SET) != 0) {
+            fclose(fp);
+            yyaml_set_failure(err, YYAML_ERR_IO, "unable to read file");
+            return NULL;
+        }
+        buf = (char *)malloc(size ? (size_t)size : 1);
+        if (!buf) {
+            fclose(fp);
+            yyaml_set_failure(err, YYAML_ERR_MEMORY, "out of memory");
+            return NULL;
+        }
+        if (fread(buf, 1, (size_t)size, fp) != (size_t)size) {
+            free(buf);
+            fclose(fp);
+            yyaml_set_failure(err, YYAML_ERR_IO, "unable to read file");
+            return NULL;
+        }
+        fclose(fp);
+        doc = yyaml_read(buf, (size_t)size, opts, err);
+        free(buf);
+    }
+#endif
+    return doc;
+}
+
 YYAML_API yyaml_doc *yyaml_doc_new(void) {
     yyaml_doc *doc = (yyaml_doc *)calloc(1, sizeof(*doc));
     if (!doc) return NULL;
     doc->root = YYAML_INDEX_NONE;
+    doc->free_head = YYAML_INDEX_NONE;
     return doc;
 }
 
@@ -1459,8 +1946,28 @@ YYAML_API yyaml_doc *yyaml_doc_new(void) {
 
 YYAML_API void yyaml_doc_free(yyaml_doc *doc) {
     if (!doc) return;
-    free(doc->nodes);
-    free(doc->scalars);
+    if (doc->read_only) {
+        /* the document itself lives inside the mapping */
+#ifdef YYAML_HAS_POSIX
+        munmap(doc->mapped, doc->mapped_len);
+#endif
+        return;
+    }
+    if (doc->mapped) {
+#ifdef YYAML_HAS_POSIX
+        munmap(doc->mapped, doc->mapped_len);
+#endif
+    } else {
+        free(doc->nodes);
+        free(doc->scalars);
+        free(doc->subtree);
+    }
+    free(doc->seq_index);
+    free(doc->tails);
+    free(doc->str_class);
+    free(doc->spans);
+    free(doc->hashes);
+    free(doc->source);
     free(doc);
 }
 
@@ -1471,6 +1978,7 @@ YYAML_API const yyaml_node *yyaml_doc_get_root(const yyaml_doc *doc) {
 
 YYAML_API const yyaml_node *yyaml_doc_get(const yyaml_doc *doc, uint32_t idx) {
     if (!doc || idx == YYAML_INDEX_NONE || idx >= doc->node_count) return NULL;
+    if (!doc->nodes[idx].doc) return NULL; /* released slot */
     return &doc->nodes[idx];
 }
 
@@ -1514,6 +2022,44 @@ YYAML_API const yyaml_node *yyaml_map_get(const yyaml_node *map,
     return node;
 }
 
+/* Build the sequence index: the first node_count slots hold, for every
+ * sequence node, the offset of its first element in the element area that
+ * follows. Elements of one sequence are stored back to back so indexed access
+ * is a single lookup. Only built from non-const entry points; readers never
+ * write to the document. */
+static bool yyaml_doc_build_seq_index(yyaml_doc *doc) {
+    size_t count = doc->node_count;
+    size_t pos = 0;
+    size_t i;
+    uint32_t *index;
+    uint32_t *elems;
+    if (doc->seq_index_valid) return true;
+    if (!count || count > SIZE_MAX / (2 * sizeof(uint32_t))) return false;
+    index = (uint32_t *)realloc(doc->seq_index, 2 * count * sizeof(uint32_t));
+    if (!index) return false;
+    doc->seq_index = index;
+    elems = index + count;
+    for (i = 0; i < count; i++) {
+        const yyaml_node *node = &doc->nodes[i];
+        uint32_t idx;
+        if (node->type != YYAML_SEQUENCE) continue;
+        index[i] = (uint32_t)pos;
+        for (idx = node->child; idx != YYAML_INDEX_NONE && pos < count;
+             idx = doc->nodes[idx].next) {
+            elems[pos++] = idx;
+        }
+    }
+    doc->seq_index_valid = true;
+    return true;
+}
+
+YYAML_API bool yyaml_doc_index_sequences(yyaml_doc *doc) {
+    if (!doc) return false;
+    if (doc->compact) return true;
+    if (doc->read_only) return false;
+    return yyaml_doc_build_seq_index(doc);
+}
+
 YYAML_API const yyaml_node *yyaml_seq_get(const yyaml_node *seq,
                                           size_t index) {
     uint32_t idx;
@@ -1521,6 +2067,14 @@ YYAML_API const yyaml_node *yyaml_seq_get(const yyaml_node *seq,
     if (!seq || seq->type != YYAML_SEQUENCE) return NULL;
     doc = seq->doc;
     if (!doc) return NULL;
+    if (index >= (size_t)seq->val.integer) return NULL;
+    if (doc->compact) return &doc->nodes[seq->child + index];
+    if (doc->seq_index_valid) {
+        size_t seq_idx = (size_t)(seq - doc->nodes);
+        idx = doc->seq_index[doc->node_count + doc->seq_index[seq_idx] + index];
+        return &doc->nodes[idx];
+    }
+    /* links changed since the index was built: walk them */
     idx = seq->child;
     while (idx != YYAML_INDEX_NONE && index--) {
         idx = doc->nodes[idx].next;
@@ -1539,454 +2093,4344 @@ YYAML_API size_t yyaml_map_len(const yyaml_node *map) {
     return (size_t)map->val.integer;
 }
 
-/* --------------------------- building API ------------------------------- */
-
-YYAML_API bool yyaml_doc_set_root(yyaml_doc *doc, uint32_t idx) {
-    if (!doc || idx == YYAML_INDEX_NONE || idx >= doc->node_count) return false;
-    doc->root = idx;
-    return true;
+/* Next node after idx in a pre-order walk of the subtree rooted at top, or
+ * YYAML_INDEX_NONE when the walk is done. No stack is needed: descend first,
+ * then climb to the next sibling of the nearest ancestor that has one. */
+static uint32_t yyaml_preorder_next(const yyaml_doc *doc, uint32_t top,
+                                    uint32_t idx) {
+    const yyaml_node *cur = &doc->nodes[idx];
+    if (yyaml_is_container(cur) && cur->child != YYAML_INDEX_NONE) {
+        return cur->child;
+    }
+    while (idx != top && doc->nodes[idx].next == YYAML_INDEX_NONE) {
+        idx = doc->nodes[idx].parent;
+    }
+    return idx == top ? YYAML_INDEX_NONE : doc->nodes[idx].next;
 }
 
-YYAML_API uint32_t yyaml_doc_add_null(yyaml_doc *doc) {
-    if (!doc) return YYAML_INDEX_NONE;
-    return yyaml_doc_add_node(doc, YYAML_NULL);
+YYAML_API size_t yyaml_node_subtree_size(const yyaml_node *node) {
+    const yyaml_doc *doc;
+    size_t count = 0;
+    uint32_t idx;
+    uint32_t top;
+    if (!node) return 0;
+    doc = node->doc;
+    if (!doc) return 0;
+    top = (uint32_t)(node - doc->nodes);
+    if (doc->compact) return doc->subtree[top];
+    for (idx = top; idx != YYAML_INDEX_NONE;
+         idx = yyaml_preorder_next(doc, top, idx)) {
+        count++;
+    }
+    return count;
 }
 
-YYAML_API uint32_t yyaml_doc_add_bool(yyaml_doc *doc, bool value) {
+/* ------------------------------- key order ------------------------------- */
+
+/* A mapping entry in sorted order. prefix holds the first eight key bytes
+ * big-endian, so most comparisons never leave the array. */
+typedef struct {
+    uint64_t prefix;
     uint32_t idx;
-    if (!doc) return YYAML_INDEX_NONE;
-    idx = yyaml_doc_add_node(doc, YYAML_BOOL);
-    if (idx != YYAML_INDEX_NONE) {
-        doc->nodes[idx].val.boolean = value;
+} yyaml_key_ref;
+
+/* Length of the runs insertion-sorted before merging. */
+#define YYAML_SORT_RUN 16
+
+static uint64_t yyaml_key_prefix(const char *key, size_t len) {
+    uint64_t prefix = 0;
+    size_t i;
+    for (i = 0; i < 8; i++) {
+        prefix = (prefix << 8) | (i < len ? (unsigned char)key[i] : 0u);
     }
-    return idx;
+    return prefix;
 }
 
-YYAML_API uint32_t yyaml_doc_add_int(yyaml_doc *doc, int64_t value) {
-    uint32_t idx;
-    if (!doc) return YYAML_INDEX_NONE;
-    idx = yyaml_doc_add_node(doc, YYAML_INT);
-    if (idx != YYAML_INDEX_NONE) {
-        doc->nodes[idx].val.integer = value;
+/* Byte order of the keys of two entries; a key sorts before its extensions. */
+static int yyaml_key_ref_cmp(const yyaml_doc *doc, const char *keys,
+                             const yyaml_key_ref *a, const yyaml_key_ref *b) {
+    const yyaml_node *na;
+    const yyaml_node *nb;
+    int cmp;
+    if (a->prefix != b->prefix) return a->prefix < b->prefix ? -1 : 1;
+    na = &doc->nodes[a->idx];
+    nb = &doc->nodes[b->idx];
+    cmp = memcmp(keys + na->extra, keys + nb->extra,
+                 na->flags < nb->flags ? na->flags : nb->flags);
+    if (cmp) return cmp;
+    return (na->flags > nb->flags) - (na->flags < nb->flags);
+}
+
+/* Stable sort of refs by key: insertion-sorted runs, then bottom-up merges
+ * through tmp (n entries). */
+static void yyaml_key_sort(const yyaml_doc *doc, yyaml_key_ref *refs,
+                           yyaml_key_ref *tmp, size_t n) {
+    const char *keys = yyaml_doc_get_scalar_buf(doc);
+    yyaml_key_ref *src = refs;
+    yyaml_key_ref *dst = tmp;
+    size_t width;
+    size_t lo;
+    if (!keys) keys = "";
+    for (lo = 0; lo < n; lo += YYAML_SORT_RUN) {
+        size_t hi = lo + YYAML_SORT_RUN < n ? lo + YYAML_SORT_RUN : n;
+        size_t i;
+        for (i = lo + 1; i < hi; i++) {
+            yyaml_key_ref cur = refs[i];
+            size_t j = i;
+            while (j > lo && yyaml_key_ref_cmp(doc, keys, &cur, &refs[j - 1]) < 0) {
+                refs[j] = refs[j - 1];
+                j--;
+            }
+            refs[j] = cur;
+        }
     }
-    return idx;
+    for (width = YYAML_SORT_RUN; width < n; width *= 2) {
+        yyaml_key_ref *swap;
+        for (lo = 0; lo < n; lo += 2 * width) {
+            size_t mid = lo + width < n ? lo + width : n;
+            size_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+            size_t a = lo;
+            size_t b = mid;
+            size_t k = lo;
+            while (a < mid && b < hi) {
+                dst[k++] = yyaml_key_ref_cmp(doc, keys, &src[b], &src[a]) < 0
+                               ? src[b++]
+                               : src[a++];
+            }
+            while (a < mid) dst[k++] = src[a++];
+            while (b < hi) dst[k++] = src[b++];
+        }
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != refs) memcpy(refs, src, n * sizeof(*refs));
 }
 
-YYAML_API uint32_t yyaml_doc_add_double(yyaml_doc *doc, double value) {
+/* Walks the children of a container in document order or, for a mapping
+ * written with sorted keys, through an index sorted by key (duplicates keep
+ * their order). The nodes themselves are never moved; small mappings are
+ * sorted in place in local. Release with yyaml_child_iter_done. */
+typedef struct {
+    yyaml_key_ref local[YYAML_SORT_RUN];
+    yyaml_key_ref *refs; /* sorted entries, NULL in document order */
+    size_t count;
+    size_t pos;
+    uint32_t next;
+} yyaml_child_iter;
+
+/* False when the sort index cannot be allocated. */
+static bool yyaml_child_iter_init(yyaml_child_iter *it, const yyaml_doc *doc,
+                                  const yyaml_node *node, bool sort) {
+    const char *keys;
+    size_t n;
     uint32_t idx;
-    if (!doc) return YYAML_INDEX_NONE;
-    idx = yyaml_doc_add_node(doc, YYAML_DOUBLE);
-    if (idx != YYAML_INDEX_NONE) {
-        doc->nodes[idx].val.real = value;
+    it->refs = NULL;
+    it->count = 0;
+    it->pos = 0;
+    it->next = node->child;
+    if (!sort || node->type != YYAML_MAPPING || node->child == YYAML_INDEX_NONE ||
+        doc->nodes[node->child].next == YYAML_INDEX_NONE)
+        return true;
+    keys = yyaml_doc_get_scalar_buf(doc);
+    if (!keys) keys = "";
+    n = (size_t)node->val.integer;
+    it->refs = n <= YYAML_SORT_RUN
+                   ? it->local
+                   : (yyaml_key_ref *)malloc(2 * n * sizeof(yyaml_key_ref));
+    if (!it->refs) return false;
+    for (idx = node->child; idx != YYAML_INDEX_NONE && it->count < n;
+         idx = doc->nodes[idx].next) {
+        const yyaml_node *child = &doc->nodes[idx];
+        it->refs[it->count].prefix = yyaml_key_prefix(keys + child->extra,
+                                                      child->flags);
+        it->refs[it->count++].idx = idx;
     }
-    return idx;
+    yyaml_key_sort(doc, it->refs, it->refs + n, it->count);
+    return true;
 }
 
-YYAML_API uint32_t yyaml_doc_add_string(yyaml_doc *doc, const char *str,
-                                        size_t len) {
+static uint32_t yyaml_child_iter_next(yyaml_child_iter *it,
+                                      const yyaml_doc *doc) {
     uint32_t idx;
-    uint32_t ofs = 0;
-    if (!doc || !str) return YYAML_INDEX_NONE;
-    idx = yyaml_doc_add_node(doc, YYAML_STRING);
-    if (idx == YYAML_INDEX_NONE) return YYAML_INDEX_NONE;
-    if (!yyaml_doc_store_string(doc, str, len, &ofs)) return YYAML_INDEX_NONE;
-    doc->nodes[idx].val.str.ofs = ofs;
-    doc->nodes[idx].val.str.len = (uint32_t)len;
+    if (it->refs) {
+        return it->pos < it->count ? it->refs[it->pos++].idx : YYAML_INDEX_NONE;
+    }
+    idx = it->next;
+    if (idx != YYAML_INDEX_NONE) it->next = doc->nodes[idx].next;
     return idx;
 }
 
-YYAML_API uint32_t yyaml_doc_add_sequence(yyaml_doc *doc) {
-    uint32_t idx;
-    if (!doc) return YYAML_INDEX_NONE;
-    idx = yyaml_doc_add_node(doc, YYAML_SEQUENCE);
-    if (idx != YYAML_INDEX_NONE) {
-        doc->nodes[idx].val.integer = 0;
+static void yyaml_child_iter_done(yyaml_child_iter *it) {
+    if (it->refs != it->local) free(it->refs);
+}
+
+/* -------------------------------- hashing -------------------------------- */
+
+/* splitmix64 finalizer */
+static uint64_t yyaml_hash_mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+/* Hash of len bytes read as little-endian words, whatever the host order. */
+static uint64_t yyaml_hash_bytes(const char *str, size_t len, uint64_t seed) {
+    const unsigned char *p = (const unsigned char *)str;
+    uint64_t h = yyaml_hash_mix(seed ^ ((uint64_t)len * 0x9e3779b97f4a7c15ull));
+    uint64_t word;
+    size_t i;
+    for (; len >= 8; p += 8, len -= 8) {
+        word = 0;
+        for (i = 0; i < 8; i++) word |= (uint64_t)p[i] << (8 * i);
+        h = yyaml_hash_mix(h ^ word);
     }
-    return idx;
+    word = 0;
+    for (i = 0; i < len; i++) word |= (uint64_t)p[i] << (8 * i);
+    return yyaml_hash_mix(h ^ word);
 }
 
-YYAML_API uint32_t yyaml_doc_add_mapping(yyaml_doc *doc) {
+static uint64_t yyaml_hash_node(const yyaml_doc *doc, const char *scalars,
+                                bool store, const yyaml_node *node);
+
+static uint64_t yyaml_hash_value(const yyaml_doc *doc, const char *scalars,
+                                 bool store, const yyaml_node *node) {
+    uint64_t tag = ((uint64_t)node->type + 1) * 0x9e3779b97f4a7c15ull;
+    uint64_t h = 0;
+    uint64_t bits;
+    double real;
     uint32_t idx;
-    if (!doc) return YYAML_INDEX_NONE;
-    idx = yyaml_doc_add_node(doc, YYAML_MAPPING);
-    if (idx != YYAML_INDEX_NONE) {
-        doc->nodes[idx].val.integer = 0;
+    switch (node->type) {
+    case YYAML_NULL:
+        return yyaml_hash_mix(tag);
+    case YYAML_BOOL:
+        return yyaml_hash_mix(tag ^ (uint64_t)node->val.boolean);
+    case YYAML_INT:
+        return yyaml_hash_mix(yyaml_hash_mix(tag) ^ (uint64_t)node->val.integer);
+    case YYAML_DOUBLE:
+        real = node->val.real;
+        if (real == 0) real = 0.0;
+        if (isnan(real)) bits = 0x7ff8000000000000ull;
+        else memcpy(&bits, &real, sizeof(bits));
+        return yyaml_hash_mix(yyaml_hash_mix(tag) ^ bits);
+    case YYAML_STRING:
+        return yyaml_hash_bytes(scalars + node->val.str.ofs, node->val.str.len,
+                                tag);
+    case YYAML_SEQUENCE:
+        h = yyaml_hash_mix(tag);
+        for (idx = node->child; idx != YYAML_INDEX_NONE;
+             idx = doc->nodes[idx].next) {
+            h = yyaml_hash_mix(h ^ yyaml_hash_node(doc, scalars, store,
+                                                   &doc->nodes[idx]));
+        }
+        return yyaml_hash_mix(h ^ (uint64_t)node->val.integer);
+    case YYAML_MAPPING:
+        /* entries combine by addition, which does not see their order */
+        for (idx = node->child; idx != YYAML_INDEX_NONE;
+             idx = doc->nodes[idx].next) {
+            const yyaml_node *child = &doc->nodes[idx];
+            uint64_t key = yyaml_hash_bytes(scalars + child->extra, child->flags,
+                                            tag);
+            h += yyaml_hash_mix(key ^ yyaml_hash_mix(
+                                          yyaml_hash_node(doc, scalars, store,
+                                                          child) +
+                                          0x9e3779b97f4a7c15ull));
+        }
+        return yyaml_hash_mix(yyaml_hash_mix(tag ^ (uint64_t)node->val.integer) ^ h);
+    default:
+        return 0;
     }
-    return idx;
 }
 
-YYAML_API bool yyaml_doc_seq_append(yyaml_doc *doc, uint32_t seq_idx,
-                                    uint32_t child_idx) {
-    yyaml_node *seq;
-    if (!doc || seq_idx == YYAML_INDEX_NONE || child_idx == YYAML_INDEX_NONE) {
-        return false;
-    }
-    if (seq_idx >= doc->node_count || child_idx >= doc->node_count) {
-        return false;
-    }
-    seq = &doc->nodes[seq_idx];
-    if (seq->type != YYAML_SEQUENCE) return false;
-    if (!yyaml_doc_link_last(doc, seq_idx, child_idx)) return false;
-    seq->val.integer++;
-    return true;
+/* Digest of node, served from the document's cache when it holds one and
+ * stored into it with store. A node's digest covers its subtree but not its
+ * key, which belongs to the parent's digest, so renaming an entry only
+ * invalidates the parent. */
+static uint64_t yyaml_hash_node(const yyaml_doc *doc, const char *scalars,
+                                bool store, const yyaml_node *node) {
+    size_t at = (size_t)(node - doc->nodes);
+    uint64_t h;
+    if (doc->hashes && doc->hashes[at]) return doc->hashes[at];
+    h = yyaml_hash_value(doc, scalars, store, node);
+    h += !h; /* 0 marks a digest not computed yet */
+    if (store) doc->hashes[at] = h;
+    return h;
 }
 
-YYAML_API bool yyaml_doc_map_append(yyaml_doc *doc, uint32_t map_idx,
-                                    const char *key, size_t key_len,
-                                    uint32_t val_idx) {
-    yyaml_node *map;
-    yyaml_node *val;
-    uint32_t key_ofs = 0;
-    if (!doc || !key || map_idx == YYAML_INDEX_NONE || val_idx == YYAML_INDEX_NONE) {
-        return false;
+YYAML_API bool yyaml_doc_cache_hashes(yyaml_doc *doc) {
+    const char *scalars;
+    if (!doc || doc->read_only) return false;
+    if (!doc->hashes) {
+        doc->hashes = (uint64_t *)calloc(doc->node_cap ? doc->node_cap : 1,
+                                         sizeof(uint64_t));
+        if (!doc->hashes) return false;
     }
-    if (map_idx >= doc->node_count || val_idx >= doc->node_count) return false;
-    map = &doc->nodes[map_idx];
-    if (map->type != YYAML_MAPPING) return false;
-    if (!yyaml_doc_store_string(doc, key, key_len, &key_ofs)) return false;
-    if (!yyaml_doc_link_last(doc, map_idx, val_idx)) return false;
-    val = &doc->nodes[val_idx];
-    val->flags = (uint32_t)key_len;
-    val->extra = key_ofs;
-    map->val.integer++;
+    if (doc->root == YYAML_INDEX_NONE) return true;
+    scalars = yyaml_doc_get_scalar_buf(doc);
+    yyaml_hash_node(doc, scalars ? scalars : "", true, &doc->nodes[doc->root]);
     return true;
 }
 
-/* ------------------------------ writing ---------------------------------- */
+/* Reads digests cached by yyaml_doc_cache_hashes but never stores any, so
+ * concurrent readers do not write to the document. */
+YYAML_API uint64_t yyaml_doc_hash(const yyaml_node *node) {
+    const yyaml_doc *doc;
+    const char *scalars;
+    if (!node || !node->doc) return 0;
+    doc = node->doc;
+    scalars = yyaml_doc_get_scalar_buf(doc);
+    return yyaml_hash_node(doc, scalars ? scalars : "", false, node);
+}
 
-typedef struct {
-    char *buf;
-    size_t len;
+/* ------------------------------- equality -------------------------------- */
+
+static bool yyaml_equal_node(const yyaml_node *a, const yyaml_node *b,
+                             bool any_order, bool trust);
+
+static bool yyaml_equal_bytes(const char *a, size_t a_len, const char *b,
+                              size_t b_len) {
+    return a_len == b_len && (!a_len || memcmp(a, b, a_len) == 0);
+}
+
+/* Same key bytes and equal values, for two mapping entries. */
+static bool yyaml_equal_entry(const yyaml_node *a, const yyaml_node *b,
+                              bool any_order, bool trust) {
+    return yyaml_equal_bytes(a->doc->scalars + a->extra, a->flags,
+                             b->doc->scalars + b->extra, b->flags) &&
+           yyaml_equal_node(a, b, any_order, trust);
+}
+
+/* Compare two mappings of the same size entry by entry in key order. Entries
+ * sharing a key are matched in document order. */
+static bool yyaml_equal_sorted(const yyaml_node *a, const yyaml_node *b,
+                               bool trust) {
+    yyaml_child_iter ia;
+    yyaml_child_iter ib;
+    bool ok = true;
+    uint32_t idx_a;
+    uint32_t idx_b;
+    if (!yyaml_child_iter_init(&ia, a->doc, a, true)) return false;
+    if (!yyaml_child_iter_init(&ib, b->doc, b, true)) {
+        yyaml_child_iter_done(&ia);
+        return false;
+    }
+    while (ok && (idx_a = yyaml_child_iter_next(&ia, a->doc)) != YYAML_INDEX_NONE) {
+        idx_b = yyaml_child_iter_next(&ib, b->doc);
+        ok = idx_b != YYAML_INDEX_NONE &&
+             yyaml_equal_entry(&a->doc->nodes[idx_a], &b->doc->nodes[idx_b],
+                               true, trust);
+    }
+    yyaml_child_iter_done(&ia);
+    yyaml_child_iter_done(&ib);
+    return ok;
+}
+
+/* Digest of node cached by yyaml_doc_cache_hashes, 0 when there is none. */
+static uint64_t yyaml_cached_hash(const yyaml_node *node) {
+    const yyaml_doc *doc = node->doc;
+    return doc->hashes ? doc->hashes[node - doc->nodes] : 0;
+}
+
+/* Type-aware comparison that stops at the first difference. Containers whose
+ * cached digests differ are rejected without a walk; with trust, containers
+ * whose cached digests match are accepted without one as well. */
+static bool yyaml_equal_node(const yyaml_node *a, const yyaml_node *b,
+                             bool any_order, bool trust) {
+    const yyaml_doc *da = a->doc;
+    const yyaml_doc *db = b->doc;
+    uint64_t ha;
+    uint64_t hb;
+    uint32_t idx_a;
+    uint32_t idx_b;
+    if (a == b) return true;
+    if (a->type != b->type) return false;
+    switch (a->type) {
+    case YYAML_NULL:
+        return true;
+    case YYAML_BOOL:
+        return a->val.boolean == b->val.boolean;
+    case YYAML_INT:
+        return a->val.integer == b->val.integer;
+    case YYAML_DOUBLE:
+        /* as in the digest: -0.0 equals 0.0 and all NaNs are one value */
+        return a->val.real == b->val.real ||
+               (isnan(a->val.real) && isnan(b->val.real));
+    case YYAML_STRING:
+        return yyaml_equal_bytes(da->scalars + a->val.str.ofs, a->val.str.len,
+                                 db->scalars + b->val.str.ofs, b->val.str.len);
+    case YYAML_SEQUENCE:
+    case YYAML_MAPPING:
+        break;
+    default:
+        return false;
+    }
+    if (a->val.integer != b->val.integer) return false;
+    ha = yyaml_cached_hash(a);
+    hb = yyaml_cached_hash(b);
+    if (ha && hb) {
+        if (ha != hb) return false;
+        if (trust) return true;
+    }
+    if (any_order && a->type == YYAML_MAPPING && a->val.integer > 1)
+        return yyaml_equal_sorted(a, b, trust);
+    idx_a = a->child;
+    idx_b = b->child;
+    while (idx_a != YYAML_INDEX_NONE && idx_b != YYAML_INDEX_NONE) {
+        const yyaml_node *ca = &da->nodes[idx_a];
+        const yyaml_node *cb = &db->nodes[idx_b];
+        if (a->type == YYAML_MAPPING
+                ? !yyaml_equal_entry(ca, cb, any_order, trust)
+                : !yyaml_equal_node(ca, cb, any_order, trust))
+            return false;
+        idx_a = ca->next;
+        idx_b = cb->next;
+    }
+    return idx_a == idx_b;
+}
+
+YYAML_API bool yyaml_node_equal(const yyaml_node *a, const yyaml_node *b,
+                                bool ignore_key_order) {
+    if (!a || !b || !a->doc || !b->doc) return a == b;
+    return yyaml_equal_node(a, b, ignore_key_order, false);
+}
+
+YYAML_API bool yyaml_node_equal_cached(const yyaml_node *a,
+                                       const yyaml_node *b) {
+    if (!a || !b || !a->doc || !b->doc) return a == b;
+    /* the digests do not see key order, so neither does the comparison */
+    return yyaml_equal_node(a, b, true, true);
+}
+
+/* ------------------------------ compaction ------------------------------- */
+
+typedef struct {
+    uint32_t node;  /* new index of the container being expanded */
+    uint32_t cur;   /* next child slot to expand */
+    uint32_t end;   /* one past the last child slot */
+} yyaml_compact_frame;
+
+/* Copy the children of dst[at] (still linked through the old pool) into a
+ * contiguous block at the end of dst and relink them inside the block. When
+ * from is given it records the old index of every placed node. */
+static void yyaml_compact_place_block(const yyaml_node *src, yyaml_node *dst,
+                                      uint32_t *from, uint32_t at,
+                                      size_t *len) {
+    uint32_t idx = dst[at].child;
+    uint32_t first = (uint32_t)*len;
+    while (idx != YYAML_INDEX_NONE) {
+        yyaml_node *out;
+        if (from) from[*len] = idx;
+        out = &dst[(*len)++];
+        *out = src[idx];
+        out->parent = at;
+        out->next = (uint32_t)*len;
+        idx = src[idx].next;
+    }
+    dst[*len - 1].next = YYAML_INDEX_NONE;
+    dst[at].child = first;
+}
+
+YYAML_API bool yyaml_doc_compact(yyaml_doc *doc) {
+    yyaml_node *dst;
+    uint32_t *subtree;
+    uint32_t *from = NULL;
+    uint8_t *str_class = NULL;
+    yyaml_span *spans = NULL;
+    uint64_t *hashes = NULL;
+    yyaml_compact_frame *stack = NULL;
+    size_t stack_sz = 0, stack_cap = 0;
+    size_t len = 0;
+    if (!doc) return false;
+    if (doc->compact) return true;
+    if (doc->read_only) return false;
+    if (doc->root == YYAML_INDEX_NONE || !doc->node_count) return true;
+    if (doc->mapped && !yyaml_doc_own_storage(doc)) return false;
+    dst = (yyaml_node *)malloc(doc->node_count * sizeof(yyaml_node));
+    subtree = (uint32_t *)malloc(doc->node_count * sizeof(uint32_t));
+    if (!dst || !subtree) goto nomem;
+    if (doc->str_class || doc->spans || doc->hashes) {
+        /* per-node side arrays follow the permutation afterwards */
+        from = (uint32_t *)malloc(doc->node_count * sizeof(uint32_t));
+        if (!from) goto nomem;
+        from[len] = doc->root;
+    }
+
+    dst[len] = doc->nodes[doc->root];
+    dst[len].parent = YYAML_INDEX_NONE;
+    dst[len].next = YYAML_INDEX_NONE;
+    len++;
+    /* Depth-first: when a container's block is placed, its children are
+     * expanded one by one before moving past it, so every subtree ends up as
+     * the node itself plus one contiguous range starting at its child. */
+    if (yyaml_is_container(&dst[0]) && dst[0].child != YYAML_INDEX_NONE) {
+        stack_cap = 16;
+        stack = (yyaml_compact_frame *)malloc(stack_cap * sizeof(*stack));
+        if (!stack) goto nomem;
+        yyaml_compact_place_block(doc->nodes, dst, from, 0, &len);
+        stack[0].node = 0;
+        stack[0].cur = dst[0].child;
+        stack[0].end = (uint32_t)len;
+        stack_sz = 1;
+    }
+    subtree[0] = 1;
+    while (stack_sz) {
+        yyaml_compact_frame *top = &stack[stack_sz - 1];
+        uint32_t at;
+        if (top->cur == top->end) {
+            uint32_t node = top->node;
+            subtree[node] = (uint32_t)(1 + len - dst[node].child);
+            stack_sz--;
+            continue;
+        }
+        at = top->cur++;
+        if (!yyaml_is_container(&dst[at]) || dst[at].child == YYAML_INDEX_NONE) {
+            subtree[at] = 1;
+            continue;
+        }
+        if (stack_sz == stack_cap) {
+            yyaml_compact_frame *grown;
+            stack_cap *= 2;
+            grown = (yyaml_compact_frame *)realloc(stack,
+                                                  stack_cap * sizeof(*stack));
+            if (!grown) goto nomem;
+            stack = grown;
+        }
+        yyaml_compact_place_block(doc->nodes, dst, from, at, &len);
+        stack[stack_sz].node = at;
+        stack[stack_sz].cur = dst[at].child;
+        stack[stack_sz].end = (uint32_t)len;
+        stack_sz++;
+    }
+    free(stack);
+    stack = NULL;
+    if (doc->str_class) {
+        size_t i;
+        str_class = (uint8_t *)malloc(len);
+        if (!str_class) goto nomem;
+        for (i = 0; i < len; i++) str_class[i] = doc->str_class[from[i]];
+    }
+    if (doc->spans) {
+        size_t i;
+        spans = (yyaml_span *)malloc(len * sizeof(yyaml_span));
+        if (!spans) goto nomem;
+        for (i = 0; i < len; i++) spans[i] = doc->spans[from[i]];
+    }
+    if (doc->hashes) {
+        size_t i;
+        hashes = (uint64_t *)malloc(len * sizeof(uint64_t));
+        if (!hashes) goto nomem;
+        for (i = 0; i < len; i++) hashes[i] = doc->hashes[from[i]];
+    }
+    free(from);
+
+    free(doc->nodes);
+    free(doc->subtree);
+    free(doc->tails);
+    doc->tails = NULL; /* rebuilt from the new links on the next append */
+    free(doc->str_class);
+    doc->str_class = str_class;
+    free(doc->spans);
+    doc->spans = spans;
+    free(doc->hashes);
+    doc->hashes = hashes;
+    doc->nodes = dst;
+    doc->node_count = len;
+    doc->node_cap = doc->node_count;
+    doc->subtree = subtree;
+    doc->root = 0;
+    doc->compact = true;
+    doc->seq_index_valid = false;
+    doc->free_head = YYAML_INDEX_NONE; /* released slots were not copied */
+    doc->free_count = 0;
+    return true;
+nomem:
+    free(stack);
+    free(dst);
+    free(subtree);
+    free(from);
+    free(str_class);
+    free(spans);
+    free(hashes);
+    return false;
+}
+
+/* --------------------------- building API ------------------------------- */
+
+YYAML_API bool yyaml_doc_set_root(yyaml_doc *doc, uint32_t idx) {
+    if (!doc || doc->read_only) return false;
+    if (idx == YYAML_INDEX_NONE || idx >= doc->node_count) return false;
+    /* only the original root may be written as the whole source */
+    if (idx != doc->root) yyaml_doc_touch(doc, idx);
+    if (idx != 0 && doc->compact) {
+        /* the compacted layout starts at the root */
+        doc->compact = false;
+        if (!doc->mapped) free(doc->subtree);
+        doc->subtree = NULL;
+    }
+    doc->root = idx;
+    return true;
+}
+
+YYAML_API uint32_t yyaml_doc_add_null(yyaml_doc *doc) {
+    if (!doc) return YYAML_INDEX_NONE;
+    return yyaml_doc_add_node(doc, YYAML_NULL);
+}
+
+YYAML_API uint32_t yyaml_doc_add_bool(yyaml_doc *doc, bool value) {
+    uint32_t idx;
+    if (!doc) return YYAML_INDEX_NONE;
+    idx = yyaml_doc_add_node(doc, YYAML_BOOL);
+    if (idx != YYAML_INDEX_NONE) {
+        doc->nodes[idx].val.boolean = value;
+    }
+    return idx;
+}
+
+YYAML_API uint32_t yyaml_doc_add_int(yyaml_doc *doc, int64_t value) {
+    uint32_t idx;
+    if (!doc) return YYAML_INDEX_NONE;
+    idx = yyaml_doc_add_node(doc, YYAML_INT);
+    if (idx != YYAML_INDEX_NONE) {
+        doc->nodes[idx].val.integer = value;
+    }
+    return idx;
+}
+
+YYAML_API uint32_t yyaml_doc_add_double(yyaml_doc *doc, double value) {
+    uint32_t idx;
+    if (!doc) return YYAML_INDEX_NONE;
+    idx = yyaml_doc_add_node(doc, YYAML_DOUBLE);
+    if (idx != YYAML_INDEX_NONE) {
+        doc->nodes[idx].val.real = value;
+    }
+    return idx;
+}
+
+YYAML_API uint32_t yyaml_doc_add_string(yyaml_doc *doc, const char *str,
+                                        size_t len) {
+    uint32_t idx;
+    uint32_t ofs = 0;
+    if (!doc || !str) return YYAML_INDEX_NONE;
+    idx = yyaml_doc_add_node(doc, YYAML_STRING);
+    if (idx == YYAML_INDEX_NONE) return YYAML_INDEX_NONE;
+    if (!yyaml_doc_store_string(doc, str, len, &ofs)) return YYAML_INDEX_NONE;
+    doc->nodes[idx].val.str.ofs = ofs;
+    doc->nodes[idx].val.str.len = (uint32_t)len;
+    yyaml_doc_classify(doc, idx, false, str, len);
+    return idx;
+}
+
+YYAML_API uint32_t yyaml_doc_add_sequence(yyaml_doc *doc) {
+    uint32_t idx;
+    if (!doc) return YYAML_INDEX_NONE;
+    idx = yyaml_doc_add_node(doc, YYAML_SEQUENCE);
+    if (idx != YYAML_INDEX_NONE) {
+        doc->nodes[idx].val.integer = 0;
+    }
+    return idx;
+}
+
+YYAML_API uint32_t yyaml_doc_add_mapping(yyaml_doc *doc) {
+    uint32_t idx;
+    if (!doc) return YYAML_INDEX_NONE;
+    idx = yyaml_doc_add_node(doc, YYAML_MAPPING);
+    if (idx != YYAML_INDEX_NONE) {
+        doc->nodes[idx].val.integer = 0;
+    }
+    return idx;
+}
+
+YYAML_API bool yyaml_doc_seq_append(yyaml_doc *doc, uint32_t seq_idx,
+                                    uint32_t child_idx) {
+    yyaml_node *seq;
+    if (!doc || doc->read_only || seq_idx == YYAML_INDEX_NONE ||
+        child_idx == YYAML_INDEX_NONE) {
+        return false;
+    }
+    if (seq_idx >= doc->node_count || child_idx >= doc->node_count) {
+        return false;
+    }
+    seq = &doc->nodes[seq_idx];
+    if (seq->type != YYAML_SEQUENCE) return false;
+    if (!yyaml_doc_link_last(doc, seq_idx, child_idx)) return false;
+    seq->val.integer++;
+    return true;
+}
+
+YYAML_API bool yyaml_doc_map_append(yyaml_doc *doc, uint32_t map_idx,
+                                    const char *key, size_t key_len,
+                                    uint32_t val_idx) {
+    yyaml_node *map;
+    yyaml_node *val;
+    uint32_t key_ofs = 0;
+    if (!doc || doc->read_only || !key || map_idx == YYAML_INDEX_NONE ||
+        val_idx == YYAML_INDEX_NONE) {
+        return false;
+    }
+    if (map_idx >= doc->node_count || val_idx >= doc->node_count) return false;
+    map = &doc->nodes[map_idx];
+    if (map->type != YYAML_MAPPING) return false;
+    if (!yyaml_doc_store_string(doc, key, key_len, &key_ofs)) return false;
+    if (!yyaml_doc_link_last(doc, map_idx, val_idx)) return false;
+    val = &doc->nodes[val_idx];
+    val->flags = (uint32_t)key_len;
+    val->extra = key_ofs;
+    yyaml_doc_classify(doc, val_idx, true, key, key_len);
+    map->val.integer++;
+    return true;
+}
+
+/* ----------------------------- mutation API ------------------------------ */
+
+/* A node may be attached when it is live, unlinked, not the root, and not an
+ * ancestor of the container it goes into (which would create a cycle). */
+static bool yyaml_doc_can_attach(const yyaml_doc *doc, uint32_t parent_idx,
+                                 uint32_t child_idx) {
+    uint32_t up;
+    if (child_idx >= doc->node_count || !doc->nodes[child_idx].doc) return false;
+    if (doc->nodes[child_idx].parent != YYAML_INDEX_NONE) return false;
+    if (child_idx == doc->root) return false;
+    for (up = parent_idx; up != YYAML_INDEX_NONE; up = doc->nodes[up].parent) {
+        if (up == child_idx) return false;
+    }
+    return true;
+}
+
+/* Release a detached subtree: every node goes onto the free list and the
+ * scalar bytes it referenced are counted as dead. The pending stack is
+ * threaded through the parent field, which released nodes no longer need. */
+static void yyaml_doc_release(yyaml_doc *doc, uint32_t top, bool has_key) {
+    uint32_t pending = top;
+    if (has_key) doc->scalar_dead += (size_t)doc->nodes[top].flags + 1;
+    doc->nodes[top].parent = YYAML_INDEX_NONE;
+    while (pending != YYAML_INDEX_NONE) {
+        uint32_t idx = pending;
+        yyaml_node *node = &doc->nodes[idx];
+        pending = node->parent;
+        if (yyaml_is_container(node)) {
+            uint32_t child = node->child;
+            while (child != YYAML_INDEX_NONE) {
+                yyaml_node *cur = &doc->nodes[child];
+                uint32_t next = cur->next;
+                if (node->type == YYAML_MAPPING) {
+                    doc->scalar_dead += (size_t)cur->flags + 1;
+                }
+                cur->parent = pending;
+                pending = child;
+                child = next;
+            }
+        } else if (node->type == YYAML_STRING) {
+            doc->scalar_dead += (size_t)node->val.str.len + 1;
+        }
+        node->doc = NULL;
+        node->type = YYAML_NULL;
+        node->flags = 0;
+        node->child = YYAML_INDEX_NONE;
+        node->extra = 0;
+        node->val.integer = 0;
+        node->next = doc->free_head;
+        if (doc->tails) doc->tails[idx] = YYAML_INDEX_NONE;
+        doc->free_head = idx;
+        doc->free_count++;
+    }
+}
+
+/* Replace the link to old_idx (preceded by prev, or first when prev is none)
+ * with new_idx, or drop it entirely when new_idx is none. */
+static void yyaml_doc_relink(yyaml_doc *doc, uint32_t parent_idx,
+                             uint32_t prev, uint32_t old_idx,
+                             uint32_t new_idx) {
+    yyaml_node *parent = &doc->nodes[parent_idx];
+    uint32_t next = doc->nodes[old_idx].next;
+    uint32_t link = next;
+    if (new_idx != YYAML_INDEX_NONE) {
+        doc->nodes[new_idx].parent = parent_idx;
+        doc->nodes[new_idx].next = next;
+        link = new_idx;
+    } else {
+        parent->val.integer--;
+    }
+    if (prev == YYAML_INDEX_NONE) parent->child = link;
+    else doc->nodes[prev].next = link;
+    if (doc->tails && doc->tails[parent_idx] == old_idx) {
+        doc->tails[parent_idx] = new_idx != YYAML_INDEX_NONE ? new_idx : prev;
+    }
+    doc->nodes[old_idx].next = YYAML_INDEX_NONE;
+    doc->seq_index_valid = false;
+    doc->compact = false;
+    yyaml_doc_touch(doc, parent_idx);
+}
+
+/* Find the sequence element at pos and its predecessor. */
+static uint32_t yyaml_doc_seq_find(const yyaml_doc *doc, uint32_t seq_idx,
+                                   size_t pos, uint32_t *prev) {
+    uint32_t idx = doc->nodes[seq_idx].child;
+    *prev = YYAML_INDEX_NONE;
+    while (idx != YYAML_INDEX_NONE && pos--) {
+        *prev = idx;
+        idx = doc->nodes[idx].next;
+    }
+    return idx;
+}
+
+YYAML_API bool yyaml_doc_map_remove(yyaml_doc *doc, uint32_t map_idx,
+                                    const char *key, size_t key_len) {
+    uint32_t prev = YYAML_INDEX_NONE;
+    uint32_t idx;
+    bool removed = false;
+    if (!doc || doc->read_only || !key || map_idx >= doc->node_count) return false;
+    if (doc->nodes[map_idx].type != YYAML_MAPPING) return false;
+    idx = doc->nodes[map_idx].child;
+    while (idx != YYAML_INDEX_NONE) {
+        yyaml_node *cur = &doc->nodes[idx];
+        uint32_t next = cur->next;
+        if (cur->flags == key_len &&
+            memcmp(doc->scalars + cur->extra, key, key_len) == 0) {
+            yyaml_doc_relink(doc, map_idx, prev, idx, YYAML_INDEX_NONE);
+            yyaml_doc_release(doc, idx, true);
+            removed = true;
+        } else {
+            prev = idx;
+        }
+        idx = next;
+    }
+    return removed;
+}
+
+YYAML_API bool yyaml_doc_map_set(yyaml_doc *doc, uint32_t map_idx,
+                                 const char *key, size_t key_len,
+                                 uint32_t val_idx) {
+    uint32_t prev = YYAML_INDEX_NONE;
+    uint32_t found = YYAML_INDEX_NONE;
+    uint32_t found_prev = YYAML_INDEX_NONE;
+    uint32_t idx;
+    if (!doc || doc->read_only || !key || map_idx >= doc->node_count) return false;
+    if (doc->nodes[map_idx].type != YYAML_MAPPING) return false;
+    if (!yyaml_doc_can_attach(doc, map_idx, val_idx)) return false;
+    /* the last duplicate wins, matching yyaml_map_get */
+    for (idx = doc->nodes[map_idx].child; idx != YYAML_INDEX_NONE;
+         idx = doc->nodes[idx].next) {
+        const yyaml_node *cur = &doc->nodes[idx];
+        if (cur->flags == key_len &&
+            memcmp(doc->scalars + cur->extra, key, key_len) == 0) {
+            found = idx;
+            found_prev = prev;
+        }
+        prev = idx;
+    }
+    if (found == YYAML_INDEX_NONE) {
+        return yyaml_doc_map_append(doc, map_idx, key, key_len, val_idx);
+    }
+    /* the new value takes over the stored key bytes */
+    doc->nodes[val_idx].flags = doc->nodes[found].flags;
+    doc->nodes[val_idx].extra = doc->nodes[found].extra;
+    if (doc->str_class) {
+        doc->str_class[val_idx] = (uint8_t)((doc->str_class[val_idx] & 0xF) |
+                                            (doc->str_class[found] & 0xF0));
+    }
+    if (doc->spans) {
+        /* keeps the comment lines above the entry, the value is new */
+        doc->spans[val_idx] = doc->spans[found];
+        doc->spans[val_idx].dirty = true;
+    }
+    yyaml_doc_relink(doc, map_idx, found_prev, found, val_idx);
+    yyaml_doc_release(doc, found, false);
+    return true;
+}
+
+YYAML_API bool yyaml_doc_seq_insert(yyaml_doc *doc, uint32_t seq_idx,
+                                    size_t pos, uint32_t child_idx) {
+    yyaml_node *seq;
+    uint32_t prev;
+    uint32_t at;
+    if (!doc || doc->read_only || seq_idx >= doc->node_count) return false;
+    seq = &doc->nodes[seq_idx];
+    if (seq->type != YYAML_SEQUENCE || pos > (size_t)seq->val.integer) {
+        return false;
+    }
+    if (!yyaml_doc_can_attach(doc, seq_idx, child_idx)) return false;
+    if (pos == (size_t)seq->val.integer) {
+        return yyaml_doc_seq_append(doc, seq_idx, child_idx);
+    }
+    at = yyaml_doc_seq_find(doc, seq_idx, pos, &prev);
+    doc->nodes[child_idx].parent = seq_idx;
+    doc->nodes[child_idx].next = at;
+    if (prev == YYAML_INDEX_NONE) seq->child = child_idx;
+    else doc->nodes[prev].next = child_idx;
+    seq->val.integer++;
+    doc->seq_index_valid = false;
+    doc->compact = false;
+    yyaml_doc_touch(doc, seq_idx);
+    return true;
+}
+
+YYAML_API bool yyaml_doc_seq_remove(yyaml_doc *doc, uint32_t seq_idx,
+                                    size_t pos) {
+    uint32_t prev;
+    uint32_t at;
+    if (!doc || doc->read_only || seq_idx >= doc->node_count) return false;
+    if (doc->nodes[seq_idx].type != YYAML_SEQUENCE ||
+        pos >= (size_t)doc->nodes[seq_idx].val.integer) {
+        return false;
+    }
+    at = yyaml_doc_seq_find(doc, seq_idx, pos, &prev);
+    if (at == YYAML_INDEX_NONE) return false;
+    yyaml_doc_relink(doc, seq_idx, prev, at, YYAML_INDEX_NONE);
+    yyaml_doc_release(doc, at, false);
+    return true;
+}
+
+YYAML_API void yyaml_doc_garbage(const yyaml_doc *doc, size_t *free_nodes,
+                                 size_t *dead_bytes) {
+    if (free_nodes) *free_nodes = doc ? doc->free_count : 0;
+    if (dead_bytes) *dead_bytes = doc ? doc->scalar_dead : 0;
+}
+
+YYAML_API bool yyaml_doc_shrink(yyaml_doc *doc) {
+    yyaml_node *nodes;
+    bool ok = true;
+    if (!doc || doc->read_only) return false;
+    /* a valid sequence index is already sized to node_count */
+    if (!doc->seq_index_valid) {
+        free(doc->seq_index);
+        doc->seq_index = NULL;
+    }
+    /* A failed shrinking realloc keeps the old, larger block, so node_cap
+     * can drop to node_count whichever array fails; the others still shrink,
+     * side arrays first and the node pool last. */
+    if (doc->node_count && doc->node_cap > doc->node_count) {
+        if (doc->tails) {
+            uint32_t *tails = (uint32_t *)realloc(
+                doc->tails, doc->node_count * sizeof(uint32_t));
+            if (tails) doc->tails = tails;
+            else ok = false;
+        }
+        if (doc->str_class) {
+            uint8_t *str_class = (uint8_t *)realloc(doc->str_class,
+                                                    doc->node_count);
+            if (str_class) doc->str_class = str_class;
+            else ok = false;
+        }
+        if (doc->spans) {
+            yyaml_span *spans = (yyaml_span *)realloc(
+                doc->spans, doc->node_count * sizeof(yyaml_span));
+            if (spans) doc->spans = spans;
+            else ok = false;
+        }
+        if (doc->hashes) {
+            uint64_t *hashes = (uint64_t *)realloc(
+                doc->hashes, doc->node_count * sizeof(uint64_t));
+            if (hashes) doc->hashes = hashes;
+            else ok = false;
+        }
+        nodes = (yyaml_node *)realloc(doc->nodes,
+                                      doc->node_count * sizeof(yyaml_node));
+        if (nodes) doc->nodes = nodes;
+        else ok = false;
+        doc->node_cap = doc->node_count;
+    }
+    if (doc->scalar_len && doc->scalar_cap > doc->scalar_len) {
+        char *scalars = (char *)realloc(doc->scalars, doc->scalar_len);
+        if (scalars) doc->scalars = scalars;
+        else ok = false;
+        doc->scalar_cap = doc->scalar_len;
+    }
+    return ok;
+}
+
+/* Copy the key and string bytes of every live node into a buffer sized to
+ * exactly what is referenced, dropping dead and orphaned scalar bytes. */
+static bool yyaml_doc_repack_scalars(yyaml_doc *doc) {
+    size_t total = 0, len = 0, i;
+    char *buf;
+    if (doc->mapped && !yyaml_doc_own_storage(doc)) return false;
+    for (i = 0; i < doc->node_count; i++) {
+        const yyaml_node *node = &doc->nodes[i];
+        if (!node->doc) continue;
+        if (node->parent != YYAML_INDEX_NONE &&
+            doc->nodes[node->parent].type == YYAML_MAPPING) {
+            total += (size_t)node->flags + 1;
+        }
+        if (node->type == YYAML_STRING) total += (size_t)node->val.str.len + 1;
+    }
+    if (total == doc->scalar_len) {
+        doc->scalar_dead = 0;
+        return true;
+    }
+    buf = total ? (char *)malloc(total) : NULL;
+    if (total && !buf) return false;
+    for (i = 0; i < doc->node_count; i++) {
+        yyaml_node *node = &doc->nodes[i];
+        if (!node->doc) continue;
+        if (node->parent != YYAML_INDEX_NONE &&
+            doc->nodes[node->parent].type == YYAML_MAPPING) {
+            memcpy(buf + len, doc->scalars + node->extra, (size_t)node->flags + 1);
+            node->extra = (uint32_t)len;
+            len += (size_t)node->flags + 1;
+        }
+        if (node->type == YYAML_STRING) {
+            memcpy(buf + len, doc->scalars + node->val.str.ofs,
+                   (size_t)node->val.str.len + 1);
+            node->val.str.ofs = (uint32_t)len;
+            len += (size_t)node->val.str.len + 1;
+        }
+    }
+    free(doc->scalars);
+    doc->scalars = buf;
+    doc->scalar_len = total;
+    doc->scalar_cap = total;
+    doc->scalar_dead = 0;
+    return true;
+}
+
+YYAML_API bool yyaml_doc_gc(yyaml_doc *doc) {
+    if (!doc || doc->read_only) return false;
+    if (!yyaml_doc_compact(doc)) return false;
+    if (!yyaml_doc_repack_scalars(doc)) return false;
+    return yyaml_doc_shrink(doc);
+}
+
+/* ----------------------------- bulk building ----------------------------- */
+
+/* Append the key and string bytes of src_node to the scalar buffer (already
+ * reserved) and point dst_node at the copies. */
+static void yyaml_import_scalars(yyaml_doc *dst, const yyaml_doc *src,
+                                 const yyaml_node *src_node,
+                                 yyaml_node *dst_node, bool has_key) {
+    if (has_key) {
+        size_t n = (size_t)src_node->flags + 1;
+        memcpy(dst->scalars + dst->scalar_len, src->scalars + src_node->extra, n);
+        dst_node->extra = (uint32_t)dst->scalar_len;
+        dst->scalar_len += n;
+    }
+    if (src_node->type == YYAML_STRING) {
+        size_t n = (size_t)src_node->val.str.len + 1;
+        memcpy(dst->scalars + dst->scalar_len,
+               src->scalars + src_node->val.str.ofs, n);
+        dst_node->val.str.ofs = (uint32_t)dst->scalar_len;
+        dst->scalar_len += n;
+    }
+}
+
+/* Fill the per-node side arrays of dst node to for a copy of src node from:
+ * string classes and digests carry over, source spans do not. */
+static void yyaml_import_side(yyaml_doc *dst, const yyaml_doc *src,
+                               uint32_t to, uint32_t from) {
+    if (dst->str_class) {
+        dst->str_class[to] = src->str_class ? src->str_class[from] : 0;
+    }
+    if (dst->hashes) dst->hashes[to] = src->hashes ? src->hashes[from] : 0;
+    if (dst->spans) {
+        dst->spans[to].key = YYAML_INDEX_NONE;
+        dst->spans[to].dirty = false;
+    }
+}
+
+/* Map an index inside a compacted subtree (top plus the range starting at
+ * first) to its position in the copy starting at base. */
+static uint32_t yyaml_import_rebase(uint32_t idx, uint32_t top, uint32_t first,
+                                    uint32_t base) {
+    if (idx == YYAML_INDEX_NONE) return YYAML_INDEX_NONE;
+    if (idx == top) return base;
+    return base + 1 + (idx - first);
+}
+
+YYAML_API uint32_t yyaml_doc_import(yyaml_doc *dst, const yyaml_node *src_node) {
+    const yyaml_doc *src;
+    uint32_t top, first = YYAML_INDEX_NONE, base, idx;
+    size_t count = 0, bytes = 0, i;
+    bool contiguous;
+    if (!dst || dst->read_only || !src_node || !src_node->doc) {
+        return YYAML_INDEX_NONE;
+    }
+    src = src_node->doc;
+    top = (uint32_t)(src_node - src->nodes);
+    /* on compacted sources the subtree is top plus one contiguous range */
+    contiguous = src->compact;
+    if (contiguous) {
+        count = src->subtree[top];
+        first = src_node->child;
+        if (src_node->type == YYAML_STRING) bytes += (size_t)src_node->val.str.len + 1;
+        for (i = 1; i < count; i++) {
+            const yyaml_node *cur = &src->nodes[first + i - 1];
+            if (src->nodes[cur->parent].type == YYAML_MAPPING) {
+                bytes += (size_t)cur->flags + 1;
+            }
+            if (cur->type == YYAML_STRING) bytes += (size_t)cur->val.str.len + 1;
+        }
+    } else {
+        for (idx = top; idx != YYAML_INDEX_NONE;
+             idx = yyaml_preorder_next(src, top, idx)) {
+            const yyaml_node *cur = &src->nodes[idx];
+            count++;
+            if (idx != top && src->nodes[cur->parent].type == YYAML_MAPPING) {
+                bytes += (size_t)cur->flags + 1;
+            }
+            if (cur->type == YYAML_STRING) bytes += (size_t)cur->val.str.len + 1;
+        }
+    }
+    if (dst->node_count + count >= YYAML_INDEX_NONE) return YYAML_INDEX_NONE;
+    /* grow once; src may be dst, so node pointers are re-read afterwards */
+    if (!yyaml_doc_reserve_nodes(dst, dst->node_count + count)) {
+        return YYAML_INDEX_NONE;
+    }
+    if (!yyaml_doc_reserve_str(dst, dst->scalar_len + bytes)) {
+        return YYAML_INDEX_NONE;
+    }
+    base = (uint32_t)dst->node_count;
+
+    if (contiguous) {
+        dst->nodes[base] = src->nodes[top];
+        if (count > 1) {
+            memcpy(&dst->nodes[base + 1], &src->nodes[first],
+                   (count - 1) * sizeof(yyaml_node));
+        }
+        for (i = 0; i < count; i++) {
+            yyaml_node *out = &dst->nodes[base + i];
+            const yyaml_node *cur = i ? &src->nodes[first + i - 1] : &src->nodes[top];
+            out->doc = dst;
+            out->parent = yyaml_import_rebase(out->parent, top, first, base);
+            out->next = yyaml_import_rebase(out->next, top, first, base);
+            if (yyaml_is_container(out)) {
+                out->child = yyaml_import_rebase(out->child, top, first, base);
+            }
+            yyaml_import_scalars(dst, src, cur, out,
+                                 i && src->nodes[cur->parent].type == YYAML_MAPPING);
+            yyaml_import_side(dst, src, base + (uint32_t)i,
+                              i ? first + (uint32_t)i - 1 : top);
+        }
+    } else {
+        uint32_t parent = YYAML_INDEX_NONE, prev = YYAML_INDEX_NONE;
+        uint32_t len = base;
+        idx = top;
+        for (;;) {
+            const yyaml_node *cur = &src->nodes[idx];
+            yyaml_node *out = &dst->nodes[len];
+            *out = *cur;
+            out->doc = dst;
+            out->parent = parent;
+            out->next = YYAML_INDEX_NONE;
+            out->child = YYAML_INDEX_NONE;
+            if (prev != YYAML_INDEX_NONE) dst->nodes[prev].next = len;
+            else if (parent != YYAML_INDEX_NONE) dst->nodes[parent].child = len;
+            yyaml_import_scalars(dst, src, cur, out,
+                                 parent != YYAML_INDEX_NONE &&
+                                 dst->nodes[parent].type == YYAML_MAPPING);
+            yyaml_import_side(dst, src, len, idx);
+            if (yyaml_is_container(cur) && cur->child != YYAML_INDEX_NONE) {
+                parent = len++;
+                prev = YYAML_INDEX_NONE;
+                idx = cur->child;
+                continue;
+            }
+            /* climb in both trees until a sibling is left to visit */
+            prev = len++;
+            while (idx != top && src->nodes[idx].next == YYAML_INDEX_NONE) {
+                idx = src->nodes[idx].parent;
+                prev = dst->nodes[prev].parent;
+            }
+            if (idx == top) break;
+            idx = src->nodes[idx].next;
+            parent = dst->nodes[prev].parent;
+        }
+    }
+
+    /* the copy is detached and carries no key of its own */
+    dst->nodes[base].parent = YYAML_INDEX_NONE;
+    dst->nodes[base].next = YYAML_INDEX_NONE;
+    dst->nodes[base].flags = 0;
+    dst->nodes[base].extra = 0;
+    if (dst->str_class) dst->str_class[base] &= 0xF;
+    dst->node_count += count;
+    if (dst->tails) {
+        for (i = base; i < dst->node_count; i++) {
+            const yyaml_node *out = &dst->nodes[i];
+            dst->tails[i] = YYAML_INDEX_NONE;
+            if (out->parent != YYAML_INDEX_NONE && out->next == YYAML_INDEX_NONE) {
+                dst->tails[out->parent] = (uint32_t)i;
+            }
+        }
+    }
+    dst->seq_index_valid = false;
+    dst->compact = false;
+    return base;
+}
+
+/* Create a sequence node immediately followed by n element nodes of the given
+ * type, already linked in order. Payloads are zeroed for the caller to fill;
+ * node storage is reserved once for the whole batch. */
+static uint32_t yyaml_doc_add_array(yyaml_doc *doc, yyaml_type type, size_t n) {
+    uint32_t seq;
+    uint32_t first;
+    size_t i;
+    if (!doc || doc->read_only) return YYAML_INDEX_NONE;
+    if (n >= (size_t)YYAML_INDEX_NONE - doc->node_count) return YYAML_INDEX_NONE;
+    if (!yyaml_doc_reserve_nodes(doc, doc->node_count + n + 1)) {
+        return YYAML_INDEX_NONE;
+    }
+    seq = yyaml_doc_add_node(doc, YYAML_SEQUENCE);
+    if (seq == YYAML_INDEX_NONE || !n) return seq;
+    first = (uint32_t)doc->node_count;
+    for (i = 0; i < n; i++) {
+        yyaml_node *node = &doc->nodes[first + i];
+        node->doc = doc;
+        node->type = type;
+        node->flags = 0;
+        node->parent = seq;
+        node->next = first + (uint32_t)i + 1;
+        node->child = YYAML_INDEX_NONE;
+        node->extra = 0;
+        node->val.integer = 0;
+    }
+    doc->nodes[first + n - 1].next = YYAML_INDEX_NONE;
+    if (doc->tails) {
+        for (i = 0; i < n; i++) doc->tails[first + i] = YYAML_INDEX_NONE;
+        doc->tails[seq] = first + (uint32_t)n - 1;
+    }
+    if (doc->str_class) memset(doc->str_class + first, 0, n);
+    if (doc->hashes) memset(doc->hashes + first, 0, n * sizeof(uint64_t));
+    if (doc->spans) {
+        for (i = 0; i < n; i++) {
+            doc->spans[first + i].key = YYAML_INDEX_NONE;
+            doc->spans[first + i].dirty = false;
+        }
+    }
+    doc->node_count += n;
+    doc->nodes[seq].child = first;
+    doc->nodes[seq].val.integer = (int64_t)n;
+    return seq;
+}
+
+YYAML_API uint32_t yyaml_doc_add_int_array(yyaml_doc *doc, const int64_t *vals,
+                                           size_t n) {
+    uint32_t seq;
+    yyaml_node *elems;
+    size_t i;
+    if (!vals && n) return YYAML_INDEX_NONE;
+    seq = yyaml_doc_add_array(doc, YYAML_INT, n);
+    if (seq == YYAML_INDEX_NONE || !n) return seq;
+    elems = &doc->nodes[doc->nodes[seq].child];
+    for (i = 0; i < n; i++) elems[i].val.integer = vals[i];
+    return seq;
+}
+
+YYAML_API uint32_t yyaml_doc_add_double_array(yyaml_doc *doc,
+                                              const double *vals, size_t n) {
+    uint32_t seq;
+    yyaml_node *elems;
+    size_t i;
+    if (!vals && n) return YYAML_INDEX_NONE;
+    seq = yyaml_doc_add_array(doc, YYAML_DOUBLE, n);
+    if (seq == YYAML_INDEX_NONE || !n) return seq;
+    elems = &doc->nodes[doc->nodes[seq].child];
+    for (i = 0; i < n; i++) elems[i].val.real = vals[i];
+    return seq;
+}
+
+YYAML_API uint32_t yyaml_doc_add_bool_array(yyaml_doc *doc, const bool *vals,
+                                            size_t n) {
+    uint32_t seq;
+    yyaml_node *elems;
+    size_t i;
+    if (!vals && n) return YYAML_INDEX_NONE;
+    seq = yyaml_doc_add_array(doc, YYAML_BOOL, n);
+    if (seq == YYAML_INDEX_NONE || !n) return seq;
+    elems = &doc->nodes[doc->nodes[seq].child];
+    for (i = 0; i < n; i++) elems[i].val.boolean = vals[i];
+    return seq;
+}
+
+YYAML_API uint32_t yyaml_doc_add_string_array(yyaml_doc *doc,
+                                              const char *const *strs,
+                                              const size_t *lens, size_t n) {
+    uint32_t seq;
+    yyaml_node *elems;
+    size_t total = 0;
+    size_t i;
+    char *out;
+    if (!doc || doc->read_only || (!strs && n)) return YYAML_INDEX_NONE;
+    for (i = 0; i < n; i++) {
+        size_t len;
+        if (!strs[i]) return YYAML_INDEX_NONE;
+        len = lens ? lens[i] : strlen(strs[i]);
+        if (len + 1 > SIZE_MAX - total) return YYAML_INDEX_NONE;
+        total += len + 1;
+    }
+    if (!yyaml_doc_reserve_str(doc, doc->scalar_len + total)) {
+        return YYAML_INDEX_NONE;
+    }
+    seq = yyaml_doc_add_array(doc, YYAML_STRING, n);
+    if (seq == YYAML_INDEX_NONE || !n) return seq;
+    elems = &doc->nodes[doc->nodes[seq].child];
+    out = doc->scalars + doc->scalar_len;
+    for (i = 0; i < n; i++) {
+        size_t len = lens ? lens[i] : strlen(strs[i]);
+        memcpy(out, strs[i], len);
+        out[len] = '\0';
+        elems[i].val.str.ofs = (uint32_t)doc->scalar_len;
+        elems[i].val.str.len = (uint32_t)len;
+        yyaml_doc_classify(doc, doc->nodes[seq].child + (uint32_t)i, false, out,
+                           len);
+        doc->scalar_len += len + 1;
+        out += len + 1;
+    }
+    return seq;
+}
+
+YYAML_API bool yyaml_doc_map_append_n(yyaml_doc *doc, uint32_t map_idx,
+                                      const char *const *keys,
+                                      const size_t *key_lens,
+                                      const uint32_t *val_idxs, size_t n) {
+    yyaml_node *map;
+    size_t total = 0;
+    size_t i;
+    uint32_t last;
+    char *out;
+    if (!doc || doc->read_only || map_idx >= doc->node_count) return false;
+    if (n && (!keys || !val_idxs)) return false;
+    map = &doc->nodes[map_idx];
+    if (map->type != YYAML_MAPPING) return false;
+    /* validate the whole batch before touching any link */
+    for (i = 0; i < n; i++) {
+        size_t len;
+        if (!keys[i] || !yyaml_doc_can_attach(doc, map_idx, val_idxs[i])) {
+            return false;
+        }
+        len = key_lens ? key_lens[i] : strlen(keys[i]);
+        if (len + 1 > SIZE_MAX - total) return false;
+        total += len + 1;
+    }
+    if (!n) return true;
+    if (!yyaml_doc_reserve_str(doc, doc->scalar_len + total)) return false;
+    /* claim every value; one already claimed appears twice in the batch */
+    for (i = 0; i < n; i++) {
+        yyaml_node *val = &doc->nodes[val_idxs[i]];
+        if (val->parent != YYAML_INDEX_NONE) {
+            while (i--) doc->nodes[val_idxs[i]].parent = YYAML_INDEX_NONE;
+            return false;
+        }
+        val->parent = map_idx;
+    }
+    /* nothing below can fail */
+    if (yyaml_doc_init_tails(doc)) {
+        last = doc->tails[map_idx];
+    } else {
+        last = map->child;
+        while (last != YYAML_INDEX_NONE &&
+               doc->nodes[last].next != YYAML_INDEX_NONE) {
+            last = doc->nodes[last].next;
+        }
+    }
+    out = doc->scalars + doc->scalar_len;
+    for (i = 0; i < n; i++) {
+        size_t len = key_lens ? key_lens[i] : strlen(keys[i]);
+        uint32_t idx = val_idxs[i];
+        yyaml_node *val = &doc->nodes[idx];
+        memcpy(out, keys[i], len);
+        out[len] = '\0';
+        val->flags = (uint32_t)len;
+        val->extra = (uint32_t)doc->scalar_len;
+        yyaml_doc_classify(doc, idx, true, out, len);
+        val->next = YYAML_INDEX_NONE;
+        if (last == YYAML_INDEX_NONE) map->child = idx;
+        else doc->nodes[last].next = idx;
+        last = idx;
+        doc->scalar_len += len + 1;
+        out += len + 1;
+    }
+    if (doc->tails) doc->tails[map_idx] = last;
+    map->val.integer += (int64_t)n;
+    doc->seq_index_valid = false;
+    doc->compact = false;
+    yyaml_doc_touch(doc, map_idx);
+    return true;
+}
+
+/* --------------------------- binary snapshots ---------------------------- */
+
+/*
+ * Snapshot layout: header, node pool, scalar bytes, then the subtree sizes of
+ * compacted documents. Sections start on 8-byte boundaries so the file can be
+ * mapped and used in place. Nodes are stored as they sit in memory with the
+ * doc back-pointer zeroed; the loader restores it in a single linear pass that
+ * also bounds-checks every link.
+ */
+#define YYAML_BIN_MAGIC "YYAMLBIN"
+#define YYAML_BIN_VERSION 1u
+#define YYAML_BIN_ENDIAN 0x01020304u
+#define YYAML_BIN_COMPACT 1u
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;      /* YYAML_BIN_ENDIAN in the producer's byte order */
+    uint32_t node_size;   /* sizeof(yyaml_node) of the producer */
+    uint32_t flags;       /* YYAML_BIN_COMPACT when subtree sizes follow */
+    uint32_t root;
+    uint32_t free_head;
+    uint64_t node_count;
+    uint64_t free_count;
+    uint64_t scalar_len;
+    uint64_t scalar_dead;
+    uint64_t nodes_ofs;
+    uint64_t scalars_ofs;
+    uint64_t subtree_ofs; /* 0 when the document was not compacted */
+} yyaml_bin_header;
+
+static uint64_t yyaml_bin_align(uint64_t ofs) {
+    return (ofs + 7u) & ~(uint64_t)7u;
+}
+
+static bool yyaml_bin_pad(FILE *fp, uint64_t from, uint64_t to) {
+    static const char zeros[8] = {0};
+    return from == to || fwrite(zeros, 1, (size_t)(to - from), fp) == to - from;
+}
+
+/* Move nodes, scalars and subtree sizes out of the snapshot mapping into
+ * heap buffers so they can be reallocated and freed normally. */
+static bool yyaml_doc_own_storage(yyaml_doc *doc) {
+    yyaml_node *nodes = NULL;
+    char *scalars = NULL;
+    uint32_t *subtree = NULL;
+    if (!doc->mapped) return true;
+    if (doc->node_count) {
+        nodes = (yyaml_node *)malloc(doc->node_count * sizeof(yyaml_node));
+        if (!nodes) goto nomem;
+        memcpy(nodes, doc->nodes, doc->node_count * sizeof(yyaml_node));
+    }
+    if (doc->scalar_len) {
+        scalars = (char *)malloc(doc->scalar_len);
+        if (!scalars) goto nomem;
+        memcpy(scalars, doc->scalars, doc->scalar_len);
+    }
+    if (doc->subtree) {
+        subtree = (uint32_t *)malloc(doc->node_count * sizeof(uint32_t));
+        if (!subtree) goto nomem;
+        memcpy(subtree, doc->subtree, doc->node_count * sizeof(uint32_t));
+    }
+#ifdef YYAML_HAS_POSIX
+    munmap(doc->mapped, doc->mapped_len);
+#endif
+    doc->mapped = NULL;
+    doc->mapped_len = 0;
+    doc->nodes = nodes;
+    doc->scalars = scalars;
+    doc->subtree = subtree;
+    return true;
+nomem:
+    free(nodes);
+    free(scalars);
+    return false;
+}
+
+YYAML_API bool yyaml_doc_save_binary(const yyaml_doc *doc, const char *path,
+                                     yyaml_err *err) {
+    yyaml_bin_header hdr;
+    yyaml_node chunk[256];
+    FILE *fp;
+    size_t i;
+    bool ok;
+    if (!doc || !path) {
+        yyaml_set_failure(err, YYAML_ERR_INVALID, "invalid argument");
+        return false;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, YYAML_BIN_MAGIC, sizeof(hdr.magic));
+    hdr.version = YYAML_BIN_VERSION;
+    hdr.endian = YYAML_BIN_ENDIAN;
+    hdr.node_size = (uint32_t)sizeof(yyaml_node);
+    hdr.flags = doc->compact ? YYAML_BIN_COMPACT : 0;
+    hdr.root = doc->root;
+    hdr.free_head = doc->free_head;
+    hdr.node_count = doc->node_count;
+    hdr.free_count = doc->free_count;
+    hdr.scalar_len = doc->scalar_len;
+    hdr.scalar_dead = doc->scalar_dead;
+    hdr.nodes_ofs = yyaml_bin_align(sizeof(hdr));
+    hdr.scalars_ofs = yyaml_bin_align(hdr.nodes_ofs +
+                                      hdr.node_count * sizeof(yyaml_node));
+    if (doc->compact) {
+        hdr.subtree_ofs = yyaml_bin_align(hdr.scalars_ofs + hdr.scalar_len);
+    }
+
+    fp = fopen(path, "wb");
+    if (!fp) {
+        yyaml_set_failure(err, YYAML_ERR_IO, "unable to open file for writing");
+        return false;
+    }
+    ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+         yyaml_bin_pad(fp, sizeof(hdr), hdr.nodes_ofs);
+    for (i = 0; ok && i < doc->node_count; i += 256) {
+        size_t n = doc->node_count - i < 256 ? doc->node_count - i : 256;
+        size_t j;
+        memcpy(chunk, doc->nodes + i, n * sizeof(yyaml_node));
+        for (j = 0; j < n; j++) chunk[j].doc = NULL;
+        ok = fwrite(chunk, sizeof(yyaml_node), n, fp) == n;
+    }
+    ok = ok && yyaml_bin_pad(fp, hdr.nodes_ofs + hdr.node_count * sizeof(yyaml_node),
+                             hdr.scalars_ofs);
+    if (ok && doc->scalar_len) {
+        ok = fwrite(doc->scalars, 1, doc->scalar_len, fp) == doc->scalar_len;
+    }
+    if (ok && doc->compact) {
+        ok = yyaml_bin_pad(fp, hdr.scalars_ofs + hdr.scalar_len, hdr.subtree_ofs) &&
+             fwrite(doc->subtree, sizeof(uint32_t), doc->node_count, fp) ==
+                 doc->node_count;
+    }
+    if (fclose(fp) != 0) ok = false;
+    if (!ok) yyaml_set_failure(err, YYAML_ERR_IO, "failed to write snapshot");
+    return ok;
+}
+
+static bool yyaml_bin_check(const yyaml_bin_header *hdr, uint64_t size) {
+    uint64_t nodes_end, subtree_end;
+    if (memcmp(hdr->magic, YYAML_BIN_MAGIC, sizeof(hdr->magic)) != 0) return false;
+    if (hdr->version != YYAML_BIN_VERSION) return false;
+    if (hdr->endian != YYAML_BIN_ENDIAN) return false;
+    if (hdr->node_size != sizeof(yyaml_node)) return false;
+    if (hdr->node_count >= YYAML_INDEX_NONE) return false;
+    if (hdr->scalar_len > UINT32_MAX) return false;
+    if (hdr->root != YYAML_INDEX_NONE && hdr->root >= hdr->node_count) return false;
+    if (hdr->free_count > hdr->node_count) return false;
+    if (hdr->nodes_ofs < sizeof(*hdr) || hdr->nodes_ofs % 8) return false;
+    nodes_end = hdr->nodes_ofs + hdr->node_count * sizeof(yyaml_node);
+    if (hdr->scalars_ofs < nodes_end || hdr->scalars_ofs > size) return false;
+    if (hdr->scalar_len > size - hdr->scalars_ofs) return false;
+    if (hdr->flags & YYAML_BIN_COMPACT) {
+        if (hdr->subtree_ofs < hdr->scalars_ofs + hdr->scalar_len ||
+            hdr->subtree_ofs % 8) return false;
+        subtree_end = hdr->subtree_ofs + hdr->node_count * sizeof(uint32_t);
+        if (subtree_end > size) return false;
+    }
+    return true;
+}
+
+/* Whether the links and scalar ranges of a loaded node stay inside doc. */
+static bool yyaml_bin_check_node(const yyaml_doc *doc, const yyaml_node *node) {
+    const uint32_t count = (uint32_t)doc->node_count;
+    if (node->type > YYAML_MAPPING) return false;
+    if (node->parent != YYAML_INDEX_NONE) {
+        if (node->parent >= count) return false;
+        if (doc->nodes[node->parent].type == YYAML_MAPPING &&
+            (uint64_t)node->extra + node->flags >= doc->scalar_len) {
+            return false;
+        }
+    }
+    if (node->next != YYAML_INDEX_NONE && node->next >= count) return false;
+    if (yyaml_is_container(node)) {
+        if (node->child != YYAML_INDEX_NONE && node->child >= count) return false;
+        /* compacted lookups index child blocks directly by position */
+        if (node->val.integer < 0 || node->val.integer > (int64_t)count ||
+            (doc->compact && node->child != YYAML_INDEX_NONE &&
+             (uint64_t)node->child + (uint64_t)node->val.integer > count)) {
+            return false;
+        }
+    } else if (node->type == YYAML_STRING &&
+               (uint64_t)node->val.str.ofs + node->val.str.len >=
+                   doc->scalar_len) {
+        return false;
+    }
+    return true;
+}
+
+/* Check that the children of node at form the block starting at *len, as
+ * yyaml_doc_compact places them, and move *len past it. */
+static bool yyaml_bin_check_block(const yyaml_doc *doc, uint32_t at,
+                                  size_t *len) {
+    const yyaml_node *node = &doc->nodes[at];
+    size_t n = (size_t)node->val.integer;
+    size_t i;
+    if (node->child != *len) return false;
+    for (i = 0; i < n; i++) {
+        const yyaml_node *child = &doc->nodes[*len + i];
+        if (child->parent != at ||
+            child->next != (i + 1 < n ? (uint32_t)(*len + i + 1)
+                                      : YYAML_INDEX_NONE)) {
+            return false;
+        }
+    }
+    *len += n;
+    return true;
+}
+
+/* Replay the walk of yyaml_doc_compact over the links of a loaded compacted
+ * document, so its layout is known to hold, and derive the subtree sizes:
+ * stored into subtree, or compared against doc->subtree when subtree is
+ * NULL for images that cannot be patched. Lookups and yyaml_doc_import
+ * index the stored sizes without further checks. */
+static bool yyaml_bin_check_compact(const yyaml_doc *doc, uint32_t *subtree) {
+    yyaml_compact_frame *stack = NULL;
+    size_t stack_sz = 0, stack_cap = 0;
+    size_t len = 1;
+    bool ok = false;
+    if (!doc->node_count) return true;
+    if (doc->root != 0 || doc->nodes[0].parent != YYAML_INDEX_NONE ||
+        doc->nodes[0].next != YYAML_INDEX_NONE) {
+        return false;
+    }
+    if (yyaml_is_container(&doc->nodes[0]) &&
+        doc->nodes[0].child != YYAML_INDEX_NONE) {
+        stack_cap = 16;
+        stack = (yyaml_compact_frame *)malloc(stack_cap * sizeof(*stack));
+        if (!stack || !yyaml_bin_check_block(doc, 0, &len)) goto done;
+        stack[0].node = 0;
+        stack[0].cur = doc->nodes[0].child;
+        stack[0].end = (uint32_t)len;
+        stack_sz = 1;
+    } else if (yyaml_is_container(&doc->nodes[0]) && doc->nodes[0].val.integer) {
+        return false;
+    } else if (subtree) {
+        subtree[0] = 1;
+    } else if (doc->subtree[0] != 1) {
+        return false;
+    }
+    while (stack_sz) {
+        yyaml_compact_frame *top = &stack[stack_sz - 1];
+        const yyaml_node *node;
+        uint32_t at;
+        size_t size;
+        if (top->cur == top->end) {
+            at = top->node;
+            size = 1 + len - doc->nodes[at].child;
+            stack_sz--;
+        } else {
+            at = top->cur++;
+            node = &doc->nodes[at];
+            if (yyaml_is_container(node) && node->child != YYAML_INDEX_NONE) {
+                if (stack_sz == stack_cap) {
+                    yyaml_compact_frame *grown;
+                    stack_cap *= 2;
+                    grown = (yyaml_compact_frame *)realloc(
+                        stack, stack_cap * sizeof(*stack));
+                    if (!grown) goto done;
+                    stack = grown;
+                }
+                if (!yyaml_bin_check_block(doc, at, &len)) goto done;
+                stack[stack_sz].node = at;
+                stack[stack_sz].cur = node->child;
+                stack[stack_sz].end = (uint32_t)len;
+                stack_sz++;
+                continue;
+            }
+            if (yyaml_is_container(node) && node->val.integer) goto done;
+            size = 1;
+        }
+        if (subtree) subtree[at] = (uint32_t)size;
+        else if (doc->subtree[at] != size) goto done;
+    }
+    /* every node belongs to the tree: compaction leaves no free slots */
+    ok = len == doc->node_count;
+done:
+    free(stack);
+    return ok;
+}
+
+/* Walk the links of a loaded document that was not compacted, from its
+ * unattached nodes down: every live node must be reached exactly once,
+ * through the child chain of the node its parent field names, and every
+ * container must count the children it chains. Rules out the cycles and
+ * shared nodes that would send readers and writers around a chain forever
+ * or past its stated length. Released slots are already detached. */
+static bool yyaml_bin_check_tree(const yyaml_doc *doc) {
+    const uint32_t count = (uint32_t)doc->node_count;
+    uint32_t *queue;
+    uint8_t *seen;
+    size_t head = 0, tail = 0;
+    uint32_t i;
+    bool ok = false;
+    if (!count) return true;
+    if (doc->root != YYAML_INDEX_NONE && !doc->nodes[doc->root].doc) return false;
+    queue = (uint32_t *)malloc(count * sizeof(*queue));
+    seen = (uint8_t *)calloc(count, 1);
+    if (!queue || !seen) goto done;
+    for (i = 0; i < count; i++) {
+        /* a released slot is never a child again */
+        if (!doc->nodes[i].doc) {
+            seen[i] = 1;
+        } else if (doc->nodes[i].parent == YYAML_INDEX_NONE) {
+            seen[i] = 1;
+            queue[tail++] = i;
+        }
+    }
+    for (; head < tail; head++) {
+        const uint32_t at = queue[head];
+        const yyaml_node *node = &doc->nodes[at];
+        uint32_t child;
+        int64_t n = 0;
+        if (!yyaml_is_container(node)) continue;
+        for (child = node->child; child != YYAML_INDEX_NONE;
+             child = doc->nodes[child].next) {
+            if (seen[child] || doc->nodes[child].parent != at ||
+                n == node->val.integer) {
+                goto done;
+            }
+            seen[child] = 1;
+            queue[tail++] = child;
+            n++;
+        }
+        if (n != node->val.integer) goto done;
+    }
+    /* a node left over hangs off a parent that does not chain it, or sits
+     * on a cycle of parents */
+    ok = tail == count - doc->free_count;
+done:
+    free(queue);
+    free(seen);
+    return ok;
+}
+
+/* Restore the doc back-pointers and reject out-of-range links and scalar
+ * references, then detach the slots on the free list and check the shape
+ * of the tree. */
+static bool yyaml_bin_fixup(yyaml_doc *doc) {
+    size_t i, steps;
+    uint32_t idx;
+    const uint32_t count = (uint32_t)doc->node_count;
+    for (i = 0; i < doc->node_count; i++) {
+        doc->nodes[i].doc = doc;
+        if (!yyaml_bin_check_node(doc, &doc->nodes[i])) return false;
+    }
+    idx = doc->free_head;
+    for (steps = 0; steps < doc->free_count; steps++) {
+        if (idx >= count || !doc->nodes[idx].doc) return false;
+        doc->nodes[idx].doc = NULL;
+        idx = doc->nodes[idx].next;
+    }
+    if (idx != YYAML_INDEX_NONE) return false;
+    return doc->compact ? yyaml_bin_check_compact(doc, doc->subtree)
+                        : yyaml_bin_check_tree(doc);
+}
+
+YYAML_API yyaml_doc *yyaml_doc_load_binary(const char *path, yyaml_err *err) {
+    yyaml_bin_header hdr;
+    yyaml_doc *doc;
+    uint64_t size;
+    const char *msg = "invalid snapshot";
+    yyaml_err_code code = YYAML_ERR_INVALID;
+    if (!path) {
+        yyaml_set_failure(err, YYAML_ERR_INVALID, "invalid argument");
+        return NULL;
+    }
+    doc = (yyaml_doc *)calloc(1, sizeof(*doc));
+    if (!doc) {
+        yyaml_set_failure(err, YYAML_ERR_MEMORY, "out of memory");
+        return NULL;
+    }
+#ifdef YYAML_HAS_POSIX
+    {
+        struct stat st;
+        char *base;
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            msg = "unable to open file";
+            code = YYAML_ERR_IO;
+            goto fail;
+        }
+        if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(hdr)) {
+            close(fd);
+            goto fail;
+        }
+        size = (uint64_t)st.st_size;
+        /* private writable mapping: the fixup pass and later in-place edits
+         * copy only the pages they touch */
+        base = (char *)mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (base == (char *)MAP_FAILED) {
+            msg = "unable to map file";
+            code = YYAML_ERR_IO;
+            goto fail;
+        }
+        doc->mapped = base;
+        doc->mapped_len = (size_t)size;
+        memcpy(&hdr, base, sizeof(hdr));
+        if (!yyaml_bin_check(&hdr, size)) goto fail;
+        doc->nodes = (yyaml_node *)(base + hdr.nodes_ofs);
+        doc->scalars = hdr.scalar_len ? base + hdr.scalars_ofs : NULL;
+        if (hdr.flags & YYAML_BIN_COMPACT) {
+            doc->subtree = (uint32_t *)(base + hdr.subtree_ofs);
+        }
+    }
+#else
+    {
+        FILE *fp = fopen(path, "rb");
+        long end;
+        bool ok;
+        if (!fp) {
+            msg = "unable to open file";
+            code = YYAML_ERR_IO;
+            goto fail;
+        }
+        ok = fseek(fp, 0, SEEK_END) == 0 && (end = ftell(fp)) >= 0 &&
+             fseek(fp, 0, SEEK_SET) == 0 &&
+             fread(&hdr, sizeof(hdr), 1, fp) == 1;
+        size = ok ? (uint64_t)end : 0;
+        ok = ok && yyaml_bin_check(&hdr, size);
+        if (ok && hdr.node_count) {
+            doc->nodes = (yyaml_node *)malloc((size_t)hdr.node_count *
+                                              sizeof(yyaml_node));
+            ok = doc->nodes &&
+                 fseek(fp, (long)hdr.nodes_ofs, SEEK_SET) == 0 &&
+                 fread(doc->nodes, sizeof(yyaml_node), (size_t)hdr.node_count,
+                       fp) == hdr.node_count;
+        }
+        if (ok && hdr.scalar_len) {
+            doc->scalars = (char *)malloc((size_t)hdr.scalar_len);
+            ok = doc->scalars &&
+                 fseek(fp, (long)hdr.scalars_ofs, SEEK_SET) == 0 &&
+                 fread(doc->scalars, 1, (size_t)hdr.scalar_len, fp) ==
+                     hdr.scalar_len;
+        }
+        if (ok && (hdr.flags & YYAML_BIN_COMPACT) && hdr.node_count) {
+            doc->subtree = (uint32_t *)malloc((size_t)hdr.node_count *
+                                              sizeof(uint32_t));
+            ok = doc->subtree &&
+                 fseek(fp, (long)hdr.subtree_ofs, SEEK_SET) == 0 &&
+                 fread(doc->subtree, sizeof(uint32_t), (size_t)hdr.node_count,
+                       fp) == hdr.node_count;
+        }
+        fclose(fp);
+        if (!ok) goto fail;
+    }
+#endif
+    doc->node_count = (size_t)hdr.node_count;
+    doc->node_cap = doc->node_count;
+    doc->scalar_len = (size_t)hdr.scalar_len;
+    doc->scalar_cap = doc->scalar_len;
+    doc->scalar_dead = (size_t)hdr.scalar_dead;
+    doc->root = hdr.root;
+    doc->free_head = hdr.free_head;
+    doc->free_count = (size_t)hdr.free_count;
+    doc->compact = (hdr.flags & YYAML_BIN_COMPACT) != 0;
+    if (!yyaml_bin_fixup(doc)) goto fail;
+    (void)yyaml_doc_index_sequences(doc);
+    return doc;
+fail:
+    yyaml_set_failure(err, code, msg);
+    yyaml_doc_free(doc);
+    return NULL;
+}
+
+/* --------------------------- shared documents ---------------------------- */
+
+/*
+ * A published image holds the document struct itself followed by its node
+ * pool, scalar bytes and subtree sizes, laid out for the address the
+ * publisher mapped it at. Attaching at that same address needs no fix-ups
+ * and keeps every page shared; otherwise a private mapping is patched like a
+ * binary snapshot.
+ */
+#define YYAML_SHM_MAGIC "YYAMLSHM"
+/* bump whenever the layout of yyaml_doc or yyaml_node changes */
+#define YYAML_SHM_VERSION 2u
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t node_size;   /* sizeof(yyaml_node) of the publisher */
+    uint32_t doc_size;    /* sizeof(yyaml_doc) of the publisher */
+    uint32_t reserved;
+    uint64_t base;        /* address the image was laid out for */
+    uint64_t size;        /* total image length */
+    uint64_t doc_ofs;
+    uint64_t nodes_ofs;
+    uint64_t scalars_ofs;
+    uint64_t subtree_ofs;
+} yyaml_shm_header;
+
+YYAML_API bool yyaml_doc_publish(const yyaml_doc *doc, int fd, yyaml_err *err) {
+#ifdef YYAML_HAS_POSIX
+    yyaml_shm_header hdr;
+    yyaml_doc *tmp = NULL;
+    yyaml_doc *view;
+    const yyaml_doc *src = doc;
+    size_t count, i;
+    char *base;
+    if (!doc || fd < 0) {
+        yyaml_set_failure(err, YYAML_ERR_INVALID, "invalid argument");
+        return false;
+    }
+    /* readers must never build side arrays, so publish the compacted form */
+    if (doc->root != YYAML_INDEX_NONE && !doc->compact) {
+        uint32_t root;
+        tmp = yyaml_doc_new();
+        root = tmp ? yyaml_doc_import(tmp, &doc->nodes[doc->root])
+                   : YYAML_INDEX_NONE;
+        if (root == YYAML_INDEX_NONE || !yyaml_doc_set_root(tmp, root) ||
+            !yyaml_doc_gc(tmp)) {
+            yyaml_doc_free(tmp);
+            yyaml_set_failure(err, YYAML_ERR_MEMORY, "out of memory");
+            return false;
+        }
+        src = tmp;
+    }
+    count = src->root == YYAML_INDEX_NONE ? 0 : src->node_count;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, YYAML_SHM_MAGIC, sizeof(hdr.magic));
+    hdr.version = YYAML_SHM_VERSION;
+    hdr.node_size = (uint32_t)sizeof(yyaml_node);
+    hdr.doc_size = (uint32_t)sizeof(yyaml_doc);
+    hdr.doc_ofs = yyaml_bin_align(sizeof(hdr));
+    hdr.nodes_ofs = yyaml_bin_align(hdr.doc_ofs + sizeof(yyaml_doc));
+    hdr.scalars_ofs = yyaml_bin_align(hdr.nodes_ofs + count * sizeof(yyaml_node));
+    hdr.subtree_ofs = yyaml_bin_align(hdr.scalars_ofs + src->scalar_len);
+    hdr.size = hdr.subtree_ofs + count * sizeof(uint32_t);
+
+    base = MAP_FAILED;
+    if (ftruncate(fd, (off_t)hdr.size) == 0) {
+        base = (char *)mmap(NULL, (size_t)hdr.size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, fd, 0);
+    }
+    if (base == (char *)MAP_FAILED) {
+        yyaml_doc_free(tmp);
+        yyaml_set_failure(err, YYAML_ERR_IO, "unable to map shared memory");
+        return false;
+    }
+    hdr.base = (uint64_t)(uintptr_t)base;
+    memcpy(base, &hdr, sizeof(hdr));
+
+    view = (yyaml_doc *)(base + hdr.doc_ofs);
+    memset(view, 0, sizeof(*view));
+    view->nodes = count ? (yyaml_node *)(base + hdr.nodes_ofs) : NULL;
+    view->node_count = count;
+    view->node_cap = count;
+    view->scalars = src->scalar_len ? base + hdr.scalars_ofs : NULL;
+    view->scalar_len = src->scalar_len;
+    view->scalar_cap = src->scalar_len;
+    view->root = count ? src->root : YYAML_INDEX_NONE;
+    view->subtree = count ? (uint32_t *)(base + hdr.subtree_ofs) : NULL;
+    view->compact = count != 0;
+    view->free_head = YYAML_INDEX_NONE;
+    view->mapped = base;
+    view->mapped_len = (size_t)hdr.size;
+    view->read_only = true;
+    if (count) {
+        memcpy(view->nodes, src->nodes, count * sizeof(yyaml_node));
+        for (i = 0; i < count; i++) view->nodes[i].doc = view;
+        memcpy(view->subtree, src->subtree, count * sizeof(uint32_t));
+    }
+    if (src->scalar_len) memcpy(view->scalars, src->scalars, src->scalar_len);
+    munmap(base, (size_t)hdr.size);
+    yyaml_doc_free(tmp);
+    return true;
+#else
+    (void)doc;
+    (void)fd;
+    yyaml_set_failure(err, YYAML_ERR_INVALID, "shared documents are not supported");
+    return false;
+#endif
+}
+
+#ifdef YYAML_HAS_POSIX
+/* Checks of the published struct shared by both attach paths: a read-only,
+ * compacted document whose arrays fit the regions laid out in hdr. */
+static bool yyaml_shm_check(const yyaml_doc *doc, const yyaml_shm_header *hdr) {
+    size_t count = doc->node_count;
+    if (count > UINT32_MAX ||
+        count > (hdr->scalars_ofs - hdr->nodes_ofs) / sizeof(yyaml_node) ||
+        doc->scalar_len > hdr->subtree_ofs - hdr->scalars_ofs ||
+        count > (hdr->size - hdr->subtree_ofs) / sizeof(uint32_t)) {
+        return false;
+    }
+    if (count ? doc->root >= count : doc->root != YYAML_INDEX_NONE) return false;
+    /* readers must never write: no free slots to chain, and the compacted
+     * layout gives yyaml_seq_get O(1) access without an index */
+    return doc->read_only && !doc->free_count && doc->compact == (count != 0);
+}
+
+/* At the publisher's address the mapping is used as is, so every pointer
+ * it stores must be the one yyaml_doc_publish wrote and every node must
+ * check out without being patched. */
+static bool yyaml_shm_check_in_place(const yyaml_doc *doc, const char *base,
+                                     const yyaml_shm_header *hdr) {
+    size_t count = doc->node_count;
+    size_t i;
+    if (doc->nodes != (count ? (const yyaml_node *)(base + hdr->nodes_ofs) : NULL) ||
+        doc->scalars != (doc->scalar_len ? base + hdr->scalars_ofs : NULL) ||
+        doc->subtree != (count ? (const uint32_t *)(base + hdr->subtree_ofs) : NULL) ||
+        doc->mapped != base || doc->mapped_len != hdr->size || doc->seq_index ||
+        doc->tails || doc->str_class || doc->spans || doc->source ||
+        doc->hashes) {
+        return false;
+    }
+    for (i = 0; i < count; i++) {
+        if (doc->nodes[i].doc != doc ||
+            !yyaml_bin_check_node(doc, &doc->nodes[i])) {
+            return false;
+        }
+    }
+    return yyaml_bin_check_compact(doc, NULL);
+}
+#endif
+
+YYAML_API yyaml_doc *yyaml_doc_attach(int fd, yyaml_err *err) {
+#ifdef YYAML_HAS_POSIX
+    yyaml_shm_header hdr;
+    struct stat st;
+    yyaml_doc *doc;
+    char *want;
+    char *base;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(hdr) ||
+        pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+        memcmp(hdr.magic, YYAML_SHM_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != YYAML_SHM_VERSION ||
+        hdr.node_size != sizeof(yyaml_node) ||
+        hdr.doc_size != sizeof(yyaml_doc) ||
+        hdr.size > (uint64_t)st.st_size || hdr.doc_ofs < sizeof(hdr) ||
+        (hdr.doc_ofs | hdr.nodes_ofs | hdr.scalars_ofs | hdr.subtree_ofs) & 7u ||
+        hdr.nodes_ofs < hdr.doc_ofs ||
+        hdr.nodes_ofs - hdr.doc_ofs < sizeof(yyaml_doc) ||
+        hdr.nodes_ofs > hdr.scalars_ofs || hdr.scalars_ofs > hdr.subtree_ofs ||
+        hdr.subtree_ofs > hdr.size) {
+        yyaml_set_failure(err, YYAML_ERR_INVALID, "invalid shared document");
+        return NULL;
+    }
+    /* at the publisher's address every stored pointer is valid as is */
+    want = (char *)(uintptr_t)hdr.base;
+#ifdef MAP_FIXED_NOREPLACE
+    base = (char *)mmap(want, (size_t)hdr.size, PROT_READ,
+                        MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+#else
+    base = (char *)mmap(want, (size_t)hdr.size, PROT_READ, MAP_SHARED, fd, 0);
+#endif
+    if (base == want) {
+        doc = (yyaml_doc *)(base + hdr.doc_ofs);
+        if (yyaml_shm_check(doc, &hdr) &&
+            yyaml_shm_check_in_place(doc, base, &hdr)) {
+            return doc;
+        }
+        goto invalid;
+    }
+    if (base != (char *)MAP_FAILED) munmap(base, (size_t)hdr.size);
+
+    /* address taken: patch a private copy-on-write mapping instead */
+    base = (char *)mmap(NULL, (size_t)hdr.size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE, fd, 0);
+    if (base == (char *)MAP_FAILED) {
+        yyaml_set_failure(err, YYAML_ERR_IO, "unable to map shared memory");
+        return NULL;
+    }
+    doc = (yyaml_doc *)(base + hdr.doc_ofs);
+    if (!yyaml_shm_check(doc, &hdr)) goto invalid;
+    /* none of the stored pointers is trusted: the arrays are placed from the
+     * header and the side arrays a view never has are cleared */
+    doc->mapped = base;
+    doc->mapped_len = (size_t)hdr.size;
+    doc->nodes = doc->node_count ? (yyaml_node *)(base + hdr.nodes_ofs) : NULL;
+    doc->scalars = doc->scalar_len ? base + hdr.scalars_ofs : NULL;
+    doc->subtree = doc->node_count ? (uint32_t *)(base + hdr.subtree_ofs) : NULL;
+    doc->seq_index = NULL;
+    doc->seq_index_valid = false;
+    doc->tails = NULL;
+    doc->str_class = NULL;
+    doc->spans = NULL;
+    doc->source = NULL;
+    doc->hashes = NULL;
+    if (!yyaml_bin_fixup(doc)) goto invalid;
+    return doc;
+invalid:
+    munmap(base, (size_t)hdr.size);
+    yyaml_set_failure(err, YYAML_ERR_INVALID, "invalid shared document");
+    return NULL;
+#else
+    (void)fd;
+    yyaml_set_failure(err, YYAML_ERR_INVALID, "shared documents are not supported");
+    return NULL;
+#endif
+}
+
+/* ------------------------------ writing ---------------------------------- */
+
+typedef struct {
+    char *buf;
+    size_t len;
     size_t cap;
+    yyaml_write_fn sink; /* streaming output, flushed as the buffer fills */
+    void *ctx;
+    bool sink_failed;
+    bool fixed; /* caller-owned buffer: never reallocated, no terminator slot */
 } yyaml_writer;
 
-static bool yyaml_writer_reserve(yyaml_writer *wr, size_t need) {
-    size_t cap;
-    char *new_buf;
-    if (wr->cap >= need) return true;
-    cap = yyaml_next_capacity(wr->cap, need, 128);
-    if (cap < need) cap = need;
-    new_buf = (char *)realloc(wr->buf, cap);
-    if (!new_buf) return false;
-    wr->buf = new_buf;
-    wr->cap = cap;
+static bool yyaml_writer_flush(yyaml_writer *wr) {
+    if (!wr->len) return true;
+    if (!wr->sink(wr->ctx, wr->buf, wr->len)) {
+        wr->sink_failed = true;
+        return false;
+    }
+    wr->len = 0;
+    return true;
+}
+
+static bool yyaml_writer_reserve(yyaml_writer *wr, size_t need) {
+    size_t cap;
+    char *new_buf;
+    if (wr->cap >= need) return true;
+    if (wr->fixed) return false;
+    cap = yyaml_next_capacity(wr->cap, need, 128);
+    if (cap < need) cap = need;
+    new_buf = (char *)realloc(wr->buf, cap);
+    if (!new_buf) return false;
+    wr->buf = new_buf;
+    wr->cap = cap;
+    return true;
+}
+
+static bool yyaml_writer_ensure(yyaml_writer *wr, size_t extra) {
+    size_t need;
+    if (wr->sink && wr->len + extra >= wr->cap) {
+        /* streaming: hand the staged bytes off instead of growing; larger
+         * pieces are split by the caller, see yyaml_writer_fits */
+        if (!yyaml_writer_flush(wr)) return false;
+        return extra < wr->cap;
+    }
+    if (extra > SIZE_MAX - wr->len - 1) return false;
+    need = wr->len + extra + !wr->fixed; /* reserve space for null terminator */
+    return yyaml_writer_reserve(wr, need);
+}
+
+static bool yyaml_writer_putc(yyaml_writer *wr, char c) {
+    if (!yyaml_writer_ensure(wr, 1)) return false;
+    wr->buf[wr->len++] = c;
+    return true;
+}
+
+static bool yyaml_writer_write(yyaml_writer *wr, const char *str, size_t len) {
+    if (!len) return true;
+    if (wr->sink && len >= wr->cap) {
+        /* too large to stage: pass it straight through */
+        if (!yyaml_writer_flush(wr)) return false;
+        if (!wr->sink(wr->ctx, str, len)) {
+            wr->sink_failed = true;
+            return false;
+        }
+        return true;
+    }
+    if (!yyaml_writer_ensure(wr, len)) return false;
+    memcpy(wr->buf + wr->len, str, len);
+    wr->len += len;
+    return true;
+}
+
+static const char yyaml_spaces[64] =
+    "                                                                ";
+
+/* Append pad spaces at out, which must have room for them. */
+static char *yyaml_fill_spaces(char *out, size_t pad) {
+    while (pad > sizeof(yyaml_spaces)) {
+        memcpy(out, yyaml_spaces, sizeof(yyaml_spaces));
+        out += sizeof(yyaml_spaces);
+        pad -= sizeof(yyaml_spaces);
+    }
+    memcpy(out, yyaml_spaces, pad);
+    return out + pad;
+}
+
+/* True when n bytes can be reserved at once. A streaming writer only stages
+ * one buffer, so anything that size or larger goes out in pieces. */
+static bool yyaml_writer_fits(const yyaml_writer *wr, size_t n) {
+    return !wr->sink || n < wr->cap;
+}
+
+/* Append pad spaces one block at a time. */
+static bool yyaml_writer_spaces(yyaml_writer *wr, size_t pad) {
+    while (pad > sizeof(yyaml_spaces)) {
+        if (!yyaml_writer_write(wr, yyaml_spaces, sizeof(yyaml_spaces))) {
+            return false;
+        }
+        pad -= sizeof(yyaml_spaces);
+    }
+    return yyaml_writer_write(wr, yyaml_spaces, pad);
+}
+
+static bool yyaml_writer_indent(yyaml_writer *wr, size_t indent, size_t depth) {
+    size_t total = indent * depth;
+    if (!total) return true;
+    if (!yyaml_writer_fits(wr, total)) return yyaml_writer_spaces(wr, total);
+    if (!yyaml_writer_ensure(wr, total)) return false;
+    yyaml_fill_spaces(wr->buf + wr->len, total);
+    wr->len += total;
+    return true;
+}
+
+/* Start an output line under a single reservation: an optional newline, pad
+ * spaces, then head and tail verbatim (e.g. a plain key and ": "). */
+static bool yyaml_writer_begin_line(yyaml_writer *wr, bool newline, size_t pad,
+                                    const char *head, size_t head_len,
+                                    const char *tail, size_t tail_len) {
+    size_t total = (size_t)newline + pad + head_len + tail_len;
+    char *out;
+    if (!yyaml_writer_fits(wr, total)) {
+        return (!newline || yyaml_writer_putc(wr, '\n')) &&
+               yyaml_writer_spaces(wr, pad) &&
+               yyaml_writer_write(wr, head, head_len) &&
+               yyaml_writer_write(wr, tail, tail_len);
+    }
+    if (!yyaml_writer_ensure(wr, total)) return false;
+    out = wr->buf + wr->len;
+    if (newline) *out++ = '\n';
+    out = yyaml_fill_spaces(out, pad);
+    memcpy(out, head, head_len);
+    memcpy(out + head_len, tail, tail_len);
+    wr->len += total;
+    return true;
+}
+
+static const char yyaml_digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324"
+    "25262728293031323334353637383940414243444546474849"
+    "50515253545556575859606162636465666768697071727374"
+    "75767778798081828384858687888990919293949596979899";
+
+/* Number of decimal digits in v (1 for zero). */
+static uint32_t yyaml_dec_len(uint64_t v) {
+    uint32_t n = 1;
+    for (;;) {
+        if (v < 10) return n;
+        if (v < 100) return n + 1;
+        if (v < 1000) return n + 2;
+        if (v < 10000) return n + 3;
+        v /= 10000;
+        n += 4;
+    }
+}
+
+/* Write the digits of v so that the last one lands just before end, two at a
+ * time from the pair table. Returns the first digit. */
+static char *yyaml_dec_digits(uint64_t v, char *end) {
+    while (v >= 100) {
+        const char *pair = yyaml_digit_pairs + (v % 100) * 2;
+        v /= 100;
+        *--end = pair[1];
+        *--end = pair[0];
+    }
+    if (v >= 10) {
+        *--end = yyaml_digit_pairs[v * 2 + 1];
+        *--end = yyaml_digit_pairs[v * 2];
+    } else {
+        *--end = (char)('0' + v);
+    }
+    return end;
+}
+
+/*
+ * Shortest round-trip double formatting (Ryu, Ulf Adams 2018). The 128-bit
+ * multipliers for 5^i and 2^k / 5^i are rebuilt from every 26th power with
+ * one 64x128-bit multiply plus a 2-bit correction, so only the small tables
+ * below are needed:
+ *   yyaml_pow5_split2[b]     = top 125 bits of 5^(26b)
+ *   yyaml_pow5_inv_split2[b] = floor(2^(bits(5^(26b)) + 124) / 5^(26b)) + 1
+ * with the per-index corrections packed 16 to a word.
+ */
+#define YYAML_D2S_POW5_BITS 125
+#define YYAML_D2S_POW5_INV_BITS 125
+#define YYAML_D2S_TABLE_STEP 26
+
+static const uint64_t yyaml_pow5_table[26] = {
+    1u, 5u, 25u,
+    125u, 625u, 3125u,
+    15625u, 78125u, 390625u,
+    1953125u, 9765625u, 48828125u,
+    244140625u, 1220703125u, 6103515625u,
+    30517578125u, 152587890625u, 762939453125u,
+    3814697265625u, 19073486328125u, 95367431640625u,
+    476837158203125u, 2384185791015625u, 11920928955078125u,
+    59604644775390625u, 298023223876953125u,
+};
+static const uint64_t yyaml_pow5_split2[13][2] = {
+    { 0u, 1152921504606846976u },
+    { 0u, 1490116119384765625u },
+    { 1032610780636961552u, 1925929944387235853u },
+    { 7910200175544436838u, 1244603055572228341u },
+    { 16941905809032713930u, 1608611746708759036u },
+    { 13024893955298202172u, 2079081953128979843u },
+    { 6607496772837067824u, 1343575221513417750u },
+    { 17332926989895652603u, 1736530273035216783u },
+    { 13037379183483547984u, 2244412773384604712u },
+    { 1605989338741628675u, 1450417759929778918u },
+    { 9630225068416591280u, 1874621017369538693u },
+    { 665883850346957067u, 1211445438634777304u },
+    { 14931890668723713708u, 1565756531257009982u },
+};
+static const uint32_t yyaml_pow5_offsets[21] = {
+    0x00000000u, 0x00000000u, 0x00000000u, 0x00000000u,
+    0x40000000u, 0x59695995u, 0x55545555u, 0x56555515u,
+    0x41150504u, 0x40555410u, 0x44555145u, 0x44504540u,
+    0x45555550u, 0x40004000u, 0x96440440u, 0x55565565u,
+    0x54454045u, 0x40154151u, 0x55559155u, 0x51405555u,
+    0x00000105u,
+};
+static const uint64_t yyaml_pow5_inv_split2[13][2] = {
+    { 1u, 2305843009213693952u },
+    { 5955668970331000884u, 1784059615882449851u },
+    { 8982663654677661702u, 1380349269358112757u },
+    { 7286864317269821294u, 2135987035920910082u },
+    { 7005857020398200553u, 1652639921975621497u },
+    { 17965325103354776697u, 1278668206209430417u },
+    { 8928596168509315048u, 1978643211784836272u },
+    { 10075671573058298858u, 1530901034580419511u },
+    { 597001226353042382u, 1184477304306571148u },
+    { 1527430471115325346u, 1832889850782397517u },
+    { 12533209867169019542u, 1418129833677084982u },
+    { 5577825024675947042u, 2194449627517475473u },
+    { 11006974540203867551u, 1697873161311732311u },
+};
+static const uint32_t yyaml_pow5_inv_offsets[19] = {
+    0xaaaa9aa8u, 0x5546aa5au, 0x25555555u, 0x55955859u,
+    0x8a666559u, 0x9a6aaaaau, 0x554459a6u, 0x515a5554u,
+    0x55555544u, 0x68555a96u, 0x555a99a9u, 0xaa654699u,
+    0xa66965a9u, 0x96959554u, 0x56455566u, 0x55965a55u,
+    0xaaa6a855u, 0x4aaaaaaau, 0x00000056u,
+};
+
+static uint64_t yyaml_umul128(uint64_t a, uint64_t b, uint64_t *hi) {
+#if defined(__SIZEOF_INT128__)
+    __extension__ typedef unsigned __int128 yyaml_u128;
+    yyaml_u128 p = (yyaml_u128)a * b;
+    *hi = (uint64_t)(p >> 64);
+    return (uint64_t)p;
+#else
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t p00 = a_lo * b_lo, p01 = a_lo * b_hi;
+    uint64_t p10 = a_hi * b_lo, p11 = a_hi * b_hi;
+    uint64_t mid = (p00 >> 32) + (uint32_t)p10 + (uint32_t)p01;
+    *hi = p11 + (p10 >> 32) + (p01 >> 32) + (mid >> 32);
+    return (mid << 32) | (uint32_t)p00;
+#endif
+}
+
+/* (hi:lo) >> dist for 0 < dist < 64 */
+static uint64_t yyaml_shr128(uint64_t lo, uint64_t hi, uint32_t dist) {
+    return (hi << (64 - dist)) | (lo >> dist);
+}
+
+/* ceil(log2(5^e)) for e > 0, 1 for e == 0 */
+static int32_t yyaml_pow5_bits(int32_t e) {
+    return (int32_t)(((uint32_t)e * 1217359u) >> 19) + 1;
+}
+
+/* floor(log10(2^e)) and floor(log10(5^e)) for 0 <= e <= 1650 */
+static uint32_t yyaml_log10_pow2(int32_t e) {
+    return ((uint32_t)e * 78913u) >> 18;
+}
+
+static uint32_t yyaml_log10_pow5(int32_t e) {
+    return ((uint32_t)e * 732923u) >> 20;
+}
+
+static bool yyaml_multiple_of_pow5(uint64_t value, uint32_t p) {
+    uint32_t count = 0;
+    while (value % 5 == 0) {
+        value /= 5;
+        if (++count >= p) return true;
+    }
+    return count >= p;
+}
+
+static bool yyaml_multiple_of_pow2(uint64_t value, uint32_t p) {
+    return (value & ((1ull << p) - 1)) == 0;
+}
+
+static void yyaml_d2s_mul_table(const uint64_t *mul, uint64_t m,
+                                uint64_t *lo0, uint64_t *sum, uint64_t *hi1) {
+    uint64_t high0, high1;
+    uint64_t low1 = yyaml_umul128(m, mul[1], &high1);
+    *lo0 = yyaml_umul128(m, mul[0], &high0);
+    *sum = high0 + low1;
+    if (*sum < high0) high1++;
+    *hi1 = high1;
+}
+
+static void yyaml_d2s_pow5(uint32_t i, uint64_t out[2]) {
+    uint32_t base = i / YYAML_D2S_TABLE_STEP;
+    uint32_t offset = i - base * YYAML_D2S_TABLE_STEP;
+    const uint64_t *mul = yyaml_pow5_split2[base];
+    uint64_t lo0, sum, hi1;
+    uint32_t delta;
+    if (!offset) {
+        out[0] = mul[0];
+        out[1] = mul[1];
+        return;
+    }
+    yyaml_d2s_mul_table(mul, yyaml_pow5_table[offset], &lo0, &sum, &hi1);
+    delta = (uint32_t)(yyaml_pow5_bits((int32_t)i) -
+                       yyaml_pow5_bits((int32_t)(base * YYAML_D2S_TABLE_STEP)));
+    out[0] = yyaml_shr128(lo0, sum, delta) +
+             ((yyaml_pow5_offsets[i / 16] >> ((i % 16) << 1)) & 3);
+    out[1] = yyaml_shr128(sum, hi1, delta);
+}
+
+static void yyaml_d2s_inv_pow5(uint32_t i, uint64_t out[2]) {
+    uint32_t base = (i + YYAML_D2S_TABLE_STEP - 1) / YYAML_D2S_TABLE_STEP;
+    uint32_t offset = base * YYAML_D2S_TABLE_STEP - i;
+    const uint64_t *mul = yyaml_pow5_inv_split2[base];
+    uint64_t lo0, sum, hi1;
+    uint32_t delta;
+    if (!offset) {
+        out[0] = mul[0];
+        out[1] = mul[1];
+        return;
+    }
+    yyaml_d2s_mul_table(mul, yyaml_pow5_table[offset], &lo0, &sum, &hi1);
+    delta = (uint32_t)(yyaml_pow5_bits((int32_t)(base * YYAML_D2S_TABLE_STEP)) -
+                       yyaml_pow5_bits((int32_t)i));
+    /* corrections are stored biased by one */
+    out[0] = yyaml_shr128(lo0, sum, delta) +
+             ((yyaml_pow5_inv_offsets[i / 16] >> ((i % 16) << 1)) & 3) - 1;
+    out[1] = yyaml_shr128(sum, hi1, delta);
+}
+
+/* (m * mul) >> j for a 128-bit mul and 64 < j < 128 */
+static uint64_t yyaml_d2s_mul_shift(uint64_t m, const uint64_t mul[2], int32_t j) {
+    uint64_t lo0, sum, hi1;
+    yyaml_d2s_mul_table(mul, m, &lo0, &sum, &hi1);
+    (void)lo0;
+    return yyaml_shr128(sum, hi1, (uint32_t)(j - 64));
+}
+
+/* Shortest decimal digits and exponent with value == digits * 10^exp that
+ * reads back as the same double. Finite, non-zero inputs only. */
+static void yyaml_d2s_shortest(uint64_t ieee_mantissa, uint32_t ieee_exponent,
+                               uint64_t *digits, int32_t *exp10) {
+    int32_t e2;
+    uint64_t m2, mv, vr, vp, vm, output;
+    uint32_t mm_shift;
+    int32_t e10;
+    int32_t removed = 0;
+    uint32_t last_removed = 0;
+    bool even, vm_zeros = false, vr_zeros = false;
+    uint64_t mul[2];
+
+    if (ieee_exponent == 0) {
+        e2 = 1 - 1023 - 52 - 2;
+        m2 = ieee_mantissa;
+    } else {
+        e2 = (int32_t)ieee_exponent - 1023 - 52 - 2;
+        m2 = (1ull << 52) | ieee_mantissa;
+    }
+    even = (m2 & 1) == 0;
+    mv = 4 * m2;
+    mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+
+    /* scale the interval [vm, vp] around vr = 4 * m2 * 2^e2 to decimal */
+    if (e2 >= 0) {
+        uint32_t q = yyaml_log10_pow2(e2) - (e2 > 3);
+        int32_t k = YYAML_D2S_POW5_INV_BITS + yyaml_pow5_bits((int32_t)q) - 1;
+        int32_t i = -e2 + (int32_t)q + k;
+        e10 = (int32_t)q;
+        yyaml_d2s_inv_pow5(q, mul);
+        vr = yyaml_d2s_mul_shift(4 * m2, mul, i);
+        vp = yyaml_d2s_mul_shift(4 * m2 + 2, mul, i);
+        vm = yyaml_d2s_mul_shift(4 * m2 - 1 - mm_shift, mul, i);
+        if (q <= 21) {
+            if (mv % 5 == 0) {
+                vr_zeros = yyaml_multiple_of_pow5(mv, q);
+            } else if (even) {
+                vm_zeros = yyaml_multiple_of_pow5(mv - 1 - mm_shift, q);
+            } else {
+                vp -= yyaml_multiple_of_pow5(mv + 2, q);
+            }
+        }
+    } else {
+        uint32_t q = yyaml_log10_pow5(-e2) - (-e2 > 1);
+        int32_t i = -e2 - (int32_t)q;
+        int32_t k = yyaml_pow5_bits(i) - YYAML_D2S_POW5_BITS;
+        int32_t j = (int32_t)q - k;
+        e10 = (int32_t)q + e2;
+        yyaml_d2s_pow5((uint32_t)i, mul);
+        vr = yyaml_d2s_mul_shift(4 * m2, mul, j);
+        vp = yyaml_d2s_mul_shift(4 * m2 + 2, mul, j);
+        vm = yyaml_d2s_mul_shift(4 * m2 - 1 - mm_shift, mul, j);
+        if (q <= 1) {
+            vr_zeros = true;
+            if (even) vm_zeros = mm_shift == 1;
+            else vp--;
+        } else if (q < 63) {
+            vr_zeros = yyaml_multiple_of_pow2(mv, q);
+        }
+    }
+
+    /* drop digits while the interval still holds a shorter number */
+    if (vm_zeros || vr_zeros) {
+        for (;;) {
+            uint64_t vp10 = vp / 10, vm10 = vm / 10;
+            uint32_t vm_mod;
+            if (vp10 <= vm10) break;
+            vm_mod = (uint32_t)(vm - 10 * vm10);
+            vm_zeros &= vm_mod == 0;
+            vr_zeros &= last_removed == 0;
+            last_removed = (uint32_t)(vr % 10);
+            vr /= 10;
+            vp = vp10;
+            vm = vm10;
+            removed++;
+        }
+        if (vm_zeros) {
+            while (vm % 10 == 0) {
+                vr_zeros &= last_removed == 0;
+                last_removed = (uint32_t)(vr % 10);
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+        if (vr_zeros && last_removed == 5 && vr % 2 == 0) {
+            last_removed = 4; /* exactly halfway: round to even */
+        }
+        output = vr + ((vr == vm && (!even || !vm_zeros)) || last_removed >= 5);
+    } else {
+        bool round_up = false;
+        if (vp / 100 > vm / 100) {
+            round_up = vr % 100 >= 50;
+            vr /= 100;
+            vp /= 100;
+            vm /= 100;
+            removed += 2;
+        }
+        for (;;) {
+            uint64_t vp10 = vp / 10, vm10 = vm / 10;
+            if (vp10 <= vm10) break;
+            round_up = vr % 10 >= 5;
+            vr /= 10;
+            vp = vp10;
+            vm = vm10;
+            removed++;
+        }
+        output = vr + (vr == vm || round_up);
+    }
+    *digits = output;
+    *exp10 = e10 + removed;
+}
+
+/* Format a finite double like printf("%.17g") would lay it out, but with
+ * the shortest digits that round-trip, plus ".0" for integral values in
+ * fixed notation. Returns the length written to out (at most 32 bytes). */
+static size_t yyaml_format_double(double val, char *out) {
+    uint64_t bits, mantissa, digits;
+    uint32_t exponent;
+    int32_t exp10, sci, ndigits, i;
+    char tmp[20];
+    char *p = out;
+    memcpy(&bits, &val, sizeof(bits));
+    mantissa = bits & ((1ull << 52) - 1);
+    exponent = (uint32_t)((bits >> 52) & 0x7FF);
+    if (bits >> 63) *p++ = '-';
+    if (!exponent && !mantissa) {
+        memcpy(p, "0.0", 3);
+        return (size_t)(p - out) + 3;
+    }
+    if (exponent >= 1023 && exponent <= 1075 &&
+        !(mantissa & ((1ull << (1075 - exponent)) - 1))) {
+        /* integers below 2^53 are exact, only trailing zeros fold */
+        digits = ((1ull << 52) | mantissa) >> (1075 - exponent);
+        exp10 = 0;
+        while (digits % 10 == 0) {
+            digits /= 10;
+            exp10++;
+        }
+    } else {
+        yyaml_d2s_shortest(mantissa, exponent, &digits, &exp10);
+    }
+    ndigits = (int32_t)yyaml_dec_len(digits);
+    yyaml_dec_digits(digits, tmp + ndigits);
+    /* byte loops: a memcpy of the freshly stored digits stalls on
+     * store-to-load forwarding and is measurably slower here */
+    sci = exp10 + ndigits - 1;
+    if (sci < -4 || sci >= 17) {
+        *p++ = tmp[0];
+        if (ndigits > 1) {
+            *p++ = '.';
+            for (i = 1; i < ndigits; i++) *p++ = tmp[i];
+        }
+        *p++ = 'e';
+        *p++ = sci < 0 ? '-' : '+';
+        if (sci < 0) sci = -sci;
+        if (sci >= 100) {
+            *p++ = (char)('0' + sci / 100);
+            sci %= 100;
+        }
+        *p++ = yyaml_digit_pairs[sci * 2];
+        *p++ = yyaml_digit_pairs[sci * 2 + 1];
+    } else if (exp10 >= 0) {
+        for (i = 0; i < ndigits; i++) *p++ = tmp[i];
+        for (i = 0; i < exp10; i++) *p++ = '0';
+        *p++ = '.';
+        *p++ = '0';
+    } else if (sci >= 0) {
+        for (i = 0; i <= sci; i++) *p++ = tmp[i];
+        *p++ = '.';
+        for (; i < ndigits; i++) *p++ = tmp[i];
+    } else {
+        *p++ = '0';
+        *p++ = '.';
+        for (i = 0; i < -sci - 1; i++) *p++ = '0';
+        for (i = 0; i < ndigits; i++) *p++ = tmp[i];
+    }
+    return (size_t)(p - out);
+}
+
+static bool yyaml_writer_write_double(yyaml_writer *wr, double val) {
+    char tmp[32];
+    if (isnan(val)) {
+        return yyaml_writer_write(wr, "nan", 3);
+    }
+    if (isinf(val)) {
+        if (val < 0) return yyaml_writer_write(wr, "-inf", 4);
+        return yyaml_writer_write(wr, "inf", 3);
+    }
+    return yyaml_writer_write(wr, tmp, yyaml_format_double(val, tmp));
+}
+
+static bool yyaml_writer_write_int(yyaml_writer *wr, int64_t val) {
+    uint64_t mag = val < 0 ? 0 - (uint64_t)val : (uint64_t)val;
+    size_t len = yyaml_dec_len(mag) + (val < 0);
+    if (!yyaml_writer_ensure(wr, len)) return false;
+    if (val < 0) wr->buf[wr->len] = '-';
+    wr->len += len;
+    yyaml_dec_digits(mag, wr->buf + wr->len);
+    return true;
+}
+
+/* Plain-scalar classes per byte: 1 may start a plain scalar (ASCII letter or
+ * '_'), 2 may continue one (ASCII alphanumeric, '_' or '-'). */
+static const unsigned char yyaml_plain_class[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 0,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 0, 0, 0, 0, 0, 0,
+    0, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 0, 0, 0, 0, 3,
+    0, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+static bool yyaml_writer_is_plain_scalar(const char *str, size_t len) {
+    const unsigned char *s = (const unsigned char *)str;
+    size_t i;
+    if (len == 0) return false;
+    if (!(yyaml_plain_class[s[0]] & 1)) return false;
+    for (i = 1; i < len; i++) {
+        if (!(yyaml_plain_class[s[i]] & 2)) return false;
+    }
+    return true;
+}
+
+/* Length of the leading run of str that can be copied into a double-quoted
+ * scalar as is, i.e. the index of the first control byte, '"' or '\\'.
+ * Blocks are tested 16 (SSE2) or 8 (SWAR) bytes at a time; only a block that
+ * contains a hit is walked byte by byte. */
+static size_t yyaml_escape_scan(const char *str, size_t len) {
+    size_t i = 0;
+#ifdef YYAML_HAS_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i slash = _mm_set1_epi8('\\');
+    const __m128i ctrl = _mm_set1_epi8(0x1F);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(str + i));
+        /* unsigned v <= 0x1F is min(v, 0x1F) == v */
+        __m128i hit = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, slash)),
+            _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v));
+        if (_mm_movemask_epi8(hit)) break;
+    }
+#else
+    const uint64_t ones = 0x0101010101010101ull;
+    const uint64_t highs = 0x8080808080808080ull;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v, q, b;
+        memcpy(&v, str + i, sizeof(v));
+        q = v ^ (ones * '"');
+        b = v ^ (ones * '\\');
+        /* any byte < 0x20, == '"' or == '\\' (exact per word) */
+        if (((v - ones * 0x20) | (q - ones) | (b - ones)) & ~v & highs) break;
+    }
+#endif
+    for (; i < len; i++) {
+        unsigned char c = (unsigned char)str[i];
+        if (c < 0x20 || c == '"' || c == '\\') break;
+    }
+    return i;
+}
+
+/* Quoting class of str as YYAML_STR_* bits, YYAML_STR_KNOWN always set. */
+static unsigned yyaml_str_class(const char *str, size_t len) {
+    if (yyaml_writer_is_plain_scalar(str, len)) {
+        return YYAML_STR_KNOWN | YYAML_STR_PLAIN;
+    }
+    if (yyaml_escape_scan(str, len) < len) {
+        return YYAML_STR_KNOWN | YYAML_STR_ESCAPES;
+    }
+    return YYAML_STR_KNOWN;
+}
+
+/* Length of str once double-quoted and escaped, quotes included. */
+static size_t yyaml_quoted_len(const char *str, size_t len, bool json) {
+    size_t total = len + 2;
+    size_t i = 0;
+    while (i < len) {
+        unsigned char c;
+        i += yyaml_escape_scan(str + i, len - i);
+        if (i == len) break;
+        c = (unsigned char)str[i++];
+        if (c == '\\' || c == '"' || c == '\n' || c == '\r' || c == '\t') {
+            total += 1;
+        } else {
+            total += json ? 5 : 3;
+        }
+    }
+    return total;
+}
+
+/* Write str double-quoted. YAML escapes other control bytes as \xHH, JSON
+ * as \u00HH. */
+static bool yyaml_writer_write_quoted(yyaml_writer *wr, const char *str,
+                                      size_t len, bool json) {
+    /* every byte may become an escape of up to esc_max bytes; a streaming
+     * writer can only stage one buffer, so it goes in chunks */
+    size_t esc_max = json ? 6 : 4;
+    size_t max_chunk = wr->sink ? (wr->cap - 2) / esc_max : SIZE_MAX / 8;
+    size_t i = 0;
+    if (!yyaml_writer_putc(wr, '"')) return false;
+    while (i < len) {
+        size_t end = len - i > max_chunk ? i + max_chunk : len;
+        size_t need = (end - i) * esc_max + 1;
+        char *out;
+        if (!wr->sink && wr->len + need >= wr->cap) {
+            /* the worst case does not fit (e.g. a buffer sized by
+             * yyaml_write_len): count the escapes instead of growing */
+            need = yyaml_quoted_len(str + i, end - i, json) - 1;
+        }
+        if (!yyaml_writer_ensure(wr, need)) return false;
+        out = wr->buf + wr->len;
+        while (i < end) {
+            size_t run = yyaml_escape_scan(str + i, end - i);
+            unsigned char c;
+            memcpy(out, str + i, run);
+            out += run;
+            i += run;
+            if (i == end) break;
+            c = (unsigned char)str[i++];
+            *out++ = '\\';
+            switch (c) {
+            case '\\':
+                *out++ = '\\';
+                break;
+            case '\"':
+                *out++ = '\"';
+                break;
+            case '\n':
+                *out++ = 'n';
+                break;
+            case '\r':
+                *out++ = 'r';
+                break;
+            case '\t':
+                *out++ = 't';
+                break;
+            default:
+                if (json) {
+                    memcpy(out, "u00", 3);
+                    out += 3;
+                } else {
+                    *out++ = 'x';
+                }
+                *out++ = "0123456789ABCDEF"[c >> 4];
+                *out++ = "0123456789ABCDEF"[c & 0xF];
+                break;
+            }
+        }
+        wr->len = (size_t)(out - wr->buf);
+    }
+    return yyaml_writer_putc(wr, '"');
+}
+
+static bool yyaml_writer_write_string_literal(yyaml_writer *wr, const char *str,
+                                              size_t len) {
+    if (yyaml_writer_is_plain_scalar(str, len)) {
+        return yyaml_writer_write(wr, str, len);
+    }
+    return yyaml_writer_write_quoted(wr, str, len, false);
+}
+
+/* Class of the string value (key false) or key of node, taken from the
+ * document's str_class when it was recorded at parse or build time. */
+static unsigned yyaml_node_str_class(const yyaml_doc *doc,
+                                     const yyaml_node *node, bool key) {
+    const char *buf = yyaml_doc_get_scalar_buf(doc);
+    if (doc->str_class) {
+        unsigned cls = doc->str_class[node - doc->nodes];
+        cls = (key ? cls >> YYAML_STR_KEY_SHIFT : cls) & 0xF;
+        if (cls & YYAML_STR_KNOWN) return cls;
+    }
+    if (!buf) buf = "";
+    if (key) return yyaml_str_class(buf + node->extra, node->flags);
+    return yyaml_str_class(buf + node->val.str.ofs, node->val.str.len);
+}
+
+/* Write str plain (YAML only) or double-quoted as its class says; a quoted
+ * string without escapes is copied in one piece. */
+static bool yyaml_writer_write_classified(yyaml_writer *wr, const char *str,
+                                          size_t len, unsigned cls, bool json) {
+    char *out;
+    if (!json && (cls & YYAML_STR_PLAIN)) return yyaml_writer_write(wr, str, len);
+    if ((cls & YYAML_STR_ESCAPES) || wr->sink) {
+        return yyaml_writer_write_quoted(wr, str, len, json);
+    }
+    if (!yyaml_writer_ensure(wr, len + 2)) return false;
+    out = wr->buf + wr->len;
+    out[0] = '"';
+    memcpy(out + 1, str, len);
+    out[len + 1] = '"';
+    wr->len += len + 2;
+    return true;
+}
+
+static bool yyaml_writer_write_string_node(const yyaml_doc *doc,
+                                           const yyaml_node *node,
+                                           yyaml_writer *wr, bool json) {
+    const char *buf = yyaml_doc_get_scalar_buf(doc);
+    if (!buf) buf = "";
+    return yyaml_writer_write_classified(
+        wr, buf + node->val.str.ofs, node->val.str.len,
+        yyaml_node_str_class(doc, node, false), json);
+}
+
+static bool yyaml_writer_write_key(const yyaml_doc *doc, const yyaml_node *node,
+                                   yyaml_writer *wr, bool json) {
+    const char *buf = yyaml_doc_get_scalar_buf(doc);
+    if (!buf) buf = "";
+    return yyaml_writer_write_classified(wr, buf + node->extra, node->flags,
+                                         yyaml_node_str_class(doc, node, true),
+                                         json);
+}
+
+/* Emitter settings resolved from yyaml_write_opts. */
+typedef struct {
+    size_t indent;
+    yyaml_write_style style;
+    size_t flow_width;
+    bool sort_keys;
+    bool canonical;
+} yyaml_emit_cfg;
+
+static void yyaml_emit_cfg_init(yyaml_emit_cfg *cfg,
+                                const yyaml_write_opts *opts) {
+    cfg->indent = 2;
+    cfg->style = YYAML_STYLE_BLOCK;
+    cfg->flow_width = 80;
+    cfg->sort_keys = false;
+    cfg->canonical = false;
+    if (opts) {
+        if (opts->indent) cfg->indent = opts->indent;
+        cfg->style = opts->style;
+        if (opts->flow_width) cfg->flow_width = opts->flow_width;
+        cfg->canonical = opts->canonical;
+        cfg->sort_keys = opts->sort_keys || opts->canonical;
+    }
+}
+
+/* Value written for a double: canonical output folds -0.0 into 0.0. */
+static double yyaml_emit_real(const yyaml_node *node,
+                              const yyaml_emit_cfg *cfg) {
+    if (cfg->canonical && node->val.real == 0) return 0.0;
+    return node->val.real;
+}
+
+static size_t yyaml_literal_len(const char *str, size_t len, unsigned cls);
+static size_t yyaml_measure_scalar(const yyaml_doc *doc,
+                                   const yyaml_node *node,
+                                   const yyaml_emit_cfg *cfg);
+
+/* Whether a non-empty collection is written in flow style. Auto style only
+ * flows collections of scalars (and empty collections); such a mapping must
+ * also fit in flow_width. The flow style keeps the root itself in block
+ * style, which the callers handle. */
+static bool yyaml_emit_flow(const yyaml_doc *doc, const yyaml_node *node,
+                            const yyaml_emit_cfg *cfg) {
+    const char *keys = yyaml_doc_get_scalar_buf(doc);
+    bool seq = node->type == YYAML_SEQUENCE;
+    size_t width = 2; /* brackets */
+    uint32_t idx;
+    if (cfg->style == YYAML_STYLE_FLOW || cfg->style == YYAML_STYLE_LINE)
+        return true;
+    if (cfg->style != YYAML_STYLE_AUTO) return false;
+    if (!keys) keys = "";
+    for (idx = node->child; idx != YYAML_INDEX_NONE; idx = doc->nodes[idx].next) {
+        const yyaml_node *child = &doc->nodes[idx];
+        if (child->type == YYAML_SEQUENCE || child->type == YYAML_MAPPING) {
+            if (child->child != YYAML_INDEX_NONE) return false;
+            width += 2;
+        } else if (!seq) {
+            width += yyaml_measure_scalar(doc, child, cfg);
+        }
+        if (!seq) {
+            /* ", " before all but the first entry, ": " after each key */
+            width += (idx != node->child) * 2 + 2 +
+                     yyaml_literal_len(keys + child->extra, child->flags,
+                                       yyaml_node_str_class(doc, child, true));
+            if (width > cfg->flow_width) return false;
+        }
+    }
+    return true;
+}
+
+static bool yyaml_writer_write_scalar(const yyaml_doc *doc,
+                                      const yyaml_node *node,
+                                      const yyaml_emit_cfg *cfg,
+                                      yyaml_writer *wr) {
+    if (!node) return yyaml_writer_write(wr, "null", 4);
+    switch (node->type) {
+    case YYAML_NULL:
+        return yyaml_writer_write(wr, "null", 4);
+    case YYAML_BOOL:
+        return yyaml_writer_write(wr, node->val.boolean ? "true" : "false",
+                                  node->val.boolean ? 4 : 5);
+    case YYAML_INT:
+        return yyaml_writer_write_int(wr, node->val.integer);
+    case YYAML_DOUBLE:
+        return yyaml_writer_write_double(wr, yyaml_emit_real(node, cfg));
+    case YYAML_STRING:
+        return yyaml_writer_write_string_node(doc, node, wr, false);
+    default:
+        return false;
+    }
+}
+
+static bool yyaml_writer_write_flow(const yyaml_doc *doc,
+                                    const yyaml_node *node,
+                                    const yyaml_emit_cfg *cfg,
+                                    yyaml_writer *wr);
+
+/* The flow mapping node in key order, see yyaml_writer_write_flow. */
+static bool yyaml_writer_write_flow_sorted(const yyaml_doc *doc,
+                                           const yyaml_node *node,
+                                           const yyaml_emit_cfg *cfg,
+                                           yyaml_writer *wr) {
+    yyaml_child_iter it;
+    bool ok = yyaml_writer_putc(wr, '{');
+    bool first = true;
+    uint32_t idx;
+    if (!ok || !yyaml_child_iter_init(&it, doc, node, true)) return false;
+    while (ok && (idx = yyaml_child_iter_next(&it, doc)) != YYAML_INDEX_NONE) {
+        const yyaml_node *child = &doc->nodes[idx];
+        ok = (first || yyaml_writer_write(wr, ", ", 2)) &&
+             yyaml_writer_write_key(doc, child, wr, false) &&
+             yyaml_writer_write(wr, ": ", 2) &&
+             yyaml_writer_write_flow(doc, child, cfg, wr);
+        first = false;
+    }
+    yyaml_child_iter_done(&it);
+    return ok && yyaml_writer_putc(wr, '}');
+}
+
+/* Write node on the current line as `[a, b]` or `{k: v}`, recursively. */
+static bool yyaml_writer_write_flow(const yyaml_doc *doc,
+                                    const yyaml_node *node,
+                                    const yyaml_emit_cfg *cfg,
+                                    yyaml_writer *wr) {
+    const char *keys = yyaml_doc_get_scalar_buf(doc);
+    bool seq;
+    uint32_t idx;
+    if (!node || (node->type != YYAML_SEQUENCE && node->type != YYAML_MAPPING))
+        return yyaml_writer_write_scalar(doc, node, cfg, wr);
+    seq = node->type == YYAML_SEQUENCE;
+    if (node->child == YYAML_INDEX_NONE)
+        return yyaml_writer_write(wr, seq ? "[]" : "{}", 2);
+    if (cfg->sort_keys && !seq)
+        return yyaml_writer_write_flow_sorted(doc, node, cfg, wr);
+    if (!keys) keys = "";
+    if (!yyaml_writer_putc(wr, seq ? '[' : '{')) return false;
+    for (idx = node->child; idx != YYAML_INDEX_NONE; idx = doc->nodes[idx].next) {
+        const yyaml_node *child = &doc->nodes[idx];
+        bool first = idx == node->child;
+        if (seq) {
+            if (!first && !yyaml_writer_write(wr, ", ", 2)) return false;
+        } else if ((yyaml_node_str_class(doc, child, true) & YYAML_STR_PLAIN) &&
+                   yyaml_writer_fits(wr, (size_t)child->flags + 4)) {
+            /* separator, key and ": " in one reservation */
+            size_t need = (first ? 0 : 2) + child->flags + 2;
+            char *out;
+            if (!yyaml_writer_ensure(wr, need)) return false;
+            out = wr->buf + wr->len;
+            if (!first) {
+                *out++ = ',';
+                *out++ = ' ';
+            }
+            memcpy(out, keys + child->extra, child->flags);
+            out += child->flags;
+            out[0] = ':';
+            out[1] = ' ';
+            wr->len += need;
+        } else {
+            if (!first && !yyaml_writer_write(wr, ", ", 2)) return false;
+            if (!yyaml_writer_write_key(doc, child, wr, false)) return false;
+            if (!yyaml_writer_write(wr, ": ", 2)) return false;
+        }
+        if (!yyaml_writer_write_flow(doc, child, cfg, wr)) return false;
+    }
+    return yyaml_writer_putc(wr, seq ? ']' : '}');
+}
+
+static bool yyaml_write_node_internal(const yyaml_doc *doc,
+                                      const yyaml_node *node, size_t depth,
+                                      const yyaml_emit_cfg *cfg,
+                                      yyaml_writer *wr, yyaml_err *err);
+
+static bool yyaml_writer_write_mapping(const yyaml_doc *doc,
+                                       const yyaml_node *node, size_t depth,
+                                       const yyaml_emit_cfg *cfg,
+                                       yyaml_writer *wr, yyaml_err *err,
+                                       bool inline_first);
+
+static bool yyaml_writer_write_sequence(const yyaml_doc *doc,
+                                        const yyaml_node *node, size_t depth,
+                                        const yyaml_emit_cfg *cfg,
+                                        yyaml_writer *wr, yyaml_err *err,
+                                        bool inline_first);
+
+/* Copy src[from, to) moving each line that starts in it from column col to
+ * column pad (from counts as a line start when first is set); blank lines
+ * are left alone. With wr NULL the output length is added to *len. */
+static bool yyaml_source_copy(yyaml_writer *wr, size_t *len, const char *src,
+                              size_t from, size_t to, size_t col, size_t pad,
+                              bool first) {
+    while (from < to) {
+        const char *nl;
+        size_t stop;
+        if (first && pad != col) {
+            size_t n = 0;
+            while (from + n < to && src[from + n] == ' ') n++;
+            from += n;
+            if (from < to && src[from] != '\n' && src[from] != '\r')
+                n = n + pad > col ? n + pad - col : 0;
+            if (!wr) *len += n;
+            else if (!yyaml_writer_indent(wr, 1, n)) return false;
+        }
+        nl = pad == col ? NULL
+                        : (const char *)memchr(src + from, '\n', to - from);
+        stop = nl ? (size_t)(nl - src) + 1 : to;
+        if (!wr) *len += stop - from;
+        else if (!yyaml_writer_write(wr, src + from, stop - from)) return false;
+        from = stop;
+        first = true;
+    }
     return true;
 }
 
-static bool yyaml_writer_ensure(yyaml_writer *wr, size_t extra) {
-    size_t need;
-    if (extra > SIZE_MAX - wr->len - 1) return false;
-    need = wr->len + extra + 1; /* reserve space for null terminator */
-    return yyaml_writer_reserve(wr, need);
+/* Reuse the kept source text of a block entry written at pad (see
+ * yyaml_writer_write_seq_item): an unchanged entry is copied whole and *done
+ * set, a changed one only gets the comment lines above it, after which
+ * *newline is cleared. The entry's own column is moved to the one its
+ * siblings get; the first entry of a mapping written after "- " starts from
+ * its key. With wr NULL the output length is added to *len instead. */
+static bool yyaml_emit_source(const yyaml_doc *doc, const yyaml_node *child,
+                              size_t depth, const yyaml_emit_cfg *cfg,
+                              yyaml_writer *wr, size_t *len, bool *newline,
+                              size_t pad, bool *done) {
+    const yyaml_span *span;
+    const char *src = doc->source;
+    size_t target = cfg->indent * depth;
+    size_t line;
+    size_t col;
+    *done = false;
+    /* copied text keeps its own key order */
+    if (!doc->spans || cfg->style != YYAML_STYLE_BLOCK || cfg->sort_keys)
+        return true;
+    span = &doc->spans[child - doc->nodes];
+    if (span->key == YYAML_INDEX_NONE) return true;
+    line = span->key;
+    while (line && src[line - 1] != '\n') line--;
+    col = span->key - line;
+    if (pad != target) {
+        if (span->dirty) return true;
+        *done = true;
+        return yyaml_source_copy(wr, len, src, span->key, span->end, col,
+                                 target, false);
+    }
+    if (!span->dirty) {
+        bool at_line = span->start <= line;
+        *done = true;
+        if (!wr) *len += *newline + (at_line ? 0 : pad);
+        else if (!yyaml_writer_begin_line(wr, *newline, at_line ? 0 : pad, "",
+                                          0, "", 0))
+            return false;
+        return yyaml_source_copy(wr, len, src, at_line ? span->start : span->key,
+                                 span->end, col, pad, at_line);
+    }
+    if (span->start >= line) return true;
+    if (!wr) *len += *newline;
+    else if (!yyaml_writer_begin_line(wr, *newline, 0, "", 0, "", 0))
+        return false;
+    *newline = false;
+    return yyaml_source_copy(wr, len, src, span->start, line, col, pad, true);
+}
+
+/* Kept source span of root when its whole text can be copied verbatim. */
+static const yyaml_span *yyaml_root_source(const yyaml_node *root,
+                                           const yyaml_emit_cfg *cfg) {
+    const yyaml_doc *doc = root ? root->doc : NULL;
+    const yyaml_span *span;
+    if (!doc || !doc->spans || cfg->style != YYAML_STYLE_BLOCK ||
+        cfg->sort_keys || root != &doc->nodes[doc->root])
+        return NULL;
+    span = &doc->spans[doc->root];
+    if (span->dirty || span->key == YYAML_INDEX_NONE || !span->end) return NULL;
+    return span;
+}
+
+/* One `- item` entry of a block sequence at depth, starting with a newline
+ * unless it is the first line written, indented by pad. */
+static bool yyaml_writer_write_seq_item(const yyaml_doc *doc,
+                                        const yyaml_node *child, size_t depth,
+                                        const yyaml_emit_cfg *cfg,
+                                        yyaml_writer *wr, yyaml_err *err,
+                                        bool newline, size_t pad) {
+    if (doc->spans) {
+        bool done;
+        if (!yyaml_emit_source(doc, child, depth, cfg, wr, NULL, &newline, pad,
+                               &done))
+            return false;
+        if (done) return true;
+    }
+    if ((child->type == YYAML_SEQUENCE || child->type == YYAML_MAPPING) &&
+        child->child != YYAML_INDEX_NONE && yyaml_emit_flow(doc, child, cfg)) {
+        if (!yyaml_writer_begin_line(wr, newline, pad, "- ", 2, "", 0))
+            return false;
+        return yyaml_writer_write_flow(doc, child, cfg, wr);
+    }
+    if (child->type == YYAML_SEQUENCE) {
+        if (child->child == YYAML_INDEX_NONE) {
+            return yyaml_writer_begin_line(wr, newline, pad, "- []", 4, "", 0);
+        }
+        if (!yyaml_writer_begin_line(wr, newline, pad, "-\n", 2, "", 0))
+            return false;
+        return yyaml_writer_write_sequence(doc, child, depth + 1, cfg, wr, err,
+                                           false);
+    }
+    if (!yyaml_writer_begin_line(wr, newline, pad, "- ", 2, "", 0))
+        return false;
+    if (child->type == YYAML_MAPPING) {
+        return yyaml_writer_write_mapping(doc, child, depth + 1, cfg, wr, err,
+                                          true);
+    }
+    return yyaml_writer_write_scalar(doc, child, cfg, wr);
+}
+
+/* One `key: value` entry of a block mapping at depth, see
+ * yyaml_writer_write_seq_item. */
+static bool yyaml_writer_write_map_entry(const yyaml_doc *doc,
+                                         const yyaml_node *child, size_t depth,
+                                         const yyaml_emit_cfg *cfg,
+                                         yyaml_writer *wr, yyaml_err *err,
+                                         bool newline, size_t pad) {
+    const char *keys = yyaml_doc_get_scalar_buf(doc);
+    const char *key;
+    const char *sep = ": ";
+    bool value = true;
+    bool flow = false;
+    if (doc->spans) {
+        bool done;
+        if (!yyaml_emit_source(doc, child, depth, cfg, wr, NULL, &newline, pad,
+                               &done))
+            return false;
+        if (done) return true;
+    }
+    if (!keys) keys = "";
+    key = keys + child->extra;
+    if (child->type == YYAML_MAPPING && child->child == YYAML_INDEX_NONE) {
+        sep = ": {}";
+        value = false;
+    } else if (child->type == YYAML_SEQUENCE &&
+               child->child == YYAML_INDEX_NONE) {
+        sep = ": []";
+        value = false;
+    } else if (child->type == YYAML_SEQUENCE || child->type == YYAML_MAPPING) {
+        flow = yyaml_emit_flow(doc, child, cfg);
+        if (!flow) sep = ":\n";
+    }
+    if (yyaml_node_str_class(doc, child, true) & YYAML_STR_PLAIN) {
+        /* newline, indentation, key and separator in one go */
+        if (!yyaml_writer_begin_line(wr, newline, pad, key, child->flags, sep,
+                                     strlen(sep)))
+            return false;
+    } else {
+        if (!yyaml_writer_begin_line(wr, newline, pad, "", 0, "", 0))
+            return false;
+        if (!yyaml_writer_write_key(doc, child, wr, false)) return false;
+        if (!yyaml_writer_write(wr, sep, strlen(sep))) return false;
+    }
+    if (flow) return yyaml_writer_write_flow(doc, child, cfg, wr);
+    if (value) {
+        return yyaml_write_node_internal(doc, child, depth + 1, cfg, wr, err);
+    }
+    return true;
+}
+
+static bool yyaml_writer_write_sequence(const yyaml_doc *doc,
+                                        const yyaml_node *node, size_t depth,
+                                        const yyaml_emit_cfg *cfg,
+                                        yyaml_writer *wr, yyaml_err *err,
+                                        bool inline_first) {
+    size_t pad_len = cfg->indent * depth;
+    uint32_t idx;
+    if (!node || node->type != YYAML_SEQUENCE) return false;
+    if (node->child == YYAML_INDEX_NONE) {
+        if (!inline_first) {
+            if (!yyaml_writer_indent(wr, cfg->indent, depth)) return false;
+        }
+        return yyaml_writer_write(wr, "[]", 2);
+    }
+    for (idx = node->child; idx != YYAML_INDEX_NONE; idx = doc->nodes[idx].next) {
+        bool first = idx == node->child;
+        if (!yyaml_writer_write_seq_item(doc, &doc->nodes[idx], depth, cfg, wr,
+                                         err, !first,
+                                         (inline_first && first) ? 0 : pad_len))
+            return false;
+    }
+    return true;
+}
+
+/* The entries of a mapping in key order, see yyaml_writer_write_mapping. */
+static bool yyaml_writer_write_sorted(const yyaml_doc *doc,
+                                      const yyaml_node *node, size_t depth,
+                                      const yyaml_emit_cfg *cfg,
+                                      yyaml_writer *wr, yyaml_err *err,
+                                      bool inline_first) {
+    size_t pad_len = cfg->indent * depth;
+    yyaml_child_iter it;
+    bool first = true;
+    bool ok = true;
+    uint32_t idx;
+    if (!yyaml_child_iter_init(&it, doc, node, true)) {
+        yyaml_set_failure(err, YYAML_ERR_MEMORY, "out of memory");
+        return false;
+    }
+    while ((idx = yyaml_child_iter_next(&it, doc)) != YYAML_INDEX_NONE) {
+        if (!yyaml_writer_write_map_entry(doc, &doc->nodes[idx], depth, cfg, wr,
+                                          err, !first,
+                                          (inline_first && first) ? 0 : pad_len)) {
+            ok = false;
+            break;
+        }
+        first = false;
+    }
+    yyaml_child_iter_done(&it);
+    return ok;
+}
+
+static bool yyaml_writer_write_mapping(const yyaml_doc *doc,
+                                       const yyaml_node *node, size_t depth,
+                                       const yyaml_emit_cfg *cfg,
+                                       yyaml_writer *wr, yyaml_err *err,
+                                       bool inline_first) {
+    size_t pad_len = cfg->indent * depth;
+    uint32_t idx;
+    if (!node || node->type != YYAML_MAPPING) return false;
+    if (node->child == YYAML_INDEX_NONE) {
+        if (!inline_first) {
+            if (!yyaml_writer_indent(wr, cfg->indent, depth)) return false;
+        }
+        return yyaml_writer_write(wr, "{}", 2);
+    }
+    if (cfg->sort_keys) {
+        return yyaml_writer_write_sorted(doc, node, depth, cfg, wr, err,
+                                         inline_first);
+    }
+    for (idx = node->child; idx != YYAML_INDEX_NONE; idx = doc->nodes[idx].next) {
+        bool first = idx == node->child;
+        if (!yyaml_writer_write_map_entry(doc, &doc->nodes[idx], depth, cfg, wr,
+                                          err, !first,
+                                          (inline_first && first) ? 0 : pad_len))
+            return false;
+    }
+    return true;
+}
+
+static bool yyaml_write_node_internal(const yyaml_doc *doc,
+                                      const yyaml_node *node, size_t depth,
+                                      const yyaml_emit_cfg *cfg,
+                                      yyaml_writer *wr, yyaml_err *err) {
+    if (node && node->type == YYAML_SEQUENCE)
+        return yyaml_writer_write_sequence(doc, node, depth, cfg, wr, err,
+                                           false);
+    if (node && node->type == YYAML_MAPPING)
+        return yyaml_writer_write_mapping(doc, node, depth, cfg, wr, err,
+                                          false);
+    return yyaml_writer_write_scalar(doc, node, cfg, wr);
+}
+
+/* Whether root itself is written in flow style. */
+static bool yyaml_emit_flow_root(const yyaml_node *root,
+                                 const yyaml_emit_cfg *cfg) {
+    return root && (root->type == YYAML_SEQUENCE ||
+                    root->type == YYAML_MAPPING) &&
+           root->child != YYAML_INDEX_NONE &&
+           cfg->style != YYAML_STYLE_FLOW &&
+           yyaml_emit_flow(root->doc, root, cfg);
+}
+
+/* Serialize root followed by the optional final newline into wr. */
+static bool yyaml_write_root(const yyaml_node *root, yyaml_writer *wr,
+                             const yyaml_write_opts *opts, yyaml_err *err) {
+    yyaml_emit_cfg cfg;
+    const yyaml_span *span;
+    bool final_newline = opts ? opts->final_newline : true;
+    yyaml_emit_cfg_init(&cfg, opts);
+    span = yyaml_root_source(root, &cfg);
+    if (!root) {
+        if (!yyaml_writer_write(wr, "null", 4)) return false;
+    } else if (span) {
+        /* nothing changed since parsing */
+        if (!yyaml_writer_write(wr, root->doc->source, span->end)) return false;
+    } else if (yyaml_emit_flow_root(root, &cfg)) {
+        if (!yyaml_writer_write_flow(root->doc, root, &cfg, wr)) return false;
+    } else {
+        if (!yyaml_write_node_internal(root->doc, root, 0, &cfg, wr, err))
+            return false;
+    }
+    if (final_newline) {
+        if (!yyaml_writer_putc(wr, '\n')) return false;
+    }
+    return true;
+}
+
+/*
+ * Measuring pass: the exact number of bytes the YAML emitter above produces,
+ * computed from digit counts, escape counts and indentation without
+ * formatting anything but doubles. Must mirror the emitter line for line.
+ */
+static size_t yyaml_literal_len(const char *str, size_t len, unsigned cls) {
+    if (cls & YYAML_STR_PLAIN) return len;
+    if (!(cls & YYAML_STR_ESCAPES)) return len + 2;
+    return yyaml_quoted_len(str, len, false);
+}
+
+static size_t yyaml_measure_scalar(const yyaml_doc *doc,
+                                   const yyaml_node *node,
+                                   const yyaml_emit_cfg *cfg) {
+    double real;
+    const char *scalars;
+    char tmp[32];
+    if (!node) return 4;
+    switch (node->type) {
+    case YYAML_NULL:
+        return 4;
+    case YYAML_BOOL:
+        return node->val.boolean ? 4 : 5;
+    case YYAML_INT: {
+        int64_t val = node->val.integer;
+        return yyaml_dec_len(val < 0 ? 0 - (uint64_t)val : (uint64_t)val) +
+               (val < 0);
+    }
+    case YYAML_DOUBLE:
+        real = yyaml_emit_real(node, cfg);
+        if (isnan(real)) return 3;
+        if (isinf(real)) return real < 0 ? 4 : 3;
+        return yyaml_format_double(real, tmp);
+    case YYAML_STRING:
+        scalars = yyaml_doc_get_scalar_buf(doc);
+        if (!scalars) scalars = "";
+        return yyaml_literal_len(scalars + node->val.str.ofs, node->val.str.len,
+                                 yyaml_node_str_class(doc, node, false));
+    default:
+        return 0;
+    }
+}
+
+/* Flow-style length of node; stops early with some value above limit once
+ * the running total exceeds it. */
+static size_t yyaml_measure_flow(const yyaml_doc *doc, const yyaml_node *node,
+                                 const yyaml_emit_cfg *cfg, size_t limit) {
+    const char *keys = yyaml_doc_get_scalar_buf(doc);
+    size_t total = 2; /* brackets */
+    uint32_t idx;
+    if (!node || (node->type != YYAML_SEQUENCE && node->type != YYAML_MAPPING))
+        return yyaml_measure_scalar(doc, node, cfg);
+    if (!keys) keys = "";
+    for (idx = node->child; idx != YYAML_INDEX_NONE; idx = doc->nodes[idx].next) {
+        const yyaml_node *child = &doc->nodes[idx];
+        if (idx != node->child) total += 2; /* ", " */
+        if (node->type == YYAML_MAPPING) {
+            total += yyaml_literal_len(keys + child->extra, child->flags,
+                                       yyaml_node_str_class(doc, child, true));
+            total += 2;
+        }
+        total += yyaml_measure_flow(doc, child, cfg, limit);
+        if (total > limit) break;
+    }
+    return total;
+}
+
+static size_t yyaml_measure_node(const yyaml_doc *doc, const yyaml_node *node,
+                                 size_t depth, const yyaml_emit_cfg *cfg);
+
+static size_t yyaml_measure_sequence(const yyaml_doc *doc,
+                                     const yyaml_node *node, size_t depth,
+                                     const yyaml_emit_cfg *cfg,
+                                     bool inline_first);
+
+static size_t yyaml_measure_mapping(const yyaml_doc *doc,
+                                    const yyaml_node *node, size_t depth,
+                                    const yyaml_emit_cfg *cfg,
+                                    bool inline_first) {
+    const char *keys = yyaml_doc_get_scalar_buf(doc);
+    size_t pad_len = cfg->indent * depth;
+    size_t total = 0;
+    uint32_t idx;
+    bool first = true;
+    if (node->child == YYAML_INDEX_NONE) return (inline_first ? 0 : pad_len) + 2;
+    if (!keys) keys = "";
+    for (idx = node->child; idx != YYAML_INDEX_NONE; idx = doc->nodes[idx].next) {
+        const yyaml_node *child = &doc->nodes[idx];
+        size_t pad = (inline_first && first) ? 0 : pad_len;
+        bool newline = !first;
+        first = false;
+        if (doc->spans) {
+            bool done;
+            yyaml_emit_source(doc, child, depth, cfg, NULL, &total, &newline,
+                              pad, &done);
+            if (done) continue;
+        }
+        total += newline + pad;
+        total += yyaml_literal_len(keys + child->extra, child->flags,
+                                   yyaml_node_str_class(doc, child, true));
+        if ((child->type == YYAML_MAPPING || child->type == YYAML_SEQUENCE) &&
+            child->child == YYAML_INDEX_NONE) {
+            total += 4; /* ": {}" or ": []" */
+        } else if ((child->type == YYAML_MAPPING ||
+                    child->type == YYAML_SEQUENCE) &&
+                   yyaml_emit_flow(doc, child, cfg)) {
+            total += 2 + yyaml_measure_flow(doc, child, cfg, SIZE_MAX);
+        } else {
+            total += 2 + yyaml_measure_node(doc, child, depth + 1, cfg);
+        }
+    }
+    return total;
+}
+
+static size_t yyaml_measure_sequence(const yyaml_doc *doc,
+                                     const yyaml_node *node, size_t depth,
+                                     const yyaml_emit_cfg *cfg,
+                                     bool inline_first) {
+    size_t pad_len = cfg->indent * depth;
+    size_t total = 0;
+    uint32_t idx;
+    bool first = true;
+    if (node->child == YYAML_INDEX_NONE) return (inline_first ? 0 : pad_len) + 2;
+    for (idx = node->child; idx != YYAML_INDEX_NONE; idx = doc->nodes[idx].next) {
+        const yyaml_node *child = &doc->nodes[idx];
+        size_t pad = (inline_first && first) ? 0 : pad_len;
+        bool newline = !first;
+        first = false;
+        if (doc->spans) {
+            bool done;
+            yyaml_emit_source(doc, child, depth, cfg, NULL, &total, &newline,
+                              pad, &done);
+            if (done) continue;
+        }
+        total += newline + pad + 2;
+        if ((child->type == YYAML_SEQUENCE || child->type == YYAML_MAPPING) &&
+            child->child != YYAML_INDEX_NONE && yyaml_emit_flow(doc, child, cfg)) {
+            total += yyaml_measure_flow(doc, child, cfg, SIZE_MAX);
+        } else if (child->type == YYAML_SEQUENCE) {
+            if (child->child == YYAML_INDEX_NONE) {
+                total += 2; /* "- []" */
+            } else {
+                total += yyaml_measure_sequence(doc, child, depth + 1, cfg,
+                                                false);
+            }
+        } else if (child->type == YYAML_MAPPING) {
+            total += yyaml_measure_mapping(doc, child, depth + 1, cfg, true);
+        } else {
+            total += yyaml_measure_scalar(doc, child, cfg);
+        }
+    }
+    return total;
+}
+
+static size_t yyaml_measure_node(const yyaml_doc *doc, const yyaml_node *node,
+                                 size_t depth, const yyaml_emit_cfg *cfg) {
+    if (node && node->type == YYAML_SEQUENCE)
+        return yyaml_measure_sequence(doc, node, depth, cfg, false);
+    if (node && node->type == YYAML_MAPPING)
+        return yyaml_measure_mapping(doc, node, depth, cfg, false);
+    return yyaml_measure_scalar(doc, node, cfg);
+}
+
+YYAML_API size_t yyaml_write_len(const yyaml_node *root,
+                                 const yyaml_write_opts *opts) {
+    yyaml_emit_cfg cfg;
+    bool final_newline = opts ? opts->final_newline : true;
+    size_t total;
+    yyaml_emit_cfg_init(&cfg, opts);
+    if (!root) {
+        total = 4;
+    } else {
+        const yyaml_span *span = yyaml_root_source(root, &cfg);
+        if (!root->doc) return 0;
+        if (span) {
+            total = span->end;
+        } else if (yyaml_emit_flow_root(root, &cfg)) {
+            total = yyaml_measure_flow(root->doc, root, &cfg, SIZE_MAX);
+        } else {
+            total = yyaml_measure_node(root->doc, root, 0, &cfg);
+        }
+    }
+    return total + final_newline;
+}
+
+/* Separator before a JSON array element or object member: a comma unless it
+ * is the first, then in pretty mode a newline and the indentation. */
+static bool yyaml_json_begin_item(yyaml_writer *wr, bool first, size_t pad,
+                                  bool pretty) {
+    size_t total = !first + (pretty ? pad + 1 : 0);
+    char *out;
+    if (!yyaml_writer_fits(wr, total)) {
+        return (first || yyaml_writer_putc(wr, ',')) &&
+               (!pretty || (yyaml_writer_putc(wr, '\n') &&
+                            yyaml_writer_spaces(wr, pad)));
+    }
+    if (!yyaml_writer_ensure(wr, total)) return false;
+    out = wr->buf + wr->len;
+    if (!first) *out++ = ',';
+    if (pretty) {
+        *out++ = '\n';
+        yyaml_fill_spaces(out, pad);
+    }
+    wr->len += total;
+    return true;
+}
+
+static bool yyaml_write_json_node(const yyaml_doc *doc, const yyaml_node *node,
+                                  size_t depth, const yyaml_emit_cfg *cfg,
+                                  bool pretty, yyaml_writer *wr);
+
+/* The JSON object node in key order, see yyaml_write_json_node. */
+static bool yyaml_write_json_sorted(const yyaml_doc *doc, const yyaml_node *node,
+                                    size_t depth, const yyaml_emit_cfg *cfg,
+                                    bool pretty, yyaml_writer *wr) {
+    size_t pad = cfg->indent * (depth + 1);
+    yyaml_child_iter it;
+    bool ok = yyaml_writer_putc(wr, '{');
+    bool first = true;
+    uint32_t idx;
+    if (!ok || !yyaml_child_iter_init(&it, doc, node, true)) return false;
+    while (ok && (idx = yyaml_child_iter_next(&it, doc)) != YYAML_INDEX_NONE) {
+        const yyaml_node *child = &doc->nodes[idx];
+        ok = yyaml_json_begin_item(wr, first, pad, pretty) &&
+             yyaml_writer_write_key(doc, child, wr, true) &&
+             yyaml_writer_write(wr, ": ", pretty ? 2 : 1) &&
+             yyaml_write_json_node(doc, child, depth + 1, cfg, pretty, wr);
+        first = false;
+    }
+    yyaml_child_iter_done(&it);
+    return ok && yyaml_writer_begin_line(wr, pretty,
+                                         pretty ? pad - cfg->indent : 0, "}", 1,
+                                         "", 0);
+}
+
+static bool yyaml_write_json_node(const yyaml_doc *doc, const yyaml_node *node,
+                                  size_t depth, const yyaml_emit_cfg *cfg,
+                                  bool pretty, yyaml_writer *wr) {
+    const char *scalars = yyaml_doc_get_scalar_buf(doc);
+    size_t indent = cfg->indent;
+    size_t pad = indent * (depth + 1);
+    uint32_t idx;
+    bool first = true;
+    if (!scalars) scalars = "";
+    if (!node) return yyaml_writer_write(wr, "null", 4);
+    switch (node->type) {
+    case YYAML_NULL:
+        return yyaml_writer_write(wr, "null", 4);
+    case YYAML_BOOL:
+        return yyaml_writer_write(wr, node->val.boolean ? "true" : "false",
+                                  node->val.boolean ? 4 : 5);
+    case YYAML_INT:
+        return yyaml_writer_write_int(wr, node->val.integer);
+    case YYAML_DOUBLE:
+        /* JSON has no literal for nan or infinities */
+        if (isnan(node->val.real) || isinf(node->val.real)) {
+            return yyaml_writer_write(wr, "null", 4);
+        }
+        return yyaml_writer_write_double(wr, yyaml_emit_real(node, cfg));
+    case YYAML_STRING:
+        return yyaml_writer_write_string_node(doc, node, wr, true);
+    case YYAML_SEQUENCE:
+    case YYAML_MAPPING:
+        break;
+    default:
+        return false;
+    }
+    if (node->child == YYAML_INDEX_NONE) {
+        return yyaml_writer_write(wr, node->type == YYAML_SEQUENCE ? "[]" : "{}",
+                                  2);
+    }
+    if (cfg->sort_keys && node->type == YYAML_MAPPING)
+        return yyaml_write_json_sorted(doc, node, depth, cfg, pretty, wr);
+    if (!yyaml_writer_putc(wr, node->type == YYAML_SEQUENCE ? '[' : '{'))
+        return false;
+    for (idx = node->child; idx != YYAML_INDEX_NONE; idx = doc->nodes[idx].next) {
+        const yyaml_node *child = &doc->nodes[idx];
+        if (!yyaml_json_begin_item(wr, first, pad, pretty)) return false;
+        if (node->type == YYAML_MAPPING) {
+            if (!yyaml_writer_write_key(doc, child, wr, true)) return false;
+            if (!yyaml_writer_write(wr, ": ", pretty ? 2 : 1)) return false;
+        }
+        if (!yyaml_write_json_node(doc, child, depth + 1, cfg, pretty, wr))
+            return false;
+        first = false;
+    }
+    if (!yyaml_writer_begin_line(wr, pretty, pretty ? pad - indent : 0,
+                                 node->type == YYAML_SEQUENCE ? "]" : "}", 1,
+                                 "", 0))
+        return false;
+    return true;
+}
+
+/* Serialize root as JSON followed by the optional final newline into wr. */
+static bool yyaml_write_json_root(const yyaml_node *root, yyaml_writer *wr,
+                                  const yyaml_write_opts *opts) {
+    yyaml_emit_cfg cfg;
+    bool final_newline = true;
+    bool pretty = false;
+    yyaml_emit_cfg_init(&cfg, opts);
+    if (opts) {
+        final_newline = opts->final_newline;
+        pretty = opts->pretty;
+    }
+    if (!root) {
+        if (!yyaml_writer_write(wr, "null", 4)) return false;
+    } else {
+        if (!yyaml_write_json_node(root->doc, root, 0, &cfg, pretty, wr))
+            return false;
+    }
+    if (final_newline) {
+        if (!yyaml_writer_putc(wr, '\n')) return false;
+    }
+    return true;
+}
+
+/*
+ * Parallel writer: the entries of a large block root are split into ranges
+ * of similar subtree size, each range is rendered by its own thread into its
+ * own buffer at depth 0, and the buffers are joined in order. Every entry
+ * after the first line starts with its own newline, so the joined text is
+ * byte for byte what the serial emitter produces.
+ */
+typedef struct {
+    const yyaml_node *root;
+    const yyaml_emit_cfg *cfg;
+    uint32_t first;   /* first entry of the range */
+    uint32_t end;     /* entry after the range, YYAML_INDEX_NONE at the end */
+    size_t weight;    /* nodes in the range, used to pre-size the buffer */
+    yyaml_writer wr;
+    bool ok;
+#ifdef YYAML_HAS_POSIX
+    pthread_t thread;
+    bool started;
+#endif
+} yyaml_write_part;
+
+static void *yyaml_write_part_run(void *arg) {
+    yyaml_write_part *part = (yyaml_write_part *)arg;
+    const yyaml_doc *doc = part->root->doc;
+    bool seq = part->root->type == YYAML_SEQUENCE;
+    uint32_t idx;
+    part->ok = yyaml_writer_reserve(&part->wr, part->weight * 24 + 64);
+    for (idx = part->first; part->ok && idx != part->end;
+         idx = doc->nodes[idx].next) {
+        bool newline = idx != part->root->child;
+        part->ok = seq ? yyaml_writer_write_seq_item(doc, &doc->nodes[idx], 0,
+                                                     part->cfg, &part->wr, NULL,
+                                                     newline, 0)
+                       : yyaml_writer_write_map_entry(doc, &doc->nodes[idx], 0,
+                                                      part->cfg, &part->wr,
+                                                      NULL, newline, 0);
+    }
+    return NULL;
+}
+
+/* Split root's entries into up to opts->threads ranges with at least
+ * YYAML_WRITE_SPLIT_NODES nodes each. Returns the number of ranges, or 0
+ * when the document is written serially. */
+static size_t yyaml_write_split(const yyaml_node *root,
+                                const yyaml_write_opts *opts,
+                                const yyaml_emit_cfg *cfg,
+                                yyaml_write_part *parts) {
+#ifdef YYAML_HAS_POSIX
+    const yyaml_doc *doc;
+    size_t total;
+    size_t count;
+    size_t acc = 0;
+    size_t n = 0;
+    size_t i;
+    uint32_t idx;
+    uint32_t next;
+    if (!opts || opts->threads < 2 || !root || !root->doc) return 0;
+    if ((root->type != YYAML_SEQUENCE && root->type != YYAML_MAPPING) ||
+        root->child == YYAML_INDEX_NONE || yyaml_emit_flow_root(root, cfg) ||
+        yyaml_root_source(root, cfg) ||
+        (cfg->sort_keys && root->type == YYAML_MAPPING))
+        return 0;
+    doc = root->doc;
+    total = yyaml_node_subtree_size(root) - 1;
+    count = total / YYAML_WRITE_SPLIT_NODES;
+    if (count > opts->threads) count = opts->threads;
+    if (count > YYAML_WRITE_MAX_THREADS) count = YYAML_WRITE_MAX_THREADS;
+    if (count < 2) return 0;
+    memset(parts, 0, count * sizeof(*parts));
+    parts[0].first = root->child;
+    for (idx = root->child; idx != YYAML_INDEX_NONE; idx = next) {
+        size_t size = yyaml_node_subtree_size(&doc->nodes[idx]);
+        next = doc->nodes[idx].next;
+        acc += size;
+        parts[n].weight += size;
+        /* close the range once the ranges so far hold their share */
+        if (n + 1 < count && next != YYAML_INDEX_NONE &&
+            acc >= total / count * (n + 1)) {
+            parts[n].end = next;
+            parts[++n].first = next;
+        }
+    }
+    parts[n].end = YYAML_INDEX_NONE;
+    for (i = 0; i <= n; i++) {
+        parts[i].root = root;
+        parts[i].cfg = cfg;
+    }
+    return n ? n + 1 : 0;
+#else
+    (void)root;
+    (void)opts;
+    (void)cfg;
+    (void)parts;
+    return 0;
+#endif
+}
+
+/* Render every range, the first on the calling thread. A range whose thread
+ * cannot be started is rendered on the calling thread as well. */
+static bool yyaml_write_parts(yyaml_write_part *parts, size_t n) {
+    bool ok = true;
+    size_t i;
+#ifdef YYAML_HAS_POSIX
+    for (i = 1; i < n; i++) {
+        parts[i].started = pthread_create(&parts[i].thread, NULL,
+                                          yyaml_write_part_run, &parts[i]) == 0;
+    }
+#endif
+    yyaml_write_part_run(&parts[0]);
+    for (i = 1; i < n; i++) {
+#ifdef YYAML_HAS_POSIX
+        if (parts[i].started) {
+            pthread_join(parts[i].thread, NULL);
+            continue;
+        }
+#endif
+        yyaml_write_part_run(&parts[i]);
+    }
+    for (i = 0; i < n; i++) ok = ok && parts[i].ok;
+    return ok;
+}
+
+static void yyaml_write_parts_free(yyaml_write_part *parts, size_t n) {
+    size_t i;
+    for (i = 0; i < n; i++) free(parts[i].wr.buf);
+}
+
+/* Join rendered ranges and the final newline into one buffer: the first
+ * range's buffer grows to the exact size and the rest are copied behind. */
+static bool yyaml_write_join(yyaml_write_part *parts, size_t n,
+                             bool final_newline, char **out, size_t *out_len) {
+    size_t total = final_newline;
+    size_t i;
+    char *buf;
+    for (i = 0; i < n; i++) total += parts[i].wr.len;
+    buf = (char *)realloc(parts[0].wr.buf, total + 1);
+    if (!buf) return false;
+    parts[0].wr.buf = buf;
+    total = parts[0].wr.len;
+    for (i = 1; i < n; i++) {
+        memcpy(buf + total, parts[i].wr.buf, parts[i].wr.len);
+        total += parts[i].wr.len;
+    }
+    if (final_newline) buf[total++] = '\n';
+    buf[total] = '\0';
+    parts[0].wr.buf = NULL; /* now owned by the caller */
+    *out = buf;
+    if (out_len) *out_len = total;
+    return true;
+}
+
+/* Report a failed write: the reason recorded while emitting when there is
+ * one, otherwise what the writer itself ran into. */
+static void yyaml_write_failed(yyaml_err *err, const yyaml_err *inner,
+                               const yyaml_writer *wr) {
+    if (inner->code != YYAML_ERR_NONE) {
+        if (err) *err = *inner;
+    } else if (wr->sink_failed) {
+        yyaml_set_failure(err, YYAML_ERR_IO, "output write failed");
+    } else {
+        yyaml_set_failure(err, YYAML_ERR_MEMORY, "out of memory");
+    }
 }
 
-static bool yyaml_writer_putc(yyaml_writer *wr, char c) {
-    if (!yyaml_writer_ensure(wr, 1)) return false;
-    wr->buf[wr->len++] = c;
+/* Serialize root into a newly allocated, NUL-terminated buffer. */
+static bool yyaml_write_alloc(const yyaml_node *root, char **out,
+                              size_t *out_len, const yyaml_write_opts *opts,
+                              bool json, yyaml_err *err) {
+    yyaml_writer wr = {0};
+    yyaml_err inner = {0};
+    const yyaml_doc *doc = root ? root->doc : NULL;
+    bool ok;
+    if (!out) {
+        yyaml_set_failure(err, YYAML_ERR_INVALID, "invalid output buffer");
+        return false;
+    }
+    *out = NULL;
+    if (out_len) *out_len = 0;
+    if (root && !doc) {
+        yyaml_set_failure(err, YYAML_ERR_INVALID, "node is not bound to a document");
+        return false;
+    }
+    if (!json) {
+        yyaml_write_part parts[YYAML_WRITE_MAX_THREADS];
+        yyaml_emit_cfg cfg;
+        size_t n;
+        yyaml_emit_cfg_init(&cfg, opts);
+        n = yyaml_write_split(root, opts, &cfg, parts);
+        if (n) {
+            /* the joined buffer is exact, so exact_size needs no measuring */
+            ok = yyaml_write_parts(parts, n) &&
+                 yyaml_write_join(parts, n, opts->final_newline, out, out_len);
+            yyaml_write_parts_free(parts, n);
+            if (!ok) yyaml_set_failure(err, YYAML_ERR_MEMORY, "out of memory");
+            return ok;
+        }
+    }
+    if (!json && opts && opts->exact_size) {
+        /* measure first so the buffer is allocated once, without slack */
+        wr.cap = yyaml_write_len(root, opts) + 1;
+        wr.buf = (char *)malloc(wr.cap);
+        if (!wr.buf) goto nomem;
+    } else if (doc) {
+        /* Pre-size the writer buffer to reduce reallocations for large
+         * documents. */
+        size_t guess = doc->scalar_len + (doc->node_count * 32) + 32;
+        if (guess < 256) guess = 256;
+        yyaml_writer_reserve(&wr, guess);
+    }
+    ok = json ? yyaml_write_json_root(root, &wr, opts)
+              : yyaml_write_root(root, &wr, opts, &inner);
+    if (!ok) goto nomem;
+    if (!yyaml_writer_ensure(&wr, 0)) goto nomem;
+    wr.buf[wr.len] = '\0';
+    *out = wr.buf;
+    if (out_len) *out_len = wr.len;
     return true;
+nomem:
+    yyaml_write_failed(err, &inner, &wr);
+    free(wr.buf);
+    return false;
 }
 
-static bool yyaml_writer_write(yyaml_writer *wr, const char *str, size_t len) {
-    if (!len) return true;
-    if (!yyaml_writer_ensure(wr, len)) return false;
-    memcpy(wr->buf + wr->len, str, len);
-    wr->len += len;
-    return true;
+YYAML_API bool yyaml_write(const yyaml_node *root, char **out, size_t *out_len,
+                           const yyaml_write_opts *opts, yyaml_err *err) {
+    return yyaml_write_alloc(root, out, out_len, opts, false, err);
 }
 
-static bool yyaml_writer_indent(yyaml_writer *wr, size_t indent, size_t depth) {
-    size_t total = indent * depth;
-    size_t i;
-    if (!total) return true;
-    if (!yyaml_writer_ensure(wr, total)) return false;
-    for (i = 0; i < total; i++) {
-        wr->buf[wr->len++] = ' ';
+YYAML_API bool yyaml_write_json(const yyaml_node *root, char **out,
+                                size_t *out_len, const yyaml_write_opts *opts,
+                                yyaml_err *err) {
+    return yyaml_write_alloc(root, out, out_len, opts, true, err);
+}
+
+YYAML_API bool yyaml_write_buf(const yyaml_node *root, char *buf, size_t cap,
+                               size_t *written, const yyaml_write_opts *opts,
+                               yyaml_err *err) {
+    yyaml_writer wr = {0};
+    yyaml_err inner = {0};
+    if (written) *written = 0;
+    if (!buf && cap) {
+        yyaml_set_failure(err, YYAML_ERR_INVALID, "invalid output buffer");
+        return false;
+    }
+    if (root && !root->doc) {
+        yyaml_set_failure(err, YYAML_ERR_INVALID, "node is not bound to a document");
+        return false;
+    }
+    wr.buf = buf;
+    wr.cap = cap;
+    wr.fixed = true;
+    if (!yyaml_write_root(root, &wr, opts, &inner)) {
+        if (inner.code != YYAML_ERR_NONE) {
+            if (err) *err = inner;
+            return false;
+        }
+        /* the writer itself only fails by running out of room */
+        if (written) *written = yyaml_write_len(root, opts);
+        yyaml_set_failure(err, YYAML_ERR_INVALID, "output buffer too small");
+        return false;
     }
+    if (wr.len < cap) buf[wr.len] = '\0';
+    if (written) *written = wr.len;
     return true;
 }
 
-static bool yyaml_writer_write_double(yyaml_writer *wr, double val) {
-    char tmp[64];
-    int len;
-    if (isnan(val)) {
-        return yyaml_writer_write(wr, "nan", 3);
+YYAML_API bool yyaml_write_cb(const yyaml_node *root, yyaml_write_fn sink,
+                              void *ctx, const yyaml_write_opts *opts,
+                              yyaml_err *err) {
+    yyaml_writer wr = {0};
+    yyaml_err inner = {0};
+    bool ok;
+    if (!sink) {
+        yyaml_set_failure(err, YYAML_ERR_INVALID, "invalid output sink");
+        return false;
     }
-    if (isinf(val)) {
-        if (val < 0) return yyaml_writer_write(wr, "-inf", 4);
-        return yyaml_writer_write(wr, "inf", 3);
+    if (root && !root->doc) {
+        yyaml_set_failure(err, YYAML_ERR_INVALID, "node is not bound to a document");
+        return false;
     }
-    len = snprintf(tmp, sizeof(tmp), "%.17g", val);
-    if (len < 0) return false;
-
-    /* Ensure we preserve a decimal suffix when the value originated from a
-     * floating literal like "1.0". The default %g formatting drops the
-     * fractional part for integral values, so append ".0" when no decimal or
-     * exponent is present. */
-    if (strchr(tmp, '.') == NULL && strchr(tmp, 'e') == NULL &&
-        strchr(tmp, 'E') == NULL) {
-        if ((size_t)len + 2 >= sizeof(tmp)) return false;
-        tmp[len++] = '.';
-        tmp[len++] = '0';
-        tmp[len] = '\0';
+    if (!yyaml_writer_reserve(&wr, YYAML_WRITE_BUF_SIZE)) {
+        yyaml_set_failure(err, YYAML_ERR_MEMORY, "out of memory");
+        return false;
     }
+    wr.sink = sink;
+    wr.ctx = ctx;
+    ok = yyaml_write_root(root, &wr, opts, &inner) && yyaml_writer_flush(&wr);
+    if (!ok) yyaml_write_failed(err, &inner, &wr);
+    free(wr.buf);
+    return ok;
+}
 
-    return yyaml_writer_write(wr, tmp, (size_t)len);
+static bool yyaml_write_fp_sink(void *ctx, const char *data, size_t len) {
+    return fwrite(data, 1, len, (FILE *)ctx) == len;
 }
 
-static bool yyaml_writer_write_int(yyaml_writer *wr, int64_t val) {
-    char tmp[32];
-    int len = snprintf(tmp, sizeof(tmp), "%lld", (long long)val);
-    if (len < 0) return false;
-    return yyaml_writer_write(wr, tmp, (size_t)len);
+YYAML_API bool yyaml_write_fp(const yyaml_node *root, FILE *fp,
+                              const yyaml_write_opts *opts, yyaml_err *err) {
+    if (!fp) {
+        yyaml_set_failure(err, YYAML_ERR_INVALID, "invalid output stream");
+        return false;
+    }
+    return yyaml_write_cb(root, yyaml_write_fp_sink, fp, opts, err);
 }
 
-static bool yyaml_writer_is_plain_scalar(const char *str, size_t len) {
-    size_t i;
-    if (len == 0) return false;
-    if (!(isalpha((unsigned char)str[0]) || str[0] == '_')) return false;
-    for (i = 0; i < len; i++) {
-        unsigned char c = (unsigned char)str[i];
-        if (!(isalnum(c) || c == '_' || c == '-')) return false;
+#ifdef YYAML_HAS_POSIX
+static bool yyaml_write_fd_sink(void *ctx, const char *data, size_t len) {
+    int fd = *(const int *)ctx;
+    while (len) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= (size_t)n;
     }
     return true;
 }
 
-static bool yyaml_writer_write_string_literal(yyaml_writer *wr, const char *str,
-                                              size_t len) {
+/* writev every iovec to fd, retrying partial writes and EINTR. */
+static bool yyaml_writev_all(int fd, struct iovec *iov, int count) {
+    while (count) {
+        ssize_t n = writev(fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        while (count && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return true;
+}
+#endif
+
+YYAML_API bool yyaml_write_fd(const yyaml_node *root, int fd,
+                              const yyaml_write_opts *opts, yyaml_err *err) {
+#ifdef YYAML_HAS_POSIX
+    yyaml_write_part parts[YYAML_WRITE_MAX_THREADS];
+    struct iovec iov[YYAML_WRITE_MAX_THREADS + 1];
+    yyaml_emit_cfg cfg;
+    size_t n;
     size_t i;
-    if (yyaml_writer_is_plain_scalar(str, len)) {
-        return yyaml_writer_write(wr, str, len);
+    bool ok;
+    if (fd < 0) {
+        yyaml_set_failure(err, YYAML_ERR_INVALID, "invalid file descriptor");
+        return false;
     }
-    if (!yyaml_writer_putc(wr, '"')) return false;
-    for (i = 0; i < len; i++) {
-        unsigned char c = (unsigned char)str[i];
-        switch (c) {
-        case '\\':
-            if (!yyaml_writer_write(wr, "\\\\", 2)) return false;
-            break;
-        case '\"':
-            if (!yyaml_writer_write(wr, "\\\"", 2)) return false;
-            break;
-        case '\n':
-            if (!yyaml_writer_write(wr, "\\n", 2)) return false;
-            break;
-        case '\r':
-            if (!yyaml_writer_write(wr, "\\r", 2)) return false;
-            break;
-        case '\t':
-            if (!yyaml_writer_write(wr, "\\t", 2)) return false;
-            break;
-        default:
-            if (c < 0x20) {
-                char esc[5];
-                esc[0] = '\\';
-                esc[1] = 'x';
-                esc[2] = "0123456789ABCDEF"[c >> 4];
-                esc[3] = "0123456789ABCDEF"[c & 0xF];
-                esc[4] = '\0';
-                if (!yyaml_writer_write(wr, esc, 4)) return false;
-            } else {
-                if (!yyaml_writer_putc(wr, (char)c)) return false;
-            }
-            break;
-        }
+    if (root && !root->doc) {
+        yyaml_set_failure(err, YYAML_ERR_INVALID, "node is not bound to a document");
+        return false;
     }
-    return yyaml_writer_putc(wr, '"');
+    yyaml_emit_cfg_init(&cfg, opts);
+    n = yyaml_write_split(root, opts, &cfg, parts);
+    if (!n) return yyaml_write_cb(root, yyaml_write_fd_sink, &fd, opts, err);
+    /* render every range in memory, then scatter them in one writev */
+    if (!yyaml_write_parts(parts, n)) {
+        yyaml_write_parts_free(parts, n);
+        yyaml_set_failure(err, YYAML_ERR_MEMORY, "out of memory");
+        return false;
+    }
+    for (i = 0; i < n; i++) {
+        iov[i].iov_base = parts[i].wr.buf;
+        iov[i].iov_len = parts[i].wr.len;
+    }
+    iov[n].iov_base = (void *)"\n";
+    iov[n].iov_len = opts->final_newline;
+    ok = yyaml_writev_all(fd, iov, (int)n + 1);
+    yyaml_write_parts_free(parts, n);
+    if (!ok) yyaml_set_failure(err, YYAML_ERR_IO, "output write failed");
+    return ok;
+#else
+    (void)root;
+    (void)fd;
+    (void)opts;
+    yyaml_set_failure(err, YYAML_ERR_INVALID, "file descriptor output is not supported");
+    return false;
+#endif
 }
 
-static bool yyaml_writer_write_string_node(const yyaml_doc *doc,
-                                           const yyaml_node *node,
-                                           yyaml_writer *wr) {
-    const char *buf = yyaml_doc_get_scalar_buf(doc);
-    if (!buf) buf = "";
-    return yyaml_writer_write_string_literal(
-        wr, buf + node->val.str.ofs, node->val.str.len);
+/* ---------------------------- streaming emitter ---------------------------- */
+
+/* How a block collection starts: it cannot be written until its first entry
+ * or its end shows whether it is empty (`key: []`) or not (`key:` and a new
+ * line). */
+enum { YYAML_EMIT_ROOT, YYAML_EMIT_ITEM, YYAML_EMIT_VALUE };
+
+typedef struct {
+    bool seq;           /* sequence, else mapping */
+    bool flow;
+    bool inline_first;  /* mapping opened by "- ": first entry not indented */
+    bool key_pending;   /* mapping: key written, value expected */
+    bool open_newline;  /* item context: newline before "- " */
+    uint8_t ctx;        /* YYAML_EMIT_* context the collection was begun in */
+    size_t open_pad;    /* item context: indentation before "- " */
+    size_t depth;
+    size_t count;       /* entries written so far */
+} yyaml_emit_frame;
+
+struct yyaml_emitter {
+    yyaml_writer wr;
+    yyaml_emit_cfg cfg;
+    bool final_newline;
+    bool root_done;
+    yyaml_emit_frame *stack;
+    size_t depth;        /* frames in use */
+    size_t cap;
+    const char *error;   /* first failure; every later call fails too */
+    yyaml_err_code error_code;
+};
+
+static yyaml_emitter *yyaml_emitter_alloc(const yyaml_write_opts *opts) {
+    yyaml_emitter *em = (yyaml_emitter *)calloc(1, sizeof(*em));
+    if (!em) return NULL;
+    yyaml_emit_cfg_init(&em->cfg, opts);
+    em->final_newline = opts ? opts->final_newline : true;
+    return em;
 }
 
-static bool yyaml_writer_write_key(const yyaml_doc *doc, const yyaml_node *node,
-                                   yyaml_writer *wr) {
-    const char *buf = yyaml_doc_get_scalar_buf(doc);
-    if (!buf) buf = "";
-    return yyaml_writer_write_string_literal(wr, buf + node->extra,
-                                             node->flags);
+YYAML_API yyaml_emitter *yyaml_emitter_new(const yyaml_write_opts *opts) {
+    return yyaml_emitter_alloc(opts);
 }
 
-static bool yyaml_write_node_internal(const yyaml_doc *doc,
-                                      const yyaml_node *node,
-                                      size_t depth, size_t indent,
-                                      yyaml_writer *wr, yyaml_err *err);
+YYAML_API yyaml_emitter *yyaml_emitter_new_cb(yyaml_write_fn sink, void *ctx,
+                                              const yyaml_write_opts *opts) {
+    yyaml_emitter *em;
+    if (!sink) return NULL;
+    em = yyaml_emitter_alloc(opts);
+    if (!em) return NULL;
+    if (!yyaml_writer_reserve(&em->wr, YYAML_WRITE_BUF_SIZE)) {
+        free(em);
+        return NULL;
+    }
+    em->wr.sink = sink;
+    em->wr.ctx = ctx;
+    return em;
+}
 
-static bool yyaml_writer_write_mapping(const yyaml_doc *doc,
-                                       const yyaml_node *node, size_t depth,
-                                       size_t indent, yyaml_writer *wr,
-                                       yyaml_err *err, bool inline_first);
+YYAML_API void yyaml_emitter_free(yyaml_emitter *em) {
+    if (!em) return;
+    free(em->wr.buf);
+    free(em->stack);
+    free(em);
+}
 
-static bool yyaml_writer_write_sequence(const yyaml_doc *doc,
-                                        const yyaml_node *node, size_t depth,
-                                        size_t indent, yyaml_writer *wr,
-                                        yyaml_err *err, bool inline_first) {
-    uint32_t idx;
-    bool first = true;
-    if (!node || node->type != YYAML_SEQUENCE) return false;
-    if (node->child == YYAML_INDEX_NONE) {
-        if (!inline_first) {
-            if (!yyaml_writer_indent(wr, indent, depth)) return false;
-        }
-        return yyaml_writer_write(wr, "[]", 2);
+static bool yyaml_emitter_fail(yyaml_emitter *em, yyaml_err_code code,
+                               const char *msg) {
+    if (!em->error) {
+        em->error = msg;
+        em->error_code = code;
     }
-    idx = node->child;
-    while (idx != YYAML_INDEX_NONE) {
-        const yyaml_node *child = &doc->nodes[idx];
-        if (!first) {
-            if (!yyaml_writer_putc(wr, '\n')) return false;
-        }
-        if (!(inline_first && first)) {
-            if (!yyaml_writer_indent(wr, indent, depth)) return false;
+    return false;
+}
+
+/* A writer call failed: out of memory, or the sink refused the data. */
+static bool yyaml_emitter_write_failed(yyaml_emitter *em) {
+    if (em->wr.sink_failed) {
+        return yyaml_emitter_fail(em, YYAML_ERR_IO, "output write failed");
+    }
+    return yyaml_emitter_fail(em, YYAML_ERR_MEMORY, "out of memory");
+}
+
+/* Start of the line for the next entry of block collection f. */
+static bool yyaml_emitter_line(yyaml_emitter *em, const yyaml_emit_frame *f,
+                               const char *head, size_t head_len) {
+    size_t pad = (f->count == 0 && f->inline_first) ? 0
+                                                    : em->cfg.indent * f->depth;
+    return yyaml_writer_begin_line(&em->wr, f->count > 0, pad, head, head_len,
+                                   "", 0);
+}
+
+/* Write the deferred start of block collection f before its first entry,
+ * or its empty form when it ends without one. */
+static bool yyaml_emitter_open(yyaml_emitter *em, const yyaml_emit_frame *f,
+                               bool empty) {
+    static const char *item[2][2] = {{"- {}", "- []"}, {"- ", "-\n"}};
+    switch (f->ctx) {
+    case YYAML_EMIT_ITEM:
+        return yyaml_writer_begin_line(&em->wr, f->open_newline, f->open_pad,
+                                       item[!empty][f->seq],
+                                       empty ? 4 : 2, "", 0);
+    case YYAML_EMIT_VALUE:
+        if (empty) return yyaml_writer_write(&em->wr, f->seq ? ": []" : ": {}", 4);
+        return yyaml_writer_write(&em->wr, ":\n", 2);
+    default:
+        if (empty) return yyaml_writer_write(&em->wr, f->seq ? "[]" : "{}", 2);
+        return true;
+    }
+}
+
+/* Account for a new value in the innermost collection and write what goes
+ * before it. A block collection begun here writes nothing yet; its context
+ * is recorded in child instead. */
+static bool yyaml_emitter_value(yyaml_emitter *em, yyaml_emit_frame *child) {
+    yyaml_emit_frame *f;
+    bool deferred = child && !child->flow;
+    if (em->error) return false;
+    if (!em->depth) {
+        if (em->root_done) {
+            return yyaml_emitter_fail(em, YYAML_ERR_INVALID,
+                                      "multiple root values");
         }
-        if (child->type == YYAML_SEQUENCE) {
-            if (child->child == YYAML_INDEX_NONE) {
-                if (!yyaml_writer_write(wr, "- []", 4)) return false;
-            } else {
-                if (!yyaml_writer_write(wr, "-\n", 2)) return false;
-                if (!yyaml_writer_write_sequence(doc, child, depth + 1, indent, wr,
-                                                 err, false))
-                    return false;
-            }
-        } else if (child->type == YYAML_MAPPING) {
-            if (!yyaml_writer_write(wr, "- ", 2)) return false;
-            if (!yyaml_writer_write_mapping(doc, child, depth + 1, indent, wr,
-                                            err, true))
-                return false;
+        em->root_done = true;
+        if (deferred) child->ctx = YYAML_EMIT_ROOT;
+        return true;
+    }
+    f = &em->stack[em->depth - 1];
+    if (f->seq) {
+        bool ok = true;
+        if (!f->flow && f->count == 0) ok = yyaml_emitter_open(em, f, false);
+        if (f->flow) {
+            if (f->count) ok = ok && yyaml_writer_write(&em->wr, ", ", 2);
+        } else if (deferred) {
+            child->ctx = YYAML_EMIT_ITEM;
+            child->open_newline = f->count > 0;
+            child->open_pad = (f->count == 0 && f->inline_first)
+                                  ? 0 : em->cfg.indent * f->depth;
         } else {
-            if (!yyaml_writer_write(wr, "- ", 2)) return false;
-            if (!yyaml_write_node_internal(doc, child, depth + 1, indent, wr,
-                                           err))
-                return false;
+            ok = ok && yyaml_emitter_line(em, f, "- ", 2);
         }
-        first = false;
-        idx = child->next;
+        f->count++;
+        return ok || yyaml_emitter_write_failed(em);
     }
-    return true;
+    if (!f->key_pending) {
+        return yyaml_emitter_fail(em, YYAML_ERR_INVALID,
+                                  "mapping value without key");
+    }
+    f->key_pending = false;
+    if (deferred) {
+        child->ctx = YYAML_EMIT_VALUE;
+        return true;
+    }
+    return yyaml_writer_write(&em->wr, ": ", 2) || yyaml_emitter_write_failed(em);
 }
 
-static bool yyaml_writer_write_mapping(const yyaml_doc *doc,
-                                       const yyaml_node *node, size_t depth,
-                                       size_t indent, yyaml_writer *wr,
-                                       yyaml_err *err, bool inline_first) {
-    uint32_t idx;
-    bool first = true;
-    if (!node || node->type != YYAML_MAPPING) return false;
-    if (node->child == YYAML_INDEX_NONE) {
-        if (!inline_first) {
-            if (!yyaml_writer_indent(wr, indent, depth)) return false;
+static bool yyaml_emitter_begin(yyaml_emitter *em, bool seq) {
+    yyaml_emit_frame frame = {0};
+    const yyaml_emit_frame *top = em->depth ? &em->stack[em->depth - 1] : NULL;
+    frame.seq = seq;
+    /* the auto style needs the whole collection up front, so it emits block */
+    frame.flow = em->cfg.style == YYAML_STYLE_LINE ||
+                 (em->cfg.style == YYAML_STYLE_FLOW && top);
+    frame.depth = top ? top->depth + 1 : 0;
+    frame.inline_first = !seq && top && top->seq && !top->flow;
+    if (!yyaml_emitter_value(em, &frame)) return false;
+    if (frame.flow && !yyaml_writer_putc(&em->wr, seq ? '[' : '{'))
+        return yyaml_emitter_write_failed(em);
+    if (em->depth == em->cap) {
+        size_t cap = yyaml_next_capacity(em->cap, em->depth + 1, 16);
+        yyaml_emit_frame *stack = (yyaml_emit_frame *)realloc(
+            em->stack, cap * sizeof(*stack));
+        if (!stack) {
+            return yyaml_emitter_fail(em, YYAML_ERR_MEMORY, "out of memory");
         }
-        return yyaml_writer_write(wr, "{}", 2);
+        em->stack = stack;
+        em->cap = cap;
     }
-    idx = node->child;
-    while (idx != YYAML_INDEX_NONE) {
-        const yyaml_node *child = &doc->nodes[idx];
-        if (!first) {
-            if (!yyaml_writer_putc(wr, '\n')) return false;
-        }
-        if (!(inline_first && first)) {
-            if (!yyaml_writer_indent(wr, indent, depth)) return false;
-        }
-        if (!yyaml_writer_write_key(doc, child, wr)) return false;
-        if (child->type == YYAML_MAPPING && child->child == YYAML_INDEX_NONE) {
-            if (!yyaml_writer_write(wr, ": {}", 4)) return false;
-        } else if (child->type == YYAML_SEQUENCE &&
-                   child->child == YYAML_INDEX_NONE) {
-            if (!yyaml_writer_write(wr, ": []", 4)) return false;
-        } else if (child->type == YYAML_SEQUENCE || child->type == YYAML_MAPPING) {
-            if (!yyaml_writer_write(wr, ":\n", 2)) return false;
-            if (!yyaml_write_node_internal(doc, child, depth + 1, indent, wr,
-                                           err))
-                return false;
+    em->stack[em->depth++] = frame;
+    return true;
+}
+
+static bool yyaml_emitter_end(yyaml_emitter *em, bool seq) {
+    yyaml_emit_frame *f;
+    bool ok;
+    if (em->error) return false;
+    f = em->depth ? &em->stack[em->depth - 1] : NULL;
+    if (!f || f->seq != seq) {
+        return yyaml_emitter_fail(em, YYAML_ERR_INVALID,
+                                  seq ? "end_seq without open sequence"
+                                      : "end_map without open mapping");
+    }
+    if (f->key_pending) {
+        return yyaml_emitter_fail(em, YYAML_ERR_INVALID,
+                                  "mapping key without value");
+    }
+    if (f->flow) ok = yyaml_writer_putc(&em->wr, seq ? ']' : '}');
+    else ok = f->count || yyaml_emitter_open(em, f, true);
+    em->depth--;
+    return ok || yyaml_emitter_write_failed(em);
+}
+
+YYAML_API bool yyaml_emitter_begin_seq(yyaml_emitter *em) {
+    return em && yyaml_emitter_begin(em, true);
+}
+
+YYAML_API bool yyaml_emitter_end_seq(yyaml_emitter *em) {
+    return em && yyaml_emitter_end(em, true);
+}
+
+YYAML_API bool yyaml_emitter_begin_map(yyaml_emitter *em) {
+    return em && yyaml_emitter_begin(em, false);
+}
+
+YYAML_API bool yyaml_emitter_end_map(yyaml_emitter *em) {
+    return em && yyaml_emitter_end(em, false);
+}
+
+YYAML_API bool yyaml_emitter_key(yyaml_emitter *em, const char *key,
+                                 size_t len) {
+    yyaml_emit_frame *f;
+    bool ok = true;
+    if (!em || em->error) return false;
+    f = em->depth ? &em->stack[em->depth - 1] : NULL;
+    if (!f || f->seq) {
+        return yyaml_emitter_fail(em, YYAML_ERR_INVALID, "key outside a mapping");
+    }
+    if (f->key_pending) {
+        return yyaml_emitter_fail(em, YYAML_ERR_INVALID,
+                                  "mapping key without value");
+    }
+    if (!key && len) {
+        return yyaml_emitter_fail(em, YYAML_ERR_INVALID, "invalid argument");
+    }
+    if (!key) key = "";
+    if (f->flow) {
+        if (f->count) ok = yyaml_writer_write(&em->wr, ", ", 2);
+        ok = ok && yyaml_writer_write_string_literal(&em->wr, key, len);
+    } else {
+        if (f->count == 0) ok = yyaml_emitter_open(em, f, false);
+        if (yyaml_writer_is_plain_scalar(key, len)) {
+            ok = ok && yyaml_emitter_line(em, f, key, len);
         } else {
-            if (!yyaml_writer_write(wr, ": ", 2)) return false;
-            if (!yyaml_write_node_internal(doc, child, depth + 1, indent, wr,
-                                           err))
-                return false;
+            ok = ok && yyaml_emitter_line(em, f, "", 0) &&
+                 yyaml_writer_write_quoted(&em->wr, key, len, false);
         }
-        first = false;
-        idx = child->next;
     }
-    return true;
+    f->count++;
+    f->key_pending = true;
+    return ok || yyaml_emitter_write_failed(em);
 }
 
-static bool yyaml_write_node_internal(const yyaml_doc *doc,
-                                      const yyaml_node *node,
-                                      size_t depth, size_t indent,
-                                      yyaml_writer *wr, yyaml_err *err) {
-    (void)err;
-    if (!node) return yyaml_writer_write(wr, "null", 4);
-    switch (node->type) {
-    case YYAML_NULL:
-        return yyaml_writer_write(wr, "null", 4);
-    case YYAML_BOOL:
-        return yyaml_writer_write(wr, node->val.boolean ? "true" : "false",
-                                  node->val.boolean ? 4 : 5);
-    case YYAML_INT:
-        return yyaml_writer_write_int(wr, node->val.integer);
-    case YYAML_DOUBLE:
-        return yyaml_writer_write_double(wr, node->val.real);
-    case YYAML_STRING:
-        return yyaml_writer_write_string_node(doc, node, wr);
-    case YYAML_SEQUENCE:
-        return yyaml_writer_write_sequence(doc, node, depth, indent, wr, err,
-                                           false);
-    case YYAML_MAPPING:
-        return yyaml_writer_write_mapping(doc, node, depth, indent, wr, err,
-                                          false);
-    default:
-        return false;
-    }
+YYAML_API bool yyaml_emitter_null(yyaml_emitter *em) {
+    if (!em || !yyaml_emitter_value(em, NULL)) return false;
+    return yyaml_writer_write(&em->wr, "null", 4) ||
+           yyaml_emitter_write_failed(em);
 }
 
-YYAML_API bool yyaml_write(const yyaml_node *root, char **out, size_t *out_len,
-                           const yyaml_write_opts *opts, yyaml_err *err) {
-    yyaml_writer wr = {0};
-    const yyaml_doc *doc = root ? root->doc : NULL;
-    size_t indent = 2;
-    bool final_newline = true;
-    if (!out) {
-        yyaml_set_error(err, 0, 0, 0, "invalid output buffer");
-        return false;
+YYAML_API bool yyaml_emitter_bool(yyaml_emitter *em, bool value) {
+    if (!em || !yyaml_emitter_value(em, NULL)) return false;
+    return yyaml_writer_write(&em->wr, value ? "true" : "false",
+                              value ? 4 : 5) ||
+           yyaml_emitter_write_failed(em);
+}
+
+YYAML_API bool yyaml_emitter_int(yyaml_emitter *em, int64_t value) {
+    if (!em || !yyaml_emitter_value(em, NULL)) return false;
+    return yyaml_writer_write_int(&em->wr, value) ||
+           yyaml_emitter_write_failed(em);
+}
+
+YYAML_API bool yyaml_emitter_double(yyaml_emitter *em, double value) {
+    if (!em || !yyaml_emitter_value(em, NULL)) return false;
+    if (em->cfg.canonical && value == 0) value = 0.0;
+    return yyaml_writer_write_double(&em->wr, value) ||
+           yyaml_emitter_write_failed(em);
+}
+
+YYAML_API bool yyaml_emitter_string(yyaml_emitter *em, const char *str,
+                                    size_t len) {
+    if (!em) return false;
+    if (!str && len) {
+        return yyaml_emitter_fail(em, YYAML_ERR_INVALID, "invalid argument");
     }
-    *out = NULL;
+    if (!yyaml_emitter_value(em, NULL)) return false;
+    return yyaml_writer_write_string_literal(&em->wr, str ? str : "", len) ||
+           yyaml_emitter_write_failed(em);
+}
+
+YYAML_API bool yyaml_emitter_finish(yyaml_emitter *em, char **out,
+                                    size_t *out_len, yyaml_err *err) {
+    bool ok = true;
+    if (out) *out = NULL;
     if (out_len) *out_len = 0;
-    if (opts) {
-        if (opts->indent) indent = opts->indent;
-        final_newline = opts->final_newline;
-    }
-    if (root && !doc) {
-        yyaml_set_error(err, 0, 0, 0, "node is not bound to a document");
+    if (!em) {
+        yyaml_set_failure(err, YYAML_ERR_INVALID, "invalid argument");
         return false;
     }
-    /* Pre-size the writer buffer to reduce reallocations for large documents. */
-    if (doc) {
-        size_t guess = doc->scalar_len + (doc->node_count * 32) + 32;
-        if (guess < 256) guess = 256;
-        yyaml_writer_reserve(&wr, guess);
+    if (!em->wr.sink && !out) {
+        yyaml_emitter_fail(em, YYAML_ERR_INVALID, "invalid output buffer");
     }
-    if (!root) {
-        if (!yyaml_writer_write(&wr, "null", 4)) goto nomem;
-    } else {
-        if (!yyaml_write_node_internal(doc, root, 0, indent, &wr, err))
-            goto nomem;
+    if (em->depth) yyaml_emitter_fail(em, YYAML_ERR_INVALID, "unclosed collection");
+    if (!em->error) {
+        /* an empty stream is a null document, as for yyaml_write(NULL) */
+        if (!em->root_done) ok = yyaml_writer_write(&em->wr, "null", 4);
+        if (em->final_newline) ok = ok && yyaml_writer_putc(&em->wr, '\n');
+        ok = ok && (em->wr.sink ? yyaml_writer_flush(&em->wr)
+                                : yyaml_writer_ensure(&em->wr, 0));
+        if (!ok) yyaml_emitter_write_failed(em);
     }
-    if (final_newline) {
-        if (!yyaml_writer_putc(&wr, '\n')) goto nomem;
+    if (em->error) {
+        yyaml_set_failure(err, em->error_code, em->error);
+        return false;
     }
-    if (!yyaml_writer_ensure(&wr, 0)) goto nomem;
-    wr.buf[wr.len] = '\0';
-    *out = wr.buf;
-    if (out_len) *out_len = wr.len;
+    if (!em->wr.sink) {
+        em->wr.buf[em->wr.len] = '\0';
+        *out = em->wr.buf;
+        if (out_len) *out_len = em->wr.len;
+        em->wr.buf = NULL;
+    }
+    em->error = "emitter already finished";
+    em->error_code = YYAML_ERR_INVALID;
     return true;
-nomem:
-    yyaml_set_error(err, 0, 0, 0, "out of memory");
-    free(wr.buf);
-    return false;
 }
 
 YYAML_API void yyaml_free_string(char *str) {
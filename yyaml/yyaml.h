@@ -51,6 +51,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
 
 #ifdef __cplusplus
@@ -89,6 +90,21 @@ extern "C" {
 #    define YYAML_STR_CAP_INIT 256
 #endif
 
+/* Configure the buffer size used by the streaming writers. */
+#ifndef YYAML_WRITE_BUF_SIZE
+#    define YYAML_WRITE_BUF_SIZE 65536
+#endif
+
+/* Configure the upper bound on yyaml_write_opts.threads. */
+#ifndef YYAML_WRITE_MAX_THREADS
+#    define YYAML_WRITE_MAX_THREADS 64
+#endif
+
+/* Configure the minimum number of nodes each writer thread is given. */
+#ifndef YYAML_WRITE_SPLIT_NODES
+#    define YYAML_WRITE_SPLIT_NODES 16384
+#endif
+
 /* ----------------------------- public types ------------------------------ */
 
 /**
@@ -137,24 +153,70 @@ typedef struct yyaml_read_opts {
     bool allow_trailing_content; /**< ignore trailing non-empty content */
     bool allow_inf_nan;          /**< parse inf/nan literals */
     size_t max_nesting;          /**< maximum indentation nesting depth */
+    bool compact;                /**< run yyaml_doc_compact after parsing */
+    bool keep_source;            /**< keep a copy of the text and each block
+                                      node's byte range, so yyaml_write copies
+                                      entries that were not modified verbatim,
+                                      comments and spacing included */
 } yyaml_read_opts;
 
+/**
+ * @brief Category of a reported error.
+ */
+typedef enum yyaml_err_code {
+    YYAML_ERR_NONE = 0, /**< nothing reported */
+    YYAML_ERR_PARSE,    /**< malformed input, located by pos, line and column */
+    YYAML_ERR_IO,       /**< a file, mapping or output sink failed */
+    YYAML_ERR_MEMORY,   /**< an allocation failed */
+    YYAML_ERR_INVALID   /**< bad argument, misuse or corrupt binary image */
+} yyaml_err_code;
+
 /**
  * @brief Error details returned by the parser and writer.
+ *
+ * Position fields are 0 unless code is YYAML_ERR_PARSE.
  */
 typedef struct yyaml_err {
     size_t pos;      /**< byte offset */
     size_t line;     /**< 1-based line number */
     size_t column;   /**< 1-based column number */
     char msg[96];    /**< error message */
+    yyaml_err_code code; /**< what kind of failure msg describes */
 } yyaml_err;
 
 /**
- * @brief Serialization options for yyaml_write.
+ * @brief Collection layout used by yyaml_write.
+ *
+ * Flow collections are always written on one line, e.g. `[1, 2]` or
+ * `{a: 1, b: x}`.
+ */
+typedef enum yyaml_write_style {
+    YYAML_STYLE_BLOCK = 0, /**< block collections everywhere (default) */
+    YYAML_STYLE_AUTO,      /**< flow for scalar-only sequences and for
+                                scalar-only mappings within flow_width */
+    YYAML_STYLE_FLOW,      /**< every collection below the root in flow, so
+                                each root entry takes one line */
+    YYAML_STYLE_LINE       /**< the whole document on a single line */
+} yyaml_write_style;
+
+/**
+ * @brief Serialization options for yyaml_write and yyaml_write_json.
  */
 typedef struct yyaml_write_opts {
     size_t indent;        /**< spaces per indentation level, default 2 */
     bool final_newline;   /**< append trailing newline (default true) */
+    bool pretty;          /**< JSON only: one value per line (default minified) */
+    bool exact_size;      /**< yyaml_write: measure first, allocate once */
+    yyaml_write_style style; /**< YAML only: collection layout, default block */
+    size_t flow_width;    /**< YYAML_STYLE_AUTO mapping limit, default 80 */
+    size_t threads;       /**< yyaml_write, yyaml_write_fd: split large block
+                               documents across this many threads (POSIX
+                               only, 0 or 1 = serial) */
+    bool sort_keys;       /**< write mapping entries ordered by key bytes,
+                               duplicate keys keep their order */
+    bool canonical;       /**< deterministic output for hashing and diffing:
+                               sorted keys, -0.0 written as 0.0 and no text
+                               reused from keep_source */
 } yyaml_write_opts;
 
 /* ---------------------------- reading API -------------------------------- */
@@ -172,6 +234,20 @@ YYAML_API yyaml_doc *yyaml_read(const char *data, size_t len,
                                 const yyaml_read_opts *opts,
                                 yyaml_err *err);
 
+/**
+ * @brief Parse a YAML file.
+ *
+ * On POSIX systems the file is memory-mapped and parsed in place with a
+ * sequential access hint; elsewhere it is read into a temporary buffer.
+ * The document does not reference the file once the call returns.
+ *
+ * @param path Path to the YAML file.
+ * @return Allocated document on success or NULL on failure.
+ */
+YYAML_API yyaml_doc *yyaml_read_file(const char *path,
+                                     const yyaml_read_opts *opts,
+                                     yyaml_err *err);
+
 /** @brief Allocate an empty document for manual construction. */
 YYAML_API yyaml_doc *yyaml_doc_new(void);
 
@@ -181,7 +257,7 @@ YYAML_API void yyaml_doc_free(yyaml_doc *doc);
 /** @brief Retrieve the root node of a document. */
 YYAML_API const yyaml_node *yyaml_doc_get_root(const yyaml_doc *doc);
 
-/** @brief Fetch a node by index within the document pool. */
+/** @brief Fetch a node by index within the document pool, NULL if released. */
 YYAML_API const yyaml_node *yyaml_doc_get(const yyaml_doc *doc, uint32_t idx);
 
 /** @brief Compute the index of a node within its owning document. */
@@ -193,6 +269,93 @@ YYAML_API const char *yyaml_doc_get_scalar_buf(const yyaml_doc *doc);
 /** @brief Total number of nodes allocated within a document. */
 YYAML_API size_t yyaml_doc_node_count(const yyaml_doc *doc);
 
+/**
+ * @brief Rewrite the node pool in depth-first order.
+ *
+ * Children of every container become contiguous and each subtree occupies the
+ * node itself plus one contiguous range starting at its first child, so
+ * sequence indexing and subtree skipping are O(1) and traversal is a forward
+ * scan. Nodes unreachable from the root are dropped. Node indices and pointers
+ * obtained before the call are invalidated; the root moves to index 0.
+ * Linking new children afterwards clears the compact state.
+ *
+ * @return true on success, false when out of memory (document unchanged).
+ */
+YYAML_API bool yyaml_doc_compact(yyaml_doc *doc);
+
+/**
+ * @brief Number of nodes in the subtree rooted at node, including itself.
+ *
+ * O(1) on compacted documents, otherwise proportional to the subtree size.
+ */
+YYAML_API size_t yyaml_node_subtree_size(const yyaml_node *node);
+
+/**
+ * @brief Stable 64-bit digest of the subtree rooted at node.
+ *
+ * Computed from the values directly, without producing text. Scalars hash by
+ * type and value (-0.0 equals 0.0 and all NaNs are one value), sequences in
+ * element order and mappings by their set of key/value pairs, so reordering
+ * mapping entries keeps the digest, as it keeps the canonical output. The
+ * result does not depend on the host, on compaction or on how the document
+ * was built.
+ *
+ * Never writes to the document, so concurrent readers are safe. Subtrees
+ * whose digests were cached by yyaml_doc_cache_hashes() are not walked again;
+ * everything else is hashed on every call.
+ * @return Digest, or 0 when node is NULL or not bound to a document.
+ */
+YYAML_API uint64_t yyaml_doc_hash(const yyaml_node *node);
+
+/**
+ * @brief Compute and cache the digest of every node reachable from the root.
+ *
+ * The cache takes 8 bytes per node. The mutation API drops the digests of a
+ * changed node and its ancestors, so calling this again after an edit only
+ * rehashes the path to the root. yyaml_doc_hash(), yyaml_node_equal() and
+ * yyaml_node_equal_cached() read the cache but never fill it.
+ *
+ * @return false when out of memory or doc is read-only.
+ */
+YYAML_API bool yyaml_doc_cache_hashes(yyaml_doc *doc);
+
+/**
+ * @brief Structural equality of two subtrees, possibly from different documents.
+ *
+ * Scalars compare by type and value, so the int 1 differs from the double 1.0,
+ * with the digest's rules for -0.0 and NaN. Sequences compare element by
+ * element. Mappings compare entry by entry in document order or, with
+ * ignore_key_order, in key order (entries sharing a key are matched in
+ * document order). The walk stops at the first difference. Containers whose
+ * digests are cached on both sides (see yyaml_doc_cache_hashes()) and differ
+ * are rejected without a walk, so a changed section of a reloaded document is
+ * told apart from the previous one in O(1) once both have been cached.
+ * Equal digests are never taken as proof: equal subtrees are always confirmed
+ * by comparing them, so unchanged sections are walked in full; use
+ * yyaml_node_equal_cached() to skip them. Never writes to either document.
+ * @return True when equal or both NULL; false otherwise, or when the key
+ *         order index cannot be allocated.
+ */
+YYAML_API bool yyaml_node_equal(const yyaml_node *a, const yyaml_node *b,
+                                bool ignore_key_order);
+
+/**
+ * @brief Equality that takes matching cached digests as proof.
+ *
+ * Compares like yyaml_node_equal() with ignore_key_order, since the digests
+ * do not see key order, but also accepts containers whose digests are cached
+ * on both sides and match without walking them. Comparing a reloaded
+ * document against the previous one is then O(1) for every unchanged
+ * section once both have been cached with yyaml_doc_cache_hashes(). Two
+ * different subtrees collide with a probability of about 2^-64; use
+ * yyaml_node_equal() where that is not acceptable. Never writes to either
+ * document.
+ * @return True when equal or both NULL; false otherwise, or when the key
+ *         order index cannot be allocated.
+ */
+YYAML_API bool yyaml_node_equal_cached(const yyaml_node *a,
+                                       const yyaml_node *b);
+
 /* -------------------------- convenience helpers -------------------------- */
 
 /** @brief True when the node is a scalar type (null, bool, int, double, string). */
@@ -224,10 +387,29 @@ YYAML_INLINE bool yyaml_str_eq(const yyaml_doc *doc, const yyaml_node *node,
 YYAML_API const yyaml_node *yyaml_map_get(const yyaml_node *map,
                                           const char *key);
 
-/** @brief Retrieve a sequence element by index. */
+/**
+ * @brief Retrieve a sequence element by index.
+ *
+ * Never writes to the document, so concurrent readers are safe. Runs in
+ * constant time on parsed, loaded and compacted documents. Documents built
+ * from yyaml_doc_new(), or edited since they were indexed, fall back to an
+ * O(N) walk of the sequence until yyaml_doc_index_sequences() is called; the
+ * C++ binding calls it on the first indexed access after an edit.
+ */
 YYAML_API const yyaml_node *yyaml_seq_get(const yyaml_node *seq,
                                           size_t index);
 
+/**
+ * @brief Rebuild the element index behind yyaml_seq_get.
+ *
+ * One linear pass over the node pool, 8 bytes per node. Parsing and loading
+ * build it already; call this after edits before indexing large sequences.
+ * A no-op on compacted documents and while the index is current.
+ *
+ * @return false when out of memory or doc is read-only.
+ */
+YYAML_API bool yyaml_doc_index_sequences(yyaml_doc *doc);
+
 /** @brief Number of elements inside a sequence. */
 YYAML_API size_t yyaml_seq_len(const yyaml_node *seq);
 
@@ -236,7 +418,12 @@ YYAML_API size_t yyaml_map_len(const yyaml_node *map);
 
 /* --------------------------- building API ------------------------------- */
 
-/** @brief Set the document root node by index. */
+/**
+ * @brief Set the document root node by index.
+ *
+ * Any root other than node 0 ends the compacted layout, so a later
+ * yyaml_doc_gc drops the nodes the new root no longer reaches.
+ */
 YYAML_API bool yyaml_doc_set_root(yyaml_doc *doc, uint32_t idx);
 
 /** @brief Create a null node and return its index, or UINT32_MAX on failure. */
@@ -270,11 +457,194 @@ YYAML_API bool yyaml_doc_map_append(yyaml_doc *doc, uint32_t map_idx,
                                     const char *key, size_t key_len,
                                     uint32_t val_idx);
 
+/* ---------------------------- mutation API ------------------------------- */
+
+/*
+ * Removed and replaced subtrees are released: their node slots go to a free
+ * list reused by later yyaml_doc_add_* calls, and the scalar bytes they held
+ * are counted as garbage (see yyaml_doc_garbage). Indices and pointers to
+ * released nodes must not be used afterwards. Nodes passed in as new values
+ * must be unlinked, must not be the root and must not be an ancestor of the
+ * target container. In documents read with keep_source, a mutation marks
+ * the container and its ancestors as modified, so yyaml_write serializes
+ * them again instead of copying their source text.
+ */
+
+/** @brief Remove every member with the given key; false when none matched. */
+YYAML_API bool yyaml_doc_map_remove(yyaml_doc *doc, uint32_t map_idx,
+                                    const char *key, size_t key_len);
+
+/**
+ * @brief Set a mapping member, replacing the value in place when the key
+ *        exists (the last duplicate wins) or appending it otherwise.
+ */
+YYAML_API bool yyaml_doc_map_set(yyaml_doc *doc, uint32_t map_idx,
+                                 const char *key, size_t key_len,
+                                 uint32_t val_idx);
+
+/** @brief Insert a child before position pos; pos equal to the length appends. */
+YYAML_API bool yyaml_doc_seq_insert(yyaml_doc *doc, uint32_t seq_idx,
+                                    size_t pos, uint32_t child_idx);
+
+/** @brief Remove the element at position pos. */
+YYAML_API bool yyaml_doc_seq_remove(yyaml_doc *doc, uint32_t seq_idx,
+                                    size_t pos);
+
+/**
+ * @brief Report reclaimable storage left behind by mutations.
+ *
+ * @param free_nodes Released node slots waiting on the free list, may be NULL.
+ * @param dead_bytes Scalar bytes no longer referenced by any node, may be NULL.
+ */
+YYAML_API void yyaml_doc_garbage(const yyaml_doc *doc, size_t *free_nodes,
+                                 size_t *dead_bytes);
+
+/**
+ * @brief Release spare capacity in the node and scalar buffers.
+ *
+ * Reallocates storage down to its used size and drops a sequence index that
+ * edits made stale. Node pointers obtained before the call are invalidated;
+ * indices stay valid.
+ *
+ * @return true on success, false when a reallocation fails (document intact
+ *         and consistent, some buffers possibly not shrunk).
+ */
+YYAML_API bool yyaml_doc_shrink(yyaml_doc *doc);
+
+/**
+ * @brief Compact the document and reclaim all garbage.
+ *
+ * Runs yyaml_doc_compact, copies only the scalar bytes still referenced by
+ * live nodes into a fresh buffer and shrinks every buffer to fit. Nodes
+ * unreachable from the root are dropped; indices and pointers obtained
+ * before the call are invalidated.
+ *
+ * @return true on success, false when out of memory (document stays valid).
+ */
+YYAML_API bool yyaml_doc_gc(yyaml_doc *doc);
+
+/* -------------------------- bulk building API ---------------------------- */
+
+/**
+ * @brief Create a sequence of n integers in one call.
+ *
+ * Node storage is reserved once and the elements are linked in a single
+ * pass; the elements are stored contiguously right after the sequence node.
+ * @return Index of the new sequence, or UINT32_MAX on failure.
+ */
+YYAML_API uint32_t yyaml_doc_add_int_array(yyaml_doc *doc, const int64_t *vals,
+                                           size_t n);
+
+/** @brief Create a sequence of n doubles, see yyaml_doc_add_int_array. */
+YYAML_API uint32_t yyaml_doc_add_double_array(yyaml_doc *doc,
+                                              const double *vals, size_t n);
+
+/** @brief Create a sequence of n booleans, see yyaml_doc_add_int_array. */
+YYAML_API uint32_t yyaml_doc_add_bool_array(yyaml_doc *doc, const bool *vals,
+                                            size_t n);
+
+/**
+ * @brief Create a sequence of n strings, see yyaml_doc_add_int_array.
+ *
+ * @param lens Byte length of each string, or NULL when all strings are
+ *             NUL-terminated. Scalar storage is reserved once for the batch.
+ */
+YYAML_API uint32_t yyaml_doc_add_string_array(yyaml_doc *doc,
+                                              const char *const *strs,
+                                              const size_t *lens, size_t n);
+
+/**
+ * @brief Append n key/value pairs to a mapping in one call.
+ *
+ * Keys and values are parallel arrays; key_lens may be NULL for
+ * NUL-terminated keys. Every value must be a detached node that may be
+ * attached to the mapping and appear only once in the batch. The batch is
+ * validated up front, so on failure the mapping is left unchanged.
+ */
+YYAML_API bool yyaml_doc_map_append_n(yyaml_doc *doc, uint32_t map_idx,
+                                      const char *const *keys,
+                                      const size_t *key_lens,
+                                      const uint32_t *val_idxs, size_t n);
+
+/**
+ * @brief Deep-copy the subtree rooted at src_node into dst.
+ *
+ * src_node may belong to dst or to another document. Storage is reserved
+ * once and the copy is laid out contiguously; when the source document is
+ * compacted its node range is copied with one memcpy and rebased in a linear
+ * pass. The copy is detached, so link it with yyaml_doc_seq_append,
+ * yyaml_doc_map_append or yyaml_doc_set_root.
+ * @return Index of the copied root in dst, or UINT32_MAX on failure.
+ */
+YYAML_API uint32_t yyaml_doc_import(yyaml_doc *dst, const yyaml_node *src_node);
+
+/* ------------------------- binary snapshot API --------------------------- */
+
+/**
+ * @brief Write the node pool and scalar buffer to a binary snapshot file.
+ *
+ * The snapshot is versioned and tagged with the producer's byte order and
+ * node size; it can only be loaded on a platform with the same layout.
+ * Compacted documents keep their compact state across a save/load cycle.
+ *
+ * @return true on success, false on I/O failure with err populated.
+ */
+YYAML_API bool yyaml_doc_save_binary(const yyaml_doc *doc, const char *path,
+                                     yyaml_err *err);
+
+/**
+ * @brief Load a snapshot written by yyaml_doc_save_binary without parsing.
+ *
+ * On POSIX systems the file is memory-mapped privately and used in place;
+ * only the per-node document back-pointers are restored, in one linear pass
+ * that also bounds-checks links and scalar references. A second pass walks
+ * the links once and rejects files whose nodes form cycles, are shared
+ * between parents or disagree with their container's child count. Storage
+ * is copied to the heap the first time the document needs to grow.
+ *
+ * @return Document on success, NULL on failure with err populated.
+ */
+YYAML_API yyaml_doc *yyaml_doc_load_binary(const char *path, yyaml_err *err);
+
+/* ------------------------- shared document API ---------------------------- */
+
+/**
+ * @brief Publish a read-only image of doc into a shared memory object.
+ *
+ * fd is a writable descriptor for a POSIX shared memory object (shm_open),
+ * a memfd or a regular file; it is resized to fit the image. Documents that
+ * are not compacted are published in compacted form, doc itself is left
+ * untouched. Not available on platforms without mmap.
+ *
+ * @return true on success, false on failure with err populated.
+ */
+YYAML_API bool yyaml_doc_publish(const yyaml_doc *doc, int fd, yyaml_err *err);
+
+/**
+ * @brief Attach a read-only view of a document published with
+ *        yyaml_doc_publish.
+ *
+ * When the publisher's address is free in this process, the image is mapped
+ * there shared and used as is, so every attached process reads the same
+ * physical pages. Otherwise a private mapping is patched to the new address.
+ * All read and writing APIs work on the view; building and mutation calls
+ * fail. Release the view with yyaml_doc_free.
+ *
+ * @return Read-only document, or NULL on failure with err populated.
+ */
+YYAML_API yyaml_doc *yyaml_doc_attach(int fd, yyaml_err *err);
+
 /* --------------------------- writing API --------------------------------- */
 
 /**
  * @brief Serialize a node tree to YAML text.
  *
+ * In block style, documents read with keep_source reuse the original text:
+ * every mapping entry or sequence item whose subtree was not modified since
+ * parsing is copied verbatim, together with the comment and blank lines
+ * above it, and re-indented when opts->indent moves it to another column.
+ * Modified entries, and everything built afterwards, are serialized.
+ *
  * @param root Root node to serialize.
  * @param out Output buffer pointer set to allocated YAML text on success.
  * @param out_len Length of the returned buffer.
@@ -285,9 +655,131 @@ YYAML_API bool yyaml_doc_map_append(yyaml_doc *doc, uint32_t map_idx,
 YYAML_API bool yyaml_write(const yyaml_node *root, char **out, size_t *out_len,
                            const yyaml_write_opts *opts, yyaml_err *err);
 
-/** @brief Free buffers returned by yyaml_write. */
+/**
+ * @brief Serialize a node tree to JSON text.
+ *
+ * Minified unless opts->pretty is set, in which case each array element and
+ * object member goes on its own line indented by opts->indent. Non-finite
+ * doubles are written as null; keys are always quoted. The buffer is
+ * released with yyaml_free_string.
+ */
+YYAML_API bool yyaml_write_json(const yyaml_node *root, char **out,
+                                size_t *out_len, const yyaml_write_opts *opts,
+                                yyaml_err *err);
+
+/**
+ * @brief Exact length of the YAML text yyaml_write produces for root.
+ *
+ * Computed by a measuring traversal that formats nothing but doubles, so
+ * callers can size their own buffer. The count excludes the NUL terminator.
+ * @return Byte count, or 0 when root is not bound to a document.
+ */
+YYAML_API size_t yyaml_write_len(const yyaml_node *root,
+                                 const yyaml_write_opts *opts);
+
+/**
+ * @brief Serialize a node tree to YAML text in caller-provided memory.
+ *
+ * Nothing is allocated. On success *written holds the text length and a NUL
+ * terminator follows when cap leaves room for it. When the text does not
+ * fit, returns false with "output buffer too small" and sets *written to the
+ * length required (see yyaml_write_len); buf contents are then unspecified.
+ */
+YYAML_API bool yyaml_write_buf(const yyaml_node *root, char *buf, size_t cap,
+                               size_t *written, const yyaml_write_opts *opts,
+                               yyaml_err *err);
+
+/** @brief Free buffers returned by yyaml_write and yyaml_write_json. */
 YYAML_API void yyaml_free_string(char *str);
 
+/**
+ * @brief Output callback for the streaming writers.
+ *
+ * Receives consecutive chunks of the serialized text; return false to abort.
+ */
+typedef bool (*yyaml_write_fn)(void *ctx, const char *data, size_t len);
+
+/**
+ * @brief Serialize a node tree through a callback.
+ *
+ * Output is staged in a fixed YYAML_WRITE_BUF_SIZE buffer that is handed to
+ * sink whenever it fills, so memory use does not grow with the document.
+ * Keys, scalars and indentation larger than the buffer are handed over in
+ * pieces or directly. Chunks are not NUL-terminated.
+ *
+ * @return true on success, false when sink fails or memory runs out.
+ */
+YYAML_API bool yyaml_write_cb(const yyaml_node *root, yyaml_write_fn sink,
+                              void *ctx, const yyaml_write_opts *opts,
+                              yyaml_err *err);
+
+/** @brief Serialize a node tree to a stdio stream, see yyaml_write_cb. */
+YYAML_API bool yyaml_write_fp(const yyaml_node *root, FILE *fp,
+                              const yyaml_write_opts *opts, yyaml_err *err);
+
+/**
+ * @brief Serialize a node tree to a file descriptor, see yyaml_write_cb.
+ *
+ * Partial writes and EINTR are retried. Not available on platforms without
+ * POSIX write().
+ */
+YYAML_API bool yyaml_write_fd(const yyaml_node *root, int fd,
+                              const yyaml_write_opts *opts, yyaml_err *err);
+
+/* ------------------------- streaming emitter API -------------------------- */
+
+/**
+ * @brief Event-driven YAML writer that needs no document.
+ *
+ * Values are written as they arrive, with the same layout as yyaml_write:
+ * begin a collection, add keys (mappings only) and values, end it. Every
+ * call returns false once a call has failed, and yyaml_emitter_finish
+ * reports the first failure. YYAML_STYLE_AUTO needs whole collections up
+ * front, so the emitter writes it as block style; for the same reason keys
+ * are written in call order even with sort_keys or canonical set.
+ */
+typedef struct yyaml_emitter yyaml_emitter;
+
+/** @brief Create an emitter that collects output for yyaml_emitter_finish. */
+YYAML_API yyaml_emitter *yyaml_emitter_new(const yyaml_write_opts *opts);
+
+/**
+ * @brief Create an emitter that hands output to sink in chunks of up to
+ * YYAML_WRITE_BUF_SIZE bytes, see yyaml_write_cb.
+ * @return NULL when sink is NULL or memory runs out.
+ */
+YYAML_API yyaml_emitter *yyaml_emitter_new_cb(yyaml_write_fn sink, void *ctx,
+                                              const yyaml_write_opts *opts);
+
+/** @brief Release an emitter and any output not taken by finish. */
+YYAML_API void yyaml_emitter_free(yyaml_emitter *em);
+
+YYAML_API bool yyaml_emitter_begin_seq(yyaml_emitter *em);
+YYAML_API bool yyaml_emitter_end_seq(yyaml_emitter *em);
+YYAML_API bool yyaml_emitter_begin_map(yyaml_emitter *em);
+YYAML_API bool yyaml_emitter_end_map(yyaml_emitter *em);
+
+/** @brief Write the key of the next entry of the innermost mapping. */
+YYAML_API bool yyaml_emitter_key(yyaml_emitter *em, const char *key,
+                                 size_t len);
+
+YYAML_API bool yyaml_emitter_null(yyaml_emitter *em);
+YYAML_API bool yyaml_emitter_bool(yyaml_emitter *em, bool value);
+YYAML_API bool yyaml_emitter_int(yyaml_emitter *em, int64_t value);
+YYAML_API bool yyaml_emitter_double(yyaml_emitter *em, double value);
+YYAML_API bool yyaml_emitter_string(yyaml_emitter *em, const char *str,
+                                    size_t len);
+
+/**
+ * @brief Complete the document: append the final newline and flush the sink,
+ * or hand the NUL-terminated text to *out (release with yyaml_free_string).
+ *
+ * An emitter with no value writes `null`. Fails on unclosed collections and
+ * on any earlier error. The emitter accepts no further calls afterwards.
+ */
+YYAML_API bool yyaml_emitter_finish(yyaml_emitter *em, char **out,
+                                    size_t *out_len, yyaml_err *err);
+
 #ifdef __cplusplus
 }
 #endif